@@ -336,7 +336,7 @@ def export_global_config(scene, fs, sort_resource_path):
     integrator_type = sort_data.integrator_type_prop
     accelerator_type = sort_data.accelerator_type_prop
 
-    fs.serialize( 0 )
+    fs.serialize( 3 )
     fs.serialize( sort_resource_path )
     fs.serialize( sort_output_file )
     fs.serialize( 64 )    # tile size, hard-coded it until I need to update it throught exposed interface later.
@@ -345,6 +345,9 @@ def export_global_config(scene, fs, sort_resource_path):
     fs.serialize( int(xres) )
     fs.serialize( int(yres) )
     fs.serialize( sort_data.clampping )
+    fs.serialize( bool(sort_data.denoise) )
+    fs.serialize( bool(sort_data.output_aov) )
+    fs.serialize( SID(sort_data.sampler_type_prop) )
 
     if accelerator_type == "bvh":
         fs.serialize( SID('Bvh') )
@@ -371,8 +374,16 @@ def export_global_config(scene, fs, sort_resource_path):
 
     fs.serialize( SID(integrator_type) )
     fs.serialize( int(sort_data.inte_max_recur_depth) )
-    if integrator_type == "PathTracing":
+    if integrator_type == "PathTracing" or integrator_type == "WavefrontPathTracing":
         fs.serialize( int(sort_data.max_bssrdf_bounces) )
+        # path guiding is only supported in path tracing for now
+        fs.serialize( bool(sort_data.pt_path_guiding) and integrator_type == "PathTracing" )
+        fs.serialize( int(sort_data.pt_guiding_training_passes) )
+        # so is efficiency-aware russian roulette and splitting
+        fs.serialize( bool(sort_data.pt_rrs) and integrator_type == "PathTracing" )
+        fs.serialize( int(sort_data.pt_rrs_training_spp) )
+    if integrator_type == "WavefrontPathTracing":
+        fs.serialize( int(sort_data.wavefront_batch_size) )
     if integrator_type == "AmbientOcclusion":
         fs.serialize( sort_data.ao_max_dist )
     if integrator_type == "BidirPathTracing" or integrator_type == "LightTracing":
@@ -381,6 +392,10 @@ def export_global_config(scene, fs, sort_resource_path):
         fs.serialize( sort_data.ir_light_path_set_num )
         fs.serialize( sort_data.ir_light_path_num )
         fs.serialize( sort_data.ir_min_dist )
+        fs.serialize( sort_data.ir_lightcut_error )
+    if integrator_type == "VertexConnectionMerging":
+        fs.serialize( sort_data.vcm_radius_factor )
+        fs.serialize( sort_data.vcm_radius_alpha )
 
 # export a mesh
 def export_mesh(mesh, fs):
@@ -33,7 +33,9 @@ class SORTRenderData(bpy.types.PropertyGroup):
                          ("InstantRadiosity", "Instant Radiosity", "", 4),
                          ("AmbientOcclusion", "Ambient Occlusion", "", 5),
                          ("DirectLight", "Direct Lighting", "", 6),
-                         ("WhittedRT", "Whitted", "", 7) ]
+                         ("WhittedRT", "Whitted", "", 7),
+                         ("WavefrontPathTracing", "Wavefront Path Tracing", "", 8),
+                         ("VertexConnectionMerging", "Vertex Connection and Merging", "", 9) ]
     integrator_type_prop : bpy.props.EnumProperty(items=integrator_types, name='Accelerator')
 
     # general integrator parameters
@@ -42,6 +44,17 @@ class SORTRenderData(bpy.types.PropertyGroup):
     # maxmum bounces supported in BSSRDF, exceeding the threshold will result in replacing BSSRDF with Lambert
     max_bssrdf_bounces : bpy.props.IntProperty(name='Maximum Bounces in SSS path', default=4, min=1)
 
+    # path guiding parameters
+    pt_path_guiding : bpy.props.BoolProperty(name='Path Guiding', default=False)
+    pt_guiding_training_passes : bpy.props.IntProperty(name='Guiding Training Passes', default=4, min=1, max=10)
+
+    # efficiency-aware russian roulette and splitting parameters
+    pt_rrs : bpy.props.BoolProperty(name='Russian Roulette and Splitting', default=False, description='Terminate and split paths based on their expected efficiency learned in a coarse pass')
+    pt_rrs_training_spp : bpy.props.IntProperty(name='Training Samples per Pixel', default=4, min=2, max=64)
+
+    # wavefront path tracing parameters
+    wavefront_batch_size : bpy.props.IntProperty(name='Paths in a Batch', default=4096, min=1)
+
     # ao integrator parameters
     ao_max_dist : bpy.props.FloatProperty(name='Maximum Distance', default=3.0, min=0.01)
 
@@ -49,10 +62,15 @@ class SORTRenderData(bpy.types.PropertyGroup):
     ir_light_path_set_num : bpy.props.IntProperty(name='Light Path Set Num', default=1, min=1)
     ir_light_path_num : bpy.props.IntProperty(name='Light Path Num', default=64, min=1)
     ir_min_dist : bpy.props.FloatProperty(name='Minimum Distance', default=1.0, min=0.0)
+    ir_lightcut_error : bpy.props.FloatProperty(name='Lightcut Error Ratio', default=0.02, min=0.0, max=1.0)
 
     # bidirectional path tracing parameters
     bdpt_mis : bpy.props.BoolProperty(name='Multiple Importance Sampling', default=True)
 
+    # vertex connection and merging parameters
+    vcm_radius_factor : bpy.props.FloatProperty(name='Merging Radius Factor', default=0.003, min=0.0001, max=0.1)
+    vcm_radius_alpha : bpy.props.FloatProperty(name='Merging Radius Alpha', default=0.75, min=0.0, max=1.0)
+
     #------------------------------------------------------------------------------------#
     #                              Spatial Accelerator Settings                          #
     #------------------------------------------------------------------------------------#
@@ -90,10 +108,24 @@ class SORTRenderData(bpy.types.PropertyGroup):
     #------------------------------------------------------------------------------------#
     clampping : bpy.props.FloatProperty(name='Clampping',default=0, min=0)
 
+    #------------------------------------------------------------------------------------#
+    #                                 Denoising Settings                                 #
+    #------------------------------------------------------------------------------------#
+    denoise : bpy.props.BoolProperty(name='Denoise',default=False)
+
+    #------------------------------------------------------------------------------------#
+    #                                    AOV Settings                                    #
+    #------------------------------------------------------------------------------------#
+    output_aov : bpy.props.BoolProperty(name='Output AOVs',default=False,description='Save albedo, normal, depth and other per-pixel channels as layers of a multi-layer EXR file')
+
     #------------------------------------------------------------------------------------#
     #                                 Sampling Settings                                  #
     #------------------------------------------------------------------------------------#
     sampler_count_prop : bpy.props.IntProperty(name='Count',default=1, min=1)
+    sampler_types = [ ("Random", "Random", "Independent random numbers for all decisions", 0),
+                      ("SobolSampler", "Sobol", "Owen scrambled Sobol sequence, well stratified samples in each pixel", 1),
+                      ("BlueNoiseSampler", "Blue Noise", "Sobol sequence dithered by a blue noise mask, error is distributed as blue noise", 2) ]
+    sampler_type_prop : bpy.props.EnumProperty(items=sampler_types, name='Sampler', default='SobolSampler')
 
     #------------------------------------------------------------------------------------#
     #                                 Threading Settings                                 #
@@ -150,8 +182,17 @@ class RENDER_PT_IntegratorPanel(SORTRenderPanel,bpy.types.Panel):
         integrator_type = data.integrator_type_prop
         if integrator_type != "WhittedRT" and integrator_type != "DirectLight" and integrator_type != "AmbientOcclusion":
             self.layout.prop(data,"inte_max_recur_depth")
-        if integrator_type == "PathTracing":
+        if integrator_type == "PathTracing" or integrator_type == "WavefrontPathTracing":
             self.layout.prop(data,"max_bssrdf_bounces" )
+        if integrator_type == "PathTracing":
+            self.layout.prop(data,"pt_path_guiding")
+            if data.pt_path_guiding:
+                self.layout.prop(data,"pt_guiding_training_passes")
+            self.layout.prop(data,"pt_rrs")
+            if data.pt_rrs:
+                self.layout.prop(data,"pt_rrs_training_spp")
+        if integrator_type == "WavefrontPathTracing":
+            self.layout.prop(data,"wavefront_batch_size")
         if integrator_type == "AmbientOcclusion":
             self.layout.prop(data,"ao_max_dist")
         if integrator_type == "BidirPathTracing":
@@ -160,6 +201,10 @@ class RENDER_PT_IntegratorPanel(SORTRenderPanel,bpy.types.Panel):
             self.layout.prop(data,"ir_light_path_set_num")
             self.layout.prop(data,"ir_light_path_num")
             self.layout.prop(data, "ir_min_dist")
+            self.layout.prop(data, "ir_lightcut_error")
+        if integrator_type == "VertexConnectionMerging":
+            self.layout.prop(data,"vcm_radius_factor")
+            self.layout.prop(data,"vcm_radius_alpha")
 
 @base.register_class
 class RENDER_PT_AcceleratorPanel(SORTRenderPanel,bpy.types.Panel):
@@ -191,6 +236,20 @@ class RENDER_PT_ClamppingPanel(SORTRenderPanel,bpy.types.Panel):
         data = context.scene.sort_data
         self.layout.prop(data,"clampping")
 
+@base.register_class
+class RENDER_PT_DenoisingPanel(SORTRenderPanel,bpy.types.Panel):
+    bl_label = 'Denoising'
+    def draw(self, context):
+        data = context.scene.sort_data
+        self.layout.prop(data,"denoise")
+
+@base.register_class
+class RENDER_PT_AOVPanel(SORTRenderPanel,bpy.types.Panel):
+    bl_label = 'AOVs'
+    def draw(self, context):
+        data = context.scene.sort_data
+        self.layout.prop(data,"output_aov")
+
 @base.register_class
 class RENDER_PT_MultiThreadPanel(SORTRenderPanel, bpy.types.Panel):
     bl_label = 'MultiThread'
@@ -201,6 +260,7 @@ class RENDER_PT_MultiThreadPanel(SORTRenderPanel, bpy.types.Panel):
 class RENDER_PT_SamplerPanel(SORTRenderPanel, bpy.types.Panel):
     bl_label = 'Sample'
     def draw(self, context):
+        self.layout.prop(context.scene.sort_data,"sampler_type_prop")
         self.layout.prop(context.scene.sort_data,"sampler_count_prop")
 
 @base.register_class
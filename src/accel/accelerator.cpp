@@ -15,20 +15,52 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <algorithm>
 #include "accelerator.h"
 #include "core/primitive.h"
+#include "medium/medium.h"
 
 SORT_STATS_DEFINE_COUNTER(sRayCount)
 SORT_STATS_DEFINE_COUNTER(sShadowRayCount)
 SORT_STATS_DEFINE_COUNTER(sIntersectionTest)
+SORT_STATS_DEFINE_COUNTER(sTraversedNodeCount)
+
+#ifndef ENABLE_TRANSPARENT_SHADOW
+void Accelerator::IsOccluded( const Ray* rays , unsigned cnt , bool* occluded ) const {
+    for( auto i = 0u ; i < cnt ; ++i )
+        occluded[i] = IsOccluded( rays[i] );
+}
+#else
+void Accelerator::GetAttenuation( const Ray* rays , unsigned cnt , Spectrum* attenuation , MediumStack* ms ) const {
+    for( auto i = 0u ; i < cnt ; ++i ){
+        auto ray = rays[i];
+        auto medium_stack = ms ? ms + i : nullptr;
+
+        attenuation[i] = 1.0f;
+        while( !attenuation[i].IsBlack() ){
+            // the segment after the last surface is attenuated by mediums too, the same as what a single traversal does.
+            Spectrum att( 1.0f );
+            if( !GetAttenuation( ray , att , medium_stack ) ){
+                attenuation[i] *= att;
+                break;
+            }
+
+            if( att.IsBlack() ){
+                attenuation[i] = att;
+                break;
+            }
+
+            attenuation[i] *= att;
+        }
+    }
+}
 
-#ifdef ENABLE_TRANSPARENT_SHADOW
 bool Accelerator::GetAttenuation( Ray& ray , Spectrum& attenuation , MediumStack* ms ) const {
     SurfaceInteraction intersection;
     intersection.query_shadow = true;
     if (!GetIntersect(ray, intersection)) {
         if (ms)
-            attenuation *= ms->Tr(ray, ray.m_fMax);
+            attenuation *= ms->Tr(ray, ray.m_fMax - ray.m_fMin);
         return false;
     }
 
@@ -47,7 +79,7 @@ bool Accelerator::GetAttenuation( Ray& ray , Spectrum& attenuation , MediumStack
 
     // consider beam transmittance during ray traversal if medium is presented.
     if (ms && !attenuation.IsBlack() ) {
-        attenuation *= ms->Tr(ray, intersection.t);
+        attenuation *= ms->Tr(ray, intersection.t - ray.m_fMin);
 
         const auto theta_wi = dot(ray.m_Dir, intersection.gnormal);
         const auto theta_wo = -theta_wi;
@@ -63,10 +95,56 @@ bool Accelerator::GetAttenuation( Ray& ray , Spectrum& attenuation , MediumStack
     ray.m_fMin = 0.001f;              // avoid self collision again.
     ray.m_fMax -= intersection.t;
 
+    // the gap skipped to avoid self collision is still inside the mediums behind the surface.
+    if( ms && !attenuation.IsBlack() )
+        attenuation *= ms->Tr( ray , ray.m_fMin );
+
     return true;
 }
+
+Spectrum Accelerator::resolveMediumBoundaries( const Ray& ray , MediumBoundaries& boundaries , MediumStack& ms ) const{
+    auto begin = boundaries.m_boundaries;
+    auto end = begin + boundaries.m_boundaryCnt;
+    std::sort( begin , end , []( const MediumBoundaries::Boundary& b0 , const MediumBoundaries::Boundary& b1 ){ return b0.t < b1.t; } );
+
+    // walk through the segments between boundaries, each of them is attenuated by the mediums at the time. the segment
+    // after the last boundary is attenuated as well, it is the same as what 'GetAttenuation' does with one hit at a time.
+    Spectrum tr( 1.0f );
+    Ray segment = ray;
+    auto t = ray.m_fMin;
+    for( auto it = begin ; it != end ; ++it ){
+        segment.m_Ori = ray( t );
+        tr *= ms.Tr( segment , it->t - t );
+
+        MediumInteraction mi;
+        mi.intersect = ray( it->t );
+        it->material->UpdateMediumStack( mi , update_interaction_flag( it->cos_theta , -it->cos_theta ) , ms );
+
+        t = it->t;
+    }
+
+    segment.m_Ori = ray( t );
+    tr *= ms.Tr( segment , ray.m_fMax - t );
+    return tr;
+}
 #endif
 
+void Accelerator::Refit(){
+    rebuild();
+}
+
+void Accelerator::rebuild(){
+    if( nullptr == m_primitives )
+        return;
+
+    BBox bbox;
+    for( const auto primitive : *m_primitives )
+        bbox.Union( primitive->GetBBox() );
+
+    m_isValid = false;
+    Build( *m_primitives , bbox );
+}
+
 bool Accelerator::UpdateMediumStack( Ray& ray , MediumStack& ms , const bool reversed ) const{
 	SurfaceInteraction intersection;
 	intersection.query_shadow = false;
@@ -29,6 +29,7 @@
 class Ray;
 struct SurfaceInteraction;
 struct BSSRDFIntersections;
+struct MediumBoundaries;
 
 #ifdef ENABLE_TRANSPARENT_SHADOW
 SORT_FORCEINLINE bool isShadowRay( const SurfaceInteraction* intersection ){
@@ -80,7 +81,29 @@ public:
     //! @param r            The ray to be tested.
     //! @return             Whether the ray is occluded by anything.
     virtual bool IsOccluded( const Ray& r ) const = 0;
+
+    //! @brief  Detect occlusion of a batch of shadow rays.
+    //!
+    //! The default implementation simply tests the rays one by one, accelerators are free to do better.
+    //!
+    //! @param rays         The rays to be tested, each of them has its own maximum distance.
+    //! @param cnt          Number of rays to be tested.
+    //! @param occluded     Whether each of the rays is occluded by anything.
+    virtual void IsOccluded( const Ray* rays , unsigned cnt , bool* occluded ) const;
 #else
+    //! @brief  Evaluate attenuation of a batch of shadow rays.
+    //!
+    //! Unlike the other 'GetAttenuation', this function evaluates the full attenuation along each ray. The default
+    //! implementation walks through the transparent surfaces one at a time by re-launching the ray from the last
+    //! intersection, accelerators are free to do it in one single traversal.
+    //!
+    //! @param rays         The rays to be tested, each of them has its own maximum distance.
+    //! @param cnt          Number of rays to be tested.
+    //! @param attenuation  The attenuation along each of the rays, 0 means fully occluded.
+    //! @param ms           Medium stacks of each ray, it is either nullptr or an array of 'cnt' medium stacks.
+    virtual void GetAttenuation( const Ray* rays , unsigned cnt , Spectrum* attenuation , MediumStack* ms = nullptr ) const;
+
+
     //! @brief  Evaluate attenuation along a ray segment.
     //!
     //! This function just returned the attenuation of the first intersection. It is not responsible for evaluating all attenuations
@@ -124,6 +147,15 @@ public:
     //! @param bbox             The bounding box of the scene.
     virtual void Build(const std::vector<const Primitive*>& primitives, const BBox& bbox) = 0;
 
+    //! @brief Refit the acceleration structure after primitives are moved.
+    //!
+    //! This is for the cases where primitives move with no change in topology, like turn tables or cloth simulations. Instead of
+    //! building everything from scratch, bounding boxes of the existing structure are updated from the new bounding boxes of the
+    //! primitives, which is a lot cheaper. If the quality of the refit structure degrades too much, it falls back to a full rebuild.
+    //! Bounding boxes of primitives need to be up to date before calling this function. The default implementation simply rebuilds
+    //! the whole structure.
+    virtual void Refit();
+
     //! @brief Get the bounding box of the primitive set.
     //!
     //! @return Bounding box of the spatial acceleration structure.
@@ -152,4 +184,21 @@ protected:
     BBox                                    m_bbox;
     /**< Whether the spatial structure is constructed before. */
     bool                                    m_isValid = false;
+    /**< A refit structure whose SAH cost grows beyond this ratio of the one right after construction will be rebuilt. */
+    float                                   m_rebuildThreshold = 1.5f;
+
+    //! @brief Rebuild the acceleration structure with the same primitive set.
+    void    rebuild();
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    //! @brief  Evaluate beam transmittance along a shadow ray with the medium boundaries recorded in a single traversal.
+    //!
+    //! Boundaries are sorted first so that the medium stack is updated in the order of intersections along the ray.
+    //!
+    //! @param ray          The shadow ray.
+    //! @param boundaries   Boundaries of mediums along the ray, they will be sorted in place.
+    //! @param ms           The medium stack at the origin of the ray, it is updated all the way to the end of the ray.
+    //! @return             The beam transmittance along the ray.
+    Spectrum    resolveMediumBoundaries( const Ray& ray , MediumBoundaries& boundaries , MediumStack& ms ) const;
+#endif
 };
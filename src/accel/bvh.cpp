@@ -17,11 +17,14 @@
 
 #include <string.h>
 #include <algorithm>
+#include <unordered_map>
 #include "bvh.h"
 #include "math/ray.h"
 #include "math/interaction.h"
 #include "scatteringevent/scatteringevent.h"
 #include "core/memory.h"
+#include "medium/medium.h"
+#include "core/globalconfig.h"
 
 IMPLEMENT_RTTI(Bvh);
 
@@ -40,6 +43,12 @@ SORT_STATS_COUNTER("Spatial-Structure(BVH)", "BVH Depth", sBVHDepth);
 SORT_STATS_COUNTER("Spatial-Structure(BVH)", "Maximum Primitive in Leaf", sBvhMaxPriCountInLeaf);
 SORT_STATS_AVG_COUNT("Spatial-Structure(BVH)", "Average Primitive Count in Leaf", sBvhPrimitiveCount , sBvhLeafNodeCount );
 SORT_STATS_AVG_COUNT("Spatial-Structure(BVH)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
+SORT_STATS_AVG_COUNT("Spatial-Structure(BVH)", "Average Node Visited per Ray", sTraversedNodeCount, sRayCount);
+
+#ifdef SORT_ENABLE_CACHE_LINE_STATS
+SORT_STATS_DEFINE_COUNTER(sBvhNodeCacheLineCount)
+SORT_STATS_AVG_COUNT("Spatial-Structure(BVH)", "Average Node Cache Lines Touched per Ray", sBvhNodeCacheLineCount, sRayCount);
+#endif
 
 void Bvh::Build(const std::vector<const Primitive*>& primitives, const BBox& bbox){
     SORT_PROFILE("Build Bvh");
@@ -58,9 +67,12 @@ void Bvh::Build(const std::vector<const Primitive*>& primitives, const BBox& bbo
         m_bvhpri[i].SetPrimitive((*m_primitives)[i]);
 
     // recursively split node
-    m_root = std::make_unique<Bvh_Node>();
-    splitNode( m_root.get() , 0u , (unsigned)m_primitives->size() , 1u );
+    splitNode( allocateNode() , 0u , (unsigned)m_primitives->size() , 1u );
 
+    // lay out the nodes in a cache friendly way
+    layoutNodes();
+
+    m_sahCost = sahCost();
     m_isValid = true;
 
     SORT_STATS(++sBvhNodeCount);
@@ -69,6 +81,7 @@ void Bvh::Build(const std::vector<const Primitive*>& primitives, const BBox& bbo
 
 void Bvh::splitNode( Bvh_Node* node , unsigned start , unsigned end , unsigned depth ){
     SORT_STATS(sBVHDepth = std::max( sBVHDepth , (StatsInt)depth ) );
+    m_depth = std::max( m_depth , depth );
 
     // generate the bounding box for the node
     for( auto i = start ; i < end ; i++ )
@@ -102,11 +115,11 @@ void Bvh::splitNode( Bvh_Node* node , unsigned start , unsigned end , unsigned d
         return;
     }
 
-    node->left = std::make_unique<Bvh_Node>();
-    splitNode( node->left.get() , start , mid , depth + 1 );
+    node->left = allocateNode();
+    splitNode( node->left , start , mid , depth + 1 );
 
-    node->right = std::make_unique<Bvh_Node>();
-    splitNode( node->right.get() , mid , end , depth + 1 );
+    node->right = allocateNode();
+    splitNode( node->right , mid , end , depth + 1 );
 
     SORT_STATS(sBvhNodeCount+=2);
 }
@@ -119,6 +132,73 @@ void Bvh::makeLeaf( Bvh_Node* node , unsigned start , unsigned end ){
     SORT_STATS(sBvhMaxPriCountInLeaf = std::max( sBvhMaxPriCountInLeaf , (StatsInt)node->pri_num) );
 }
 
+Bvh::Bvh_Node* Bvh::allocateNode(){
+    m_buildNodes.push_back( std::make_unique<Bvh_Node>() );
+    return m_buildNodes.back().get();
+}
+
+void Bvh::layoutNodes(){
+    std::vector<Bvh_Node*> order;
+    order.reserve( m_buildNodes.size() );
+
+    const auto children = []( Bvh_Node* node , const auto& visit ){
+        if( node->left ) visit( node->left );
+        if( node->right ) visit( node->right );
+    };
+    vanEmdeBoasLayout( m_buildNodes.front().get() , m_depth , children , order );
+    sAssert( order.size() == m_buildNodes.size() , SPATIAL_ACCELERATOR );
+
+    std::unordered_map<const Bvh_Node*, Bvh_Node*> remap;
+    m_nodeCnt = (unsigned)order.size();
+    m_nodes = std::make_unique<Bvh_Node[]>( order.size() );
+    for( auto i = 0u ; i < order.size() ; ++i ){
+        m_nodes[i] = *order[i];
+        remap[order[i]] = &m_nodes[i];
+    }
+    for( auto i = 0u ; i < order.size() ; ++i ){
+        if( m_nodes[i].left ) m_nodes[i].left = remap[m_nodes[i].left];
+        if( m_nodes[i].right ) m_nodes[i].right = remap[m_nodes[i].right];
+    }
+
+    m_buildNodes.clear();
+    m_buildNodes.shrink_to_fit();
+}
+
+void Bvh::Refit(){
+    SORT_PROFILE("Refit Bvh");
+
+    if( !m_isValid )
+        return;
+
+    const auto children = []( Bvh_Node* node , const auto& visit ){
+        if( node->left ) visit( node->left );
+        if( node->right ) visit( node->right );
+    };
+    const auto refit_node = [&]( Bvh_Node* node ){
+        node->bbox = BBox();
+        if( 0 != node->pri_num ){
+            for( auto i = node->pri_offset ; i < node->pri_offset + node->pri_num ; ++i )
+                node->bbox.Union( m_bvhpri[i].GetBBox() );
+        }else{
+            node->bbox = Union( node->left->bbox , node->right->bbox );
+        }
+    };
+    refitTree( m_nodes.get() , m_nodeCnt >= REFIT_PARALLEL_NODE_CNT ? std::max( 1u , g_threadCnt ) : 1u , children , refit_node );
+
+    m_bbox = m_nodes[0].bbox;
+
+    // the tree could be far from optimal if primitives moved a lot, it is better to rebuild it in such a case.
+    if( sahCost() > m_sahCost * m_rebuildThreshold )
+        rebuild();
+}
+
+float Bvh::sahCost() const{
+    auto cost = 0.0f;
+    for( auto i = 0u ; i < m_nodeCnt ; ++i )
+        cost += sahNodeCost( m_nodes[i].bbox , m_nodes[i].pri_num , m_nodes[0].bbox );
+    return cost;
+}
+
 bool Bvh::GetIntersect(const Ray& ray, SurfaceInteraction& intersect) const{
     SORT_PROFILE("Traverse Bvh");
     SORT_STATS(++sRayCount);
@@ -133,7 +213,10 @@ bool Bvh::GetIntersect(const Ray& ray, SurfaceInteraction& intersect) const{
     if (fmin < 0.0f)
         return false;
 
-    if( traverseNode(m_root.get(), ray, &intersect, fmin) ){
+    SORT_CACHE_LINE_STATS(CacheLineCounter cache_line_counter(sBvhNodeCacheLineCount));
+    SORT_STATS_TOUCH_NODE(m_nodes.get());
+
+    if( traverseNode(m_nodes.get(), ray, &intersect, fmin) ){
 #ifdef ENABLE_TRANSPARENT_SHADOW
         return intersect.query_shadow || ( nullptr != intersect.primitive );
 #else
@@ -155,7 +238,79 @@ bool Bvh::IsOccluded( const Ray& ray ) const{
     if (fmin < 0.0f)
         return false;
 
-    return traverseNode(m_root.get(), ray, nullptr, fmin);
+    SORT_CACHE_LINE_STATS(CacheLineCounter cache_line_counter(sBvhNodeCacheLineCount));
+    SORT_STATS_TOUCH_NODE(m_nodes.get());
+
+    return traverseNode(m_nodes.get(), ray, nullptr, fmin);
+}
+#else
+void Bvh::GetAttenuation( const Ray* rays , unsigned cnt , Spectrum* attenuation , MediumStack* ms ) const{
+    SORT_PROFILE("Traverse Bvh");
+
+    for( auto i = 0u ; i < cnt ; ++i ){
+        SORT_STATS(++sRayCount);
+        SORT_STATS(++sShadowRayCount);
+
+        const auto& ray = rays[i];
+        ray.Prepare();
+
+        MediumBoundaries boundaries;
+        attenuation[i] = 1.0f;
+        if( Intersect( ray , m_bbox ) >= 0.0f && traverseShadow( m_nodes.get() , ray , attenuation[i] , ms ? &boundaries : nullptr ) ){
+            attenuation[i] = 0.0f;
+            continue;
+        }
+
+        if( nullptr == ms )
+            continue;
+
+        // the medium stack needs to be updated in the order of intersections along the ray, restart from scratch if some boundaries are missed.
+        if( UNLIKELY( boundaries.m_overflow ) )
+            Accelerator::GetAttenuation( rays + i , 1 , attenuation + i , ms + i );
+        else
+            attenuation[i] *= resolveMediumBoundaries( ray , boundaries , ms[i] );
+    }
+}
+
+bool Bvh::traverseShadow( const Bvh_Node* node , const Ray& ray , Spectrum& attenuation , MediumBoundaries* boundaries ) const{
+    SORT_STATS(++sTraversedNodeCount);
+
+    if( node->pri_num != 0 ){
+        const auto _start = node->pri_offset;
+        const auto _end = _start + node->pri_num;
+        for( auto i = _start ; i < _end ; i++ ){
+            SORT_STATS(++sIntersectionTest);
+
+            SurfaceInteraction intersection;
+            if( !m_bvhpri[i].primitive->GetIntersect( ray , &intersection ) )
+                continue;
+
+            const auto material = m_bvhpri[i].primitive->GetMaterial();
+            if( !material->HasTransparency() )
+                return true;
+
+            // a ray could pass through a primitive more than once, like entering and leaving a sphere. all of the
+            // intersections attenuate the ray, the same as the SIMD version and the fallback one hit at a time.
+            Ray next( ray );
+            next.Prepare();
+            do{
+                if( ( attenuation *= material->EvaluateTransparency( intersection ) ).IsBlack() )
+                    return true;
+
+                if( boundaries && material->HasVolumeAttached() )
+                    boundaries->Add( intersection.t , dot( ray.m_Dir , intersection.gnormal ) , material );
+
+                next.m_fMin = intersection.t + 0.001f;
+                intersection = SurfaceInteraction();
+            }while( m_bvhpri[i].primitive->GetIntersect( next , &intersection ) );
+        }
+        return false;
+    }
+
+    // the order of intersections doesn't matter, there is no need to visit the nearer child first.
+    if( Intersect( ray , node->left->bbox ) >= 0.0f && traverseShadow( node->left , ray , attenuation , boundaries ) )
+        return true;
+    return Intersect( ray , node->right->bbox ) >= 0.0f && traverseShadow( node->right , ray , attenuation , boundaries );
 }
 #endif
 
@@ -166,6 +321,8 @@ bool Bvh::traverseNode( const Bvh_Node* node , const Ray& ray , SurfaceInteracti
     if( intersect && intersect->t < fmin )
         return true;
 
+    SORT_STATS(++sTraversedNodeCount);
+
     if( node->pri_num != 0 ){
         const auto _start = node->pri_offset;
         const auto _pri = node->pri_num;
@@ -194,8 +351,10 @@ bool Bvh::traverseNode( const Bvh_Node* node , const Ray& ray , SurfaceInteracti
         return found;
     }
 
-    const auto left = node->left.get();
-    const auto right = node->right.get();
+    const auto left = node->left;
+    const auto right = node->right;
+    SORT_STATS_TOUCH_NODE(left);
+    SORT_STATS_TOUCH_NODE(right);
 
     const auto fmin0 = Intersect( ray , left->bbox );
     const auto fmin1 = Intersect( ray , right->bbox );
@@ -226,7 +385,11 @@ void Bvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const
     const auto fmin = Intersect(ray, m_bbox);
     if( fmin < 0.0f )
         return;
-    traverseNode(m_root.get(), ray, intersect, fmin, matID);
+
+    SORT_CACHE_LINE_STATS(CacheLineCounter cache_line_counter(sBvhNodeCacheLineCount));
+    SORT_STATS_TOUCH_NODE(m_nodes.get());
+
+    traverseNode(m_nodes.get(), ray, intersect, fmin, matID);
 }
 
 void Bvh::traverseNode( const Bvh_Node* node , const Ray& ray , BSSRDFIntersections& intersect , float fmin , const StringID matID ) const{
@@ -235,6 +398,8 @@ void Bvh::traverseNode( const Bvh_Node* node , const Ray& ray , BSSRDFIntersecti
     if( intersect.maxt < fmin )
         return;
 
+    SORT_STATS(++sTraversedNodeCount);
+
     if( 0 != node->pri_num ){
         auto _start = node->pri_offset;
         auto _pri = node->pri_num;
@@ -274,8 +439,10 @@ void Bvh::traverseNode( const Bvh_Node* node , const Ray& ray , BSSRDFIntersecti
        return;
     }
 
-    const auto left = node->left.get();
-    const auto right = node->right.get();
+    const auto left = node->left;
+    const auto right = node->right;
+    SORT_STATS_TOUCH_NODE(left);
+    SORT_STATS_TOUCH_NODE(right);
 
     const auto fmin0 = Intersect( ray , left->bbox );
     const auto fmin1 = Intersect( ray , right->bbox );
@@ -44,8 +44,8 @@ class Bvh : public Accelerator{
         BBox                        bbox;                   /**< Bounding box of the BVH node. */
         unsigned                    pri_num = 0;            /**< Number of primitives in the BVH node. */
         unsigned                    pri_offset = 0;         /**< Offset in the primitive buffer. It is 0 for interior nodes. */
-        std::unique_ptr<Bvh_Node>   left = nullptr;         /**< Left child of the BVH node. */
-        std::unique_ptr<Bvh_Node>   right = nullptr;        /**< Right child of the BVH node. */
+        Bvh_Node*                   left = nullptr;         /**< Left child of the BVH node. */
+        Bvh_Node*                   right = nullptr;        /**< Right child of the BVH node. */
     };
 
 public:
@@ -78,6 +78,17 @@ public:
     //! @param r            The ray to be tested.
     //! @return             Whether the ray is occluded by anything.
     bool IsOccluded( const Ray& r ) const override;
+#else
+    //! @brief  Evaluate attenuation of a batch of shadow rays.
+    //!
+    //! Each ray walks through all transparent surfaces along it in one single traversal, it stops as soon as the ray is fully blocked.
+    //! Surfaces with volume attached are recorded and sorted afterward to update the medium stacks in order.
+    //!
+    //! @param rays         The rays to be tested, each of them has its own maximum distance.
+    //! @param cnt          Number of rays to be tested.
+    //! @param attenuation  The attenuation along each of the rays, 0 means fully occluded.
+    //! @param ms           Medium stacks of each ray, it is either nullptr or an array of 'cnt' medium stacks.
+    void    GetAttenuation( const Ray* rays , unsigned cnt , Spectrum* attenuation , MediumStack* ms = nullptr ) const override;
 #endif
 
     //! @brief Get multiple intersections between the ray and the primitive set using spatial data structure.
@@ -105,6 +116,12 @@ public:
     //! @param bbox             The bounding box of the scene.
     void    Build(const std::vector<const Primitive*>& primitives, const BBox& bbox) override;
 
+    //! @brief Refit the BVH after primitives are moved.
+    //!
+    //! Bounding boxes of all nodes are updated bottom-up in parallel, the structure of the tree is untouched. If the SAH cost of the
+    //! refit tree grows too much comparing with the one right after construction, the BVH will be rebuilt from scratch.
+    void    Refit() override;
+
     //! @brief      Serializing data from stream.
     //!
     //! @param      Stream where the serialization data comes from. Depending on different situation,
@@ -124,8 +141,16 @@ public:
 private:
     /**< Primitive list during BVH construction. */
     std::unique_ptr<Bvh_Primitive[]>        m_bvhpri = nullptr;
-    /**< Root node of the BVH structure. */
-    std::unique_ptr<Bvh_Node>               m_root = nullptr;
+    /**< All BVH nodes in one continuous memory block in van Emde Boas layout, the first one is the root node. */
+    std::unique_ptr<Bvh_Node[]>             m_nodes = nullptr;
+    /**< Number of nodes in the BVH. */
+    unsigned                                m_nodeCnt = 0;
+    /**< SAH cost of the BVH right after construction. */
+    float                                   m_sahCost = 0.0f;
+    /**< Nodes allocated during BVH construction, they are moved to 'm_nodes' once the construction is done. */
+    std::vector<std::unique_ptr<Bvh_Node>>  m_buildNodes;
+    /**< Depth of the BVH. */
+    unsigned                                m_depth = 0;
     /**< Maximum primitives in a leaf node. During BVH construction, a node with less primitives will be marked as a leaf node. */
     unsigned                                m_maxPriInLeaf = 8;
     /**< Maximum depth of node in BVH. */
@@ -146,6 +171,22 @@ private:
     //! @param end          The end offset of primitives that the node holds.
     void    makeLeaf( Bvh_Node* node , unsigned start , unsigned end );
 
+    //! @brief Allocate a new node during BVH construction.
+    //!
+    //! @return             The newly allocated node.
+    Bvh_Node*   allocateNode();
+
+    //! @brief Move all nodes into one continuous memory block in van Emde Boas layout.
+    //!
+    //! Nodes allocated one by one during construction could be anywhere in memory, this pass makes sure nodes close to each other
+    //! in the tree are also close in memory, so that rays, especially incoherent ones, touch less cache lines during traversal.
+    void    layoutNodes();
+
+    //! @brief Evaluate the SAH cost of the whole BVH.
+    //!
+    //! @return             The SAH cost of the BVH.
+    float   sahCost() const;
+
     //! @brief A recursive function that traverses the BVH node.
     //!
     //! @param node         The root node of the (sub)tree to be traversed.
@@ -166,5 +207,16 @@ private:
     //! @param              Material ID to avoid if it is not invalid.
     void    traverseNode( const Bvh_Node* node , const Ray& ray , BSSRDFIntersections& intersect , float fmin , const StringID matID ) const;
 
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    //! @brief A recursive helper function that accumulates the transparency of all intersections along a shadow ray.
+    //!
+    //! @param node         The root node of the (sub)tree to be traversed.
+    //! @param ray          The shadow ray to be tested.
+    //! @param attenuation  The attenuation to be accumulated.
+    //! @param boundaries   Surfaces with volume attached along the ray are recorded here if it is not nullptr.
+    //! @return             Whether the ray is fully blocked.
+    bool    traverseShadow( const Bvh_Node* node , const Ray& ray , Spectrum& attenuation , MediumBoundaries* boundaries ) const;
+#endif
+
     SORT_STATS_ENABLE( "Spatial-Structure(BVH)" )
 };
@@ -17,29 +17,66 @@
 
 #pragma once
 
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
 #include "core/define.h"
+#include "core/stats.h"
+#include "core/thread.h"
 #include "math/point.h"
 #include "math/bbox.h"
-
-class Primitive;
+#include "core/primitive.h"
+#include "shape/line.h"
 
 //! @brief Bounding volume hierarchy node primitives. It is used during BVH construction.
+/**
+ * A BVH primitive usually refers to a whole primitive. A line could also be referred by several BVH primitives,
+ * each covers a piece of the line, so that long diagonal line segments are not bounded by huge bounding boxes.
+ */
 struct Bvh_Primitive {
     const Primitive*    primitive;              /**< Primitive lists for this node. */
     Point               m_centroid;             /**< Center point of the BVH node. */
+    float               m_s0 = 0.0f;            /**< Parametric position where the covered piece of a line starts. */
+    float               m_s1 = 1.0f;            /**< Parametric position where the covered piece of a line ends. */
 
     //! @brief Set primitive.
     //!
     //! @param p    Primitive list holding all primitives in the node.
     void SetPrimitive(const Primitive* p){
         primitive = p;
+        m_s0 = 0.0f;
+        m_s1 = 1.0f;
         m_centroid = (p->GetBBox().m_Max + p->GetBBox().m_Min) * 0.5f;
     }
 
+    //! @brief Set a piece of a line as the primitive.
+    //!
+    //! @param p    Primitive whose shape is a line.
+    //! @param s0   Parametric position where the piece starts.
+    //! @param s1   Parametric position where the piece ends.
+    void SetLineSegment(const Primitive* p, float s0, float s1){
+        sAssert( SHAPE_LINE == p->GetShapeType() , SPATIAL_ACCELERATOR );
+        primitive = p;
+        m_s0 = s0;
+        m_s1 = s1;
+        const auto bbox = GetBBox();
+        m_centroid = (bbox.m_Max + bbox.m_Min) * 0.5f;
+    }
+
+    //! @brief Whether only a piece of the primitive is covered.
+    //!
+    //! @return     Whether it is a piece of a line.
+    bool IsLineSegment() const {
+        return m_s0 > 0.0f || m_s1 < 1.0f;
+    }
+
     //! Get bounding box of this primitive set.
     //!
     //! @return     Axis-Aligned bounding box holding all the primitives.
-    const BBox& GetBBox() const {
+    BBox GetBBox() const {
+        if( UNLIKELY( IsLineSegment() ) )
+            return static_cast<const Line*>( primitive->GetShape() )->GetSubBBox( m_s0 , m_s1 );
         return primitive->GetBBox();
     }
 };
@@ -113,4 +150,190 @@ SORT_FORCEINLINE float pickBestSplit( unsigned& axis , float& splitPos , const B
     }
 
     return min_sah;
-}
\ No newline at end of file
+}
+
+//! @brief Order the nodes of a tree in van Emde Boas layout.
+//!
+//! A tree of height h is cut in the middle, the top half tree is laid out first, followed by each of the bottom half sub-trees.
+//! Every half is laid out recursively in the same way. Since nodes close to each other in the tree end up close in memory no matter
+//! what the size of a cache line or a page is, a ray traversing down the tree touches a lot less cache lines and pages than it does
+//! with nodes allocated in construction order.
+//!
+//! @param node         Root node of the (sub)tree to be laid out.
+//! @param height       Height of the (sub)tree to be laid out, nodes deeper than it are not touched.
+//! @param children     A functor taking a node and a callback, it should call the callback with each child of the node.
+//! @param order        Nodes in van Emde Boas order are appended to it.
+template<class Node, class ChildrenVisitor>
+void vanEmdeBoasLayout( Node* node , unsigned height , const ChildrenVisitor& children , std::vector<Node*>& order ){
+    if( nullptr == node || 0 == height )
+        return;
+
+    if( 1 == height ){
+        order.push_back( node );
+        return;
+    }
+
+    const auto top_height = height / 2;
+    vanEmdeBoasLayout( node , top_height , children , order );
+
+    // collect roots of the bottom sub-trees
+    std::vector<Node*> roots( 1 , node ) , next;
+    for( auto i = 0u ; i < top_height ; ++i ){
+        next.clear();
+        for( auto n : roots )
+            children( n , [&]( Node* child ){ next.push_back( child ); } );
+        roots.swap( next );
+    }
+
+    for( auto n : roots )
+        vanEmdeBoasLayout( n , height - top_height , children , order );
+}
+
+//! @brief Refit a sub-tree bottom-up.
+//!
+//! @param node         Root node of the sub-tree to be refit.
+//! @param children     A functor taking a node and a callback, it should call the callback with each child of the node.
+//! @param refit_node   A functor updating the bounding box of a node, assuming its children are already up to date.
+template<class Node, class ChildrenVisitor, class NodeRefitter>
+void refitSubtree( Node* node , const ChildrenVisitor& children , const NodeRefitter& refit_node ){
+    children( node , [&]( Node* child ){ refitSubtree( child , children , refit_node ); } );
+    refit_node( node );
+}
+
+// Trees with fewer nodes than this are refit in the calling thread, spawning threads costs more than it saves.
+static constexpr unsigned REFIT_PARALLEL_NODE_CNT = 16384;
+
+//! @brief Refit a tree bottom-up, in parallel if requested.
+//!
+//! Sub-trees below the top levels of the tree are independent of each other, they are refit by multiple threads in parallel.
+//! The few nodes at the top levels are refit afterwards in the calling thread.
+//!
+//! @param root         Root node of the tree.
+//! @param thread_cnt   Maximum number of threads refitting the tree, the whole tree is refit in the calling thread if it is 1.
+//! @param children     A functor taking a node and a callback, it should call the callback with each child of the node.
+//! @param refit_node   A functor updating the bounding box of a node, assuming its children are already up to date.
+template<class Node, class ChildrenVisitor, class NodeRefitter>
+void refitTree( Node* root , unsigned thread_cnt , const ChildrenVisitor& children , const NodeRefitter& refit_node ){
+    if( thread_cnt <= 1 ){
+        refitSubtree( root , children , refit_node );
+        return;
+    }
+
+    // split the tree until there are enough sub-trees to keep all threads busy.
+    std::vector<Node*> top , roots( 1 , root ) , next;
+    while( roots.size() < 4 * thread_cnt ){
+        next.clear();
+        for( auto n : roots ){
+            auto is_leaf = true;
+            children( n , [&]( Node* child ){ next.push_back( child ); is_leaf = false; } );
+            if( is_leaf )
+                next.push_back( n );
+            else
+                top.push_back( n );
+        }
+        if( next.size() == roots.size() )
+            break;
+        roots.swap( next );
+    }
+
+    std::atomic<unsigned> next_root( 0 );
+    const auto worker = [&]( unsigned ){
+        for( auto i = next_root++ ; i < roots.size() ; i = next_root++ )
+            refitSubtree( roots[i] , children , refit_node );
+    };
+    const auto worker_cnt = std::min( thread_cnt , (unsigned)roots.size() );
+    if( worker_cnt <= 1 )
+        worker( 0 );
+    else
+        RunHelperThreads( worker_cnt , worker );
+
+    // nodes in the top levels are in breadth first order, children always show up after their parents.
+    for( auto it = top.rbegin() ; it != top.rend() ; ++it )
+        refit_node( *it );
+}
+
+//! @brief SAH cost of a single node, it is the probability of a ray hitting the node times the cost of visiting it.
+//!
+//! @param bbox         Bounding box of the node.
+//! @param pri_cnt      Number of primitives in the node, it should be 0 for interior nodes.
+//! @param root_bbox    Bounding box of the whole tree.
+//! @return             The SAH cost of the node, traversing an interior node costs as much as intersecting a primitive.
+SORT_FORCEINLINE float sahNodeCost( const BBox& bbox , unsigned pri_cnt , const BBox& root_bbox ){
+    return bbox.HalfSurfaceArea() / root_bbox.HalfSurfaceArea() * (float)std::max( pri_cnt , 1u );
+}
+
+//! @brief Stack of nodes to be visited in an iterative BVH traversal.
+//!
+//! Each thread keeps one stack per traversal method and shares it among all trees, whose depths may be different. The
+//! stack grows whenever a deeper tree is traversed, it never shrinks.
+template<class T>
+class TraversalStack{
+public:
+    //! @brief Make sure the stack holds at least a specific number of entries.
+    //!
+    //! @param cnt      Number of entries needed by the tree to be traversed.
+    //! @return         Entries of the stack, content of the stack is lost if it grows.
+    SORT_FORCEINLINE T* Reserve( unsigned cnt ){
+        if( UNLIKELY( cnt > m_capacity ) ){
+            m_entries = std::make_unique<T[]>( cnt );
+            m_capacity = cnt;
+        }
+        return m_entries.get();
+    }
+
+private:
+    std::unique_ptr<T[]>    m_entries;          /**< Entries of the stack. */
+    unsigned                m_capacity = 0;     /**< Number of entries the stack can hold. */
+};
+
+#if defined(SORT_ENABLE_STATS_COLLECTION) && defined(SORT_ENABLE_CACHE_LINE_STATS)
+//! @brief Count the distinct cache lines touched by a ray during BVH traversal.
+//!
+//! This is a proxy of L1/L2 cache misses during traversal, it reveals how well the memory layout of a BVH serves rays. The count
+//! is accumulated into the counter once the object goes out of scope, which is by the end of the ray traversal.
+//! Recording every visited node is far from free, it is only compiled in with 'SORT_ENABLE_CACHE_LINE_STATS' on top of the
+//! regular stats system.
+class CacheLineCounter{
+public:
+    static constexpr uintptr_t CACHE_LINE_SIZE = 64;
+
+    //! @brief Constructor.
+    //!
+    //! @param counter      The counter to accumulate the number of touched cache lines.
+    CacheLineCounter( StatsInt& counter ) : m_counter( counter ) {
+        lines().clear();
+    }
+
+    //! @brief Destructor, it accumulates the number of distinct touched cache lines.
+    ~CacheLineCounter(){
+        auto& touched = lines();
+        std::sort( touched.begin() , touched.end() );
+        m_counter += (StatsInt)( std::unique( touched.begin() , touched.end() ) - touched.begin() );
+    }
+
+    //! @brief Record the cache lines covered by a piece of memory.
+    //!
+    //! @param address      Address of the memory touched.
+    //! @param size         Size of the memory touched.
+    static void Touch( const void* address , size_t size ){
+        const auto first = (uintptr_t)address / CACHE_LINE_SIZE;
+        const auto last = ( (uintptr_t)address + size - 1 ) / CACHE_LINE_SIZE;
+        for( auto line = first ; line <= last ; ++line )
+            lines().push_back( line );
+    }
+
+private:
+    StatsInt&   m_counter;
+
+    static std::vector<uintptr_t>& lines(){
+        static thread_local std::vector<uintptr_t> touched;
+        return touched;
+    }
+};
+
+#define SORT_CACHE_LINE_STATS(expr)     expr
+#define SORT_STATS_TOUCH_NODE(node)     CacheLineCounter::Touch( node , sizeof( *node ) )
+#else
+#define SORT_CACHE_LINE_STATS(expr)
+#define SORT_STATS_TOUCH_NODE(node)
+#endif
\ No newline at end of file
@@ -20,6 +20,7 @@
 #include "accelerator.h"
 #include "bvh_utils.h"
 #include "core/primitive.h"
+#include "core/memory.h"
 
 #if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
 static_assert(false, "More than one SIMD version is defined before including fast_bvh.h");
@@ -32,19 +33,51 @@ static_assert(false, "More than one SIMD version is defined before including fas
 #define FBVH_CHILD_CNT  4
 #endif
 
+// Quantized bounding boxes save quite some memory at the cost of extra instructions during traversal.
+#ifdef SORT_QUANTIZED_BVH
+#define Fast_Bvh_BBox   Simd_Quantized_BBox
+#else
+#define Fast_Bvh_BBox   Simd_BBox
+#endif
+
 #if defined(OBVH_IMPLEMENTATION)
 #define Fast_Bvh_Node   Obvh_Node
 #define FBVH_CHILD_CNT  8
 #endif
 
 #ifdef SIMD_BVH_IMPLEMENTATION
-struct Fast_Bvh_Node_Deallocator{
+struct Fast_Bvh_Aligned_Deallocator{
     void operator()(void* p){
         free_aligned(p);
     }
 };
 
+//! @brief  Allocator for the primitive packets while building leaves, the default one doesn't respect their alignment before C++17.
+template<class T>
+struct Fast_Bvh_Aligned_Allocator{
+    using value_type = T;
+
+    Fast_Bvh_Aligned_Allocator() = default;
+    template<class U>
+    Fast_Bvh_Aligned_Allocator( const Fast_Bvh_Aligned_Allocator<U>& ) {}
+
+    T* allocate( size_t cnt ) const {
+        return (T*)malloc_aligned( (unsigned)( sizeof(T) * cnt ) , SIMD_ALIGNMENT );
+    }
+    void deallocate( T* p , size_t ) const {
+        free_aligned(p);
+    }
+
+    template<class U>
+    bool operator == ( const Fast_Bvh_Aligned_Allocator<U>& ) const { return true; }
+    template<class U>
+    bool operator != ( const Fast_Bvh_Aligned_Allocator<U>& ) const { return false; }
+};
+
 struct Fast_Bvh_Node;
+struct Fast_Bvh_Node_Deallocator{
+    void operator()(Fast_Bvh_Node* p) const;
+};
 using Fast_Bvh_Node_Ptr = std::unique_ptr<Fast_Bvh_Node,Fast_Bvh_Node_Deallocator>;
 
 #else
@@ -52,21 +85,37 @@ struct Fast_Bvh_Node;
 using Fast_Bvh_Node_Ptr = std::unique_ptr<Fast_Bvh_Node>;
 #endif
 
+//! @brief Deallocator of the continuous memory block holding all nodes of a QBVH/OBVH.
+struct Fast_Bvh_Node_Array_Deallocator{
+    unsigned    cnt = 0;                                        /**< Number of nodes in the memory block. */
+    void operator()(Fast_Bvh_Node* p) const;
+};
+using Fast_Bvh_Node_Array = std::unique_ptr<Fast_Bvh_Node[],Fast_Bvh_Node_Array_Deallocator>;
+
 struct Fast_Bvh_Node {
 #ifdef SIMD_BVH_IMPLEMENTATION
-    using Simd_Triangle_Container   = std::unique_ptr<Simd_Triangle[]>;
-    using Simd_Line_Container       = std::unique_ptr<Simd_Line[]>;
-    Simd_BBox                       bbox;                       /**< Bounding boxes of its four children. */
+    using Simd_Triangle_Container   = std::unique_ptr<Simd_Triangle[],Fast_Bvh_Aligned_Deallocator>;
+    using Simd_Line_Container       = std::unique_ptr<Simd_Line[],Fast_Bvh_Aligned_Deallocator>;
+    using Simd_Sphere_Container     = std::unique_ptr<Simd_Sphere[],Fast_Bvh_Aligned_Deallocator>;
+    using Simd_Disk_Container       = std::unique_ptr<Simd_Disk[],Fast_Bvh_Aligned_Deallocator>;
+    using Simd_Quad_Container       = std::unique_ptr<Simd_Quad[],Fast_Bvh_Aligned_Deallocator>;
+    Fast_Bvh_BBox                   bbox;                       /**< Bounding boxes of its four children. */
     Simd_Triangle_Container         tri_list;
     Simd_Line_Container             line_list;
+    Simd_Sphere_Container           sphere_list;
+    Simd_Disk_Container             disk_list;
+    Simd_Quad_Container             quad_list;
     unsigned int                    tri_cnt = 0;
     unsigned int                    line_cnt = 0;
+    unsigned int                    sphere_cnt = 0;
+    unsigned int                    disk_cnt = 0;
+    unsigned int                    quad_cnt = 0;
     std::vector<const Primitive*>   other_list;
 #else
     BBox                            bbox[FBVH_CHILD_CNT];       /**< Bounding boxes of its children. */
 #endif
 
-    Fast_Bvh_Node_Ptr               children[FBVH_CHILD_CNT];   /**< Children of its four nodes. */
+    Fast_Bvh_Node*                  children[FBVH_CHILD_CNT] = { nullptr };   /**< Children of its four nodes. */
 
     unsigned                        pri_cnt = 0;                /**< Number of primitives in the node. */
     unsigned                        pri_offset = 0;             /**< Offset of primitives in the buffer. */
@@ -84,8 +133,23 @@ struct Fast_Bvh_Node {
 
 #ifdef SIMD_BVH_IMPLEMENTATION
     static_assert( sizeof( Fast_Bvh_Node ) % SIMD_ALIGNMENT == 0 , "Incorrect size of Fast_Bvh_Node." );
+
+inline void Fast_Bvh_Node_Deallocator::operator()(Fast_Bvh_Node* p) const{
+    if( p ){
+        p->~Fast_Bvh_Node();
+        free_aligned(p);
+    }
+}
 #endif
 
+inline void Fast_Bvh_Node_Array_Deallocator::operator()(Fast_Bvh_Node* p) const{
+    if( p ){
+        for( auto i = 0u ; i < cnt ; ++i )
+            p[i].~Fast_Bvh_Node();
+        free_aligned(p);
+    }
+}
+
 #endif
 
 //! @brief Fast Bounding volume hierarchy.
@@ -132,6 +196,19 @@ public:
     //! @param r            The ray to be tested.
     //! @return             Whether the ray is occluded by anything.
     bool    IsOccluded(const Ray& r) const override;
+#else
+    //! @brief  Evaluate attenuation of a batch of shadow rays.
+    //!
+    //! Each ray walks through all transparent surfaces along it in one single traversal with no need to sort the traversed nodes,
+    //! it stops as soon as the ray is fully blocked. With medium stacks, surfaces with volume attached are recorded during the
+    //! traversal and sorted afterward to update the medium stacks in order. Only in the rare case of too many such surfaces along
+    //! a ray, it falls back to the default implementation.
+    //!
+    //! @param rays         The rays to be tested, each of them has its own maximum distance.
+    //! @param cnt          Number of rays to be tested.
+    //! @param attenuation  The attenuation along each of the rays, 0 means fully occluded.
+    //! @param ms           Medium stacks of each ray, it is either nullptr or an array of 'cnt' medium stacks.
+    void    GetAttenuation( const Ray* rays , unsigned cnt , Spectrum* attenuation , MediumStack* ms = nullptr ) const override;
 #endif
 
     //! @brief Get multiple intersections between the ray and the primitive set using spatial data structure.
@@ -152,6 +229,13 @@ public:
     //! @param bbox             The bounding box of the scene.
     void    Build(const std::vector<const Primitive*>& primitives, const BBox& bbox) override;
 
+    //! @brief Refit the QBVH/OBVH after primitives are moved.
+    //!
+    //! Bounding boxes of all nodes and SIMD primitive packets in leaves are updated bottom-up in parallel, the structure of the tree
+    //! is untouched. If the SAH cost of the refit tree grows too much comparing with the one right after construction, the QBVH/OBVH
+    //! will be rebuilt from scratch.
+    void    Refit() override;
+
     //! @brief      Serializing data from stream.
     //!
     //! @param      Stream where the serialization data comes from. Depending on different situation,
@@ -172,8 +256,14 @@ private:
     /**< Primitive list during QBVH/OBVH construction. */
     std::unique_ptr<Bvh_Primitive[]>    m_bvhpri = nullptr;
 
-    /**< Root node of the BVH. */
-    Fast_Bvh_Node_Ptr                   m_root;
+    /**< All nodes in one continuous memory block in van Emde Boas layout, the first one is the root node. */
+    Fast_Bvh_Node_Array                 m_nodes;
+    /**< Nodes allocated during construction, they are moved to 'm_nodes' once the construction is done. */
+    std::vector<Fast_Bvh_Node_Ptr>      m_buildNodes;
+    /**< Number of nodes in the QBVH/OBVH. */
+    unsigned                            m_nodeCnt = 0;
+    /**< SAH cost of the QBVH/OBVH right after construction. */
+    float                               m_sahCost = 0.0f;
 
     /**< Maximum primitives in a leaf node. During BVH construction, a node with less primitives will be marked as a leaf node. */
     unsigned                            m_maxPriInLeaf = 8;
@@ -198,12 +288,62 @@ private:
     //! @param depth        Depth of the current node.
     void    makeLeaf( Fbvh_Node* const node , unsigned start , unsigned end , unsigned depth );
 
+    //! @brief Allocate a new node during construction.
+    //!
+    //! @param start        The start offset of primitives that the node holds.
+    //! @param cnt          Number of primitives in the node.
+    //! @return             The newly allocated node.
+    Fbvh_Node*  allocateNode( unsigned start , unsigned cnt );
+
+    //! @brief Move all nodes into one continuous memory block in van Emde Boas layout.
+    //!
+    //! Nodes allocated one by one during construction could be anywhere in memory, this pass makes sure nodes close to each other
+    //! in the tree are also close in memory, so that rays, especially incoherent ones, touch less cache lines during traversal.
+    void        layoutNodes();
+
+    //! @brief Update bounding boxes of all nodes bottom-up.
+    //!
+    //! @param node_bbox    Bounding box of each node, indexed by the offset of the node in the memory block.
+    //! @param update       Whether to update the nodes and SIMD primitive packets too, otherwise only 'node_bbox' is evaluated.
+    void        refitNodes( std::vector<BBox>& node_bbox , bool update );
+
+    //! @brief Evaluate the SAH cost of the whole tree.
+    //!
+    //! @param node_bbox    Bounding box of each node, indexed by the offset of the node in the memory block.
+    //! @return             The SAH cost of the tree.
+    float       sahCost( const std::vector<BBox>& node_bbox ) const;
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    //! @brief  Evaluate attenuation along a shadow ray in one single traversal.
+    //!
+    //! @param ray          The shadow ray to be tested.
+    //! @param boundaries   Surfaces with volume attached along the ray are recorded here if it is not nullptr.
+    //! @return             The attenuation along the ray, not considering any medium.
+    Spectrum    getAttenuation( const Ray& ray , MediumBoundaries* boundaries = nullptr ) const;
+#endif
+
 #ifdef SIMD_BVH_IMPLEMENTATION
     //! @brief A helper function calculating bounding box of a node.
     //!
     //! @param children     The children nodes
     //! @return             The 4/8 bounding box of the node, there could be degenerated ones if there is no four children.
-    Simd_BBox   calcBoundingBoxSIMD(const Fast_Bvh_Node_Ptr* children) const;
+    Fast_Bvh_BBox   calcBoundingBoxSIMD(Fast_Bvh_Node* const* children) const;
+
+    //! @brief A helper function packing bounding boxes of children into the format of a node.
+    //!
+    //! @param bbox         Bounding boxes of the 4/8 children.
+    //! @param bb_valid     Whether each of the children exists.
+    //! @return             The 4/8 bounding box of the node.
+    Fast_Bvh_BBox   packBoundingBoxSIMD(const BBox* bbox, const bool* bb_valid) const;
+
+    //! @brief Decide how many pieces each line primitive is split into during construction.
+    //!
+    //! A line is split if the surface area of its bounding box is dominated by the empty space around a long diagonal line.
+    //! The total number of extra references is capped by the number of primitives so that memory usage is bounded.
+    //!
+    //! @param piece_cnt    Number of pieces of each primitive, it is one for any primitive that is not split.
+    //! @return             Total number of references in the tree.
+    unsigned        splitLines( std::vector<unsigned>& piece_cnt ) const;
 #endif
 
 #ifdef QBVH_IMPLEMENTATION
@@ -16,8 +16,10 @@
  */
 
 #include <queue>
+#include <unordered_map>
 #include "core/memory.h"
 #include "core/stats.h"
+#include "core/globalconfig.h"
 #include "scatteringevent/bssrdf/bssrdf.h"
 
 SORT_STATIC_FORCEINLINE Fast_Bvh_Node_Ptr makeFastBvhNode( unsigned int start , unsigned int end ){
@@ -30,15 +32,13 @@ SORT_STATIC_FORCEINLINE Fast_Bvh_Node_Ptr makeFastBvhNode( unsigned int start ,
 #endif
 }
 
-template<class T>
-SORT_STATIC_FORCEINLINE std::unique_ptr<T[]> makePrimitiveList( unsigned int cnt ){
 #ifdef SIMD_BVH_IMPLEMENTATION
+template<class T>
+SORT_STATIC_FORCEINLINE std::unique_ptr<T[],Fast_Bvh_Aligned_Deallocator> makePrimitiveList( unsigned int cnt ){
     auto* address = malloc_aligned( sizeof(T) * cnt , SIMD_ALIGNMENT );
-    return std::move(std::unique_ptr<T[]>((T*)address));
-#else
-    return std::move(std::unique_ptr<T[]>(cnt));
-#endif
+    return std::move(std::unique_ptr<T[],Fast_Bvh_Aligned_Deallocator>((T*)address));
 }
+#endif
 
 #if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
 static_assert(false, "More than one SIMD version is defined before including fast_bvh.hpp");
@@ -52,6 +52,7 @@ SORT_STATS_DEFINE_COUNTER(sQbvhLeafNodeCount)
 SORT_STATS_DEFINE_COUNTER(sQbvhDepth)
 SORT_STATS_DEFINE_COUNTER(sQbvhMaxPriCountInLeaf)
 SORT_STATS_DEFINE_COUNTER(sQbvhPrimitiveCount)
+SORT_STATS_DEFINE_COUNTER(sQbvhLineSegmentCount)
 
 SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Total Ray Count", sRayCount);
 SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Shadow Ray Count", sShadowRayCount);
@@ -62,12 +63,21 @@ SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "BVH Depth", sQbvhDepth);
 SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Maximum Primitive in Leaf", sQbvhMaxPriCountInLeaf);
 SORT_STATS_AVG_COUNT("Spatial-Structure(QBVH)", "Average Primitive Count in Leaf", sQbvhPrimitiveCount , sQbvhLeafNodeCount );
 SORT_STATS_AVG_COUNT("Spatial-Structure(QBVH)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
+SORT_STATS_AVG_COUNT("Spatial-Structure(QBVH)", "Average Node Visited per Ray", sTraversedNodeCount, sRayCount);
+SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Line Sub-Segment Count", sQbvhLineSegmentCount);
+
+#ifdef SORT_ENABLE_CACHE_LINE_STATS
+SORT_STATS_DEFINE_COUNTER(sQbvhNodeCacheLineCount)
+SORT_STATS_AVG_COUNT("Spatial-Structure(QBVH)", "Average Node Cache Lines Touched per Ray", sQbvhNodeCacheLineCount, sRayCount);
+#endif
 
 #define sFbvhNodeCount          sQbvhNodeCount
 #define sFbvhLeafNodeCount      sQbvhLeafNodeCount
 #define sFbvhDepth              sQbvhDepth
 #define sFbvhMaxPriCountInLeaf  sQbvhMaxPriCountInLeaf
 #define sFbvhPrimitiveCount     sQbvhPrimitiveCount
+#define sFbvhNodeCacheLineCount sQbvhNodeCacheLineCount
+#define sFbvhLineSegmentCount   sQbvhLineSegmentCount
 
 #endif
 
@@ -79,6 +89,7 @@ SORT_STATS_DEFINE_COUNTER(sObvhLeafNodeCount)
 SORT_STATS_DEFINE_COUNTER(sObvhDepth)
 SORT_STATS_DEFINE_COUNTER(sObvhMaxPriCountInLeaf)
 SORT_STATS_DEFINE_COUNTER(sObvhPrimitiveCount)
+SORT_STATS_DEFINE_COUNTER(sObvhLineSegmentCount)
 
 SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Total Ray Count", sRayCount);
 SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Shadow Ray Count", sShadowRayCount);
@@ -89,12 +100,21 @@ SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "BVH Depth", sObvhDepth);
 SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Maximum Primitive in Leaf", sObvhMaxPriCountInLeaf);
 SORT_STATS_AVG_COUNT("Spatial-Structure(OBVH)", "Average Primitive Count in Leaf", sObvhPrimitiveCount , sObvhLeafNodeCount );
 SORT_STATS_AVG_COUNT("Spatial-Structure(OBVH)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
+SORT_STATS_AVG_COUNT("Spatial-Structure(OBVH)", "Average Node Visited per Ray", sTraversedNodeCount, sRayCount);
+SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Line Sub-Segment Count", sObvhLineSegmentCount);
+
+#ifdef SORT_ENABLE_CACHE_LINE_STATS
+SORT_STATS_DEFINE_COUNTER(sObvhNodeCacheLineCount)
+SORT_STATS_AVG_COUNT("Spatial-Structure(OBVH)", "Average Node Cache Lines Touched per Ray", sObvhNodeCacheLineCount, sRayCount);
+#endif
 
 #define sFbvhNodeCount          sObvhNodeCount
 #define sFbvhLeafNodeCount      sObvhLeafNodeCount
 #define sFbvhDepth              sObvhDepth
 #define sFbvhMaxPriCountInLeaf  sObvhMaxPriCountInLeaf
 #define sFbvhPrimitiveCount     sObvhPrimitiveCount
+#define sFbvhNodeCacheLineCount sObvhNodeCacheLineCount
+#define sFbvhLineSegmentCount   sObvhLineSegmentCount
 
 #endif
 
@@ -107,6 +127,76 @@ SORT_STATIC_FORCEINLINE BBox calcBoundingBox(const Fbvh_Node* const node , const
     return node_bbox;
 }
 
+#ifdef SIMD_BVH_IMPLEMENTATION
+//! @brief  Merge pieces of the same line and order lines along the strands they belong to.
+//!
+//! There is no explicit strand information in line primitives, consecutive segments of a strand are found by matching
+//! the end point of one segment with the start point of another one.
+//!
+//! @param  line_refs   References of lines in a leaf node.
+//! @return             Line references ordered along strands.
+static std::vector<Bvh_Primitive> sortLinesInStrands( std::vector<Bvh_Primitive>& line_refs ){
+    // merge continuous pieces of the same line into one reference.
+    std::sort( line_refs.begin() , line_refs.end() , []( const Bvh_Primitive& p0 , const Bvh_Primitive& p1 ){
+        return p0.primitive < p1.primitive || ( p0.primitive == p1.primitive && p0.m_s0 < p1.m_s0 );
+    });
+    std::vector<Bvh_Primitive> merged;
+    for( const auto& ref : line_refs ){
+        if( !merged.empty() && merged.back().primitive == ref.primitive && merged.back().m_s1 == ref.m_s0 )
+            merged.back().m_s1 = ref.m_s1;
+        else
+            merged.push_back( ref );
+    }
+
+    // it is a quadratic algorithm, which is only worth it for small leaves.
+    constexpr unsigned max_chained_cnt = 64u;
+    const auto cnt = (unsigned)merged.size();
+    if( cnt <= 1 || cnt > max_chained_cnt )
+        return merged;
+
+    const auto line = [&]( unsigned i ){ return static_cast<const Line*>( merged[i].primitive->GetShape() ); };
+    const auto connected = [&]( unsigned i , unsigned j ){
+        if( merged[i].m_s1 < 1.0f || merged[j].m_s0 > 0.0f )
+            return false;
+        const auto li = line( i );
+        const auto lj = line( j );
+        const auto length_i = ( li->GetCenterPoint( 1.0f ) - li->GetCenterPoint( 0.0f ) ).Length();
+        const auto length_j = ( lj->GetCenterPoint( 1.0f ) - lj->GetCenterPoint( 0.0f ) ).Length();
+        const auto threshold = 1e-4f * std::max( length_i , length_j );
+        return ( li->GetCenterPoint( 1.0f ) - lj->GetCenterPoint( 0.0f ) ).Length() <= threshold;
+    };
+
+    std::vector<int> next( cnt , -1 );
+    std::vector<bool> has_prev( cnt , false );
+    for( auto i = 0u ; i < cnt ; ++i ){
+        for( auto j = 0u ; j < cnt ; ++j ){
+            if( i == j || has_prev[j] || !connected( i , j ) )
+                continue;
+            next[i] = j;
+            has_prev[j] = true;
+            break;
+        }
+    }
+
+    // walk the strands from their heads, loops are picked up at the end.
+    std::vector<Bvh_Primitive> ret;
+    std::vector<bool> visited( cnt , false );
+    const auto walk = [&]( unsigned i ){
+        for( auto k = (int)i ; k >= 0 && !visited[k] ; k = next[k] ){
+            visited[k] = true;
+            ret.push_back( merged[k] );
+        }
+    };
+    for( auto i = 0u ; i < cnt ; ++i ){
+        if( !has_prev[i] )
+            walk( i );
+    }
+    for( auto i = 0u ; i < cnt ; ++i )
+        walk( i );
+    return ret;
+}
+#endif
+
 void Fbvh::Build(const std::vector<const Primitive*>& primitives, const BBox& bbox){
     SORT_PROFILE("Build Fbvh");
 
@@ -114,18 +204,46 @@ void Fbvh::Build(const std::vector<const Primitive*>& primitives, const BBox& bb
 	if( primitives.empty() )
 		return;
 
-    m_bvhpri = std::make_unique<Bvh_Primitive[]>(m_primitives->size());
-
     m_bbox = bbox;
 
     // generate BVH primitives
     const auto primitive_cnt = m_primitives->size();
+#ifdef SIMD_BVH_IMPLEMENTATION
+    // Long diagonal lines in hair have terrible axis aligned bounding boxes, they are split into several pieces so that
+    // the lowest levels of the tree bound the strands a lot tighter. Each piece is an individual reference in the tree.
+    std::vector<unsigned> piece_cnt( primitive_cnt , 1u );
+    const auto ref_cnt = splitLines( piece_cnt );
+
+    m_bvhpri = std::make_unique<Bvh_Primitive[]>(ref_cnt);
+    for (auto i = 0u, k = 0u; i < primitive_cnt; ++i) {
+        const auto primitive = (*m_primitives)[i];
+        if( 1 == piece_cnt[i] ){
+            m_bvhpri[k++].SetPrimitive(primitive);
+            continue;
+        }
+        for( auto j = 0u ; j < piece_cnt[i] ; ++j ){
+            const auto s0 = (float)j / (float)piece_cnt[i];
+            const auto s1 = ( j + 1 == piece_cnt[i] ) ? 1.0f : (float)( j + 1 ) / (float)piece_cnt[i];
+            m_bvhpri[k++].SetLineSegment(primitive, s0, s1);
+        }
+    }
+#else
+    const auto ref_cnt = (unsigned)primitive_cnt;
+    m_bvhpri = std::make_unique<Bvh_Primitive[]>(ref_cnt);
     for (auto i = 0u; i < primitive_cnt; ++i)
         m_bvhpri[i].SetPrimitive((*m_primitives)[i]);
-    
+#endif
+
     // recursively split node
-    m_root = makeFastBvhNode( 0 , (unsigned)m_primitives->size() );
-    splitNode( m_root.get() , m_bbox , 1u );
+    splitNode( allocateNode( 0 , ref_cnt ) , m_bbox , 1u );
+
+    // lay out the nodes in a cache friendly way
+    layoutNodes();
+
+    // bounds of the nodes are only needed for the SAH cost here, a single pass in this thread is way cheaper than spawning threads.
+    std::vector<BBox> node_bbox( m_nodeCnt );
+    refitNodes( node_bbox , false );
+    m_sahCost = sahCost( node_bbox );
 
     // if the algorithm reaches here, it is a valid QBVH
     m_isValid = true;
@@ -183,7 +301,7 @@ void Fbvh::splitNode( Fbvh_Node* const node , const BBox& node_bbox , unsigned d
             while (!q.empty()) {
                 const auto cur = q.front();
                 q.pop();
-                node->children[node->child_cnt++] = makeFastBvhNode( cur.first , cur.second - cur.first );
+                node->children[node->child_cnt++] = allocateNode( cur.first , cur.second - cur.first );
             }
         };
 
@@ -194,11 +312,11 @@ void Fbvh::splitNode( Fbvh_Node* const node , const BBox& node_bbox , unsigned d
     // split children if needed.
     for( auto j = 0u ; j < node->child_cnt ; ++j ){
 #ifdef SIMD_BVH_IMPLEMENTATION
-        const auto bbox = calcBoundingBox(node->children[j].get(), m_bvhpri.get());
-        splitNode(node->children[j].get(), bbox, depth + 1);
+        const auto bbox = calcBoundingBox(node->children[j], m_bvhpri.get());
+        splitNode(node->children[j], bbox, depth + 1);
 #else
-        node->bbox[j] = calcBoundingBox( node->children[j].get() , m_bvhpri.get() );
-        splitNode( node->children[j].get() , node->bbox[j] , depth + 1 );
+        node->bbox[j] = calcBoundingBox( node->children[j] , m_bvhpri.get() );
+        splitNode( node->children[j] , node->bbox[j] , depth + 1 );
 #endif
     }
 
@@ -219,8 +337,15 @@ void Fbvh::makeLeaf( Fbvh_Node* const node , unsigned start , unsigned end , uns
 #ifdef SIMD_BVH_IMPLEMENTATION
     Simd_Triangle   sind_tri;
     Simd_Line       simd_line;
-    std::vector<Simd_Triangle>  tri_list;
-    std::vector<Simd_Line>      line_list;
+    Simd_Sphere     simd_sphere;
+    Simd_Disk       simd_disk;
+    Simd_Quad       simd_quad;
+    std::vector<Simd_Triangle,Fast_Bvh_Aligned_Allocator<Simd_Triangle>>  tri_list;
+    std::vector<Simd_Line,Fast_Bvh_Aligned_Allocator<Simd_Line>>          line_list;
+    std::vector<Simd_Sphere,Fast_Bvh_Aligned_Allocator<Simd_Sphere>>      sphere_list;
+    std::vector<Simd_Disk,Fast_Bvh_Aligned_Allocator<Simd_Disk>>          disk_list;
+    std::vector<Simd_Quad,Fast_Bvh_Aligned_Allocator<Simd_Quad>>          quad_list;
+    std::vector<Bvh_Primitive>  line_refs;
     const auto _start = node->pri_offset;
     const auto _end = _start + node->pri_cnt;
     for(auto i = _start ; i < _end ; i++ ){
@@ -234,21 +359,47 @@ void Fbvh::makeLeaf( Fbvh_Node* const node , unsigned start , unsigned end , uns
                 }
             }
         }else if( SHAPE_LINE == shape_type ){
-            if( simd_line.PushLine( primitive ) ){
-                if( simd_line.PackData() ){
-                    line_list.push_back( simd_line );
-                    simd_line.Reset();
-                }
+            line_refs.push_back( m_bvhpri[i] );
+        }else if( SHAPE_SPHERE == shape_type ){
+            if( simd_sphere.PushPrimitive( primitive ) && simd_sphere.PackData() ){
+                sphere_list.push_back( simd_sphere );
+                simd_sphere.Reset();
+            }
+        }else if( SHAPE_DISK == shape_type ){
+            if( simd_disk.PushPrimitive( primitive ) && simd_disk.PackData() ){
+                disk_list.push_back( simd_disk );
+                simd_disk.Reset();
+            }
+        }else if( SHAPE_QUAD == shape_type ){
+            if( simd_quad.PushPrimitive( primitive ) && simd_quad.PackData() ){
+                quad_list.push_back( simd_quad );
+                simd_quad.Reset();
             }
         }else{
-            // line will also be specially treated in the future.
             node->other_list.push_back( primitive );
         }
     }
+
+    // Lines are packed in the order of the strands so that the oriented bounding box of each packet is as tight as possible.
+    for( const auto& line_ref : sortLinesInStrands( line_refs ) ){
+        if( simd_line.PushLine( line_ref.primitive , line_ref.m_s0 , line_ref.m_s1 ) ){
+            if( simd_line.PackData() ){
+                line_list.push_back( simd_line );
+                simd_line.Reset();
+            }
+        }
+    }
+
     if (sind_tri.PackData())
         tri_list.push_back(sind_tri);
     if (simd_line.PackData())
         line_list.push_back(simd_line);
+    if (simd_sphere.PackData())
+        sphere_list.push_back(simd_sphere);
+    if (simd_disk.PackData())
+        disk_list.push_back(simd_disk);
+    if (simd_quad.PackData())
+        quad_list.push_back(simd_quad);
     
     if( tri_list.size() ){
         node->tri_list = makePrimitiveList<Simd_Triangle>( (unsigned int)tri_list.size() );
@@ -262,29 +413,209 @@ void Fbvh::makeLeaf( Fbvh_Node* const node , unsigned start , unsigned end , uns
         for( auto i = 0u ; i < line_list.size() ; ++i )
             node->line_list[i] = line_list[i];
     }
+    if( sphere_list.size() ){
+        node->sphere_list = makePrimitiveList<Simd_Sphere>( (unsigned int)sphere_list.size() );
+        node->sphere_cnt = (unsigned int)sphere_list.size();
+        for( auto i = 0u ; i < sphere_list.size() ; ++i )
+            node->sphere_list[i] = sphere_list[i];
+    }
+    if( disk_list.size() ){
+        node->disk_list = makePrimitiveList<Simd_Disk>( (unsigned int)disk_list.size() );
+        node->disk_cnt = (unsigned int)disk_list.size();
+        for( auto i = 0u ; i < disk_list.size() ; ++i )
+            node->disk_list[i] = disk_list[i];
+    }
+    if( quad_list.size() ){
+        node->quad_list = makePrimitiveList<Simd_Quad>( (unsigned int)quad_list.size() );
+        node->quad_cnt = (unsigned int)quad_list.size();
+        for( auto i = 0u ; i < quad_list.size() ; ++i )
+            node->quad_list[i] = quad_list[i];
+    }
 #endif
 
     SORT_STATS(++sFbvhLeafNodeCount);
     SORT_STATS(sFbvhMaxPriCountInLeaf = std::max( sFbvhMaxPriCountInLeaf , (StatsInt)node->pri_cnt) );
 }
 
+Fbvh_Node* Fbvh::allocateNode( unsigned start , unsigned cnt ){
+    m_buildNodes.push_back( makeFastBvhNode( start , cnt ) );
+    return m_buildNodes.back().get();
+}
+
+void Fbvh::layoutNodes(){
+    std::vector<Fbvh_Node*> order;
+    order.reserve( m_buildNodes.size() );
+
+    const auto children = []( Fbvh_Node* node , const auto& visit ){
+        for( auto i = 0u ; i < node->child_cnt ; ++i )
+            visit( node->children[i] );
+    };
+    vanEmdeBoasLayout( m_buildNodes.front().get() , m_depth , children , order );
+    sAssert( order.size() == m_buildNodes.size() , SPATIAL_ACCELERATOR );
+
+    const auto cnt = (unsigned)order.size();
+    m_nodeCnt = cnt;
+    auto* address = malloc_aligned( sizeof(Fbvh_Node) * cnt , alignof(Fbvh_Node) );
+    m_nodes = Fast_Bvh_Node_Array( (Fbvh_Node*)address , Fast_Bvh_Node_Array_Deallocator{ 0 } );
+
+    std::unordered_map<const Fbvh_Node*, Fbvh_Node*> remap;
+    for( auto i = 0u ; i < cnt ; ++i ){
+        new (&m_nodes[i]) Fbvh_Node( std::move( *order[i] ) );
+        m_nodes.get_deleter().cnt = i + 1;
+        remap[order[i]] = &m_nodes[i];
+    }
+    for( auto i = 0u ; i < cnt ; ++i ){
+        for( auto j = 0u ; j < m_nodes[i].child_cnt ; ++j )
+            m_nodes[i].children[j] = remap[m_nodes[i].children[j]];
+    }
+
+    m_buildNodes.clear();
+    m_buildNodes.shrink_to_fit();
+}
+
+void Fbvh::Refit(){
+    SORT_PROFILE("Refit Fbvh");
+
+    if( !m_isValid )
+        return;
+
+    std::vector<BBox> node_bbox( m_nodeCnt );
+    refitNodes( node_bbox , true );
+
+    m_bbox = node_bbox[0];
+
+    // the tree could be far from optimal if primitives moved a lot, it is better to rebuild it in such a case.
+    if( sahCost( node_bbox ) > m_sahCost * m_rebuildThreshold )
+        rebuild();
+}
+
+void Fbvh::refitNodes( std::vector<BBox>& node_bbox , bool update ){
+    const auto children = []( Fbvh_Node* node , const auto& visit ){
+        for( auto i = 0u ; i < node->child_cnt ; ++i )
+            visit( node->children[i] );
+    };
+    const auto refit_node = [&]( Fbvh_Node* node ){
+        auto& bbox = node_bbox[node - m_nodes.get()];
+        bbox = BBox();
+
+        if( 0 == node->child_cnt ){
+            bbox = calcBoundingBox( node , m_bvhpri.get() );
 #ifdef SIMD_BVH_IMPLEMENTATION
-Simd_BBox Fbvh::calcBoundingBoxSIMD(const Fast_Bvh_Node_Ptr* children) const {
+            if( update ){
+                for( auto i = 0u ; i < node->tri_cnt ; ++i )
+                    node->tri_list[i].PackData();
+                for( auto i = 0u ; i < node->line_cnt ; ++i )
+                    node->line_list[i].PackData();
+                for( auto i = 0u ; i < node->sphere_cnt ; ++i )
+                    node->sphere_list[i].PackData();
+                for( auto i = 0u ; i < node->disk_cnt ; ++i )
+                    node->disk_list[i].PackData();
+                for( auto i = 0u ; i < node->quad_cnt ; ++i )
+                    node->quad_list[i].PackData();
+            }
+#endif
+            return;
+        }
+
+        BBox    child_bbox[FBVH_CHILD_CNT];
+        bool    child_valid[FBVH_CHILD_CNT] = { false };
+        for( auto i = 0u ; i < node->child_cnt ; ++i ){
+            child_bbox[i] = node_bbox[node->children[i] - m_nodes.get()];
+            child_valid[i] = true;
+            bbox.Union( child_bbox[i] );
+        }
+
+        if( update ){
+#ifdef SIMD_BVH_IMPLEMENTATION
+            node->bbox = packBoundingBoxSIMD( child_bbox , child_valid );
+#else
+            for( auto i = 0u ; i < node->child_cnt ; ++i )
+                node->bbox[i] = child_bbox[i];
+#endif
+        }
+    };
+    // only refitting the packed bounds of a large tree is worth doing in parallel.
+    const auto thread_cnt = ( update && m_nodeCnt >= REFIT_PARALLEL_NODE_CNT ) ? std::max( 1u , g_threadCnt ) : 1u;
+    refitTree( m_nodes.get() , thread_cnt , children , refit_node );
+}
+
+float Fbvh::sahCost( const std::vector<BBox>& node_bbox ) const{
+    auto cost = 0.0f;
+    for( auto i = 0u ; i < m_nodeCnt ; ++i )
+        cost += sahNodeCost( node_bbox[i] , m_nodes[i].pri_cnt * ( 0 == m_nodes[i].child_cnt ) , node_bbox[0] );
+    return cost;
+}
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+Fast_Bvh_BBox Fbvh::calcBoundingBoxSIMD(Fast_Bvh_Node* const* children) const {
+    BBox    bbox[SIMD_CHANNEL];
+    bool    bb_valid[SIMD_CHANNEL] = { false };
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+        bbox[i] = calcBoundingBox( children[i] , m_bvhpri.get() );
+        bb_valid[i] = ( nullptr != children[i] );
+    }
+    return packBoundingBoxSIMD( bbox , bb_valid );
+}
+
+unsigned Fbvh::splitLines( std::vector<unsigned>& piece_cnt ) const{
+    // at most this number of pieces for a single line.
+    constexpr unsigned max_piece_cnt = 4u;
+
+    const auto primitive_cnt = (unsigned)m_primitives->size();
+    auto extra_cnt = 0u;
+    for( auto i = 0u ; i < primitive_cnt ; ++i ){
+        const auto primitive = (*m_primitives)[i];
+        if( SHAPE_LINE != primitive->GetShapeType() )
+            continue;
+
+        const auto line = static_cast<const Line*>( primitive->GetShape() );
+        const auto d = line->GetCenterPoint( 1.0f ) - line->GetCenterPoint( 0.0f );
+        const auto w = std::max( line->GetRadius( 0.0f ) , line->GetRadius( 1.0f ) );
+        const auto ax = fabs( d.x ) , ay = fabs( d.y ) , az = fabs( d.z );
+
+        // Splitting a line into k pieces divides the part of the surface area caused by the diagonal direction by k, while the
+        // part caused by the width of the line stays the same. It only makes sense to split if the former one dominates.
+        const auto diagonal = ax * ay + ay * az + az * ax;
+        const auto width = 4.0f * w * ( ax + ay + az );
+        if( diagonal <= width )
+            continue;
+
+        const auto k = std::min( max_piece_cnt , (unsigned)ceil( diagonal / std::max( width , FLT_MIN ) ) );
+        piece_cnt[i] = k;
+        extra_cnt += k - 1;
+    }
+
+    // scale the pieces down if there are too many of them.
+    if( extra_cnt > primitive_cnt ){
+        const auto ratio = (float)primitive_cnt / (float)extra_cnt;
+        extra_cnt = 0u;
+        for( auto& cnt : piece_cnt ){
+            cnt = 1u + (unsigned)( ( cnt - 1u ) * ratio );
+            extra_cnt += cnt - 1u;
+        }
+    }
+
+    SORT_STATS(sFbvhLineSegmentCount += (StatsInt)extra_cnt);
+
+    return primitive_cnt + extra_cnt;
+}
+
+Fast_Bvh_BBox Fbvh::packBoundingBoxSIMD(const BBox* bbox, const bool* bb_valid) const {
+#ifdef SORT_QUANTIZED_BVH
+    return QuantizeBBox_SIMD( bbox , bb_valid );
+#else
     Simd_BBox node_bbox;
 
     float   min_x[SIMD_CHANNEL] , min_y[SIMD_CHANNEL] , min_z[SIMD_CHANNEL];
     float   max_x[SIMD_CHANNEL] , max_y[SIMD_CHANNEL] , max_z[SIMD_CHANNEL];
-    bool    bb_valid[SIMD_CHANNEL] = { false };
     for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
-        const auto bb = calcBoundingBox( children[i].get() , m_bvhpri.get() );
+        const auto& bb = bbox[i];
         min_x[i] = bb.m_Min.x;
         min_y[i] = bb.m_Min.y;
         min_z[i] = bb.m_Min.z;
         max_x[i] = bb.m_Max.x;
         max_y[i] = bb.m_Max.y;
         max_z[i] = bb.m_Max.z;
-
-        bb_valid[i] = ( nullptr != children[i].get() );
     }
 
     node_bbox.m_min_x = simd_set_ps( min_x );
@@ -298,14 +629,14 @@ Simd_BBox Fbvh::calcBoundingBoxSIMD(const Fast_Bvh_Node_Ptr* children) const {
     node_bbox.m_mask = simd_set_mask( bb_valid );
 
     return node_bbox;
+#endif
 }
 #endif
 
 bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
     // std::stack is by no means an option here due to its overhead under the hood.
-    static thread_local std::unique_ptr<std::pair<Fbvh_Node*, float>[]> bvh_stack = nullptr;
-    if (UNLIKELY(nullptr == bvh_stack))
-        bvh_stack = std::make_unique<std::pair<Fbvh_Node*, float>[]>(m_depth * FBVH_CHILD_CNT);
+    static thread_local TraversalStack<std::pair<Fbvh_Node*, float>> traversal_stack;
+    const auto bvh_stack = traversal_stack.Reserve( m_depth * FBVH_CHILD_CNT );
 
 #ifdef QBVH_IMPLEMENTATION
     SORT_PROFILE("Traverse Qbvh");
@@ -333,7 +664,9 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
 
     // stack index
     auto si = 0;
-    bvh_stack[si++] = std::make_pair( m_root.get() , fmin );
+    bvh_stack[si++] = std::make_pair( m_nodes.get() , fmin );
+
+    SORT_CACHE_LINE_STATS(CacheLineCounter cache_line_counter(sFbvhNodeCacheLineCount));
 
     while( si > 0 ){
         const auto top = bvh_stack[--si];
@@ -343,6 +676,9 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
         if( intersect.t < fmin )
             continue;
 
+        SORT_STATS_TOUCH_NODE(node);
+        SORT_STATS(++sTraversedNodeCount);
+
 #ifdef SIMD_BVH_IMPLEMENTATION
         // check if it is a leaf node
         if( 0 == node->child_cnt ){
@@ -387,6 +723,32 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
                 }
 #endif
             }
+
+            // spheres, disks and quads share the same logic, only the packets differ.
+            const auto intersect_analytic = [&]( const auto& shape_list , unsigned shape_cnt ){
+                for( auto i = 0u ; i < shape_cnt ; ++i ){
+                    const auto blocked = intersectAnalytic_SIMD( ray , simd_ray , shape_list[i] , &intersect );
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+                    if( intersect.query_shadow && blocked ){
+                        sAssert( nullptr != intersect.primitive , SPATIAL_ACCELERATOR );
+                        sAssert( nullptr != intersect.primitive->GetMaterial() , SPATIAL_ACCELERATOR );
+                        if( !intersect.primitive->GetMaterial()->HasTransparency() ){
+                            intersect.primitive = nullptr;
+                            return true;
+                        }
+                    }
+#endif
+                }
+                return false;
+            };
+            if( intersect_analytic( node->sphere_list , node->sphere_cnt ) ||
+                intersect_analytic( node->disk_list , node->disk_cnt ) ||
+                intersect_analytic( node->quad_list , node->quad_cnt ) ){
+                SORT_STATS(sIntersectionTest += node->pri_cnt);
+                return true;
+            }
+
             if( UNLIKELY(!node->other_list.empty()) ){
                 for( auto i = 0u ; i < node->other_list.size() ; ++i ){
                     const auto blocked = node->other_list[i]->GetIntersect( ray , &intersect );
@@ -396,7 +758,7 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
                         sAssert( nullptr != intersect.primitive , SPATIAL_ACCELERATOR );
                         sAssert( nullptr != intersect.primitive->GetMaterial() , SPATIAL_ACCELERATOR );
                         if( !intersect.primitive->GetMaterial()->HasTransparency() ){
-                            SORT_STATS(sIntersectionTest += i + 1 + ( node->tri_cnt + node->line_cnt ) * 4);
+                            SORT_STATS(sIntersectionTest += i + 1 + ( node->tri_cnt + node->line_cnt + node->sphere_cnt + node->disk_cnt + node->quad_cnt ) * 4);
                             intersect.primitive = nullptr;
                             return true;
                         }
@@ -418,7 +780,7 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
         m &= m - 1;
         if( LIKELY( 0 == m ) ){
             sAssert( t0 >= 0.0f , SPATIAL_ACCELERATOR );
-            bvh_stack[si++] = std::make_pair( node->children[k0].get() , t0 );
+            bvh_stack[si++] = std::make_pair( node->children[k0] , t0 );
         }else{
             const int k1 = __bsf( m );
             m &= m - 1;
@@ -428,11 +790,11 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
                 sAssert( t1 >= 0.0f , SPATIAL_ACCELERATOR );
 
                 if( t0 < t1 ){
-                    bvh_stack[si++] = std::make_pair(node->children[k1].get(), t1 );
-                    bvh_stack[si++] = std::make_pair(node->children[k0].get(), t0 );
+                    bvh_stack[si++] = std::make_pair(node->children[k1], t1 );
+                    bvh_stack[si++] = std::make_pair(node->children[k0], t0 );
                 }else{
-                    bvh_stack[si++] = std::make_pair(node->children[k0].get(), t0);
-                    bvh_stack[si++] = std::make_pair(node->children[k1].get(), t1);
+                    bvh_stack[si++] = std::make_pair(node->children[k0], t0);
+                    bvh_stack[si++] = std::make_pair(node->children[k1], t1);
                 }
             }else{
                 for (auto i = 0u; i < node->child_cnt; ++i) {
@@ -449,7 +811,7 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
                         break;
 
                     sse_f_min[k] = -1.0f;
-                    bvh_stack[si++] = std::make_pair(node->children[k].get(), maxDist);
+                    bvh_stack[si++] = std::make_pair(node->children[k], maxDist);
                 }
             }
         }
@@ -496,7 +858,7 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
                 break;
 
             f_min[k] = -1.0f;
-            bvh_stack[si++] = std::make_pair( node->children[k].get() , maxDist );
+            bvh_stack[si++] = std::make_pair( node->children[k] , maxDist );
         }
 #endif
     }
@@ -507,9 +869,8 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
 bool  Fbvh::IsOccluded(const Ray& ray) const{
     // std::stack is by no means an option here due to its overhead under the hood.
     using Fbvh_Node_Ptr = Fbvh_Node*;
-    static thread_local std::unique_ptr<Fbvh_Node_Ptr[]> bvh_stack = nullptr;
-    if (UNLIKELY(nullptr == bvh_stack))
-        bvh_stack = std::make_unique<Fbvh_Node_Ptr[]>(m_depth * FBVH_CHILD_CNT);
+    static thread_local TraversalStack<Fbvh_Node_Ptr> traversal_stack;
+    const auto bvh_stack = traversal_stack.Reserve( m_depth * FBVH_CHILD_CNT );
 
 #ifdef QBVH_IMPLEMENTATION
     SORT_PROFILE("Traverse Qbvh");
@@ -533,10 +894,14 @@ bool  Fbvh::IsOccluded(const Ray& ray) const{
 
     // stack index
     auto si = 0;
-    bvh_stack[si++] = m_root.get();
+    bvh_stack[si++] = m_nodes.get();
+
+    SORT_CACHE_LINE_STATS(CacheLineCounter cache_line_counter(sFbvhNodeCacheLineCount));
 
     while (si > 0) {
         const auto node = bvh_stack[--si];
+        SORT_STATS_TOUCH_NODE(node);
+        SORT_STATS(++sTraversedNodeCount);
 
 #ifdef SIMD_BVH_IMPLEMENTATION
         // check if it is a leaf node
@@ -553,10 +918,28 @@ bool  Fbvh::IsOccluded(const Ray& ray) const{
                     return true;
                 }
             }
+            for (auto i = 0u; i < node->sphere_cnt; ++i) {
+                if (intersectAnalyticFast_SIMD(ray, simd_ray, node->sphere_list[i])) {
+                    SORT_STATS(sIntersectionTest += (i + 1 + node->tri_cnt + node->line_cnt) * 4);
+                    return true;
+                }
+            }
+            for (auto i = 0u; i < node->disk_cnt; ++i) {
+                if (intersectAnalyticFast_SIMD(ray, simd_ray, node->disk_list[i])) {
+                    SORT_STATS(sIntersectionTest += (i + 1 + node->tri_cnt + node->line_cnt + node->sphere_cnt) * 4);
+                    return true;
+                }
+            }
+            for (auto i = 0u; i < node->quad_cnt; ++i) {
+                if (intersectAnalyticFast_SIMD(ray, simd_ray, node->quad_list[i])) {
+                    SORT_STATS(sIntersectionTest += (i + 1 + node->tri_cnt + node->line_cnt + node->sphere_cnt + node->disk_cnt) * 4);
+                    return true;
+                }
+            }
             if (UNLIKELY(!node->other_list.empty())) {
                 for (auto i = 0u; i < node->other_list.size(); ++i) {
                     if (node->other_list[i]->GetIntersect(ray, nullptr)) {
-                        SORT_STATS(sIntersectionTest += i + 1 + ( node->tri_cnt + node->line_cnt ) * 4);
+                        SORT_STATS(sIntersectionTest += i + 1 + ( node->tri_cnt + node->line_cnt + node->sphere_cnt + node->disk_cnt + node->quad_cnt ) * 4);
                         return true;
                     }
                 }
@@ -574,7 +957,7 @@ bool  Fbvh::IsOccluded(const Ray& ray) const{
         m &= m - 1;
         if (LIKELY(0 == m)) {
             sAssert(sse_f_min[k0] >= 0.0f, SPATIAL_ACCELERATOR);
-            bvh_stack[si++] = node->children[k0].get();
+            bvh_stack[si++] = node->children[k0];
         }
         else {
             const int k1 = __bsf(m);
@@ -583,8 +966,8 @@ bool  Fbvh::IsOccluded(const Ray& ray) const{
             sAssert(sse_f_min[k1] >= 0.0f, SPATIAL_ACCELERATOR);
 
             if (LIKELY(0 == m)) {
-                bvh_stack[si++] = node->children[k1].get();
-                bvh_stack[si++] = node->children[k0].get();
+                bvh_stack[si++] = node->children[k1];
+                bvh_stack[si++] = node->children[k0];
             } else {
                 const int k2 = __bsf(m);
                 sAssert(sse_f_min[k2] >= 0.0f, SPATIAL_ACCELERATOR);
@@ -592,9 +975,9 @@ bool  Fbvh::IsOccluded(const Ray& ray) const{
                 m &= m - 1;
 
                 if( LIKELY(0==m) ){
-                    bvh_stack[si++] = node->children[k2].get();
-                    bvh_stack[si++] = node->children[k1].get();
-                    bvh_stack[si++] = node->children[k0].get();
+                    bvh_stack[si++] = node->children[k2];
+                    bvh_stack[si++] = node->children[k1];
+                    bvh_stack[si++] = node->children[k0];
                 }else{
 #if defined(SIMD_AVX_IMPLEMENTATION)
                     for (auto i = 0u; i < node->child_cnt; ++i) {
@@ -611,17 +994,17 @@ bool  Fbvh::IsOccluded(const Ray& ray) const{
                             break;
 
                         sse_f_min[k] = -1.0f;
-                        bvh_stack[si++] = node->children[k].get();
+                        bvh_stack[si++] = node->children[k];
                     }
 #endif
 #if defined(SIMD_SSE_IMPLEMENTATION)
                     const int k3 = __bsf(m);
                     sAssert(sse_f_min[k3] >= 0.0f, SPATIAL_ACCELERATOR);
 
-                    bvh_stack[si++] = node->children[k3].get();
-                    bvh_stack[si++] = node->children[k2].get();
-                    bvh_stack[si++] = node->children[k1].get();
-                    bvh_stack[si++] = node->children[k0].get();
+                    bvh_stack[si++] = node->children[k3];
+                    bvh_stack[si++] = node->children[k2];
+                    bvh_stack[si++] = node->children[k1];
+                    bvh_stack[si++] = node->children[k0];
 #endif
                 }
             }
@@ -648,18 +1031,188 @@ bool  Fbvh::IsOccluded(const Ray& ray) const{
 
         for (auto i = 0u; i < node->child_cnt; ++i)
             if( f_min[i] >= 0.0f )
-                bvh_stack[si++] = node->children[i].get();
+                bvh_stack[si++] = node->children[i];
 #endif
     }
     return false;
 }
+#else
+void Fbvh::GetAttenuation( const Ray* rays , unsigned cnt , Spectrum* attenuation , MediumStack* ms ) const{
+    if( !ms ){
+        for( auto i = 0u ; i < cnt ; ++i )
+            attenuation[i] = getAttenuation( rays[i] );
+        return;
+    }
+
+    for( auto i = 0u ; i < cnt ; ++i ){
+        MediumBoundaries boundaries;
+        attenuation[i] = getAttenuation( rays[i] , &boundaries );
+        if( attenuation[i].IsBlack() )
+            continue;
+
+        // the medium stack needs to be updated in the order of intersections along the ray, restart from scratch if some boundaries are missed.
+        if( UNLIKELY( boundaries.m_overflow ) )
+            Accelerator::GetAttenuation( rays + i , 1 , attenuation + i , ms + i );
+        else
+            attenuation[i] *= resolveMediumBoundaries( rays[i] , boundaries , ms[i] );
+    }
+}
+
+Spectrum Fbvh::getAttenuation( const Ray& ray , MediumBoundaries* boundaries ) const{
+    // std::stack is by no means an option here due to its overhead under the hood.
+    using Fbvh_Node_Ptr = Fbvh_Node*;
+    static thread_local TraversalStack<Fbvh_Node_Ptr> traversal_stack;
+    const auto bvh_stack = traversal_stack.Reserve( m_depth * FBVH_CHILD_CNT );
+
+#ifdef QBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Qbvh");
+#endif
+#ifdef OBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Obvh");
+#endif
+
+    SORT_STATS(++sRayCount);
+    SORT_STATS(++sShadowRayCount);
+
+    Spectrum attenuation( 1.0f );
+
+    ray.Prepare();
+#ifdef SIMD_BVH_IMPLEMENTATION
+    Simd_Ray_Data   simd_ray;
+    resolveRayData( ray , simd_ray );
+#endif
+
+    const auto fmin = Intersect(ray, m_bbox);
+    if (fmin < 0.0f)
+        return attenuation;
+
+    // stack index
+    auto si = 0;
+    bvh_stack[si++] = m_nodes.get();
+
+    // Unlike regular intersection tests, the nearest intersection is of no interest here. All intersections along the ray contribute to
+    // the attenuation and the order of them doesn't matter, there is no need to sort the children or to shrink the ray during traversal.
+    SORT_CACHE_LINE_STATS(CacheLineCounter cache_line_counter(sFbvhNodeCacheLineCount));
+
+    while (si > 0) {
+        const auto node = bvh_stack[--si];
+        SORT_STATS_TOUCH_NODE(node);
+        SORT_STATS(++sTraversedNodeCount);
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+        // check if it is a leaf node
+        if (0 == node->child_cnt) {
+            for (auto i = 0u; i < node->tri_cnt; ++i) {
+                if (intersectTriangleShadow_SIMD(ray, simd_ray, node->tri_list[i], attenuation, boundaries)) {
+                    SORT_STATS(sIntersectionTest += ( i + 1 ) * SIMD_CHANNEL);
+                    return 0.0f;
+                }
+            }
+            for (auto i = 0u; i < node->line_cnt; ++i) {
+                if (intersectLineShadow_SIMD(ray, simd_ray, node->line_list[i], attenuation, boundaries)) {
+                    SORT_STATS(sIntersectionTest += (i + 1 + node->tri_cnt) * SIMD_CHANNEL);
+                    return 0.0f;
+                }
+            }
+            for (auto i = 0u; i < node->sphere_cnt; ++i) {
+                if (intersectAnalyticShadow_SIMD(ray, simd_ray, node->sphere_list[i], attenuation, boundaries))
+                    return 0.0f;
+            }
+            for (auto i = 0u; i < node->disk_cnt; ++i) {
+                if (intersectAnalyticShadow_SIMD(ray, simd_ray, node->disk_list[i], attenuation, boundaries))
+                    return 0.0f;
+            }
+            for (auto i = 0u; i < node->quad_cnt; ++i) {
+                if (intersectAnalyticShadow_SIMD(ray, simd_ray, node->quad_list[i], attenuation, boundaries))
+                    return 0.0f;
+            }
+            if (UNLIKELY(!node->other_list.empty())) {
+                for (auto i = 0u; i < node->other_list.size(); ++i) {
+                    SurfaceInteraction intersection;
+                    if (!node->other_list[i]->GetIntersect(ray, &intersection))
+                        continue;
+
+                    const auto material = node->other_list[i]->GetMaterial();
+                    if (!material->HasTransparency())
+                        return 0.0f;
+
+                    // every crossing of the primitive attenuates the ray, not just the nearest one.
+                    Ray next(ray);
+                    next.Prepare();
+                    do {
+                        attenuation *= material->EvaluateTransparency(intersection);
+                        if (attenuation.IsBlack())
+                            return 0.0f;
+
+                        if (boundaries && material->HasVolumeAttached())
+                            boundaries->Add(intersection.t, dot(ray.m_Dir, intersection.gnormal), material);
+
+                        next.m_fMin = intersection.t + 0.001f;
+                        intersection = SurfaceInteraction();
+                    } while (node->other_list[i]->GetIntersect(next, &intersection));
+                }
+            }
+            SORT_STATS(sIntersectionTest += node->pri_cnt);
+            continue;
+        }
+
+        simd_data sse_f_min;
+        auto m = IntersectBBox_SIMD(ray, simd_ray, node->bbox, sse_f_min);
+        while (m) {
+            const int k = __bsf(m);
+            m &= m - 1;
+            bvh_stack[si++] = node->children[k];
+        }
+#else
+        // check if it is a leaf node
+        if (0 == node->child_cnt) {
+            const auto _start = node->pri_offset;
+            const auto _end = _start + node->pri_cnt;
+
+            for (auto i = _start; i < _end; i++) {
+                SurfaceInteraction intersection;
+                if (!m_bvhpri[i].primitive->GetIntersect(ray, &intersection))
+                    continue;
+
+                const auto material = m_bvhpri[i].primitive->GetMaterial();
+                if (!material->HasTransparency()) {
+                    SORT_STATS(sIntersectionTest += i - _start + 1);
+                    return 0.0f;
+                }
+
+                // every crossing of the primitive attenuates the ray, not just the nearest one.
+                Ray next(ray);
+                next.Prepare();
+                do {
+                    if ((attenuation *= material->EvaluateTransparency(intersection)).IsBlack()) {
+                        SORT_STATS(sIntersectionTest += i - _start + 1);
+                        return 0.0f;
+                    }
+
+                    if (boundaries && material->HasVolumeAttached())
+                        boundaries->Add(intersection.t, dot(ray.m_Dir, intersection.gnormal), material);
+
+                    next.m_fMin = intersection.t + 0.001f;
+                    intersection = SurfaceInteraction();
+                } while (m_bvhpri[i].primitive->GetIntersect(next, &intersection));
+            }
+            SORT_STATS(sIntersectionTest += node->pri_cnt);
+            continue;
+        }
+
+        for (auto i = 0u; i < node->child_cnt; ++i)
+            if (Intersect(ray, node->bbox[i]) >= 0.0f)
+                bvh_stack[si++] = node->children[i];
+#endif
+    }
+    return attenuation;
+}
 #endif
 
 void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const StringID matID ) const{
     // std::stack is by no means an option here due to its overhead under the hood.
-    static thread_local std::unique_ptr<std::pair<Fbvh_Node*, float>[]> bvh_stack = nullptr;
-    if ( UNLIKELY( nullptr == bvh_stack ) )
-        bvh_stack = std::make_unique<std::pair<Fbvh_Node*, float>[]>(m_depth * FBVH_CHILD_CNT);
+    static thread_local TraversalStack<std::pair<Fbvh_Node*, float>> traversal_stack;
+    const auto bvh_stack = traversal_stack.Reserve( m_depth * FBVH_CHILD_CNT );
 
 #ifdef QBVH_IMPLEMENTATION
     SORT_PROFILE("Traverse Qbvh");
@@ -685,7 +1238,9 @@ void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const
 
     // stack index
     auto si = 0;
-    bvh_stack[si++] = std::make_pair(m_root.get(), fmin);
+    bvh_stack[si++] = std::make_pair(m_nodes.get(), fmin);
+
+    SORT_CACHE_LINE_STATS(CacheLineCounter cache_line_counter(sFbvhNodeCacheLineCount));
 
     while (si > 0) {
         const auto top = bvh_stack[--si];
@@ -695,6 +1250,9 @@ void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const
         if (intersect.maxt < fmin)
             continue;
 
+        SORT_STATS_TOUCH_NODE(node);
+        SORT_STATS(++sTraversedNodeCount);
+
 #ifdef SIMD_BVH_IMPLEMENTATION
         if (0 == node->child_cnt) {
             // Note, only triangle shape support SSS here. This is the only big difference between AVX and non-AVX version implementation.
@@ -717,7 +1275,7 @@ void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const
         m &= m - 1;
         if (LIKELY(0 == m)) {
             sAssert(t0 >= 0.0f, SPATIAL_ACCELERATOR);
-            bvh_stack[si++] = std::make_pair(node->children[k0].get(), t0);
+            bvh_stack[si++] = std::make_pair(node->children[k0], t0);
         }
         else {
             const int k1 = __bsf(m);
@@ -728,12 +1286,12 @@ void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const
                 sAssert(t1 >= 0.0f, SPATIAL_ACCELERATOR);
 
                 if (t0 < t1) {
-                    bvh_stack[si++] = std::make_pair(node->children[k1].get(), t1);
-                    bvh_stack[si++] = std::make_pair(node->children[k0].get(), t0);
+                    bvh_stack[si++] = std::make_pair(node->children[k1], t1);
+                    bvh_stack[si++] = std::make_pair(node->children[k0], t0);
                 }
                 else {
-                    bvh_stack[si++] = std::make_pair(node->children[k0].get(), t0);
-                    bvh_stack[si++] = std::make_pair(node->children[k1].get(), t1);
+                    bvh_stack[si++] = std::make_pair(node->children[k0], t0);
+                    bvh_stack[si++] = std::make_pair(node->children[k1], t1);
                 }
             }
             else {
@@ -752,7 +1310,7 @@ void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const
                         break;
 
                     sse_f_min[k] = -1.0f;
-                    bvh_stack[si++] = std::make_pair(node->children[k].get(), maxDist);
+                    bvh_stack[si++] = std::make_pair(node->children[k], maxDist);
                 }
             }
         }
@@ -765,7 +1323,7 @@ void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const
 
             SurfaceInteraction intersection;
             for (auto i = _start; i < _end; i++) {
-                if (matID != m_bvhpri[i].primitive->GetMaterial()->GetID())
+                if (matID != m_bvhpri[i].primitive->GetMaterial()->GetUniqueID())
                     continue;
 
                 SORT_STATS(++sIntersectionTest);
@@ -815,7 +1373,7 @@ void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const
                 break;
 
             f_min[k] = -1.0f;
-            bvh_stack[si++] = std::make_pair(node->children[k].get(), maxDist);
+            bvh_stack[si++] = std::make_pair(node->children[k], maxDist);
         }
 #endif
     }
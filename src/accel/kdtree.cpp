@@ -16,8 +16,12 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <iterator>
 #include "kdtree.h"
 #include "core/primitive.h"
+#include "core/thread.h"
+#include "core/globalconfig.h"
 #include "math/interaction.h"
 #include "scatteringevent/scatteringevent.h"
 #include "core/memory.h"
@@ -39,49 +43,111 @@ SORT_STATS_COUNTER("Spatial-Structure(KDTree)", "KDTree Depth", sKDTreeDepth);
 SORT_STATS_COUNTER("Spatial-Structure(KDTree)", "Maximum Primitive in Leaf", sKDTreeMaxPriCountInLeaf);
 SORT_STATS_AVG_COUNT("Spatial-Structure(KDTree)", "Average Primitive Count in Leaf", sKDTreePrimitiveCount , sKDTreeLeafNodeCount );
 SORT_STATS_AVG_COUNT("Spatial-Structure(KDTree)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
+SORT_STATS_AVG_COUNT("Spatial-Structure(KDTree)", "Average Node Visited per Ray", sTraversedNodeCount, sRayCount);
+
+// Nodes with fewer primitives than this are not worth spawning threads for splitting their event lists.
+static constexpr unsigned KD_PARALLEL_EVENT_THRESHOLD = 4096;
+
+// Execute the function for all three axes, they are spread over at most the given number of threads.
+template<class T>
+static void forEachAxis( const unsigned thread_cnt , const T& func ){
+    if( thread_cnt <= 1 ){
+        for( auto k = 0 ; k < 3 ; ++k )
+            func( k );
+        return;
+    }
+
+    const auto cnt = std::min( thread_cnt , 3u );
+    RunHelperThreads( cnt , [&]( unsigned tid ){
+        for( auto k = tid ; k < 3u ; k += cnt )
+            func( (int)k );
+    });
+}
 
 void KDTree::Build( const std::vector<const Primitive*>& primitives, const BBox& bbox){
     SORT_PROFILE("Build KdTree");
 
     m_primitives = &primitives;
+    m_nodes.clear();
+    m_leafPrimitives.clear();
 	if (primitives.empty())
 		return;
 
-    // pre-malloc node and leaf primitive list memory
-    auto tmp = std::make_unique<unsigned char[]>(m_primitives->size());
-
     m_bbox = bbox;
 
-    // create the split candidates
+    // the build never takes more threads than the renderer is configured with.
+    const auto thread_cnt = std::max( 1u , g_threadCnt );
+
+    // create the split candidates, events along different axes are independent of each other.
     auto count = (unsigned int)m_primitives->size();
     Splits splits;
-    for(auto i = 0 ; i < 3 ; i++ )
-        splits.split[i] = std::make_unique<Split[]>(2*count);
-    for(auto k = 0 ; k < 3 ; k++ ){
+    forEachAxis( count >= KD_PARALLEL_EVENT_THRESHOLD ? thread_cnt : 1u , [&]( int k ){
+        splits.split[k] = std::make_unique<Split[]>(2*count);
         for(auto i = 0u ; i < count ; i++ ){
             auto pri = (*m_primitives)[i];
             auto box = pri->GetBBox();
             splits.split[k][2*i] = Split(box.m_Min[k], Split_Type::Split_Start, i, pri);
             splits.split[k][2*i+1] = Split(box.m_Max[k], Split_Type::Split_End, i, pri);
         }
-    }
-    for(auto i = 0 ; i < 3 ; i++ )
-        std::sort( splits.split[i].get() , splits.split[i].get() + 2 * count);
+        std::sort( splits.split[k].get() , splits.split[k].get() + 2 * count);
+    });
 
     // create root node
-    m_root = std::make_unique<Kd_Node>(m_bbox);
+    auto root = std::make_unique<Kd_Node>(m_bbox);
+
+    // split the top levels breadth-first until there are enough sub-trees to keep all threads busy. Nodes of the same
+    // level are split concurrently, the threads left over generate the events along different axes concurrently.
+    std::vector<Kd_Build_Task> tasks( 1 );
+    tasks[0].node = root.get();
+    tasks[0].splits = std::move( splits );
+    tasks[0].prinum = count;
+    tasks[0].depth = 1u;
+    while( !tasks.empty() && tasks.size() < thread_cnt ){
+        const auto task_cnt = (unsigned)tasks.size();
+        const auto axis_thread_cnt = thread_cnt / task_cnt;
+        std::vector<std::vector<Kd_Build_Task>> next( task_cnt );
+        auto split = [&]( unsigned i ){
+            auto tmp = std::make_unique<unsigned char[]>(count);
+            splitNode( tasks[i].node , tasks[i].splits , tasks[i].prinum , tasks[i].depth , tmp.get() , &next[i] , axis_thread_cnt );
+        };
+        if( task_cnt == 1 )
+            split( 0 );
+        else
+            RunHelperThreads( task_cnt , split );
+
+        std::vector<Kd_Build_Task> level;
+        for( auto& n : next )
+            std::move( n.begin() , n.end() , std::back_inserter( level ) );
+        tasks = std::move( level );
+    }
 
-    // build kd-tree
-    splitNode( m_root.get() , splits , count , 1u , tmp.get() );
+    // build the rest sub-trees concurrently, the larger ones get picked first for better load balancing.
+    // Primitives straddling a split plane belong to both sides, each thread needs its own marking buffer.
+    std::sort( tasks.begin() , tasks.end() , []( const Kd_Build_Task& t0 , const Kd_Build_Task& t1 ){
+        return t0.prinum > t1.prinum;
+    });
+    std::atomic<unsigned> next_task( 0 );
+    auto worker = [&]( unsigned ){
+        auto tmp = std::make_unique<unsigned char[]>(count);
+        for( auto i = next_task++ ; i < tasks.size() ; i = next_task++ ){
+            auto& task = tasks[i];
+            splitNode( task.node , task.splits , task.prinum , task.depth , tmp.get() );
+            task.splits = Splits();
+        }
+    };
+    const auto worker_cnt = std::min( thread_cnt , (unsigned)tasks.size() );
+    if( worker_cnt <= 1 )
+        worker( 0 );
+    else
+        RunHelperThreads( worker_cnt , worker );
 
-    SORT_STATS(++sKDTreeNodeCount);
+    // flatten the tree for traversal, the intermediate tree is not needed anymore after this.
+    flattenNode( root.get() , 1u );
 
     m_isValid = true;
 }
 
-void KDTree::splitNode( Kd_Node* node , Splits& splits , unsigned prinum , unsigned depth , unsigned char* tmp ){
-    SORT_STATS(sKDTreeDepth = std::max(sKDTreeDepth, (StatsInt)depth));
-
+void KDTree::splitNode( Kd_Node* node , Splits& splits , unsigned prinum , unsigned depth , unsigned char* tmp , std::vector<Kd_Build_Task>* deferred , unsigned thread_cnt ){
     if( prinum < m_maxPriInLeaf || depth >= m_maxDepth ){
         makeLeaf( node , splits , prinum );
         return;
@@ -129,11 +195,10 @@ void KDTree::splitNode( Kd_Node* node , Splits& splits , unsigned prinum , unsig
     // generate new events
     Splits l_splits;
     Splits r_splits;
-    for(auto k = 0 ; k < 3 ; k++ ){
+    forEachAxis( prinum >= KD_PARALLEL_EVENT_THRESHOLD ? thread_cnt : 1u , [&]( int k ){
         l_splits.split[k] = std::make_unique<Split[]>(2*l_num);
         r_splits.split[k] = std::make_unique<Split[]>(2*r_num);
-    }
-    for(auto k = 0 ; k < 3 ; k++ ){
+
         auto l_offset = 0, r_offset = 0;
         for(auto i = 0u ; i < split_count ; i++ ){
             const Split& old = splits.split[k][i];
@@ -145,19 +210,33 @@ void KDTree::splitNode( Kd_Node* node , Splits& splits , unsigned prinum , unsig
         }
         sAssert(l_offset == 2 * l_num, SPATIAL_ACCELERATOR);
         sAssert(r_offset == 2 * r_num, SPATIAL_ACCELERATOR);
-    }
+    });
 
     auto left_box = node->bbox;
     left_box.m_Max[split_Axis] = node->split;
     node->leftChild = std::make_unique<Kd_Node>(left_box);
-    splitNode( node->leftChild.get() , l_splits , l_num , depth + 1 , tmp );
 
     auto right_box = node->bbox;
     right_box.m_Min[split_Axis] = node->split;
     node->rightChild = std::make_unique<Kd_Node>(right_box);
-    splitNode( node->rightChild.get() , r_splits , r_num , depth + 1 , tmp );
 
-    SORT_STATS(sKDTreeNodeCount += 2);
+    if( deferred ){
+        Kd_Build_Task l_task, r_task;
+        l_task.node = node->leftChild.get();
+        l_task.splits = std::move( l_splits );
+        l_task.prinum = l_num;
+        l_task.depth = depth + 1;
+        r_task.node = node->rightChild.get();
+        r_task.splits = std::move( r_splits );
+        r_task.prinum = r_num;
+        r_task.depth = depth + 1;
+        deferred->push_back( std::move( l_task ) );
+        deferred->push_back( std::move( r_task ) );
+        return;
+    }
+
+    splitNode( node->leftChild.get() , l_splits , l_num , depth + 1 , tmp );
+    splitNode( node->rightChild.get() , r_splits , r_num , depth + 1 , tmp );
 }
 
 float KDTree::sah( unsigned l , unsigned r , unsigned axis , float split , const BBox& box ){
@@ -217,11 +296,34 @@ void KDTree::makeLeaf( Kd_Node* node , Splits& splits , unsigned prinum ){
                 node->primitivelist.push_back(primitive);
         }
     }
+}
 
-    SORT_STATS(++sKDTreeLeafNodeCount);
+unsigned KDTree::flattenNode( const Kd_Node* node , unsigned depth ){
+    // statistics are only gathered here since the construction threads don't flush their data.
     SORT_STATS(++sKDTreeNodeCount);
-    SORT_STATS(sKDTreePrimitiveCount += prinum);
-    SORT_STATS(sKDTreeMaxPriCountInLeaf = std::max(sKDTreeMaxPriCountInLeaf, (StatsInt)prinum));
+    SORT_STATS(sKDTreeDepth = std::max(sKDTreeDepth, (StatsInt)depth));
+
+    const auto index = (unsigned)m_nodes.size();
+    sAssertMsg( index < ( 1u << 30 ) , SPATIAL_ACCELERATOR , "Too many nodes in KD-Tree." );
+    m_nodes.push_back( Kd_Flat_Node() );
+
+    if( node->flag == 3 ){
+        const auto prinum = (unsigned)node->primitivelist.size();
+        m_nodes[index].pri_offset = (unsigned)m_leafPrimitives.size();
+        m_nodes[index].flags = 3u | ( prinum << 2 );
+        m_leafPrimitives.insert( m_leafPrimitives.end() , node->primitivelist.begin() , node->primitivelist.end() );
+
+        SORT_STATS(++sKDTreeLeafNodeCount);
+        SORT_STATS(sKDTreePrimitiveCount += prinum);
+        SORT_STATS(sKDTreeMaxPriCountInLeaf = std::max(sKDTreeMaxPriCountInLeaf, (StatsInt)prinum));
+        return index;
+    }
+
+    m_nodes[index].split = node->split;
+    flattenNode( node->leftChild.get() , depth + 1 );
+    const auto above = flattenNode( node->rightChild.get() , depth + 1 );
+    m_nodes[index].flags = node->flag | ( above << 2 );
+    return index;
 }
 
 bool KDTree::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const{
@@ -239,7 +341,7 @@ bool KDTree::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const{
     if( fmin < 0.0f )
         return false;
 
-    return traverse( m_root.get() , r , &intersect , fmin , fmax );
+    return traverse( m_nodes.data() , r , &intersect , fmin , fmax );
 }
 
 #ifndef ENABLE_TRANSPARENT_SHADOW
@@ -255,12 +357,11 @@ bool KDTree::IsOccluded( const Ray& r ) const{
     if( fmin < 0.0f )
         return false;
 
-    return traverse( m_root.get() , r , nullptr , fmin , fmax );
+    return traverse( m_nodes.data() , r , nullptr , fmin , fmax );
 }
 #endif
 
-bool KDTree::traverse( const Kd_Node* node , const Ray& ray , SurfaceInteraction* intersect , float fmin , float fmax ) const{
-    static const auto       mask = 0x00000003u;
+bool KDTree::traverse( const Kd_Flat_Node* node , const Ray& ray , SurfaceInteraction* intersect , float fmin , float fmax ) const{
     static const auto       delta = 0.001f;
 
     if( fmin > fmax )
@@ -268,10 +369,14 @@ bool KDTree::traverse( const Kd_Node* node , const Ray& ray , SurfaceInteraction
     if( intersect && intersect->t < fmin - delta )
         return true;
 
+    SORT_STATS(++sTraversedNodeCount);
+
     // it's a leaf node
-    if( (node->flag & mask) == 3 ){
+    if( node->IsLeaf() ){
         auto inter = false;
-        for( auto primitive : node->primitivelist ){
+        const auto primitives = m_leafPrimitives.data() + node->pri_offset;
+        for( auto i = 0u ; i < node->PrimitiveCount() ; ++i ){
+            const auto primitive = primitives[i];
             SORT_STATS(++sIntersectionTest);
             inter |= primitive->GetIntersect( ray , intersect );
             if( isShadowRay( intersect ) && inter ){
@@ -291,12 +396,12 @@ bool KDTree::traverse( const Kd_Node* node , const Ray& ray , SurfaceInteraction
     }
 
     // get the intersection point between the ray and the splitting plane
-    const auto split_axis = node->flag & mask;
+    const auto split_axis = node->SplitAxis();
     const auto dir = ray.m_Dir[split_axis];
     const auto t = (dir==0.0f) ? FLT_MAX : ( node->split - ray.m_Ori[split_axis] ) / dir;
 
-    const auto* first = node->leftChild.get();
-    const auto* second = node->rightChild.get();
+    const auto* first = node + 1;
+    const auto* second = m_nodes.data() + node->AboveChild();
     if( dir < 0.0f || (dir==0.0f&&ray.m_Ori[split_axis] > node->split) )
         std::swap(first, second);
 
@@ -325,11 +430,10 @@ void KDTree::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , con
     if( fmin < 0.0f )
         return;
 
-    traverse( m_root.get() , ray , intersect , fmin , fmax , matID );
+    traverse( m_nodes.data() , ray , intersect , fmin , fmax , matID );
 }
 
-void KDTree::traverse( const Kd_Node* node , const Ray& ray , BSSRDFIntersections& intersect , float fmin , float fmax , const StringID matID ) const{
-    static const auto       mask = 0x00000003u;
+void KDTree::traverse( const Kd_Flat_Node* node , const Ray& ray , BSSRDFIntersections& intersect , float fmin , float fmax , const StringID matID ) const{
     static const auto       delta = 0.001f;
 
     if( fmin > fmax )
@@ -338,11 +442,15 @@ void KDTree::traverse( const Kd_Node* node , const Ray& ray , BSSRDFIntersection
     if( intersect.maxt < fmin )
         return;
 
+    SORT_STATS(++sTraversedNodeCount);
+
     // it's a leaf node
-    if( (node->flag & mask) == 3 ){
+    if( node->IsLeaf() ){
         SurfaceInteraction intersection;
-        
-        for( auto primitive : node->primitivelist ){
+
+        const auto primitives = m_leafPrimitives.data() + node->pri_offset;
+        for( auto j = 0u ; j < node->PrimitiveCount() ; ++j ){
+            const auto primitive = primitives[j];
             if( matID != primitive->GetMaterial()->GetUniqueID() )
                 continue;
             
@@ -388,12 +496,12 @@ void KDTree::traverse( const Kd_Node* node , const Ray& ray , BSSRDFIntersection
     }
 
     // get the intersection point between the ray and the splitting plane
-    const auto split_axis = node->flag & mask;
+    const auto split_axis = node->SplitAxis();
     const auto dir = ray.m_Dir[split_axis];
     const auto t = (dir==0.0f) ? FLT_MAX : ( node->split - ray.m_Ori[split_axis] ) / dir;
 
-    const auto* first = node->leftChild.get();
-    const auto* second = node->rightChild.get();
+    const auto* first = node + 1;
+    const auto* second = m_nodes.data() + node->AboveChild();
     if( dir < 0.0f || ( dir==0.0f && ray.m_Ori[split_axis] > node->split ) )
         std::swap(first, second);
 
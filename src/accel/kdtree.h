@@ -34,7 +34,10 @@ class KDTree : public Accelerator{
         Split_End = 2,      /**< Split plane at the end of one primitive along an axis. */
     };
 
-    //! @brief KD-Tree node structure.
+    //! @brief KD-Tree node structure used during construction.
+    //!
+    //! This is only an intermediate representation, it is flattened into Kd_Flat_Node once the
+    //! construction is done and gets released afterward.
     struct Kd_Node {
     public:
         /**< Pointer to the left child of the KD-Tree node. */
@@ -57,6 +60,34 @@ class KDTree : public Accelerator{
         Kd_Node(const BBox& bb) :bbox(bb) {}
     };
 
+    //! @brief Compact KD-Tree node used for traversal.
+    //!
+    //! Nodes are stored in depth-first order so that the child below the split plane always
+    //! follows its parent immediately, only the index of the other child needs to be recorded.
+    //! This packs one node into 8 bytes so that eight of them fit in one cache line.
+    struct Kd_Flat_Node {
+        union {
+            /**< Split position along the split axis, for interior nodes only. */
+            float       split;
+            /**< Offset of the first primitive in the leaf primitive list, for leaf nodes only. */
+            unsigned    pri_offset;
+        };
+        /**< The lowest two bits are the split axis, or 3 for leaf nodes. The rest bits hold
+        the index of the child above the split plane for interior nodes, or the number of
+        primitives for leaf nodes. */
+        unsigned        flags;
+
+        //! @brief  Whether the node is a leaf node.
+        bool        IsLeaf() const { return ( flags & 3u ) == 3u; }
+        //! @brief  Split axis of an interior node.
+        unsigned    SplitAxis() const { return flags & 3u; }
+        //! @brief  Index of the child above the split plane of an interior node.
+        unsigned    AboveChild() const { return flags >> 2; }
+        //! @brief  Number of primitives in a leaf node.
+        unsigned    PrimitiveCount() const { return flags >> 2; }
+    };
+    static_assert( sizeof( Kd_Flat_Node ) == 8 , "Flattened KD-Tree node is expected to be 8 bytes." );
+
     //! @brief  A split candidate.
     struct Split {
         /**< Position of the split plane along a specific axis. */
@@ -95,6 +126,18 @@ class KDTree : public Accelerator{
         std::unique_ptr<Split[]>        split[3] = { nullptr , nullptr , nullptr };
     };
 
+    //! @brief  A sub-tree pending to be built by one of the construction threads.
+    struct Kd_Build_Task {
+        /**< The node to be split. */
+        Kd_Node*    node = nullptr;
+        /**< Split planes of all primitives in the node. */
+        Splits      splits;
+        /**< Number of primitives in the node. */
+        unsigned    prinum = 0;
+        /**< Depth of the node. */
+        unsigned    depth = 0;
+    };
+
 public:
     DEFINE_RTTI( KDTree , Accelerator );
 
@@ -142,6 +185,10 @@ public:
     //!
     //! The construction of this KD-Tree works in O(N*lg(N)), which is proved to be the
     //! optimal solution in one single thread.
+    //! The top levels of the tree are split breadth-first with the event lists of the three axes
+    //! processed in parallel. Once there are more pending nodes than threads, each of the
+    //! sub-trees is built as an independent task. The result is flattened into a compact node
+    //! array at the end.
     //! Please refer to this paper <a href = "http://www.eng.utah.edu/~cs6965/papers/kdtree.pdf">
     //! On building fast KD-Trees for Ray Tracing, and on doing that in O(N log N)</a>
     //! for further details.
@@ -167,8 +214,10 @@ public:
 	std::unique_ptr<Accelerator>	Clone() const override;
 
 private:
-    /**< Root node of the KD-Tree. */
-    std::unique_ptr<Kd_Node>        m_root = nullptr;
+    /**< Flattened KD-Tree nodes in depth-first order, the first one is the root node. */
+    std::vector<Kd_Flat_Node>       m_nodes;
+    /**< Primitives of all leaf nodes. */
+    std::vector<const Primitive*>   m_leafPrimitives;
 
     /**< Maximum allowed depth of KD-Tree. */
     unsigned        m_maxDepth = 28;
@@ -181,8 +230,12 @@ private:
     //! @param splits       The split plane that holds all primitive pointers.
     //! @param prinum       The number of primitives in the node.
     //! @param depth        The current depth of the node.
-    //! @param tmp          Temporary buffer for marking primitives.
-    void splitNode( Kd_Node* node , Splits& splits , unsigned prinum , unsigned depth , unsigned char* tmp );
+    //! @param tmp          Temporary buffer for marking primitives, it can't be shared by two threads.
+    //! @param deferred     If it is not empty, the children won't be split recursively. Instead, they will
+    //!                     be pushed in this vector for later processing.
+    //! @param thread_cnt   Number of threads allowed for generating the events of the children.
+    void splitNode( Kd_Node* node , Splits& splits , unsigned prinum , unsigned depth , unsigned char* tmp ,
+                    std::vector<Kd_Build_Task>* deferred = nullptr , unsigned thread_cnt = 1 );
 
     //! @brief  Evaluate SAH value for a specific split plane.
     //!
@@ -213,6 +266,13 @@ private:
     //! @param prinum   The number of primitives in the node.
     void makeLeaf( Kd_Node* node , Splits& splits , unsigned prinum );
 
+    //! @brief  Flatten the (sub)tree into the compact node array in depth-first order.
+    //!
+    //! @param node     The root of the (sub)tree to be flattened.
+    //! @param depth    The depth of the node.
+    //! @return         Index of the flattened node.
+    unsigned flattenNode( const Kd_Node* node , unsigned depth );
+
     //! @brief  A recursive function that traverses the KD-Tree node.
     //!
     //! @param node         The node to be traversed.
@@ -223,7 +283,7 @@ private:
     //! @param fmin         The minimum range along the ray.
     //! @param fmax         The maximum range along the ray.
     //! @return             True if there is intersection, otherwise it will return false.
-    bool traverse( const Kd_Node* node , const Ray& ray , SurfaceInteraction* intersect , float fmin , float fmax ) const;
+    bool traverse( const Kd_Flat_Node* node , const Ray& ray , SurfaceInteraction* intersect , float fmin , float fmax ) const;
 
     //! @brief  A recursive function that traverses the KD-Tree node.
     //!
@@ -233,14 +293,7 @@ private:
     //! @param fmin         The minimum range along the ray.
     //! @param fmax         The maximum range along the ray.
     //! @param matID        Material ID to avoid if it is not invalid.
-    void traverse( const Kd_Node* node , const Ray& ray , BSSRDFIntersections& intersect , float fmin , float fmax , const StringID matID ) const;
-
-    //! @brief  Delete all sub tree originating from node.
-    //!
-    //! This function will recursively delete the whole (sub)tree of the node.
-    //!
-    //! @param node         The KD-Tree node to be deleted.
-    void deleteKdNode( Kd_Node* node );
+    void traverse( const Kd_Flat_Node* node , const Ray& ray , BSSRDFIntersections& intersect , float fmin , float fmax , const StringID matID ) const;
 
     SORT_STATS_ENABLE( "Spatial-Structure(KDTree)" )
 };
@@ -38,6 +38,7 @@ SORT_STATS_COUNTER("Spatial-Structure(OcTree)", "OcTree Depth", sOcTreeDepth);
 SORT_STATS_COUNTER("Spatial-Structure(OcTree)", "Maximum Primitive in Leaf", sOcTreeMaxPriCountInLeaf);
 SORT_STATS_AVG_COUNT("Spatial-Structure(OcTree)", "Average Primitive Count in Leaf", sOcTreePrimitiveCount , sOcTreeLeafNodeCount);
 SORT_STATS_AVG_COUNT("Spatial-Structure(OcTree)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
+SORT_STATS_AVG_COUNT("Spatial-Structure(OcTree)", "Average Node Visited per Ray", sTraversedNodeCount, sRayCount);
 
 void OcTree::Build(const std::vector<const Primitive*>& primitives, const BBox& bbox){
     SORT_PROFILE("Build OcTree");
@@ -185,6 +186,8 @@ bool OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , SurfaceIn
     if( intersect && intersect->t < fmin - delta )
         return true;
 
+    SORT_STATS(++sTraversedNodeCount);
+
     // Iterate if there is primitives in the node. Since it is not allowed to store primitives in non-leaf node, there is no need to proceed.
     if( node->child[0] == nullptr ){
         for( auto primitive : node->primitives ){
@@ -278,6 +281,8 @@ void OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , BSSRDFInt
     if( intersect.maxt < fmin )
         return;
 
+    SORT_STATS(++sTraversedNodeCount);
+
     // iterate if there is primitives in the node. Since it is not allowed to store primitives in non-leaf node, there is no need to proceed.
     if( node->child[0] == nullptr ){
         SurfaceInteraction intersection;
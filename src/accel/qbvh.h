@@ -32,6 +32,7 @@
 #include "simd/sse_bbox.h"
 #include "simd/sse_triangle.h"
 #include "simd/sse_line.h"
+#include "simd/sse_analytic.h"
 #include "fast_bvh.h"
 
 #ifdef SSE_ENABLED
@@ -15,6 +15,7 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <algorithm>
 #include "unigrid.h"
 #include "core/primitive.h"
 #include "math/interaction.h"
@@ -24,9 +25,18 @@
 #include "scatteringevent/scatteringevent.h"
 #include "core/memory.h"
 
+#if defined(SSE_ENABLED)
+#define SIMD_SSE_IMPLEMENTATION
+#define SIMD_BVH_IMPLEMENTATION
+#elif defined(AVX_ENABLED)
+#define SIMD_AVX_IMPLEMENTATION
+#define SIMD_BVH_IMPLEMENTATION
+#endif
+
 IMPLEMENT_RTTI(UniGrid);
 
 SORT_STATS_DEFINE_COUNTER(sUGGridCount)
+SORT_STATS_DEFINE_COUNTER(sUGSubGridCount)
 SORT_STATS_DEFINE_COUNTER(sUniformGridX)
 SORT_STATS_DEFINE_COUNTER(sUniformGridY)
 SORT_STATS_DEFINE_COUNTER(sUniformGridZ)
@@ -35,15 +45,85 @@ SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Total Ray Count", sRayCoun
 SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Shadow Ray Count", sShadowRayCount);
 SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Intersection Test", sIntersectionTest );
 SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Grid Count", sUGGridCount);
+SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Sub-Grid Count", sUGSubGridCount);
 SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Dimension X", sUniformGridX);
 SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Dimension Y", sUniformGridY);
 SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Dimension Z", sUniformGridZ);
 SORT_STATS_AVG_COUNT("Spatial-Structure(UniformGrid)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
+SORT_STATS_AVG_COUNT("Spatial-Structure(UniformGrid)", "Average Node Visited per Ray", sTraversedNodeCount, sRayCount);
+
+// A 3D-DDA walker over a regular grid. Instead of nested comparisons, the axis to step along is picked
+// from a lookup table indexed by comparing the distances to the next boundaries along the three axes.
+struct Grid_DDA{
+    int     cur[3] , step[3] , out[3];
+    float   next[3] , delta[3];
+
+    Grid_DDA( const Ray& ray , const float inv_dir[3] , const Point& p , const Point& corner , const Vector& extent , const Vector& inv_extent , const unsigned res[3] ){
+        for( auto i = 0 ; i < 3 ; ++i ){
+            const auto id = (int)std::max( 0.0f , ( p[i] - corner[i] ) * inv_extent[i] );
+            cur[i] = std::min( id , (int)res[i] - 1 );
+            if( ray.m_Dir[i] > 0.0f ){
+                next[i] = ( corner[i] + ( cur[i] + 1 ) * extent[i] - ray.m_Ori[i] ) * inv_dir[i];
+                delta[i] = extent[i] * inv_dir[i];
+                step[i] = 1;
+                out[i] = (int)res[i];
+            }else if( ray.m_Dir[i] < 0.0f ){
+                next[i] = ( corner[i] + cur[i] * extent[i] - ray.m_Ori[i] ) * inv_dir[i];
+                delta[i] = -extent[i] * inv_dir[i];
+                step[i] = -1;
+                out[i] = -1;
+            }else{
+                next[i] = FLT_MAX;
+                delta[i] = 0.0f;
+                step[i] = 0;
+                out[i] = -1;
+            }
+        }
+    }
+
+    unsigned NextAxis() const{
+        static const unsigned cmp_to_axis[8] = { 2 , 1 , 2 , 1 , 2 , 2 , 0 , 0 };   // [2] and [5] is impossible
+        const auto bits = ( (unsigned)( next[0] < next[1] ) << 2 ) | ( (unsigned)( next[0] < next[2] ) << 1 ) | (unsigned)( next[1] < next[2] );
+        return cmp_to_axis[bits];
+    }
+
+    bool Step( unsigned axis ){
+        cur[axis] += step[axis];
+        next[axis] += delta[axis];
+        return cur[axis] != out[axis];
+    }
+};
+
+// A quick branching out if a shadow ray is hit by an opaque object.
+SORT_STATIC_FORCEINLINE bool isBlockedShadowRay( SurfaceInteraction& intersect ){
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    if( !intersect.query_shadow )
+        return false;
+
+    sAssert( nullptr != intersect.primitive , SPATIAL_ACCELERATOR );
+    sAssert( nullptr != intersect.primitive->GetMaterial() , SPATIAL_ACCELERATOR );
+    if( intersect.primitive->GetMaterial()->HasTransparency() )
+        return false;
+
+    // setting primitive to be nullptr and return true at the same time is a special 'code'
+    // that the above level logic will take advantage of.
+    intersect.primitive = nullptr;
+    return true;
+#else
+    return false;
+#endif
+}
 
 void UniGrid::Build( const std::vector<const Primitive*>& primitives , const BBox& bbox ){
     SORT_PROFILE("Build Uniform Grid");
 
     m_primitives = &primitives;
+    m_cells.clear();
+    m_voxels.clear();
+    m_otherList.clear();
+#ifdef SIMD_BVH_IMPLEMENTATION
+    m_triList.clear();
+#endif
 	if (m_primitives->empty())
 		return;
 
@@ -51,64 +131,224 @@ void UniGrid::Build( const std::vector<const Primitive*>& primitives , const BBo
 
     // get the maximum extent id and distance
     auto id = m_bbox.MaxAxisId();
+    auto extent = m_bbox.m_Max[id] - m_bbox.m_Min[id];
+
+    // make sure no cell is degenerated in case the scene is flat
+    for(auto i = 0 ; i < 3 ; i++ ){
+        if( m_bbox.m_Max[i] - m_bbox.m_Min[i] < extent * 0.001f ){
+            m_bbox.m_Min[i] -= extent * 0.001f;
+            m_bbox.m_Max[i] += extent * 0.001f;
+        }
+    }
     auto delta = m_bbox.m_Max - m_bbox.m_Min;
-    auto extent = delta[id];
 
     // get the total number of primitives
     auto count = (unsigned)m_primitives->size();
 
-    // grid per distance
-    auto gridPerDistance = 3 * powf( (float)count , 0.333f ) / extent ;
+    // grid per distance, the top level grid is coarse since dense regions are refined by sub-grids later.
+    auto gridPerDistance = powf( (float)count , 0.333f ) / extent ;
 
     // the grid size
     for(auto i = 0 ; i < 3 ; i++ ){
-        m_voxelNum[i] = (unsigned)(std::min( 256.0f , gridPerDistance * delta[i] ));
-        m_voxelInvExtent[i] = m_voxelNum[i] / delta[i];
-        m_voxelExtent[i] = 1.0f / m_voxelInvExtent[i];
+        m_cellNum[i] = std::max( 1u , (unsigned)(std::min( 256.0f , gridPerDistance * delta[i] )) );
+        m_cellInvExtent[i] = m_cellNum[i] / delta[i];
+        m_cellExtent[i] = 1.0f / m_cellInvExtent[i];
+    }
+
+    m_cellCount = m_cellNum[0] * m_cellNum[1] * m_cellNum[2];
+
+    // bucket the primitives into the top level cells with a counting sort, only bounding boxes are checked at this level.
+    const auto cellRange = [&]( const Primitive* primitive , unsigned minGridId[3] , unsigned maxGridId[3] ){
+        for(auto i = 0 ; i < 3 ; i++ ){
+            minGridId[i] = point2CellId(primitive->GetBBox().m_Min , i );
+            maxGridId[i] = point2CellId(primitive->GetBBox().m_Max , i );
+        }
+    };
+    std::vector<unsigned> cellStart( m_cellCount + 1 , 0 );
+    for( const auto primitive : *m_primitives ){
+        unsigned maxGridId[3];
+        unsigned minGridId[3];
+        cellRange( primitive , minGridId , maxGridId );
+        for(auto i = minGridId[2] ; i <= maxGridId[2] ; i++ )
+            for(auto j = minGridId[1] ; j <= maxGridId[1] ; j++ )
+                for(auto k = minGridId[0] ; k <= maxGridId[0] ; k++ )
+                    ++cellStart[offset( k , j , i ) + 1];
+    }
+    for( auto i = 1u ; i <= m_cellCount ; ++i )
+        cellStart[i] += cellStart[i-1];
+
+    std::vector<const Primitive*> cellPrimitives( cellStart.back() );
+    std::vector<unsigned> cellCursor( cellStart.begin() , cellStart.end() - 1 );
+    for( const auto primitive : *m_primitives ){
+        unsigned maxGridId[3];
+        unsigned minGridId[3];
+        cellRange( primitive , minGridId , maxGridId );
+        for(auto i = minGridId[2] ; i <= maxGridId[2] ; i++ )
+            for(auto j = minGridId[1] ; j <= maxGridId[1] ; j++ )
+                for(auto k = minGridId[0] ; k <= maxGridId[0] ; k++ )
+                    cellPrimitives[cellCursor[offset( k , j , i )]++] = primitive;
     }
 
-    m_voxelCount = m_voxelNum[0] * m_voxelNum[1] * m_voxelNum[2];
+    // refine the cells and fill the voxels
+    m_cells.resize( m_cellCount );
+    for(auto i = 0u ; i < m_cellNum[2] ; i++ )
+        for(auto j = 0u ; j < m_cellNum[1] ; j++ )
+            for(auto k = 0u ; k < m_cellNum[0] ; k++ ){
+                BBox bb;
+                bb.m_Min = m_bbox.m_Min + Vector( (float)k , (float)j , (float)i ) * m_cellExtent;
+                bb.m_Max = bb.m_Min + m_cellExtent;
+
+                const auto o = offset( k , j , i );
+                buildCell( m_cells[o] , bb , cellPrimitives.data() + cellStart[o] , cellStart[o+1] - cellStart[o] );
+            }
+
+    m_isValid = true;
+
+    SORT_STATS(sUniformGridX = m_cellNum[0]);
+    SORT_STATS(sUniformGridY = m_cellNum[1]);
+    SORT_STATS(sUniformGridZ = m_cellNum[2]);
+    SORT_STATS(sUGGridCount = m_voxels.size());
+}
+
+void UniGrid::buildCell( Grid_Cell& cell , const BBox& bbox , const Primitive* const* primitives , unsigned cnt ){
+    const auto delta = bbox.m_Max - bbox.m_Min;
 
-    // allocate the memory
-    m_voxels.resize( m_voxelCount );
+    // dense cells get their own sub-grids, the resolution is picked so that each voxel holds a similar number of primitives.
+    if( cnt > m_maxPriInCell ){
+        const auto resPerDistance = powf( (float)cnt / m_subGridDensity , 0.333f ) / delta[bbox.MaxAxisId()];
+        for(auto i = 0 ; i < 3 ; i++ )
+            cell.res[i] = std::min( m_maxSubGridRes , std::max( 1u , (unsigned)ceilf( resPerDistance * delta[i] ) ) );
+        SORT_STATS(++sUGSubGridCount);
+    }
+
+    Vector voxelExtent , voxelInvExtent;
+    for(auto i = 0 ; i < 3 ; i++ ){
+        voxelExtent[i] = delta[i] / cell.res[i];
+        voxelInvExtent[i] = cell.res[i] / delta[i];
+    }
+    const auto voxelId = [&]( const Point& p , unsigned axis ){
+        const auto id = (unsigned)std::max( 0.0f , ( p[axis] - bbox.m_Min[axis] ) * voxelInvExtent[axis] );
+        return std::min( cell.res[axis] - 1 , id );
+    };
 
-    // distribute the primitives
-    for( auto& primitive : *m_primitives ){
+    // distribute the primitives, only the primitives actually intersecting with voxels are added.
+    std::vector<std::pair<unsigned,const Primitive*>> voxelPrimitives;
+    for( auto p = 0u ; p < cnt ; ++p ){
+        const auto primitive = primitives[p];
         unsigned maxGridId[3];
         unsigned minGridId[3];
         for(auto i = 0 ; i < 3 ; i++ ){
-            minGridId[i] = point2VoxelId(primitive->GetBBox().m_Min , i );
-            maxGridId[i] = point2VoxelId(primitive->GetBBox().m_Max , i );
+            minGridId[i] = voxelId( primitive->GetBBox().m_Min , i );
+            maxGridId[i] = voxelId( primitive->GetBBox().m_Max , i );
         }
 
         for(auto i = minGridId[2] ; i <= maxGridId[2] ; i++ )
             for(auto j = minGridId[1] ; j <= maxGridId[1] ; j++ )
                 for(auto k = minGridId[0] ; k <= maxGridId[0] ; k++ ){
                     BBox bb;
-                    bb.m_Min = m_bbox.m_Min + Vector( (float)k , (float)j , (float)i ) * m_voxelExtent;
-                    bb.m_Max = bb.m_Min + m_voxelExtent;
+                    bb.m_Min = bbox.m_Min + Vector( (float)k , (float)j , (float)i ) * voxelExtent;
+                    bb.m_Max = bb.m_Min + voxelExtent;
 
-                    // only add the primitives if it is actually intersected
                     if( primitive->GetIntersect( bb ) )
-                        m_voxels[offset( k , j , i )].push_back(primitive);
+                        voxelPrimitives.push_back( std::make_pair( ( i * cell.res[1] + j ) * cell.res[0] + k , primitive ) );
                 }
     }
+    std::stable_sort( voxelPrimitives.begin() , voxelPrimitives.end() , []( const std::pair<unsigned,const Primitive*>& p0 , const std::pair<unsigned,const Primitive*>& p1 ){
+        return p0.first < p1.first;
+    });
+
+    // fill the voxels, primitives of each voxel are stored contiguously.
+    const auto voxelCnt = cell.res[0] * cell.res[1] * cell.res[2];
+    cell.voxel_offset = (unsigned)m_voxels.size();
+    m_voxels.resize( m_voxels.size() + voxelCnt );
+
+    auto it = voxelPrimitives.begin();
+    for( auto v = 0u ; v < voxelCnt ; ++v ){
+        auto& voxel = m_voxels[cell.voxel_offset + v];
+        voxel.other_offset = (unsigned)m_otherList.size();
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+        voxel.tri_offset = (unsigned)m_triList.size();
+
+        Simd_Triangle simd_tri;
+        for( ; it != voxelPrimitives.end() && it->first == v ; ++it ){
+            const auto primitive = it->second;
+            if( SHAPE_TRIANGLE == primitive->GetShapeType() ){
+                if( simd_tri.PushTriangle( primitive ) ){
+                    if( simd_tri.PackData() ){
+                        m_triList.push_back( simd_tri );
+                        simd_tri.Reset();
+                    }
+                }
+            }else{
+                m_otherList.push_back( primitive );
+            }
+        }
+        if( simd_tri.PackData() )
+            m_triList.push_back( simd_tri );
 
-    m_isValid = true;
+        voxel.tri_cnt = (unsigned)m_triList.size() - voxel.tri_offset;
+#else
+        for( ; it != voxelPrimitives.end() && it->first == v ; ++it )
+            m_otherList.push_back( it->second );
+#endif
 
-    SORT_STATS(sUniformGridX = m_voxelNum[0]);
-    SORT_STATS(sUniformGridY = m_voxelNum[1]);
-    SORT_STATS(sUniformGridZ = m_voxelNum[2]);
-    SORT_STATS(sUGGridCount = m_voxelCount);
+        voxel.other_cnt = (unsigned)m_otherList.size() - voxel.other_offset;
+    }
 }
 
-unsigned UniGrid::point2VoxelId( const Point& p , unsigned axis ) const{
-    return std::min( m_voxelNum[axis] - 1 , (unsigned)( ( p[axis] - m_bbox.m_Min[axis] ) * m_voxelInvExtent[axis] ) );
+unsigned UniGrid::point2CellId( const Point& p , unsigned axis ) const{
+    return std::min( m_cellNum[axis] - 1 , (unsigned)std::max( 0.0f , ( p[axis] - m_bbox.m_Min[axis] ) * m_cellInvExtent[axis] ) );
 }
 
 // get the id offset
 unsigned UniGrid::offset( unsigned x , unsigned y , unsigned z ) const{
-    return z * m_voxelNum[1] * m_voxelNum[0] + y * m_voxelNum[0] + x;
+    return z * m_cellNum[1] * m_cellNum[0] + y * m_cellNum[0] + x;
+}
+
+template<class T>
+bool UniGrid::traverse( const Ray& r , T visitor ) const{
+    // get the intersect point
+    float maxt;
+    const auto mint = Intersect( r , m_bbox , &maxt );
+    if( mint < 0.0f )
+        return false;
+
+    const float invDir[3] = { 1.0f / r.m_Dir[0] , 1.0f / r.m_Dir[1] , 1.0f / r.m_Dir[2] };
+
+    // walk through the top level cells
+    Grid_DDA dda( r , invDir , r(mint) , m_bbox.m_Min , m_cellExtent , m_cellInvExtent , m_cellNum );
+    auto cellT = mint;
+    while( true ){
+        const auto& cell = m_cells[offset( dda.cur[0] , dda.cur[1] , dda.cur[2] )];
+        const auto axis = dda.NextAxis();
+        const auto cellExit = std::min( dda.next[axis] , maxt );
+
+        // walk through the voxels in the sub-grid of the cell, it is just one voxel if the cell is not subdivided.
+        const auto corner = m_bbox.m_Min + Vector( (float)dda.cur[0] , (float)dda.cur[1] , (float)dda.cur[2] ) * m_cellExtent;
+        const Vector extent( m_cellExtent[0] / cell.res[0] , m_cellExtent[1] / cell.res[1] , m_cellExtent[2] / cell.res[2] );
+        const Vector invExtent( m_cellInvExtent[0] * cell.res[0] , m_cellInvExtent[1] * cell.res[1] , m_cellInvExtent[2] * cell.res[2] );
+        Grid_DDA subDda( r , invDir , r(cellT) , corner , extent , invExtent , cell.res );
+        auto voxelT = cellT;
+        while( true ){
+            const auto subAxis = subDda.NextAxis();
+            const auto voxelExit = std::min( subDda.next[subAxis] , cellExit );
+            const auto voxelId = cell.voxel_offset + ( subDda.cur[2] * cell.res[1] + subDda.cur[1] ) * cell.res[0] + subDda.cur[0];
+            sAssertMsg( voxelId < m_voxels.size() , SPATIAL_ACCELERATOR , "Invalid voxel id." );
+
+            SORT_STATS(++sTraversedNodeCount);
+            if( visitor( m_voxels[voxelId] , voxelT , voxelExit ) )
+                return true;
+
+            if( voxelExit >= cellExit || !subDda.Step( subAxis ) )
+                break;
+            voxelT = voxelExit;
+        }
+
+        if( cellExit >= maxt || !dda.Step( axis ) )
+            return false;
+        cellT = cellExit;
+    }
 }
 
 bool UniGrid::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const{
@@ -121,65 +361,42 @@ bool UniGrid::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const
 
     r.Prepare();
 
-    static const auto voxelId2Point = [&]( int id[3] ){
-        Point p;
-        p.x = m_bbox.m_Min.x + id[0] * m_voxelExtent[0];
-        p.y = m_bbox.m_Min.y + id[1] * m_voxelExtent[1];
-        p.z = m_bbox.m_Min.z + id[2] * m_voxelExtent[2];
-        return p;
-    };
-
-    // get the intersect point
-    float maxt;
-    auto cur_t = Intersect( r , m_bbox , &maxt );
-    if( cur_t < 0.0f )
-        return false;
-    intersect.t = std::min( intersect.t , maxt );
-
-    int     curGrid[3] , dir[3];
-    float   delta[3] , next[3];
-    for(auto i = 0 ; i < 3 ; i++ ){
-        curGrid[i] = point2VoxelId( r(cur_t) , i );
-        dir[i] = ( r.m_Dir[i] > 0.0f ) ? 1 : -1;
-        if( r.m_Dir[i] != 0.0f )
-            delta[i] = fabs( m_voxelExtent[i] / r.m_Dir[i] );
-        else
-            delta[i] = FLT_MAX;
-    }
-    Point gridCorner = voxelId2Point( curGrid );
-    for(auto i = 0 ; i < 3 ; i++ ){
-        // get the next t
-        auto target = gridCorner[i] + ((dir[i]+1)>>1) * m_voxelExtent[i];
-        next[i] = ( target - r.m_Ori[i] ) / r.m_Dir[i];
-        if( r.m_Dir[i] == 0.0f )
-            next[i] = FLT_MAX;
-    }
-
-    // traverse the uniform grid
-    const unsigned idArray[] = { 0 , 0 , 1 , 0 , 2 , 2 , 1 , 0  };// [0] and [7] is impossible
-    while( cur_t < intersect.t ){
-        // current voxel id
-        auto voxelId = offset( curGrid[0] , curGrid[1] , curGrid[2] );
-
-        // get the next t
-        auto nextAxis = (next[0] <= next[1])+((unsigned)(next[1] <= next[2]))*2+((unsigned)(next[2] <= next[0]))*4;
-        nextAxis = idArray[nextAxis];
+#ifdef SIMD_BVH_IMPLEMENTATION
+    Simd_Ray_Data   simd_ray;
+    resolveRayData( r , simd_ray );
+#endif
 
-        // check if there is intersection in the current grid
-        if( traverse( r , &intersect , voxelId , next[nextAxis] ) )
+    auto inter = false;
+    traverse( r , [&]( const Grid_Voxel& voxel , float tmin , float tmax ){
+        // the nearest intersection is found in the previous voxels already.
+        if( intersect.t < tmin )
             return true;
 
-        // get to the next voxel
-        curGrid[nextAxis] += dir[nextAxis];
+#ifdef SIMD_BVH_IMPLEMENTATION
+        for( auto i = 0u ; i < voxel.tri_cnt ; ++i ){
+            SORT_STATS(sIntersectionTest += SIMD_CHANNEL);
+            if( intersectTriangle_SIMD( r , simd_ray , m_triList[voxel.tri_offset + i] , &intersect ) ){
+                inter = true;
+                if( isBlockedShadowRay( intersect ) )
+                    return true;
+            }
+        }
+#endif
+
+        for( auto i = 0u ; i < voxel.other_cnt ; ++i ){
+            SORT_STATS(++sIntersectionTest);
+            if( m_otherList[voxel.other_offset + i]->GetIntersect( r , &intersect ) ){
+                inter = true;
+                if( isBlockedShadowRay( intersect ) )
+                    return true;
+            }
+        }
 
-        if( curGrid[nextAxis] < 0 || (unsigned)curGrid[nextAxis] >= m_voxelNum[nextAxis] )
-            return intersect.t < maxt && intersect.primitive;
+        // an intersection behind the voxel is not necessarily the nearest one
+        return inter && intersect.t <= tmax;
+    });
 
-        // update next
-        cur_t = next[nextAxis];
-        next[nextAxis] += delta[nextAxis];
-    }
-    return intersect.t < maxt && intersect.primitive != nullptr ;
+    return inter;
 }
 
 #ifndef ENABLE_TRANSPARENT_SHADOW
@@ -190,95 +407,29 @@ bool UniGrid::IsOccluded( const Ray& r ) const{
 
     r.Prepare();
 
-    static const auto voxelId2Point = [&]( int id[3] ){
-        Point p;
-        p.x = m_bbox.m_Min.x + id[0] * m_voxelExtent[0];
-        p.y = m_bbox.m_Min.y + id[1] * m_voxelExtent[1];
-        p.z = m_bbox.m_Min.z + id[2] * m_voxelExtent[2];
-        return p;
-    };
-
-    // get the intersect point
-    float maxt;
-    auto cur_t = Intersect( r , m_bbox , &maxt );
-    if( cur_t < 0.0f )
-        return false;
-
-    int     curGrid[3] , dir[3];
-    float   delta[3] , next[3];
-    for(auto i = 0 ; i < 3 ; i++ ){
-        curGrid[i] = point2VoxelId( r(cur_t) , i );
-        dir[i] = ( r.m_Dir[i] > 0.0f ) ? 1 : -1;
-        if( r.m_Dir[i] != 0.0f )
-            delta[i] = fabs( m_voxelExtent[i] / r.m_Dir[i] );
-        else
-            delta[i] = FLT_MAX;
-    }
-    Point gridCorner = voxelId2Point( curGrid );
-    for(auto i = 0 ; i < 3 ; i++ ){
-        // get the next t
-        auto target = gridCorner[i] + ((dir[i]+1)>>1) * m_voxelExtent[i];
-        next[i] = ( target - r.m_Ori[i] ) / r.m_Dir[i];
-        if( r.m_Dir[i] == 0.0f )
-            next[i] = FLT_MAX;
-    }
-
-    // traverse the uniform grid
-    const unsigned idArray[] = { 0 , 0 , 1 , 0 , 2 , 2 , 1 , 0  };// [0] and [7] is impossible
-    while( true ){
-        // current voxel id
-        auto voxelId = offset( curGrid[0] , curGrid[1] , curGrid[2] );
-
-        // get the next t
-        auto nextAxis = (next[0] <= next[1])+((unsigned)(next[1] <= next[2]))*2+((unsigned)(next[2] <= next[0]))*4;
-        nextAxis = idArray[nextAxis];
-
-        // check if there is intersection in the current grid
-        if( traverse( r , nullptr , voxelId , next[nextAxis] ) )
-            return true;
-
-        // get to the next voxel
-        curGrid[nextAxis] += dir[nextAxis];
-
-        if( curGrid[nextAxis] < 0 || (unsigned)curGrid[nextAxis] >= m_voxelNum[nextAxis] )
-            break;
-
-        // update next
-        cur_t = next[nextAxis];
-        next[nextAxis] += delta[nextAxis];
-    }
-
-    return false;
-}
+#ifdef SIMD_BVH_IMPLEMENTATION
+    Simd_Ray_Data   simd_ray;
+    resolveRayData( r , simd_ray );
 #endif
 
-bool UniGrid::traverse( const Ray& r , SurfaceInteraction* intersect , unsigned voxelId , float nextT ) const{
-    sAssertMsg( voxelId < m_voxelCount , SPATIAL_ACCELERATOR , "Invalid voxel id." );
-
-    auto inter = false;
-    for( auto voxel : m_voxels[voxelId] ){
-        SORT_STATS(++sIntersectionTest);
-        // get intersection
-        inter |= voxel->GetIntersect( r , intersect );
-
-        // a quick branching out if a shadow ray is hit by an opaque object
-        const auto is_shadow_ray_blocked = isShadowRay( intersect ) && inter;
-        if( is_shadow_ray_blocked ){
-#ifdef ENABLE_TRANSPARENT_SHADOW
-            sAssert( nullptr != intersect->primitive , SPATIAL_ACCELERATOR );
-            sAssert( nullptr != intersect->primitive->GetMaterial() , SPATIAL_ACCELERATOR );
-            if( !intersect->primitive->GetMaterial()->HasTransparency() ){
-                // setting primitive to be nullptr and return true at the same time is a special 'code' 
-                // that the above level logic will take advantage of.
-                intersect->primitive = nullptr;
-            }
-#endif
-            return true;
+    return traverse( r , [&]( const Grid_Voxel& voxel , float tmin , float tmax ){
+#ifdef SIMD_BVH_IMPLEMENTATION
+        for( auto i = 0u ; i < voxel.tri_cnt ; ++i ){
+            SORT_STATS(sIntersectionTest += SIMD_CHANNEL);
+            if( intersectTriangleFast_SIMD( r , simd_ray , m_triList[voxel.tri_offset + i] ) )
+                return true;
         }
-    }
+#endif
 
-    return inter && ( intersect->t < nextT + 0.00001f );
+        for( auto i = 0u ; i < voxel.other_cnt ; ++i ){
+            SORT_STATS(++sIntersectionTest);
+            if( m_otherList[voxel.other_offset + i]->GetIntersect( r , nullptr ) )
+                return true;
+        }
+        return false;
+    });
 }
+#endif
 
 void UniGrid::GetIntersect( const Ray& r , BSSRDFIntersections& intersect , const StringID matID ) const{
     SORT_PROFILE("Traverse Uniform Grid");
@@ -289,111 +440,69 @@ void UniGrid::GetIntersect( const Ray& r , BSSRDFIntersections& intersect , cons
     intersect.cnt = 0;
     intersect.maxt = FLT_MAX;
 
-    static const auto voxelId2Point = [&]( int id[3] ){
-        Point p;
-        p.x = m_bbox.m_Min.x + id[0] * m_voxelExtent[0];
-        p.y = m_bbox.m_Min.y + id[1] * m_voxelExtent[1];
-        p.z = m_bbox.m_Min.z + id[2] * m_voxelExtent[2];
-        return p;
-    };
-
-    // get the intersect point
-    float maxt;
-    auto cur_t = Intersect( r , m_bbox , &maxt );
-    if( cur_t < 0.0f )
-        return;
-
-    int     curGrid[3] , dir[3];
-    float   delta[3] , next[3];
-    for(auto i = 0 ; i < 3 ; i++ ){
-        curGrid[i] = point2VoxelId( r(cur_t) , i );
-        dir[i] = ( r.m_Dir[i] > 0.0f ) ? 1 : -1;
-        if( r.m_Dir[i] != 0.0f )
-            delta[i] = fabs( m_voxelExtent[i] / r.m_Dir[i] );
-        else
-            delta[i] = FLT_MAX;
-    }
-    Point gridCorner = voxelId2Point( curGrid );
-    for(auto i = 0 ; i < 3 ; i++ ){
-        // get the next t
-        auto target = gridCorner[i] + ((dir[i]+1)>>1) * m_voxelExtent[i];
-        next[i] = ( target - r.m_Ori[i] ) / r.m_Dir[i];
-        if( r.m_Dir[i] == 0.0f )
-            next[i] = FLT_MAX;
-    }
-
-    // traverse the uniform grid
-    const unsigned idArray[] = { 0 , 0 , 1 , 0 , 2 , 2 , 1 , 0  };// [0] and [7] is impossible
-    while( cur_t < intersect.maxt ){
-        // current voxel id
-        auto voxelId = offset( curGrid[0] , curGrid[1] , curGrid[2] );
-
-        // get the next t
-        auto nextAxis = (next[0] <= next[1])+((unsigned)(next[1] <= next[2]))*2+((unsigned)(next[2] <= next[0]))*4;
-        nextAxis = idArray[nextAxis];
-
-        // check if there is intersection in the current grid
-        traverse( r , intersect , voxelId , next[nextAxis] , matID );
-
-        // get to the next voxel
-        curGrid[nextAxis] += dir[nextAxis];
-
-        if( curGrid[nextAxis] < 0 || (unsigned)curGrid[nextAxis] >= m_voxelNum[nextAxis] )
-            return;
-
-        // update next
-        cur_t = next[nextAxis];
-        next[nextAxis] += delta[nextAxis];
-    }
-}
+#ifdef SIMD_BVH_IMPLEMENTATION
+    Simd_Ray_Data   simd_ray;
+    resolveRayData( r , simd_ray );
+#endif
 
-void UniGrid::traverse( const Ray& ray , BSSRDFIntersections& intersect , unsigned voxelId , float nextT , const StringID matID ) const{
-    sAssertMsg( voxelId < m_voxelCount , SPATIAL_ACCELERATOR , "Invalid voxel id." );
+    traverse( r , [&]( const Grid_Voxel& voxel , float tmin , float tmax ){
+        if( intersect.maxt < tmin )
+            return true;
 
-    SurfaceInteraction intersection;
-    for( auto primitive : m_voxels[voxelId] ){
-        if( matID != primitive->GetMaterial()->GetUniqueID() )
-            continue;
+        // only intersections inside the voxel are accepted so that primitives overlapping multiple voxels are not reported twice.
+        auto ray = r;
+        ray.m_fMin = std::max( r.m_fMin , tmin );
+        ray.m_fMax = std::min( r.m_fMax , tmax );
 
-        // make sure the primitive is not checked before
-        auto checked = false;
-        for( auto i = 0u ; i < intersect.cnt ; ++i ){
-            if( primitive == intersect.intersections[i]->intersection.primitive ){
-                checked = true;
-                break;
-            }
+#ifdef SIMD_BVH_IMPLEMENTATION
+        for( auto i = 0u ; i < voxel.tri_cnt ; ++i ){
+            SORT_STATS(sIntersectionTest += SIMD_CHANNEL);
+            intersectTriangleMulti_SIMD( ray , simd_ray , m_triList[voxel.tri_offset + i] , matID , intersect );
         }
-        if( checked )
-            continue;
-
-        SORT_STATS(++sIntersectionTest);
+#endif
 
-        intersection.Reset();
-        const auto intersected = primitive->GetIntersect( ray , &intersection );
-        if( intersected ){
-            if( intersect.cnt < TOTAL_SSS_INTERSECTION_CNT ){
-                intersect.intersections[intersect.cnt] = SORT_MALLOC(BSSRDFIntersection)();
-                intersect.intersections[intersect.cnt++]->intersection = intersection;
-            }else{
-                auto picked_i = -1;
-                auto t = 0.0f;
-                for( auto i = 0 ; i < TOTAL_SSS_INTERSECTION_CNT ; ++i ){
-                    if( t < intersect.intersections[i]->intersection.t ){
-                        t = intersect.intersections[i]->intersection.t;
-                        picked_i = i;
+        SurfaceInteraction intersection;
+        for( auto j = 0u ; j < voxel.other_cnt ; ++j ){
+            const auto primitive = m_otherList[voxel.other_offset + j];
+            if( matID != primitive->GetMaterial()->GetUniqueID() )
+                continue;
+
+            SORT_STATS(++sIntersectionTest);
+
+            intersection.Reset();
+            const auto intersected = primitive->GetIntersect( ray , &intersection );
+            if( intersected ){
+                if( intersect.cnt < TOTAL_SSS_INTERSECTION_CNT ){
+                    intersect.intersections[intersect.cnt] = SORT_MALLOC(BSSRDFIntersection)();
+                    intersect.intersections[intersect.cnt++]->intersection = intersection;
+                }else{
+                    auto picked_i = -1;
+                    auto t = 0.0f;
+                    for( auto i = 0 ; i < TOTAL_SSS_INTERSECTION_CNT ; ++i ){
+                        if( t < intersect.intersections[i]->intersection.t ){
+                            t = intersect.intersections[i]->intersection.t;
+                            picked_i = i;
+                        }
                     }
-                }
-                if( picked_i >= 0 )
-                    intersect.intersections[picked_i]->intersection = intersection;
+                    if( picked_i >= 0 )
+                        intersect.intersections[picked_i]->intersection = intersection;
 
-                intersect.maxt = 0.0f;
-                for( auto i = 0u ; i < intersect.cnt ; ++i )
-                    intersect.maxt = std::max( intersect.maxt , intersect.intersections[i]->intersection.t );
+                    intersect.maxt = 0.0f;
+                    for( auto i = 0u ; i < intersect.cnt ; ++i )
+                        intersect.maxt = std::max( intersect.maxt , intersect.intersections[i]->intersection.t );
+                }
             }
         }
-    }
+        return false;
+    });
 }
 
 std::unique_ptr<Accelerator> UniGrid::Clone() const {
 	return std::make_unique<UniGrid>();
-}
\ No newline at end of file
+}
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+#undef SIMD_BVH_IMPLEMENTATION
+#undef SIMD_SSE_IMPLEMENTATION
+#undef SIMD_AVX_IMPLEMENTATION
+#endif
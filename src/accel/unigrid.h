@@ -17,6 +17,23 @@
 
 #pragma once
 
+#include "core/define.h"
+
+// Voxels are packed with four triangles in a packet when SSE is available, otherwise eight triangles with AVX.
+#if defined(SSE_ENABLED)
+#define SIMD_SSE_IMPLEMENTATION
+#define SIMD_BVH_IMPLEMENTATION
+#elif defined(AVX_ENABLED)
+#define SIMD_AVX_IMPLEMENTATION
+#define SIMD_BVH_IMPLEMENTATION
+#endif
+
+#include "simd/simd_ray_utils.h"
+#if defined(SSE_ENABLED)
+#include "simd/sse_triangle.h"
+#elif defined(AVX_ENABLED)
+#include "simd/avx_triangle.h"
+#endif
 #include "accelerator.h"
 
 //! @brief Uniform Grid.
@@ -25,8 +42,60 @@
  * Unlike other complex data structure, like KD-Tree, uniform grid takes linear
  * time complexity to build. However the traversal efficiency may be lower than
  * its peers.
+ *
+ * A single resolution grid doesn't handle scenes with uneven primitive density
+ * well. This implementation is a two-level grid, a coarse top level grid covers
+ * the whole scene and each dense top level cell gets its own sub-grid whose
+ * resolution depends on the number of primitives in it.
  */
 class UniGrid : public Accelerator{
+    //! @brief  Top level cell of the grid.
+    struct Grid_Cell {
+        /**< Index of the first voxel of the cell, voxels of a cell are stored contiguously. */
+        unsigned    voxel_offset = 0;
+        /**< Resolution of the sub-grid of the cell. It is one along all axes if the cell is sparse. */
+        unsigned    res[3] = { 1 , 1 , 1 };
+    };
+
+    //! @brief  Leaf voxel of the grid, it holds ranges of primitives in the packed primitive lists.
+    struct Grid_Voxel {
+        /**< Offset of the first triangle packet of the voxel. */
+        unsigned    tri_offset = 0;
+        /**< Number of triangle packets in the voxel. */
+        unsigned    tri_cnt = 0;
+        /**< Offset of the first primitive that is not packed. */
+        unsigned    other_offset = 0;
+        /**< Number of primitives that are not packed. */
+        unsigned    other_cnt = 0;
+    };
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    //! @brief  Allocator for the triangle packets, the default one doesn't respect their alignment before C++17.
+    template<class T>
+    struct Grid_Aligned_Allocator{
+        using value_type = T;
+
+        Grid_Aligned_Allocator() = default;
+        template<class U>
+        Grid_Aligned_Allocator( const Grid_Aligned_Allocator<U>& ) {}
+
+        T* allocate( size_t cnt ) const {
+            return (T*)malloc_aligned( (unsigned)( sizeof(T) * cnt ) , SIMD_ALIGNMENT );
+        }
+        void deallocate( T* p , size_t ) const {
+            free_aligned(p);
+        }
+
+        template<class U>
+        bool operator == ( const Grid_Aligned_Allocator<U>& ) const { return true; }
+        template<class U>
+        bool operator != ( const Grid_Aligned_Allocator<U>& ) const { return false; }
+    };
+
+    //! @brief  Triangle packets of all voxels, they are stored contiguously.
+    using Simd_Triangle_List = std::vector<Simd_Triangle,Grid_Aligned_Allocator<Simd_Triangle>>;
+#endif
+
 public:
     DEFINE_RTTI( UniGrid , Accelerator );
 
@@ -75,6 +144,9 @@ public:
 
     //! Build uniform grid structure in O(N).
     //!
+    //! Primitives are first bucketed into top level cells with a counting sort. Cells with more primitives than
+    //! a threshold are then subdivided into sub-grids, triangles in every voxel are packed into SIMD packets.
+    //!
     //! @param primitives       A vector holding all primitives.
     //! @param bbox             The bounding box of the scene.
     void    Build(const std::vector<const Primitive*>& primitives, const BBox& bbox) override;
@@ -93,50 +165,68 @@ public:
 	std::unique_ptr<Accelerator>	Clone() const override;
 
 private:
-    /**< Total number of voxels. */
-    unsigned                                    m_voxelCount = 0;
-    /**< Number of voxels along each axis. */
-    unsigned                                    m_voxelNum[3] = {};
-    /**< Extent of one voxel along each axis. */
-    Vector                                      m_voxelExtent;
-    /**< Inverse of extent of one voxel along each axis. */
-    Vector                                      m_voxelInvExtent;
-    /**< Vector holding all voxels. */
-    std::vector<std::vector<const Primitive*>>  m_voxels;
-
-    //! @brief      Locate the id of the voxel that the point belongs to along a specific axis.
+    /**< Total number of top level cells. */
+    unsigned                                    m_cellCount = 0;
+    /**< Number of top level cells along each axis. */
+    unsigned                                    m_cellNum[3] = {};
+    /**< Extent of one top level cell along each axis. */
+    Vector                                      m_cellExtent;
+    /**< Inverse of extent of one top level cell along each axis. */
+    Vector                                      m_cellInvExtent;
+    /**< Top level cells. */
+    std::vector<Grid_Cell>                      m_cells;
+    /**< Leaf voxels of all cells. */
+    std::vector<Grid_Voxel>                     m_voxels;
+    /**< Primitives that are not packed in SIMD packets, it holds all primitives if SIMD is not enabled. */
+    std::vector<const Primitive*>               m_otherList;
+#ifdef SIMD_BVH_IMPLEMENTATION
+    /**< Triangle packets of all voxels. */
+    Simd_Triangle_List                          m_triList;
+#endif
+
+    /**< Cells with more primitives than this get their own sub-grids. */
+    unsigned        m_maxPriInCell = 8;
+    /**< Expected number of primitives per voxel in a sub-grid. */
+    float           m_subGridDensity = 2.0f;
+    /**< Maximum resolution of a sub-grid along each axis. */
+    unsigned        m_maxSubGridRes = 32;
+
+    //! @brief      Locate the id of the cell that the point belongs to along a specific axis.
     //!
     //! @param p        The point to be evaluated.
     //! @param axis     The id of axis to be tested along.
-    //! @return         The id of the voxel along the selected axis.
-    unsigned point2VoxelId( const Point& p , unsigned axis ) const;
-
-    //! @brief      Translate voxel id from three-dimensional to one-dimensional.
-    //! @param x        ID of voxel along axis-x.
-    //! @param y        ID of voxel along axis-y.
-    //! @param z        ID of voxel along axis-z.
-    //! @return         ID of the voxel in one single dimension.
+    //! @return         The id of the cell along the selected axis.
+    unsigned point2CellId( const Point& p , unsigned axis ) const;
+
+    //! @brief      Translate cell id from three-dimensional to one-dimensional.
+    //! @param x        ID of cell along axis-x.
+    //! @param y        ID of cell along axis-y.
+    //! @param z        ID of cell along axis-z.
+    //! @return         ID of the cell in one single dimension.
     unsigned offset( unsigned x , unsigned y , unsigned z ) const;
 
-    //! @brief      Get the nearest intersection between a ray and the primitive set.
-    //! @param r            The ray to be tested.
-    //! @param intersect    A pointer to the intersection information. If it is empty, it will return
-    //!                     true as long as there is an intersection detected, which is not necessarily
-    //!                     the nearest one.
-    //! @param voxelId      ID of the voxel to be tested.
-    //! @param nextT        The intersected position of the ray and the next to-be-traversed voxel along
-    //!                     the ray.
-    //! @return             It will return true if there is an intersection, otherwise it returns false.
-    bool traverse( const Ray& r , SurfaceInteraction* intersect , unsigned voxelId , float nextT ) const;
-
-    //! @brief      Get the nearest intersection between a ray and the primitive set.
+    //! @brief      Subdivide a top level cell and fill its voxels.
+    //!
+    //! @param cell         The cell to be filled.
+    //! @param bbox         Bounding box of the cell.
+    //! @param primitives   Primitives whose bounding boxes overlap with the cell.
+    //! @param cnt          Number of primitives overlapping with the cell.
+    void buildCell( Grid_Cell& cell , const BBox& bbox , const Primitive* const* primitives , unsigned cnt );
+
+    //! @brief      Walk through all voxels along the ray in the order of the distance.
+    //!
     //! @param r            The ray to be tested.
-    //! @param intersect    Intersection data structure holds all intersection results.
-    //! @param voxelId      ID of the voxel to be tested.
-    //! @param nextT        The intersected position of the ray and the next to-be-traversed voxel along
-    //!                     the ray.
-    //! @param matID        Material ID to avoid if it is not invalid.
-    void traverse( const Ray& r , BSSRDFIntersections& intersect , unsigned voxelId , float nextT , const StringID matID ) const;
+    //! @param visitor      It is called with a voxel and the range of the ray inside it. The traversal
+    //!                     stops as soon as it returns true.
+    //! @return             Whether the traversal is stopped by the visitor.
+    template<class T>
+    bool traverse( const Ray& r , T visitor ) const;
 
     SORT_STATS_ENABLE( "Spatial-Structure(UniformGrid)" )
 };
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+#undef SIMD_BVH_IMPLEMENTATION
+#undef SIMD_SSE_IMPLEMENTATION
+#undef SIMD_AVX_IMPLEMENTATION
+#endif
@@ -0,0 +1,342 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+// This is the entry of 'sort_bench', a standalone program measuring the performance of all spatial accelerators in SORT.
+// It is not part of the renderer itself, check out the 'sort_bench' target in CMakeLists.txt for details.
+//
+// Usage:
+//   sort_bench [--input:<file>] [--scene:<uniform|thin|hair|cluster|all>] [--primitives:<n>] [--resolution:<n>]
+//              [--accelerators:<Bvh,Qbvh,...>] [--repeat:<n>] [--seed:<n>] [--output:<file>]
+//
+// The result is printed in JSON, either to stdout or to the specified output file.
+
+#include <regex>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include "core/define.h"
+#include "core/log.h"
+#include "core/stats.h"
+#include "core/memory.h"
+#include "core/primitive.h"
+#include "accel/accelerator.h"
+#include "math/interaction.h"
+#include "scatteringevent/bssrdf/bssrdf.h"
+#include "bench_scene.h"
+
+#if defined(SORT_IN_LINUX)
+    #include <malloc.h>
+#elif defined(SORT_IN_MAC)
+    #include <malloc/malloc.h>
+#elif defined(SORT_IN_WINDOWS)
+    #include <windows.h>
+    #include <psapi.h>
+    #pragma comment(lib, "psapi.lib")
+#endif
+
+SORT_STATS_DECLARE_COUNTER(sRayCount)
+SORT_STATS_DECLARE_COUNTER(sIntersectionTest)
+SORT_STATS_DECLARE_COUNTER(sTraversedNodeCount)
+
+namespace {
+    struct BenchConfig{
+        std::string                 input;
+        std::vector<std::string>    scenes = { "uniform" , "thin" , "hair" , "cluster" };
+        std::vector<std::string>    accelerators = { "Bvh" , "Qbvh" , "Obvh" , "KDTree" , "UniGrid" , "OcTree" };
+        unsigned                    primitives = 200000;
+        unsigned                    resolution = 256;
+        unsigned                    repeat = 1;
+        unsigned                    seed = 1;
+        std::string                 output;
+    };
+
+    std::vector<std::string> splitList( const std::string& str ){
+        std::vector<std::string> ret;
+        std::stringstream ss( str );
+        std::string item;
+        while( std::getline( ss , item , ',' ) )
+            if( !item.empty() )
+                ret.push_back( item );
+        return ret;
+    }
+
+    // The parsing follows the same syntax of command line arguments of the renderer, '--key:value'.
+    BenchConfig parseCommandLine( int argc , char** argv ){
+        BenchConfig config;
+
+        std::string commandline;
+        for( auto i = 1 ; i < argc ; ++i ){
+            commandline += std::string( argv[i] );
+            commandline += " ";
+        }
+
+        std::regex word_regex("--(\\w+)(?:\\s*:\\s*([^ \\n]+)\\s*)?");
+        auto words_begin = std::sregex_iterator(commandline.begin(), commandline.end(), word_regex);
+        for (std::sregex_iterator it = words_begin; it != std::sregex_iterator(); ++it) {
+            const auto m = *it;
+            std::string key_str = m[1];
+            std::string value_str = m.size() >= 3 ? std::string(m[2]) : "";
+            std::transform(key_str.begin(), key_str.end(), key_str.begin(), ::tolower);
+
+            if( key_str == "input" ){
+                config.input = value_str;
+            }else if( key_str == "scene" ){
+                if( value_str != "all" )
+                    config.scenes = splitList( value_str );
+            }else if( key_str == "accelerators" ){
+                config.accelerators = splitList( value_str );
+            }else if( key_str == "primitives" ){
+                config.primitives = std::max( 1 , std::atoi( value_str.c_str() ) );
+            }else if( key_str == "resolution" ){
+                config.resolution = std::max( 1 , std::atoi( value_str.c_str() ) );
+            }else if( key_str == "repeat" ){
+                config.repeat = std::max( 1 , std::atoi( value_str.c_str() ) );
+            }else if( key_str == "seed" ){
+                config.seed = (unsigned)std::atoi( value_str.c_str() );
+            }else if( key_str == "output" ){
+                config.output = value_str;
+            }
+        }
+
+        // a scene stream replaces the synthetic scenes
+        if( !config.input.empty() )
+            config.scenes.clear();
+
+        return config;
+    }
+
+    // Number of bytes allocated on the heap, the memory cost of an accelerator is the delta of it across building.
+    long long heapAllocatedBytes(){
+#if defined(SORT_IN_LINUX) && defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+        const auto mi = mallinfo2();
+        return (long long)( mi.uordblks + mi.hblkhd );
+#elif defined(SORT_IN_LINUX) && defined(__GLIBC__)
+        const auto mi = mallinfo();
+        return (long long)(unsigned)mi.uordblks + (long long)(unsigned)mi.hblkhd;
+#elif defined(SORT_IN_MAC)
+        malloc_statistics_t stats;
+        malloc_zone_statistics( nullptr , &stats );
+        return (long long)stats.size_in_use;
+#elif defined(SORT_IN_WINDOWS)
+        PROCESS_MEMORY_COUNTERS_EX pmc;
+        GetProcessMemoryInfo( GetCurrentProcess() , (PROCESS_MEMORY_COUNTERS*)&pmc , sizeof( pmc ) );
+        return (long long)pmc.PrivateUsage;
+#else
+        return 0;
+#endif
+    }
+
+    std::string jsonString( const std::string& str ){
+        std::string ret = "\"";
+        for( const auto c : str ){
+            if( c == '"' || c == '\\' )
+                ret += '\\';
+            ret += c;
+        }
+        return ret + "\"";
+    }
+
+    // Trace all rays in the set against the accelerator, it returns the number of hits.
+    unsigned long long traceRaySet( const Accelerator& accel , const BenchRaySet& set ){
+        auto hits = 0ull;
+        for( auto i = 0u ; i < set.rays.size() ; ++i ){
+            const auto& ray = set.rays[i];
+            switch( set.type ){
+            case BENCH_QUERY_CLOSEST:
+                {
+                    SurfaceInteraction intersection;
+                    hits += accel.GetIntersect( ray , intersection ) ? 1 : 0;
+                }
+                break;
+            case BENCH_QUERY_SHADOW:
+                {
+#ifdef ENABLE_TRANSPARENT_SHADOW
+                    SurfaceInteraction intersection;
+                    intersection.query_shadow = true;
+                    hits += accel.GetIntersect( ray , intersection ) ? 1 : 0;
+#else
+                    hits += accel.IsOccluded( ray ) ? 1 : 0;
+#endif
+                }
+                break;
+            case BENCH_QUERY_MULTI:
+                {
+                    BSSRDFIntersections intersections;
+                    accel.GetIntersect( ray , intersections , set.matIds[i] );
+                    hits += intersections.cnt;
+                    SORT_CLEAR_MEMPOOL();
+                }
+                break;
+            }
+        }
+        return hits;
+    }
+
+    void benchScene( const BenchScene& scene , const BenchConfig& config , std::ostream& out ){
+        const auto& primitives = scene.GetPrimitives();
+
+        out << "    {\n";
+        out << "      \"name\": " << jsonString( scene.GetName() ) << ",\n";
+        out << "      \"primitives\": " << primitives.size() << ",\n";
+
+        // rays are generated once with a reference accelerator so that every accelerator traces exactly the same rays
+        std::vector<BenchRaySet> sets;
+        {
+            auto reference = MakeUniqueInstance<Accelerator>( SID( "Bvh" ) );
+            reference->Build( primitives , scene.GetBBox() );
+            sets = GenerateRaySets( scene , *reference , config.resolution , config.seed );
+        }
+
+        out << "      \"accelerators\": [";
+        auto first_accel = true;
+        for( const auto& name : config.accelerators ){
+            auto accel = MakeUniqueInstance<Accelerator>( StringID( name ) );
+            if( !accel ){
+                slog( WARNING , GENERAL , "Accelerator %s is not supported, it is skipped." , name.c_str() );
+                continue;
+            }
+
+            slog( INFO , GENERAL , "Measuring %s in scene %s." , name.c_str() , scene.GetName().c_str() );
+
+            const auto memory_before = heapAllocatedBytes();
+            const auto build_start = std::chrono::steady_clock::now();
+            accel->Build( primitives , scene.GetBBox() );
+            const auto build_ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - build_start ).count();
+            const auto memory = std::max( 0ll , heapAllocatedBytes() - memory_before );
+
+            out << ( first_accel ? "\n" : ",\n" );
+            first_accel = false;
+            out << "        {\n";
+            out << "          \"name\": " << jsonString( name ) << ",\n";
+            out << "          \"build_ms\": " << build_ms << ",\n";
+            out << "          \"memory_bytes\": " << memory << ",\n";
+            out << "          \"queries\": [";
+
+            for( auto s = 0u ; s < sets.size() ; ++s ){
+                const auto& set = sets[s];
+
+                SORT_STATS(sRayCount = 0);
+                SORT_STATS(sIntersectionTest = 0);
+                SORT_STATS(sTraversedNodeCount = 0);
+
+                auto hits = 0ull;
+                const auto trace_start = std::chrono::steady_clock::now();
+                for( auto i = 0u ; i < config.repeat ; ++i )
+                    hits = traceRaySet( *accel , set );
+                const auto trace_s = std::chrono::duration<double>( std::chrono::steady_clock::now() - trace_start ).count();
+                const auto ray_cnt = (double)set.rays.size() * config.repeat;
+
+                out << ( s ? ",\n" : "\n" );
+                out << "            {\n";
+                out << "              \"name\": " << jsonString( set.name ) << ",\n";
+                out << "              \"rays\": " << set.rays.size() << ",\n";
+                out << "              \"hits\": " << hits << ",\n";
+                out << "              \"rays_per_second\": " << ( trace_s > 0.0 ? ray_cnt / trace_s : 0.0 ) << ",\n";
+#ifdef SORT_ENABLE_STATS_COLLECTION
+                const auto queried = std::max( 1.0 , (double)sRayCount );
+                out << "              \"nodes_per_ray\": " << (double)sTraversedNodeCount / queried << ",\n";
+                out << "              \"primitives_per_ray\": " << (double)sIntersectionTest / queried << "\n";
+#else
+                out << "              \"nodes_per_ray\": null,\n";
+                out << "              \"primitives_per_ray\": null\n";
+#endif
+                out << "            }";
+            }
+
+            out << "\n          ]\n";
+            out << "        }";
+        }
+        out << "\n      ]\n";
+        out << "    }";
+    }
+}
+
+#ifdef SORT_IN_WINDOWS
+int __cdecl main( int argc , char** argv )
+#elif defined(SORT_IN_LINUX) || defined(SORT_IN_MAC)
+int main(int argc, char* argv[])
+#endif
+{
+    const auto config = parseCommandLine( argc , argv );
+
+    // logs go to stdout only if the result doesn't
+    if( !config.output.empty() )
+        addLogDispatcher(std::make_unique<StdOutLogDispatcher>());
+
+    std::ostringstream out;
+    out.precision( 9 );
+    out << "{\n";
+    out << "  \"seed\": " << config.seed << ",\n";
+    out << "  \"resolution\": " << config.resolution << ",\n";
+    out << "  \"repeat\": " << config.repeat << ",\n";
+#if defined(SSE_ENABLED)
+    out << "  \"simd\": \"sse\",\n";
+#elif defined(AVX_ENABLED)
+    out << "  \"simd\": \"avx\",\n";
+#else
+    out << "  \"simd\": \"none\",\n";
+#endif
+#ifdef SORT_PRECOMPUTED_TRIANGLE
+    out << "  \"triangle_layout\": \"precomputed\",\n";
+#else
+    out << "  \"triangle_layout\": \"vertices\",\n";
+#endif
+#ifdef SORT_ENABLE_STATS_COLLECTION
+    out << "  \"stats\": true,\n";
+#else
+    out << "  \"stats\": false,\n";
+#endif
+    out << "  \"scenes\": [";
+
+    auto first_scene = true;
+    const auto bench = [&]( const BenchScene& scene ){
+        out << ( first_scene ? "\n" : ",\n" );
+        first_scene = false;
+        benchScene( scene , config , out );
+    };
+
+    if( !config.input.empty() ){
+        BenchScene scene;
+        if( !scene.LoadFromFile( config.input ) )
+            return -1;
+        bench( scene );
+    }
+    for( const auto& type : config.scenes ){
+        BenchScene scene;
+        if( scene.Generate( type , config.primitives , config.seed ) )
+            bench( scene );
+    }
+
+    out << "\n  ]\n";
+    out << "}\n";
+
+    if( config.output.empty() ){
+        std::cout << out.str();
+    }else{
+        std::ofstream file( config.output );
+        if( !file.is_open() ){
+            slog( WARNING , GENERAL , "Failed to write result to %s." , config.output.c_str() );
+            return -1;
+        }
+        file << out.str();
+        slog( INFO , GENERAL , "Benchmark result: \"%s\"", config.output.c_str() );
+    }
+
+    return 0;
+}
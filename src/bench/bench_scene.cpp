@@ -0,0 +1,303 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <random>
+#include <fstream>
+#include "bench_scene.h"
+#include "core/scene.h"
+#include "core/primitive.h"
+#include "core/globalconfig.h"
+#include "core/samplemethod.h"
+#include "core/log.h"
+#include "entity/visual.h"
+#include "material/matmanager.h"
+#include "material/osl_system.h"
+#include "stream/fstream.h"
+#include "accel/accelerator.h"
+#include "math/interaction.h"
+
+namespace {
+    // A tiny wrapper of the random number generator so that every synthetic scene is reproducible.
+    class BenchRandom{
+    public:
+        explicit BenchRandom( unsigned seed ) : m_generator( seed ) {}
+
+        float operator()( float lo = 0.0f , float hi = 1.0f ) {
+            return lo + ( hi - lo ) * m_distribution( m_generator );
+        }
+
+        Point   RandomPoint( const Point& lo , const Point& hi ){
+            const auto x = (*this)( lo.x , hi.x );
+            const auto y = (*this)( lo.y , hi.y );
+            const auto z = (*this)( lo.z , hi.z );
+            return Point( x , y , z );
+        }
+
+        Vector  RandomDirection(){
+            const auto u = (*this)();
+            const auto v = (*this)();
+            return UniformSampleSphere( u , v );
+        }
+
+    private:
+        std::mt19937                            m_generator;
+        std::uniform_real_distribution<float>   m_distribution = std::uniform_real_distribution<float>( 0.0f , 0.999999f );
+    };
+
+    // Append a triangle with its own vertices to the mesh.
+    void addTriangle( MeshMemory& mem , const Point& p0 , const Point& p1 , const Point& p2 ){
+        const auto n = normalize( cross( p1 - p0 , p2 - p0 ) );
+        const auto base = (int)mem.m_vertices.size();
+
+        MeshFaceIndex index;
+        for( auto i = 0 ; i < 3 ; ++i ){
+            MeshVertex mv;
+            mv.m_position = ( i == 0 ) ? p0 : ( ( i == 1 ) ? p1 : p2 );
+            mv.m_normal = n;
+            mem.m_vertices.push_back( mv );
+            index.m_id[i] = base + i;
+        }
+        mem.m_indices.push_back( index );
+    }
+
+    // Append a sphere tessellated along latitude and longitude to the mesh, vertices are shared among triangles.
+    void addSphere( MeshMemory& mem , const Point& center , float radius , int rings , int segments ){
+        const auto base = (int)mem.m_vertices.size();
+        for( auto i = 0 ; i <= rings ; ++i ){
+            const auto theta = PI * (float)i / (float)rings;
+            for( auto j = 0 ; j <= segments ; ++j ){
+                const auto phi = TWO_PI * (float)j / (float)segments;
+                MeshVertex mv;
+                mv.m_normal = Vector( sin( theta ) * cos( phi ) , cos( theta ) , sin( theta ) * sin( phi ) );
+                mv.m_position = center + mv.m_normal * radius;
+                mem.m_vertices.push_back( mv );
+            }
+        }
+
+        const auto vid = [&]( int i , int j ){ return base + i * ( segments + 1 ) + j; };
+        for( auto i = 0 ; i < rings ; ++i ){
+            for( auto j = 0 ; j < segments ; ++j ){
+                // skip the degenerated triangles around the poles
+                MeshFaceIndex index;
+                if( i != rings - 1 ){
+                    index.m_id[0] = vid( i , j );
+                    index.m_id[1] = vid( i + 1 , j );
+                    index.m_id[2] = vid( i + 1 , j + 1 );
+                    mem.m_indices.push_back( index );
+                }
+                if( i != 0 ){
+                    index.m_id[0] = vid( i , j );
+                    index.m_id[1] = vid( i + 1 , j + 1 );
+                    index.m_id[2] = vid( i , j + 1 );
+                    mem.m_indices.push_back( index );
+                }
+            }
+        }
+    }
+}
+
+BenchScene::~BenchScene(){
+    if( m_scene )
+        DestroyOSLThreadContexts();
+}
+
+bool BenchScene::LoadFromFile( const std::string& filename ){
+    if( !std::ifstream( filename ).good() ){
+        slog( WARNING , GENERAL , "Failed to open scene file %s." , filename.c_str() );
+        return false;
+    }
+
+    IFileStream stream( filename );
+    GlobalConfiguration::GetSingleton().Serialize( stream );
+
+    CreateOSLThreadContexts();
+
+    m_scene = std::make_unique<Scene>();
+    MatManager::GetSingleton().ParseMatFile( stream );
+    m_scene->LoadScene( stream );
+
+    m_name = filename;
+    m_primitiveList = m_scene->GetPrimitives();
+    m_bbox = m_scene->GetBBox();
+    return true;
+}
+
+bool BenchScene::Generate( const std::string& type , unsigned cnt , unsigned seed ){
+    BenchRandom rng( seed );
+    const Point lo( -1.0f ) , hi( 1.0f );
+
+    m_mesh = std::make_unique<MeshVisual>();
+    m_mesh->m_memory = std::make_unique<MeshMemory>();
+    auto& mem = *m_mesh->m_memory;
+
+    if( type == "uniform" ){
+        // triangles are roughly as large as the average spacing between them
+        const auto size = 2.0f / std::cbrt( (float)cnt );
+        for( auto i = 0u ; i < cnt ; ++i ){
+            const auto c = rng.RandomPoint( lo , hi );
+            addTriangle( mem , c + rng.RandomDirection() * size , c + rng.RandomDirection() * size , c + rng.RandomDirection() * size );
+        }
+    }else if( type == "thin" ){
+        // long slivers with random orientation, their bounding boxes are terrible approximations of themselves
+        constexpr auto length = 0.5f;
+        constexpr auto width = 0.002f;
+        for( auto i = 0u ; i < cnt ; ++i ){
+            const auto c = rng.RandomPoint( lo , hi );
+            const auto d = rng.RandomDirection();
+            Vector t , b;
+            coordinateSystem( d , t , b );
+            addTriangle( mem , c - d * length * 0.5f , c + d * length * 0.5f , c + t * width );
+        }
+    }else if( type == "hair" ){
+        // strands grow upward from a disk with a random bend, the same topology HairVisual generates
+        constexpr auto segment_cnt = 8u;
+        constexpr auto strand_length = 0.6f;
+        constexpr auto width_bottom = 0.004f;
+        constexpr auto width_tip = 0.001f;
+        const auto strand_cnt = std::max( 1u , cnt / segment_cnt );
+        for( auto i = 0u ; i < strand_cnt ; ++i ){
+            float x , z;
+            UniformSampleDisk( rng() , rng() , x , z );
+            auto cur = Point( x , -1.0f , z );
+            const auto bend = Vector( rng( -1.0f , 1.0f ) , 0.0f , rng( -1.0f , 1.0f ) ) * 0.3f;
+            for( auto j = 0u ; j < segment_cnt ; ++j ){
+                const auto v0 = (float)j / (float)segment_cnt;
+                const auto v1 = (float)( j + 1 ) / (float)segment_cnt;
+                const auto dir = normalize( Vector( 0.0f , 1.0f , 0.0f ) + bend * v1 + rng.RandomDirection() * 0.1f );
+                const auto next = cur + dir * ( strand_length / (float)segment_cnt );
+                const auto w0 = width_bottom + ( width_tip - width_bottom ) * v0;
+                const auto w1 = width_bottom + ( width_tip - width_bottom ) * v1;
+                m_lines.push_back( std::make_unique<Line>( cur , next , v0 , v1 , w0 * 0.5f , w1 * 0.5f , -1 ) );
+                m_lines.back()->SetTransform( Transform() );
+                cur = next;
+            }
+        }
+    }else if( type == "cluster" ){
+        // flattened instances of the same small mesh, with lots of overlapping among them
+        constexpr auto rings = 16;
+        constexpr auto segments = 16;
+        constexpr auto tri_per_sphere = 2 * segments * ( rings - 1 );
+        const auto sphere_cnt = std::max( 1u , cnt / tri_per_sphere );
+        const auto radius = 4.0f / std::cbrt( (float)sphere_cnt );
+        for( auto i = 0u ; i < sphere_cnt ; ++i )
+            addSphere( mem , rng.RandomPoint( lo , hi ) , radius * rng( 0.25f , 1.0f ) , rings , segments );
+    }else{
+        slog( WARNING , GENERAL , "Unknown synthetic scene type %s." , type.c_str() );
+        return false;
+    }
+
+    m_name = type;
+    fillPrimitives();
+    return true;
+}
+
+void BenchScene::fillPrimitives(){
+    auto& mem = *m_mesh->m_memory;
+    if( !mem.m_indices.empty() ){
+        mem.GenUV();
+        mem.GenSmoothTagent();
+    }
+
+    for( const auto& mi : mem.m_indices ){
+        m_mesh->m_triangles.push_back( std::make_unique<Triangle>( m_mesh.get() , mi ) );
+        m_primitives.push_back( std::make_unique<Primitive>( mi.m_mat , m_mesh->m_triangles.back().get() ) );
+    }
+    for( const auto& line : m_lines )
+        m_primitives.push_back( std::make_unique<Primitive>( nullptr , line.get() ) );
+
+    m_bbox.InvalidBBox();
+    for( const auto& primitive : m_primitives ){
+        m_primitiveList.push_back( primitive.get() );
+        m_bbox.Union( primitive->GetBBox() );
+    }
+}
+
+std::vector<BenchRaySet> GenerateRaySets( const BenchScene& scene , const Accelerator& reference , unsigned resolution , unsigned seed ){
+    BenchRandom rng( seed );
+
+    const auto& bbox = scene.GetBBox();
+    const auto center = ( bbox.m_Min + bbox.m_Max ) * 0.5f;
+    const auto radius = std::max( 0.5f * ( bbox.m_Max - bbox.m_Min ).Length() , 1e-4f );
+    const auto epsilon = radius * 1e-4f;
+
+    std::vector<BenchRaySet> sets( 4 );
+    auto& camera = sets[0];
+    auto& diffuse = sets[1];
+    auto& shadow = sets[2];
+    auto& sss = sets[3];
+    camera.name = "camera";
+    diffuse.name = "diffuse";
+    shadow.name = "shadow";
+    shadow.type = BENCH_QUERY_SHADOW;
+    sss.name = "sss";
+    sss.type = BENCH_QUERY_MULTI;
+
+    // a pinhole camera looking at the center of the scene, the bounding sphere fits in the 45 degree field of view
+    const auto eye = center + normalize( Vector( 1.0f , 0.7f , 1.3f ) ) * radius * 2.5f;
+    const auto forward = normalize( center - eye );
+    const auto right = normalize( cross( forward , Vector( 0.0f , 1.0f , 0.0f ) ) );
+    const auto up = cross( right , forward );
+    const auto tan_half_fov = tan( PI / 8.0f );
+    for( auto y = 0u ; y < resolution ; ++y ){
+        for( auto x = 0u ; x < resolution ; ++x ){
+            const auto sx = ( 2.0f * ( (float)x + rng() ) / (float)resolution - 1.0f ) * tan_half_fov;
+            const auto sy = ( 1.0f - 2.0f * ( (float)y + rng() ) / (float)resolution ) * tan_half_fov;
+            camera.rays.push_back( Ray( eye , normalize( forward + right * sx + up * sy ) ) );
+        }
+    }
+
+    // an area light slightly above the scene, covering the whole scene from top
+    const auto light_height = bbox.m_Max.y + radius * 0.5f;
+
+    // the sub-surface scattering probe radius
+    const auto sss_radius = radius * 0.02f;
+
+    for( const auto& ray : camera.rays ){
+        SurfaceInteraction intersection;
+        if( !reference.GetIntersect( ray , intersection ) || nullptr == intersection.primitive )
+            continue;
+
+        const auto& p = intersection.intersect;
+        auto n = intersection.gnormal;
+        if( dot( n , ray.m_Dir ) > 0.0f )
+            n = -n;
+        Vector t , b;
+        coordinateSystem( n , t , b );
+
+        // diffuse bounce rays
+        const auto local = CosSampleHemisphere( rng() , rng() );
+        diffuse.rays.push_back( Ray( p , t * local.x + n * local.y + b * local.z , 1 , epsilon ) );
+
+        // shadow rays
+        const auto target = Point( rng( bbox.m_Min.x , bbox.m_Max.x ) , light_height , rng( bbox.m_Min.z , bbox.m_Max.z ) );
+        const auto delta = target - p;
+        const auto len = delta.Length();
+        if( len > epsilon )
+            shadow.rays.push_back( Ray( p , delta / len , 1 , epsilon , len * ( 1.0f - 1e-3f ) ) );
+
+        // sss probe rays, they are generated the same way SeparableBssrdf does
+        float dx , dz;
+        UniformSampleDisk( rng() , rng() , dx , dz );
+        const auto r = sss_radius * std::sqrt( dx * dx + dz * dz );
+        const auto l = 2.0f * std::sqrt( std::max( 0.0f , sss_radius * sss_radius - r * r ) );
+        const auto source = p + ( t * dx + b * dz ) * sss_radius + n * l * 0.5f;
+        sss.rays.push_back( Ray( source , -n , 0 , 0.0001f , l ) );
+        sss.matIds.push_back( intersection.primitive->GetMaterial()->GetUniqueID() );
+    }
+
+    return sets;
+}
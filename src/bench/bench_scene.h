@@ -0,0 +1,113 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <string>
+#include "core/define.h"
+#include "core/strid.h"
+#include "math/ray.h"
+#include "math/bbox.h"
+
+class Primitive;
+class Accelerator;
+class Scene;
+class MeshVisual;
+class Line;
+
+//! @brief  Geometry to be measured by the accelerator benchmark.
+/**
+ * A bench scene either comes from a regular SORT scene stream or is generated procedurally.
+ * Synthetic scenes are fully deterministic given the same seed so that numbers measured on
+ * different machines or different revisions of the code are comparable.
+ */
+class BenchScene{
+public:
+    //! @brief  Load the scene from a SORT scene stream exported by the Blender plugin.
+    //!
+    //! @param  filename    Full path of the scene file.
+    //! @return             Whether the scene is loaded successfully.
+    bool    LoadFromFile( const std::string& filename );
+
+    //! @brief  Generate a synthetic scene.
+    //!
+    //! Supported types are,
+    //!  - 'uniform'    Small triangles uniformly scattered in a cube.
+    //!  - 'thin'       Long thin triangles with random orientation, the classic worst case for axis aligned bounding boxes.
+    //!  - 'hair'       Strands of line segments growing from a disk, just like what HairVisual produces.
+    //!  - 'cluster'    Copies of a small sphere mesh with heavily overlapping bounding boxes, which is what flattened instances look like.
+    //!
+    //! @param  type        Type of the synthetic scene.
+    //! @param  cnt         Approximated number of primitives to be generated.
+    //! @param  seed        Seed of the random number generator.
+    //! @return             Whether the type is supported.
+    bool    Generate( const std::string& type , unsigned cnt , unsigned seed );
+
+    //! @brief  Get name of the scene.
+    const std::string&                      GetName() const { return m_name; }
+
+    //! @brief  Get all primitives in the scene.
+    const std::vector<const Primitive*>&    GetPrimitives() const { return m_primitiveList; }
+
+    //! @brief  Get bounding box of the scene.
+    const BBox&                             GetBBox() const { return m_bbox; }
+
+    //! @brief  Destructor is not inlined since the owned types are only forward declared here.
+    ~BenchScene();
+
+private:
+    std::string                                 m_name;             /**< Name of the scene. */
+    std::unique_ptr<Scene>                      m_scene;            /**< Scene loaded from stream, it is empty for synthetic scenes. */
+    std::unique_ptr<MeshVisual>                 m_mesh;             /**< Triangle mesh of a synthetic scene. */
+    std::vector<std::unique_ptr<Line>>          m_lines;            /**< Line segments of a synthetic scene. */
+    std::vector<std::unique_ptr<Primitive>>     m_primitives;       /**< Primitives of a synthetic scene. */
+    std::vector<const Primitive*>               m_primitiveList;    /**< All primitives of the scene. */
+    BBox                                        m_bbox;             /**< Bounding box of the scene. */
+
+    //! @brief  Create primitives for all triangles in the synthetic mesh and lines.
+    void    fillPrimitives();
+};
+
+//! @brief  Query type of a ray set.
+enum BENCH_QUERY_TYPE{
+    BENCH_QUERY_CLOSEST = 0,    /**< Closest hit query, used by camera rays and bounce rays. */
+    BENCH_QUERY_SHADOW,         /**< Shadow query, any hit is good enough. */
+    BENCH_QUERY_MULTI           /**< Multi-hit query used by sub-surface scattering. */
+};
+
+//! @brief  A fixed set of rays traced against all accelerators.
+struct BenchRaySet{
+    std::string             name;                       /**< Name of the ray set. */
+    BENCH_QUERY_TYPE        type = BENCH_QUERY_CLOSEST; /**< Type of queries of all rays in the set. */
+    std::vector<Ray>        rays;                       /**< Rays in the set. */
+    std::vector<StringID>   matIds;                     /**< Material id of each ray, only used by multi-hit queries. */
+};
+
+//! @brief  Generate the fixed ray sets of a scene.
+//!
+//! Camera rays come from a pinhole camera looking at the scene. Secondary rays, including diffuse bounce rays, shadow
+//! rays towards an area light above the scene and sub-surface scattering probe rays, all start from the hit points of
+//! the camera rays, which are resolved with the reference accelerator.
+//!
+//! @param  scene       The scene to generate rays for.
+//! @param  reference   The accelerator used to resolve primary hits, it needs to be built already.
+//! @param  resolution  Resolution of the pinhole camera along each axis.
+//! @param  seed        Seed of the random number generator.
+//! @return             The camera, diffuse-bounce, shadow and sss ray sets.
+std::vector<BenchRaySet> GenerateRaySets( const BenchScene& scene , const Accelerator& reference , unsigned resolution , unsigned seed );
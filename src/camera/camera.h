@@ -55,6 +55,19 @@ public:
     //! @return     Camera forward direction in world space.
     virtual Vector GetForward() const = 0;
 
+    //! @brief      Get the region where primary rays start from.
+    //!
+    //! Primary rays start from a parallelogram centered at the returned point and spanned by the two half axes. Both axes
+    //! are zero vectors if all primary rays start from the same point, which is the case of a pinhole camera.
+    //!
+    //! @param axis_u   The first half axis of the region in world space.
+    //! @param axis_v   The second half axis of the region in world space.
+    //! @return         Center of the region in world space.
+    virtual Point GetRayOriginRegion( Vector& axis_u , Vector& axis_v ) const {
+        axis_u = axis_v = Vector();
+        return m_eye;
+    }
+
     //! @brief Get camera coordinate according to a view direction in world space. It is used in light tracing or bi-directional path tracing algorithm.
     //! @param inter            The intersection to be considered when randomly sampling a point on the sensor.
     //! @param pdfw             PDF w.r.t the solid angle of choosing the direction.
@@ -37,6 +37,12 @@ Ray OrthoCamera::GenerateRay( float x, float y, const PixelSample &ps) const{
     return Ray( ori , dir );
 }
 
+Point OrthoCamera::GetRayOriginRegion( Vector& axis_u , Vector& axis_v ) const{
+    axis_u = world2camera.TransformVector( Vector( 0.5f * m_camWidth , 0.0f , 0.0f ) );
+    axis_v = world2camera.TransformVector( Vector( 0.0f , 0.5f * m_camHeight , 0.0f ) );
+    return world2camera.TransformPoint( Point( 0.0f , 0.0f , 0.0f ) );
+}
+
 // set the camera range
 void OrthoCamera::SetCameraWidth( float w )
 {
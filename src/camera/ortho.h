@@ -35,6 +35,13 @@ public:
     //! @return     The generated ray based on the input.
     Ray GenerateRay( float x , float y , const PixelSample& ps ) const override;
 
+    //! @brief Get the region where primary rays start from, it is the whole image plane of an orthogonal camera.
+    //!
+    //! @param axis_u   The first half axis of the region in world space.
+    //! @param axis_v   The second half axis of the region in world space.
+    //! @return         Center of the region in world space.
+    Point GetRayOriginRegion( Vector& axis_u , Vector& axis_v ) const override;
+
     //! @brief Get camera viewing target.
     //! @return Camera viewing target.
     const Point& GetTarget() const { return m_target; }
@@ -63,6 +63,14 @@ void PerspectiveCamera::PreProcess()
     m_inverseApartureSize = (m_lensRadius==0)? 1.0f : (1.0f / ( m_lensRadius * m_lensRadius * PI));
 }
 
+// get the region where rays start from
+Point PerspectiveCamera::GetRayOriginRegion( Vector& axis_u , Vector& axis_v ) const{
+    // rays are generated on the lens in view space, see 'GenerateRay'
+    axis_u = m_worldToCamera.invMatrix.TransformVector( Vector( m_lensRadius , 0.0f , 0.0f ) );
+    axis_v = m_worldToCamera.invMatrix.TransformVector( Vector( 0.0f , m_lensRadius , 0.0f ) );
+    return m_worldToCamera.invMatrix.TransformPoint( Point( 0.0f , 0.0f , 0.0f ) );
+}
+
 // generate ray
 Ray PerspectiveCamera::GenerateRay( float x , float y , const PixelSample& ps ) const{
     const Point rastP( x + ps.img_u , y + ps.img_v , 0.0f );
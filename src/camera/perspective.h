@@ -56,6 +56,13 @@ public:
         return m_forward;
     }
 
+    //! @brief Get the region where primary rays start from, it is the lens if depth of field is enabled.
+    //!
+    //! @param axis_u   The first half axis of the region in world space.
+    //! @param axis_v   The second half axis of the region in world space.
+    //! @return         Center of the region in world space.
+    Point GetRayOriginRegion( Vector& axis_u , Vector& axis_v ) const override;
+
 protected:
     Point   m_target;                       /**< Viewing target of the camera. */
     Vector  m_up;                           /**< Up direction of the camera. */
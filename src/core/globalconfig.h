@@ -29,7 +29,7 @@
 #include "imagesensor/rendertargetimage.h"
 
 //! @brief  This needs to be update every time the content of GlobalConfiguration changes.
-constexpr unsigned int GLOBAL_CONFIGURATION_VERSION = 0;
+constexpr unsigned int GLOBAL_CONFIGURATION_VERSION = 3;
 
 //! @brief  GlobalConfiguration saves some global state.
 class GlobalConfiguration : public Singleton<GlobalConfiguration> , SerializableObject {
@@ -153,6 +153,31 @@ public:
         return m_clampping;
     }
 
+    //! @brief      Whether the image is denoised after rendering.
+    //!
+    //! Auxiliary features of the first hit of camera rays are collected during rendering for guiding the denoiser.
+    //!
+    //! @return     'True' if the image needs to be denoised.
+    bool            GetDenoise() const{
+        return m_denoise;
+    }
+
+    //! @brief      Whether AOVs are output along with the image.
+    //!
+    //! AOVs are saved as layers of a multi-layer EXR file, including the ones produced by the integrator.
+    //!
+    //! @return     'True' if AOVs are output.
+    bool            GetOutputAOV() const{
+        return m_outputAOV;
+    }
+
+    //! @brief      Get the type of sequence sampler driving random decisions of camera rays.
+    //!
+    //! @return     Name of the sampler class, it is not a registered class if random numbers are preferred.
+    StringID        GetSamplerType() const{
+        return m_samplerType;
+    }
+
     //! @brief      Parse command line.
     //!
     //! This is not a perfect way to parse command line arguments. If there is a space in the path,
@@ -218,6 +243,9 @@ public:
         stream >> m_samplePerPixel;
         stream >> m_resWidth >> m_resHeight;
         stream >> m_clampping;
+        stream >> m_denoise;
+        stream >> m_outputAOV;
+        stream >> m_samplerType;
         StringID accelType , integratorType;
         stream >> accelType;
         m_accelerator = MakeUniqueInstance<Accelerator>(accelType);
@@ -234,6 +262,8 @@ public:
             m_imageSensor = std::make_unique<BlenderImage>( m_resWidth , m_resHeight );
         else
             m_imageSensor = std::make_unique<RenderTargetImage>( m_resWidth , m_resHeight );
+        if( m_outputAOV )
+            m_imageSensor->EnableAOVs( m_integrator.get() );
         m_imageSensor->PreProcess();
     };
 
@@ -256,6 +286,9 @@ private:
     bool                            m_noMaterialSupport = false;    /**< Disable material support in SORT. */
     std::string                     m_inputFile;                    /**< Full path of the input file. */
     float                           m_clampping = 0.0f;             /**< Clapping value of evaluated radiance. */
+    bool                            m_denoise = false;              /**< Whether to denoise the image after rendering. */
+    bool                            m_outputAOV = false;            /**< Whether to output AOVs along with the image. */
+    StringID                        m_samplerType;                  /**< Type of sequence sampler driving random decisions of camera rays. */
 
     //! @brief  Make constructor private
     GlobalConfiguration(){}
@@ -282,4 +315,7 @@ private:
 #define g_imageSensor               GlobalConfiguration::GetSingleton().GetImageSensor()
 #define g_profilingEnabled          GlobalConfiguration::GetSingleton().GetIsProfilingEnabled()
 #define g_noMaterial                GlobalConfiguration::GetSingleton().GetNoMaterial()
-#define g_clammping                 GlobalConfiguration::GetSingleton().GetClampping()
\ No newline at end of file
+#define g_clammping                 GlobalConfiguration::GetSingleton().GetClampping()
+#define g_denoise                   GlobalConfiguration::GetSingleton().GetDenoise()
+#define g_outputAOV                 GlobalConfiguration::GetSingleton().GetOutputAOV()
+#define g_samplerType               GlobalConfiguration::GetSingleton().GetSamplerType()
\ No newline at end of file
@@ -15,117 +15,141 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <cstdint>
 #include "rand.h"
 #include "core/define.h"
 #include "core/thread.h"
+#include "sampler/sequence.h"
 
-#if defined(SORT_IN_LINUX)
-#elif defined(SORT_IN_WINDOWS)
-#include <time.h>
+#ifdef SSE_ENABLED
+#include <nmmintrin.h>
 #endif
 
-#include <random>
+/*
+    PCG32, 'PCG: A Family of Simple Fast Space-Efficient Statistically Good Algorithms for Random Number Generation',
+    Melissa E. O'Neill, 2014. A 64 bits linear congruential generator with a permuted output of 32 bits.
+
+    The state is constant initialized, there is no need to check whether it is seeded on every call. Threads that don't
+    seed it on their own share the default sequence.
+*/
+static constexpr uint64_t   PCG_MULTIPLIER = 6364136223846793005ull;
+static constexpr uint64_t   PCG_DEFAULT_STATE = 0x853c49e6748fea9bull;
+static constexpr uint64_t   PCG_DEFAULT_STREAM = 0xda3e39cb94b95bdbull;
+
+static thread_local uint64_t pcg_state = PCG_DEFAULT_STATE;
+static thread_local uint64_t pcg_inc = PCG_DEFAULT_STREAM;
+
+// initialize the state as suggested by the paper, the stream has to be odd
+static void pcg_seed( uint64_t state , uint64_t stream ){
+    pcg_state = 0u;
+    pcg_inc = ( stream << 1u ) | 1u;
+    sort_rand();
+    pcg_state += state;
+    sort_rand();
+}
 
-// different implementation of the random generator on different platforms could cause problems, switched to old solution until I have time to work on it later.
-// #define HIDE_OLD_RANDDOM_GENERATOR
+// mix all bits of a 64 bits integer, it derives well distributed states from poorly distributed keys
+static uint64_t splitmix64( uint64_t v ){
+    v += 0x9e3779b97f4a7c15ull;
+    v = ( v ^ ( v >> 30 ) ) * 0xbf58476d1ce4e5b9ull;
+    v = ( v ^ ( v >> 27 ) ) * 0x94d049bb133111ebull;
+    return v ^ ( v >> 31 );
+}
 
-#ifndef HIDE_OLD_RANDDOM_GENERATOR
-// Random Number Method Definitions
-#define M 397
-#define MATRIX_A 0x9908b0dfUL   /* constant vector a */
-#define UPPER_MASK 0x80000000UL /* most significant w-r bits */
-#define LOWER_MASK 0x7fffffffUL /* least significant r bits */
+// set the seed
+void sort_seed(){
+    sort_seed( (unsigned)ThreadId() );
+}
 
-// variables used for random number generation
-static const int N = 624;
-static thread_local unsigned long mt[N]; /* the array for the state vector  */
-static thread_local int mti;
-static thread_local bool seed_setup = false;
+// set the seed explicitly
+void sort_seed( unsigned seed ){
+    pcg_seed( splitmix64( seed ) , seed );
+}
 
-#else
+// key the generator with a pixel
+void sort_seed( int x , int y , unsigned index ){
+    const auto pixel = ( (uint64_t)(unsigned)y << 32u ) | (unsigned)x;
+    pcg_seed( splitmix64( pixel ^ splitmix64( index ) ) , pixel );
+}
 
-static thread_local std::default_random_engine  re;
+// generate a unsigned integer
+unsigned sort_rand(){
+    const auto old_state = pcg_state;
+    pcg_state = old_state * PCG_MULTIPLIER + pcg_inc;
+    const auto xorshifted = (unsigned)( ( ( old_state >> 18u ) ^ old_state ) >> 27u );
+    const auto rot = (unsigned)( old_state >> 59u );
+    return ( xorshifted >> rot ) | ( xorshifted << ( ( 32u - rot ) & 31u ) );
+}
 
-static thread_local std::uniform_int_distribution<unsigned>    dist_uint;
-static thread_local std::uniform_real_distribution<float>      dist_float( 0.0f , 1.0f );
+// generate a canonical random number
+float sort_canonical(){
+    if( g_sequenceSampler )
+        return g_sequenceSampler->Get1D();
 
-#endif
+    // higher bits of PCG are slightly better than lower ones
+    return ( sort_rand() >> 8 ) / float(1 << 24);
+}
 
-// set the seed
-void sort_seed()
-{
-    unsigned _seed = ( ThreadId() + 1 ) * (unsigned)time(0);
-
-#ifndef HIDE_OLD_RANDDOM_GENERATOR
-    mt[0]= _seed & 0xffffffffUL;
-    for (mti=1; mti<N; mti++) {
-        mt[mti] =
-        (1812433253UL * (mt[mti-1] ^ (mt[mti-1] >> 30)) + mti);
-        /* See Knuth TAOCP Vol2. 3rd Ed. P.106 for multiplier. */
-        /* In the previous versions, MSBs of the seed affect   */
-        /* only MSBs of the array mt[].                        */
-        /* 2002/01/09 modified by Makoto Matsumoto             */
-        mt[mti] &= 0xffffffffUL;
-        /* for >32 bit machines */
+// generate a pair of canonical random numbers
+void sort_canonical2D( float& u , float& v ){
+    if( g_sequenceSampler ){
+        g_sequenceSampler->Get2D( u , v );
+        return;
     }
 
-    seed_setup = true;
-#else
-    re.seed( _seed );
-#endif
+    u = sort_canonical();
+    v = sort_canonical();
 }
 
-// generate a unsigned integer
-unsigned sort_rand()
-{
-#ifndef HIDE_OLD_RANDDOM_GENERATOR
-    unsigned long y;
-    {
-        static thread_local unsigned long mag01[2]={0x0UL, MATRIX_A};
-        /* mag01[x] = x * MATRIX_A  for x=0,1 */
-
-        if( seed_setup == false )
-            sort_seed();
-
-        if (mti >= N) { /* generate N words at one time */
-            int kk;
-
-            if (mti == N+1)   /* if Seed() has not been called, */
-                sort_seed(); /* default initial seed */
-
-            for (kk=0;kk<N-M;kk++) {
-                y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-                mt[kk] = mt[kk+M] ^ (y >> 1) ^ mag01[y & 0x1UL];
-            }
-            for (;kk<N-1;kk++) {
-                y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-                mt[kk] = mt[kk+(M-N)] ^ (y >> 1) ^ mag01[y & 0x1UL];
-            }
-            y = (mt[N-1]&UPPER_MASK)|(mt[0]&LOWER_MASK);
-            mt[N-1] = mt[M-1] ^ (y >> 1) ^ mag01[y & 0x1UL];
-
-            mti = 0;
-        }
-
-        y = mt[mti++];
-
-        /* Tempering */
-        y ^= (y >> 11);
-        y ^= (y << 7) & 0x9d2c5680UL;
-        y ^= (y << 15) & 0xefc60000UL;
-        y ^= (y >> 18);
-    }
-    return y;
-#else
-    return dist_uint(re);
-#endif
+/*
+    Bulk generation is counter based, each number is a keyed hash of its index in the array, the key takes two numbers
+    from PCG. Unlike the sequential LCG, lanes don't depend on each other and SIMD takes four of them at once. The hash
+    is 'lowbias32' from Chris Wellons' hash prospector, applied twice with different halves of the key.
+*/
+SORT_STATIC_FORCEINLINE unsigned lowbias32( unsigned v ){
+    v ^= v >> 16; v *= 0x7feb352du;
+    v ^= v >> 15; v *= 0x846ca68bu;
+    v ^= v >> 16;
+    return v;
 }
 
-// generate a canonical random number
-float sort_canonical(){
-#ifndef HIDE_OLD_RANDDOM_GENERATOR
-    return (sort_rand() & 0xffffff) / float(1 << 24);
-#else
-    return dist_float(re);
+#ifdef SSE_ENABLED
+SORT_STATIC_FORCEINLINE __m128i lowbias32_sse( __m128i v ){
+    v = _mm_xor_si128( v , _mm_srli_epi32( v , 16 ) );
+    v = _mm_mullo_epi32( v , _mm_set1_epi32( (int)0x7feb352du ) );
+    v = _mm_xor_si128( v , _mm_srli_epi32( v , 15 ) );
+    v = _mm_mullo_epi32( v , _mm_set1_epi32( (int)0x846ca68bu ) );
+    v = _mm_xor_si128( v , _mm_srli_epi32( v , 16 ) );
+    return v;
+}
 #endif
+
+// fill an array with canonical random numbers
+void sort_canonical( float* samples , unsigned cnt ){
+    if( g_sequenceSampler ){
+        for( auto i = 0u ; i < cnt ; ++i )
+            samples[i] = g_sequenceSampler->Get1D();
+        return;
+    }
+
+    const auto key0 = sort_rand();
+    const auto key1 = sort_rand();
+
+    auto i = 0u;
+#ifdef SSE_ENABLED
+    const auto sse_key0 = _mm_set1_epi32( (int)key0 );
+    const auto sse_key1 = _mm_set1_epi32( (int)key1 );
+    const auto sse_scale = _mm_set1_ps( 1.0f / float(1 << 24) );
+    auto sse_index = _mm_setr_epi32( 0 , 1 , 2 , 3 );
+    for( ; i + 4 <= cnt ; i += 4 ){
+        auto v = lowbias32_sse( _mm_xor_si128( sse_index , sse_key0 ) );
+        v = lowbias32_sse( _mm_add_epi32( v , sse_key1 ) );
+        _mm_storeu_ps( samples + i , _mm_mul_ps( _mm_cvtepi32_ps( _mm_srli_epi32( v , 8 ) ) , sse_scale ) );
+        sse_index = _mm_add_epi32( sse_index , _mm_set1_epi32( 4 ) );
+    }
+#endif
+
+    // the scalar version generates exactly the same numbers as SIMD does
+    for( ; i < cnt ; ++i )
+        samples[i] = ( lowbias32( lowbias32( i ^ key0 ) + key1 ) >> 8 ) / float(1 << 24);
 }
@@ -20,14 +20,30 @@
 /*
 description :
     Random number generation method, the default 'rand' function provided by c++ standard library is not so good,
-    another random number generation method is adapted here.
+    PCG32 is adapted here, it takes only 16 bytes of state for each thread and a few instructions for each number.
+
+    Generators are keyed explicitly instead of being seeded with time, so that a re-render of a scene takes exactly
+    the same random numbers no matter which thread each tile is scheduled on.
 */
 
-// set the seed
+// set the seed based on the thread id, worker threads call it once they start
 void        sort_seed();
 
+// set the seed explicitly, threads spawned outside the task system need different seeds since they share the same thread id
+void        sort_seed( unsigned seed );
+
+// key the generator with a pixel and the index of a pass over it, like an iteration of rendering. the sequence only
+// depends on the key, not the thread taking the pixel.
+void        sort_seed( int x , int y , unsigned index );
+
 // generate a unsigned integer
 unsigned    sort_rand();
 
-// generate a canonical random number
+// generate a canonical random number, it is taken from the sequence sampler bound to the thread if there is one
 float       sort_canonical();
+
+// generate a pair of canonical random numbers, they are stratified together if a sequence sampler is bound to the thread
+void        sort_canonical2D( float& u , float& v );
+
+// fill an array with canonical random numbers, a few of them are generated at once with SIMD if it is available
+void        sort_canonical( float* samples , unsigned cnt );
@@ -32,7 +32,10 @@
 #include "entity/visual.h"
 #include "stream/fstream.h"
 #include "light/light.h"
+#include "light/lightbvh.h"
 #include "shape/shape.h"
+#include "medium/medium.h"
+#include "math/utils.h"
 
 SORT_STATS_DEFINE_COUNTER(sScenePrimitiveCount)
 SORT_STATS_DEFINE_COUNTER(sSceneLightCount)
@@ -40,6 +43,49 @@ SORT_STATS_DEFINE_COUNTER(sSceneLightCount)
 SORT_STATS_COUNTER("Statistics", "Total Primitive Count", sScenePrimitiveCount);
 SORT_STATS_COUNTER("Statistics", "Total Light Count", sSceneLightCount);
 
+// Resolution of the grid of cached medium stacks along each axis, for cameras whose primary rays don't share one origin.
+static constexpr unsigned CAMERA_MEDIUM_GRID_RES = 16;
+
+// Whether two medium stacks hold exactly the same mediums.
+static bool same_medium_stack( const MediumStack& ms0 , const MediumStack& ms1 ){
+    if( ms0.m_mediumCnt != ms1.m_mediumCnt )
+        return false;
+    for( auto i = 0u ; i < ms0.m_mediumCnt ; ++i ){
+        if( ms0.m_mediums[i] != ms1.m_mediums[i] )
+            return false;
+    }
+    return true;
+}
+
+// Whether two bounding boxes overlap, touching boxes are considered overlapping.
+static bool overlap_bbox( const BBox& bbox0 , const BBox& bbox1 ){
+    for( auto k = 0 ; k < 3 ; ++k ){
+        if( bbox0.m_Min[k] > bbox1.m_Max[k] || bbox1.m_Min[k] > bbox0.m_Max[k] )
+            return false;
+    }
+    return true;
+}
+
+// Get the bounding box of a set of primitives, it is enlarged a little.
+static BBox generate_bbox( const std::vector<const Primitive*>& primitives ){
+    BBox bbox;
+
+    // update bounding box again
+    for (auto& primitive : primitives)
+        bbox.Union(primitive->GetBBox());
+
+    // enlarge the bounding box a little
+    static const auto threshold = 0.001f;
+    auto delta = (bbox.m_Max - bbox.m_Min) * threshold;
+    bbox.m_Min -= delta;
+    bbox.m_Max += delta;
+
+    return bbox;
+}
+
+Scene::Scene() = default;
+Scene::~Scene() = default;
+
 bool Scene::LoadScene( IStreamBase& stream ){
     const StringID verificationBit( "verification bits" );
 
@@ -79,23 +125,24 @@ bool Scene::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const{
 bool Scene::IsOccluded(const Ray& r) const{
     return g_accelerator->IsOccluded(r);
 }
-#else
-Spectrum Scene::GetAttenuation( const Ray& const_ray , MediumStack* ms ) const{
-    auto ray = const_ray;
 
-    Spectrum attenuation( 1.0f );
-    while( !attenuation.IsBlack() ){
-        Spectrum att;
-        if( !g_accelerator->GetAttenuation(ray, att, ms) )
-            break;
+void Scene::IsOccluded( const Ray* rays , unsigned cnt , bool* occluded ) const{
+    g_accelerator->IsOccluded( rays , cnt , occluded );
+}
+#else
+Spectrum Scene::GetAttenuation( const Ray& ray , MediumStack* ms ) const{
+    Spectrum attenuation;
+    GetAttenuation( &ray , 1 , &attenuation , ms );
+    return attenuation;
+}
 
-        if( att.IsBlack() )
-            return att;
+void Scene::GetAttenuation( const Ray* rays , unsigned cnt , Spectrum* attenuation , MediumStack* ms ) const{
+    // medium stacks are meaningless if there is no volume in the scene at all, dropping them allows the accelerator
+    // to take a faster path since the order of intersections doesn't matter anymore.
+    if( ms && !g_acceleratorVol->GetIsValid() )
+        ms = nullptr;
 
-        attenuation *= att;
-    }
-    
-    return attenuation;
+    g_accelerator->GetAttenuation( rays , cnt , attenuation , ms );
 }
 #endif
 
@@ -110,31 +157,123 @@ void Scene::RestoreMediumStack( const Point& p , MediumStack& ms ) const{
 	while (g_accelerator->UpdateMediumStack(ray, ms, true)) {}
 }
 
+void Scene::CacheCameraMediumStack(){
+    m_cameraMediumRes = 0;
+    m_cameraMediumStacks = nullptr;
+    m_cameraMediumCached = nullptr;
+
+    // there is nothing to cache without camera or volume
+    if( nullptr == m_camera || !g_acceleratorVol->GetIsValid() )
+        return;
+
+    m_cameraOrigin = m_camera->GetRayOriginRegion( m_cameraAxis[0] , m_cameraAxis[1] );
+
+    // all primary rays start from the same point
+    if( m_cameraAxis[0].SquaredLength() == 0.0f && m_cameraAxis[1].SquaredLength() == 0.0f ){
+        m_cameraMediumRes = 1;
+        m_cameraMediumStacks = std::make_unique<MediumStack[]>(1);
+        m_cameraMediumCached = std::make_unique<bool[]>(1);
+        RestoreMediumStack( m_cameraOrigin , m_cameraMediumStacks[0] );
+        m_cameraMediumCached[0] = true;
+        return;
+    }
+
+    // medium stacks at the corners of all cells
+    const auto res = CAMERA_MEDIUM_GRID_RES;
+    std::unique_ptr<MediumStack[]> corners = std::make_unique<MediumStack[]>( ( res + 1 ) * ( res + 1 ) );
+    for( auto j = 0u ; j <= res ; ++j ){
+        for( auto i = 0u ; i <= res ; ++i ){
+            const auto u = 2.0f * i / res - 1.0f;
+            const auto v = 2.0f * j / res - 1.0f;
+            RestoreMediumStack( m_cameraOrigin + m_cameraAxis[0] * u + m_cameraAxis[1] * v , corners[ j * ( res + 1 ) + i ] );
+        }
+    }
+
+    // corners agreeing with each other is not enough, a volume smaller than a cell could sit between them. a cell is only
+    // cached if it doesn't touch the bounding box of any primitive with volume, no volume boundary crosses it then.
+    m_cameraMediumRes = res;
+    m_cameraMediumStacks = std::make_unique<MediumStack[]>( res * res );
+    m_cameraMediumCached = std::make_unique<bool[]>( res * res );
+    for( auto j = 0u ; j < res ; ++j ){
+        for( auto i = 0u ; i < res ; ++i ){
+            const auto& ms = corners[ j * ( res + 1 ) + i ];
+            const auto cell = j * res + i;
+            m_cameraMediumStacks[cell] = ms;
+            m_cameraMediumCached[cell] = same_medium_stack( ms , corners[ j * ( res + 1 ) + i + 1 ] ) &&
+                                         same_medium_stack( ms , corners[ ( j + 1 ) * ( res + 1 ) + i ] ) &&
+                                         same_medium_stack( ms , corners[ ( j + 1 ) * ( res + 1 ) + i + 1 ] );
+            if( !m_cameraMediumCached[cell] )
+                continue;
+
+            const auto u0 = 2.0f * i / res - 1.0f , u1 = 2.0f * ( i + 1 ) / res - 1.0f;
+            const auto v0 = 2.0f * j / res - 1.0f , v1 = 2.0f * ( j + 1 ) / res - 1.0f;
+            BBox cell_bbox;
+            cell_bbox.Union( m_cameraOrigin + m_cameraAxis[0] * u0 + m_cameraAxis[1] * v0 );
+            cell_bbox.Union( m_cameraOrigin + m_cameraAxis[0] * u1 + m_cameraAxis[1] * v0 );
+            cell_bbox.Union( m_cameraOrigin + m_cameraAxis[0] * u0 + m_cameraAxis[1] * v1 );
+            cell_bbox.Union( m_cameraOrigin + m_cameraAxis[0] * u1 + m_cameraAxis[1] * v1 );
+            if( !overlap_bbox( cell_bbox , m_bboxVol ) )
+                continue;
+
+            for( const auto primitive : m_volPrimitives ){
+                if( overlap_bbox( cell_bbox , primitive->GetBBox() ) ){
+                    m_cameraMediumCached[cell] = false;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void Scene::RestoreCameraMediumStack( const Point& p , MediumStack& ms ) const{
+    if( m_cameraMediumRes > 0 ){
+        // locate the cell the point falls in
+        const auto d = p - m_cameraOrigin;
+        int id[2] = { 0 , 0 };
+        for( auto k = 0 ; k < 2 ; ++k ){
+            const auto len_sqr = m_cameraAxis[k].SquaredLength();
+            const auto t = len_sqr > 0.0f ? dot( d , m_cameraAxis[k] ) / len_sqr : 0.0f;
+            id[k] = clamp( (int)( ( t * 0.5f + 0.5f ) * m_cameraMediumRes ) , 0 , (int)m_cameraMediumRes - 1 );
+        }
+
+        const auto cell = id[1] * m_cameraMediumRes + id[0];
+        if( m_cameraMediumCached[cell] ){
+            ms = m_cameraMediumStacks[cell];
+            return;
+        }
+    }
+
+    RestoreMediumStack( p , ms );
+}
+
 void Scene::GetIntersect( const Ray& r , BSSRDFIntersections& intersect , const StringID matID ) const{
+    // only primitives of the same material are visited if there is a dedicated accelerator for the material
+    const auto it = m_sssAccelerators.find( matID );
+    if( it != m_sssAccelerators.end() ){
+        it->second->GetIntersect( r , intersect , matID );
+        return;
+    }
+
     // no brute force support in BSSRDF
     if( g_accelerator != nullptr )
         g_accelerator->GetIntersect( r , intersect , matID );
 }
 
+void Scene::BuildAcceleratorsSSS(){
+    if( nullptr == g_accelerator )
+        return;
+
+    for( const auto& it : m_sssPrimitives ){
+        // only the configuration of the accelerator is cloned
+        auto accelerator = g_accelerator->Clone();
+        accelerator->Build( it.second , generate_bbox( it.second ) );
+        m_sssAccelerators[it.first] = std::move( accelerator );
+    }
+}
+
 void Scene::_generatePriBuf(){
     for( auto& entity : m_entities )
         entity->FillScene( *this );
-    
-    auto generate_bbox = [](const std::vector<const Primitive*>& primitives) {
-        BBox bbox;
-
-        // update bounding box again
-        for (auto& primitive : primitives)
-            bbox.Union(primitive->GetBBox());
-
-        // enlarge the bounding box a little
-        static const auto threshold = 0.001f;
-        auto delta = (bbox.m_Max - bbox.m_Min) * threshold;
-        bbox.m_Min -= delta;
-        bbox.m_Max += delta;
-
-        return bbox;
-    };
 
     m_bbox      = generate_bbox(m_primitives);
     m_bboxVol   = generate_bbox(m_volPrimitives);
@@ -157,6 +296,9 @@ void Scene::_genLightDistribution(){
         m_lights[i]->SetPickPDF( pdf[i] / total_pdf );
 
     m_lightsDis = std::make_unique<Distribution1D>( pdf.get() , count );
+
+    m_lightBvh = std::make_unique<LightBvh>();
+    m_lightBvh->Build( m_lights );
 }
 
 const Light* Scene::SampleLight( float u , float* pdf ) const{
@@ -172,6 +314,22 @@ const Light* Scene::SampleLight( float u , float* pdf ) const{
     return nullptr;
 }
 
+const Light* Scene::SampleLight( const Point& p , const Vector& n , float u , float* pdf ) const{
+    sAssert( u >= 0.0f && u <= 1.0f , SAMPLING );
+    sAssertMsg( m_lightBvh != nullptr , SAMPLING , "No light in the scene." );
+
+    float _pdf = 0.0f;
+    const auto light = m_lightBvh->Sample( p , n , u , &_pdf );
+    if( pdf ) *pdf = _pdf;
+    return _pdf > 0.0f ? light : nullptr;
+}
+
+float Scene::LightProbability( const Point& p , const Vector& n , const Light* light ) const{
+    if( nullptr == m_lightBvh )
+        return 0.0f;
+    return m_lightBvh->Pdf( p , n , light );
+}
+
 float Scene::LightProperbility( unsigned i ) const{
     sAssert(m_lightsDis != nullptr , LIGHT );
     return m_lightsDis->GetProperty( i );
@@ -19,6 +19,7 @@
 
 #include "core/define.h"
 #include <vector>
+#include <unordered_map>
 #include "core/sassert.h"
 #include "math/bbox.h"
 #include "spectrum/spectrum.h"
@@ -30,6 +31,8 @@
 #include "core/samplemethod.h"
 
 class Light;
+class LightBvh;
+class Accelerator;
 struct BSSRDFIntersections;
 
 //! @brief  Data structure representing the whole scene.
@@ -38,6 +41,10 @@ struct BSSRDFIntersections;
  */
 class   Scene{
 public:
+    //! @brief  Constructor and destructor are defined where light BVH and accelerator are complete types.
+    Scene();
+    ~Scene();
+
     //! @brief Serialize scene from stream.
     //!
     //! @param  stream      The streaming source where scene information is loaded from.
@@ -62,6 +69,16 @@ public:
     //! @param r            The ray to be tested.
     //! @return             Whether the ray is occluded by anything.
     bool    IsOccluded(const Ray& r) const;
+
+    //! @brief  Detect occlusion of a batch of shadow rays.
+    //!
+    //! It is more efficient than testing the rays one by one when many shadow rays are needed at the same time, like
+    //! evaluating direct illumination from all lights at a shading point.
+    //!
+    //! @param rays         The rays to be tested, each of them has its own maximum distance.
+    //! @param cnt          Number of rays to be tested.
+    //! @param occluded     Whether each of the rays is occluded by anything.
+    void    IsOccluded( const Ray* rays , unsigned cnt , bool* occluded ) const;
 #else
     //! @brief  Evaluate occlusion along a ray segment.
     //!
@@ -74,6 +91,17 @@ public:
     //! @param  ms          The medium stack to be passed in. Medium aware integrator needs to pass non-empty pointer.
     //! @return             The occlusion along the ray.
     Spectrum    GetAttenuation( const Ray& r , MediumStack* ms = nullptr ) const;
+
+    //! @brief  Evaluate occlusion of a batch of shadow rays.
+    //!
+    //! It is more efficient than evaluating the rays one by one when many shadow rays are needed at the same time, like
+    //! evaluating direct illumination from all lights at a shading point.
+    //!
+    //! @param  rays        The rays to be tested, each of them has its own maximum distance.
+    //! @param  cnt         Number of rays to be tested.
+    //! @param  attenuation The occlusion along each of the rays.
+    //! @param  ms          Medium stacks of each ray, it is either nullptr or an array of 'cnt' medium stacks.
+    void        GetAttenuation( const Ray* rays , unsigned cnt , Spectrum* attenuation , MediumStack* ms = nullptr ) const;
 #endif
 
 	//! @brief	Restore the medium stack at a specific point.
@@ -82,6 +110,21 @@ public:
 	//! @param	ms			The medium stack to be populated.
 	void		RestoreMediumStack( const Point& p , MediumStack& ms ) const ;
 
+    //! @brief  Cache medium stacks of the region where primary rays start from.
+    //!
+    //! All primary rays of a pinhole camera share one origin, a single medium stack is cached for them. Cameras with
+    //! more than one origin, like a camera with depth of field enabled, get a grid of medium stacks over the region
+    //! their rays start from. Cells of the grid touching the bounding box of a primitive with volume are not cached.
+    void        CacheCameraMediumStack();
+
+    //! @brief  Restore the medium stack at the origin of a primary ray.
+    //!
+    //! The cached medium stack is used if available, it falls back to 'RestoreMediumStack' otherwise.
+    //!
+    //! @param  p           The origin of the primary ray.
+    //! @param  ms          The medium stack to be populated.
+    void        RestoreCameraMediumStack( const Point& p , MediumStack& ms ) const;
+
     //! @brief Get multiple intersections between the ray and the primitive set using spatial data structure.
     //!
     //! This is a specific interface designed for SSS during disk ray casting. Without this interface, the algorithm has to use the
@@ -111,6 +154,27 @@ public:
     }
     // get sampled light
     const Light* SampleLight( float u , float* pdf ) const;
+
+    //! @brief  Pick a light based on its contribution to a shading point.
+    //!
+    //! Unlike the above one, lights that are close to the shading point and face towards it are more likely to be
+    //! picked. This is what next event estimation should use. Light sub-paths, which don't start from a shading point,
+    //! should use the above one instead.
+    //!
+    //! @param  p       The shading point.
+    //! @param  n       Normal at the shading point, zero vector if there is no surface, like a point in medium.
+    //! @param  u       A canonical random number.
+    //! @param  pdf     The probability of picking the light.
+    //! @return         The picked light, nullptr if no light could contribute to the shading point.
+    const Light* SampleLight( const Point& p , const Vector& n , float u , float* pdf ) const;
+
+    //! @brief  Get the probability of picking a light at a shading point with the above method.
+    //!
+    //! @param  p       The shading point.
+    //! @param  n       Normal at the shading point, zero vector if there is no surface, like a point in medium.
+    //! @param  light   The light to be evaluated.
+    //! @return         The probability of picking the light at the shading point.
+    float LightProbability( const Point& p , const Vector& n , const Light* light ) const;
     // get the properbility of the sample
     float LightProperbility( unsigned i ) const;
     // get the number of lights
@@ -139,6 +203,8 @@ public:
 		const auto material = primitive->GetMaterial();
 		if( material->HasVolumeAttached() )
 			m_volPrimitives.push_back( primitive );
+		if( material->HasSSS() )
+			m_sssPrimitives[material->GetUniqueID()].push_back( primitive );
     }
     
     //! @brief  Get all of the primitives in the scene.
@@ -155,6 +221,12 @@ public:
 		return m_volPrimitives;
 	}
 
+    //! @brief  Build a dedicated spatial accelerator for the primitives of each material with sub-surface scattering.
+    //!
+    //! Probe rays of BSSRDF are only interested in primitives of the same material, walking through the accelerator of the
+    //! whole scene for them is a waste of time, especially when there is lots of other geometry around.
+    void BuildAcceleratorsSSS();
+
     // Evaluate sky
     Spectrum    Le( const Ray& ray ) const;
 
@@ -174,11 +246,29 @@ private:
     std::vector<const Primitive*>               m_primitives;           /**< A list holding all primitives. */
     std::vector<const Primitive*>               m_volPrimitives;        /**< A list holding all primitives that has volume attached to it. */
 
+    /**< Primitives of each material with sub-surface scattering, keyed by the unique id of the material. */
+    std::unordered_map<StringID, std::vector<const Primitive*>>     m_sssPrimitives;
+    /**< Spatial accelerators of each material with sub-surface scattering, keyed by the unique id of the material. */
+    std::unordered_map<StringID, std::unique_ptr<Accelerator>>      m_sssAccelerators;
+
     Light*                  m_skyLight = nullptr;   /**< Sky light if available. */
     Camera*                 m_camera = nullptr;     /**< Camera of the scene. */
 
     /**< distribution of light power */
     std::unique_ptr<Distribution1D>             m_lightsDis = nullptr;
+    /**< Light BVH for picking lights based on their contribution to shading points. */
+    std::unique_ptr<LightBvh>                   m_lightBvh;
+
+    /**< Center of the region where primary rays start from. */
+    Point                                       m_cameraOrigin;
+    /**< Half axes of the region where primary rays start from. */
+    Vector                                      m_cameraAxis[2];
+    /**< Resolution of the grid of cached medium stacks along each axis, zero if nothing is cached. */
+    unsigned                                    m_cameraMediumRes = 0;
+    /**< Cached medium stacks of each cell in the region where primary rays start from. */
+    std::unique_ptr<MediumStack[]>              m_cameraMediumStacks;
+    /**< Whether the medium stack of each cell is cached. */
+    std::unique_ptr<bool[]>                     m_cameraMediumCached;
 
     // bounding box for the scene
     BBox    m_bbox;
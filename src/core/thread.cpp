@@ -19,12 +19,14 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 #include "core/memory.h"
 #include "core/stats.h"
 #include "core/profile.h"
 #include "task/task.h"
 #include "core/profile.h"
 #include "core/define.h"
+#include "core/rand.h"
 
 static thread_local int g_ThreadId = 0;
 int ThreadId(){
@@ -33,9 +35,26 @@ int ThreadId(){
 
 spinlock_mutex g_mutex;
 
+void RunHelperThreads( unsigned thread_cnt , const std::function<void(unsigned)>& func ){
+    std::vector<std::thread> threads;
+    for( auto i = 0u ; i < thread_cnt ; ++i ){
+        threads.push_back( std::thread( [&func,i](){
+            g_ThreadId = (int)i;
+            sort_seed();
+            func( i );
+
+            // stats of the helper thread would be lost once it is done.
+            SortStatsFlushData();
+        } ) );
+    }
+    for( auto& thread : threads )
+        thread.join();
+}
+
 void WorkerThread::BeginThread(){
     m_thread = std::thread([&]() {
         g_ThreadId = m_tid;
+        sort_seed();
         RunThread();
     });
 }
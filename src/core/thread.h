@@ -19,11 +19,17 @@
 
 #include "core/define.h"
 #include <thread>
+#include <functional>
 #include <atomic>
 
 // get the thread id
 int ThreadId();
 
+// run a job on helper threads and wait for all of them to be done, each helper thread takes the id of a worker thread
+// so that it gets its own shading context and per-thread buffers. this is only safe when worker threads are not
+// rendering, like during pre-processing. 'thread_cnt' should be no larger than the number of worker threads.
+void RunHelperThreads( unsigned thread_cnt , const std::function<void(unsigned)>& func );
+
 class WorkerThread{
 public:
     // Constructor
@@ -52,6 +52,16 @@ public:
         return (unsigned int)std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - m_start).count();
     }
 
+    //! @brief  Get elapsed time since last time the timer is reset, including fractions of a milli-second.
+    //!
+    //! This is for measuring very short operations, like evaluating a single camera ray.
+    //!
+    //! @return Get the elapsed time in million second since last
+    //!         time the timer is reset.
+    SORT_FORCEINLINE float GetPreciseElapsedTime() const {
+        return std::chrono::duration<float, std::milli>(clock::now() - m_start).count();
+    }
+
 private:
     std::chrono::time_point<clock>  m_start;        /**< Start point of last time timer is triggered. */
 };
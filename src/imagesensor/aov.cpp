@@ -0,0 +1,121 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cstring>
+#include <algorithm>
+#include "aov.h"
+#include "core/log.h"
+#include "thirdparty/tiny_exr/tinyexr.h"
+
+thread_local float* g_aovSample = nullptr;
+thread_local FirstHit* g_firstHits = nullptr;
+
+void AOV_Layout::RegisterBuiltin(){
+    // built-in AOVs are registered first and in the order of 'AOV_BUILTIN', their ids are the offsets defined there.
+    Register( "albedo" , "RGB" );
+    Register( "normal" , "XYZ" );
+    Register( "depth" , "Z" );
+    Register( "samples" , "V" , false );
+    Register( "time" , "V" , false );
+
+    sAssert( AOV_BUILTIN_CHANNEL_CNT == m_channelCnt , IMAGE );
+}
+
+AOV_Id AOV_Layout::Register( const std::string& name , const std::string& channels , bool average ){
+    for( const auto& aov : m_aovs ){
+        if( aov.name == name ){
+            sAssertMsg( aov.channels == channels , IMAGE , "AOV %s is registered with different channels." , name.c_str() );
+            return aov.id;
+        }
+    }
+
+    m_aovs.push_back( { name , channels , (AOV_Id)m_channelCnt , average } );
+    m_channelCnt += (unsigned)channels.size();
+    return m_aovs.back().id;
+}
+
+bool SaveMultiLayerEXR( const std::string& filename , int width , int height , const Spectrum* color , const AOV_Layout& layout , const float* aovs ){
+    struct Channel{
+        std::string         name;
+        std::vector<float>  data;
+    };
+
+    const auto pixel_cnt = width * height;
+    const auto aov_channel_cnt = layout.GetChannelCount();
+
+    // the image itself takes the channels without a layer.
+    std::vector<Channel> channels;
+    const char* color_names[] = { "R" , "G" , "B" };
+    for( auto c = 0 ; c < 3 ; ++c ){
+        channels.push_back( { color_names[c] , std::vector<float>( pixel_cnt ) } );
+        for( auto i = 0 ; i < pixel_cnt ; ++i )
+            channels.back().data[i] = color[i][c];
+    }
+
+    // each AOV is a layer, averaged AOVs are divided by the number of samples taken in the pixel.
+    for( const auto& aov : layout.GetAOVs() ){
+        for( auto c = 0u ; c < aov.channels.size() ; ++c ){
+            channels.push_back( { aov.name + "." + aov.channels[c] , std::vector<float>( pixel_cnt ) } );
+            auto& data = channels.back().data;
+            for( auto i = 0 ; i < pixel_cnt ; ++i ){
+                const auto pixel = aovs + i * aov_channel_cnt;
+                const auto sample_cnt = pixel[AOV_SAMPLE_COUNT];
+                data[i] = pixel[aov.id + c];
+                if( aov.average )
+                    data[i] = sample_cnt > 0.0f ? data[i] / sample_cnt : 0.0f;
+            }
+        }
+    }
+
+    // most of EXR readers expect channels sorted by name.
+    std::sort( channels.begin() , channels.end() , []( const Channel& c0 , const Channel& c1 ){ return c0.name < c1.name; } );
+
+    const auto channel_cnt = (int)channels.size();
+    std::vector<EXRChannelInfo> infos( channel_cnt );
+    std::vector<int>            pixel_types( channel_cnt , TINYEXR_PIXELTYPE_FLOAT );
+    std::vector<unsigned char*> images( channel_cnt );
+    for( auto i = 0 ; i < channel_cnt ; ++i ){
+        memset( &infos[i] , 0 , sizeof( EXRChannelInfo ) );
+        strncpy( infos[i].name , channels[i].name.c_str() , 255 );
+        images[i] = reinterpret_cast<unsigned char*>( channels[i].data.data() );
+    }
+
+    EXRHeader header;
+    InitEXRHeader( &header );
+    header.num_channels = channel_cnt;
+    header.channels = infos.data();
+    header.pixel_types = pixel_types.data();
+    header.requested_pixel_types = pixel_types.data();
+    header.compression_type = TINYEXR_COMPRESSIONTYPE_ZIP;
+
+    EXRImage image;
+    InitEXRImage( &image );
+    image.num_channels = channel_cnt;
+    image.images = images.data();
+    image.width = width;
+    image.height = height;
+
+    const char* err = nullptr;
+    const auto ret = SaveEXRImageToFile( &image , &header , filename.c_str() , &err );
+    if( TINYEXR_SUCCESS != ret ){
+        slog( WARNING , IMAGE , "Fail to save image file %s, %s" , filename.c_str() , err ? err : "" );
+        if( err )
+            FreeEXRErrorMessage( err );
+        return false;
+    }
+    return true;
+}
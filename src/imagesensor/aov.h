@@ -0,0 +1,167 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "spectrum/spectrum.h"
+#include "math/vector3.h"
+#include "core/sassert.h"
+
+//! @brief  Identifier of an AOV, it is the offset of its first channel in the AOVs of a pixel.
+using AOV_Id = int;
+
+//! @brief  Identifier of AOVs that are not registered.
+constexpr AOV_Id AOV_INVALID = -1;
+
+//! @brief  AOVs collected by the renderer for all integrators, they always take the first channels of a pixel.
+enum AOV_BUILTIN : AOV_Id {
+    AOV_ALBEDO          = 0,        /**< Albedo at the first hit, averaged over samples. */
+    AOV_NORMAL          = 3,        /**< Shading normal at the first hit, averaged over samples. */
+    AOV_DEPTH           = 6,        /**< Distance to the first hit, averaged over samples. */
+    AOV_SAMPLE_COUNT    = 7,        /**< Number of valid samples taken in the pixel. */
+    AOV_TIME            = 8,        /**< Time spent on the pixel in milliseconds. */
+    AOV_BUILTIN_CHANNEL_CNT = 9
+};
+
+//! @brief  Description of an arbitrary output variable.
+struct AOV_Desc{
+    std::string     name;           /**< Name of the AOV, it is the name of its layer in the output file. */
+    std::string     channels;       /**< Each character is the name of a channel, like 'RGB' or 'XYZ'. */
+    AOV_Id          id;             /**< Offset of the first channel in the AOVs of a pixel. */
+    bool            average;        /**< Whether the AOV is divided by the number of samples when it is output. */
+};
+
+//! @brief  Layout of all AOVs of a pixel.
+/**
+ * AOVs are named per-pixel channels output along with the image, like albedo, normal or the split of direct and
+ * indirect illumination. Each of them takes a few consecutive floats in a pixel, the layout is fixed once rendering
+ * starts. Integrators register the AOVs they produce before rendering, with nothing registered there is no cost in
+ * rendering at all.
+ */
+class AOV_Layout{
+public:
+    //! @brief  Register the AOVs collected by the renderer for all integrators.
+    void        RegisterBuiltin();
+
+    //! @brief  Register an AOV, registering an existing name simply returns the existing AOV.
+    //!
+    //! @param  name        Name of the AOV.
+    //! @param  channels    Name of each channel of the AOV, one character per channel.
+    //! @param  average     Whether the AOV is averaged over samples, instead of being summed up.
+    //! @return             Identifier of the AOV.
+    AOV_Id      Register( const std::string& name , const std::string& channels , bool average = true );
+
+    //! @brief  Number of floats taken by all AOVs of a pixel.
+    SORT_FORCEINLINE unsigned GetChannelCount() const {
+        return m_channelCnt;
+    }
+
+    //! @brief  All registered AOVs.
+    SORT_FORCEINLINE const std::vector<AOV_Desc>& GetAOVs() const {
+        return m_aovs;
+    }
+
+private:
+    std::vector<AOV_Desc>   m_aovs;             /**< All registered AOVs. */
+    unsigned                m_channelCnt = 0;   /**< Number of floats taken by all AOVs of a pixel. */
+};
+
+//! @brief  AOVs of the camera ray being evaluated by the current thread, nullptr if AOVs are not collected.
+//!
+//! Render tasks point it to a buffer of their own before evaluating a camera ray, nothing is shared among threads.
+extern thread_local float* g_aovSample;
+
+//! @brief  Add a value to an AOV of the camera ray being evaluated by the current thread.
+//!
+//! @param  id      Identifier of the AOV.
+//! @param  value   Value to be added.
+SORT_FORCEINLINE void RecordAOV( AOV_Id id , const Spectrum& value ){
+    if( !g_aovSample )
+        return;
+    sAssert( AOV_INVALID != id , IMAGE );
+    g_aovSample[id] += value.r;
+    g_aovSample[id + 1] += value.g;
+    g_aovSample[id + 2] += value.b;
+}
+
+//! @brief  Add a value to an AOV of the camera ray being evaluated by the current thread.
+//!
+//! @param  id      Identifier of the AOV.
+//! @param  value   Value to be added.
+SORT_FORCEINLINE void RecordAOV( AOV_Id id , const Vector& value ){
+    if( !g_aovSample )
+        return;
+    sAssert( AOV_INVALID != id , IMAGE );
+    g_aovSample[id] += value.x;
+    g_aovSample[id + 1] += value.y;
+    g_aovSample[id + 2] += value.z;
+}
+
+//! @brief  Add a value to an AOV of the camera ray being evaluated by the current thread.
+//!
+//! @param  id      Identifier of the AOV.
+//! @param  value   Value to be added.
+SORT_FORCEINLINE void RecordAOV( AOV_Id id , float value ){
+    if( !g_aovSample )
+        return;
+    sAssert( AOV_INVALID != id , IMAGE );
+    g_aovSample[id] += value;
+}
+
+//! @brief  The first surface hit by a camera ray, it feeds the built-in AOVs and guides the denoiser.
+struct FirstHit{
+    Spectrum    albedo = 1.0f;      /**< Albedo at the first hit, it is one if nothing is hit so that color is untouched by dividing it. */
+    Vector      normal;             /**< Shading normal at the first hit, zero if nothing is hit. */
+    float       depth = 0.0f;       /**< Distance to the first hit, zero if nothing is hit. */
+};
+
+//! @brief  First hits of the camera rays being evaluated by the current thread, nullptr if they are not needed.
+//!
+//! Render tasks point it to one record per camera ray before evaluating them, the records of a batch of camera rays are
+//! in the same order as the rays. Nothing is shared among threads.
+extern thread_local FirstHit* g_firstHits;
+
+//! @brief  Record the first hit of a camera ray being evaluated by the current thread.
+//!
+//! Integrators record it where they shade the first hit anyway, there is no need to trace the camera ray again. Camera
+//! rays of integrators that don't record it, like light tracing, look like hitting nothing.
+//!
+//! @param  albedo  Albedo at the first hit.
+//! @param  normal  Shading normal at the first hit.
+//! @param  depth   Distance to the first hit.
+//! @param  ray     Index of the camera ray in the batch, it is zero if camera rays are evaluated one at a time.
+SORT_FORCEINLINE void RecordFirstHit( const Spectrum& albedo , const Vector& normal , float depth , unsigned ray = 0 ){
+    if( !g_firstHits )
+        return;
+    auto& hit = g_firstHits[ray];
+    hit.albedo = albedo;
+    hit.normal = normal;
+    hit.depth = depth;
+}
+
+//! @brief  Save the image and all AOVs in a multi-layer EXR file.
+//!
+//! @param  filename    Name of the output file.
+//! @param  width       Width of the image.
+//! @param  height      Height of the image.
+//! @param  color       Color of each pixel.
+//! @param  layout      Layout of AOVs.
+//! @param  aovs        AOVs of each pixel, sums over all samples.
+//! @return             Whether the file is saved.
+bool SaveMultiLayerEXR( const std::string& filename , int width , int height , const Spectrum* color , const AOV_Layout& layout , const float* aovs );
@@ -39,18 +39,15 @@ void BlenderImage::StorePixel( int x , int y , const Spectrum& color , const Ren
     // get offset
     int inner_offset = offset + 4 * (x - rt.GetTopLeft().x + (g_tileSize - 1 - (y - rt.GetTopLeft().y)) * tile_w);
 
+    // each iteration only adds its share of the pixel, the preview shows what is accumulated so far.
+    const auto accumulated = m_rendertarget.GetColor(x,y) + color;
+    m_rendertarget.SetColor(x, y, accumulated);
+
     // copy data
-    data[ inner_offset ] = color.r;
-    data[ inner_offset + 1 ] = color.g;
-    data[ inner_offset + 2 ] = color.b;
+    data[ inner_offset ] = accumulated.r;
+    data[ inner_offset + 1 ] = accumulated.g;
+    data[ inner_offset + 2 ] = accumulated.b;
     data[ inner_offset + 3 ] = 1.0f;
-
-    // for final update
-    {
-        std::lock_guard<spinlock_mutex> lock(m_mutex[y*m_width+x]);
-        Spectrum _color = m_rendertarget.GetColor(x,y);
-        m_rendertarget.SetColor(x, y, color+_color);
-    }
 }
 
 void BlenderImage::FinishTile( int tile_x , int tile_y , const Render_Task& rt ){
@@ -82,6 +79,9 @@ void BlenderImage::PreProcess(){
 }
 
 void BlenderImage::PostProcess(){
+    // denoise the image before it is sent to blender
+    ImageSensor::PostProcess();
+
     // perform a copy from render target to shared memory
     float* data = (float*)(m_sharedMemory.sharedmemory.bytes + m_header_offset + m_header_offset * g_tileSize * g_tileSize * 4 * sizeof(float));
 
@@ -98,5 +98,6 @@ void BlenderImage::PostProcess(){
     // signal a final update
     m_sharedMemory.sharedmemory.bytes[m_final_update_flag_offset] = 1;
 
-    ImageSensor::PostProcess();
+    // blender only takes the image through shared memory, AOVs are saved in the resource folder for compositing.
+    OutputAOVs(GetFilePathInResourceFolder(g_outputFileName));
 }
@@ -0,0 +1,300 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+#include "denoiser.h"
+
+#ifdef SSE_ENABLED
+#define SIMD_SSE_IMPLEMENTATION
+#include "simd/simd_wrapper.h"
+#endif
+
+// Half size of the filter window, each pixel is filtered with (2 * DENOISE_RADIUS + 1)^2 neighbors.
+static constexpr int    DENOISE_RADIUS = 7;
+// Number of four-wide chunks covering a row of the filter window.
+static constexpr int    DENOISE_CHUNK_CNT = ( 2 * DENOISE_RADIUS + 1 + 3 ) / 4;
+// Padding around the image, wide enough for the filter window and the last chunk of a row reading past it.
+static constexpr int    DENOISE_PADDING = DENOISE_RADIUS + 4;
+// Size of tiles that are filtered by threads.
+static constexpr int    DENOISE_TILE_SIZE = 32;
+
+// Standard deviation of the spatial gaussian, in pixels.
+static constexpr float  DENOISE_SIGMA_SPATIAL = 4.0f;
+// How much color difference is tolerated relative to the variance.
+static constexpr float  DENOISE_K_COLOR = 0.45f;
+// Standard deviations of the differences in normal, albedo and relative depth.
+static constexpr float  DENOISE_SIGMA_NORMAL = 0.3f;
+static constexpr float  DENOISE_SIGMA_ALBEDO = 0.1f;
+static constexpr float  DENOISE_SIGMA_DEPTH = 0.1f;
+// Smallest albedo that color is divided by, this avoids amplifying color on dark surfaces.
+static constexpr float  DENOISE_MIN_ALBEDO = 0.01f;
+
+namespace {
+    // Features of the image in planar layout with padding around it, neighbors in a row are contiguous in memory.
+    struct DenoiseBuffers{
+        int                 stride = 0;     // number of floats in a padded row
+        std::vector<float>  valid;          // one for pixels in the image, zero for padding
+        std::vector<float>  guide[3];       // color averaged over 3x3 pixels, it drives the color weights
+        std::vector<float>  variance;       // variance of the guide color
+        std::vector<float>  demod[3];       // color divided by albedo, this is what is filtered
+        std::vector<float>  albedo[3];      // albedo
+        std::vector<float>  normal[3];      // shading normal
+        std::vector<float>  depth;          // distance to the first hit
+
+        SORT_FORCEINLINE int Index( int x , int y ) const {
+            return ( y + DENOISE_PADDING ) * stride + x + DENOISE_PADDING;
+        }
+    };
+
+    // Spatial weight of each lane in the filter window, lanes out of the window have zero weight.
+    struct alignas(16) SpatialWeights{
+        float   w[2 * DENOISE_RADIUS + 1][DENOISE_CHUNK_CNT * 4];
+    };
+}
+
+#ifdef SSE_ENABLED
+// Approximation of exp(x), it is accurate enough for filter weights.
+static SORT_FORCEINLINE __m128 fast_exp( const __m128 x ){
+    const auto t = _mm_mul_ps( _mm_max_ps( x , _mm_set_ps1( -80.0f ) ) , _mm_set_ps1( 1.442695041f ) );
+    const auto i = _mm_floor_ps( t );
+    const auto f = _mm_sub_ps( t , i );
+
+    // 2^f for f in [0, 1) with a polynomial, 2^i is built from the bits of the exponent.
+    auto p = _mm_add_ps( _mm_mul_ps( f , _mm_set_ps1( 0.0096181291f ) ) , _mm_set_ps1( 0.0555041087f ) );
+    p = _mm_add_ps( _mm_mul_ps( f , p ) , _mm_set_ps1( 0.2402265070f ) );
+    p = _mm_add_ps( _mm_mul_ps( f , p ) , _mm_set_ps1( 0.6931471806f ) );
+    p = _mm_add_ps( _mm_mul_ps( f , p ) , _mm_set_ps1( 1.0f ) );
+    const auto e = _mm_slli_epi32( _mm_add_epi32( _mm_cvtps_epi32( i ) , _mm_set1_epi32( 127 ) ) , 23 );
+    return _mm_mul_ps( p , _mm_castsi128_ps( e ) );
+}
+
+static SORT_FORCEINLINE float horizontal_sum( const __m128 x ){
+    const auto t = _mm_add_ps( x , _mm_movehl_ps( x , x ) );
+    return _mm_cvtss_f32( _mm_add_ss( t , _mm_shuffle_ps( t , t , 1 ) ) );
+}
+#endif
+
+// Filter a single pixel, the scalar version is the reference of the SIMD one.
+static Spectrum filterPixel( const DenoiseBuffers& buf , const SpatialWeights& spatial , int x , int y , bool simd ){
+    const auto  p = buf.Index( x , y );
+    const float gp[3] = { buf.guide[0][p] , buf.guide[1][p] , buf.guide[2][p] };
+    const float ap[3] = { buf.albedo[0][p] , buf.albedo[1][p] , buf.albedo[2][p] };
+    const float np[3] = { buf.normal[0][p] , buf.normal[1][p] , buf.normal[2][p] };
+    const auto  vp = buf.variance[p];
+    const auto  zp = buf.depth[p];
+
+    const auto  k2 = DENOISE_K_COLOR * DENOISE_K_COLOR;
+    const auto  inv_normal = 1.0f / ( DENOISE_SIGMA_NORMAL * DENOISE_SIGMA_NORMAL );
+    const auto  inv_albedo = 1.0f / ( DENOISE_SIGMA_ALBEDO * DENOISE_SIGMA_ALBEDO );
+    const auto  inv_depth = 1.0f / ( DENOISE_SIGMA_DEPTH * DENOISE_SIGMA_DEPTH * zp * zp + 1e-4f );
+
+    float sum_w = 0.0f , sum_c[3] = { 0.0f , 0.0f , 0.0f };
+
+#ifdef SSE_ENABLED
+    if( simd ){
+        const __m128 gp4[3] = { _mm_set_ps1( gp[0] ) , _mm_set_ps1( gp[1] ) , _mm_set_ps1( gp[2] ) };
+        const __m128 ap4[3] = { _mm_set_ps1( ap[0] ) , _mm_set_ps1( ap[1] ) , _mm_set_ps1( ap[2] ) };
+        const __m128 np4[3] = { _mm_set_ps1( np[0] ) , _mm_set_ps1( np[1] ) , _mm_set_ps1( np[2] ) };
+        const auto   vp4 = _mm_set_ps1( vp );
+        const auto   zp4 = _mm_set_ps1( zp );
+        const auto   third4 = _mm_set_ps1( 1.0f / 3.0f );
+        const auto   k24 = _mm_set_ps1( k2 );
+        const auto   eps4 = _mm_set_ps1( 1e-4f );
+        const auto   inv_normal4 = _mm_set_ps1( inv_normal );
+        const auto   inv_albedo4 = _mm_set_ps1( inv_albedo );
+        const auto   inv_depth4 = _mm_set_ps1( inv_depth );
+
+        auto sum_w4 = _mm_setzero_ps();
+        __m128 sum_c4[3] = { _mm_setzero_ps() , _mm_setzero_ps() , _mm_setzero_ps() };
+        for( auto dy = -DENOISE_RADIUS ; dy <= DENOISE_RADIUS ; ++dy ){
+            const auto row = p + dy * buf.stride - DENOISE_RADIUS;
+            const auto spatial_row = spatial.w[dy + DENOISE_RADIUS];
+            for( auto c = 0 ; c < DENOISE_CHUNK_CNT ; ++c ){
+                const auto q = row + 4 * c;
+
+                // color distance, the variance of both pixels is subtracted so that noise alone doesn't count.
+                auto dc = _mm_setzero_ps();
+                for( auto ch = 0 ; ch < 3 ; ++ch ){
+                    const auto diff = _mm_sub_ps( _mm_loadu_ps( &buf.guide[ch][q] ) , gp4[ch] );
+                    dc = _mm_add_ps( dc , _mm_mul_ps( diff , diff ) );
+                }
+                const auto vq4 = _mm_loadu_ps( &buf.variance[q] );
+                dc = _mm_sub_ps( _mm_mul_ps( dc , third4 ) , _mm_add_ps( vp4 , _mm_min_ps( vp4 , vq4 ) ) );
+                dc = _mm_div_ps( _mm_max_ps( dc , _mm_setzero_ps() ) , _mm_add_ps( eps4 , _mm_mul_ps( k24 , _mm_add_ps( vp4 , vq4 ) ) ) );
+
+                auto dn = _mm_setzero_ps() , da = _mm_setzero_ps();
+                for( auto ch = 0 ; ch < 3 ; ++ch ){
+                    const auto ndiff = _mm_sub_ps( _mm_loadu_ps( &buf.normal[ch][q] ) , np4[ch] );
+                    dn = _mm_add_ps( dn , _mm_mul_ps( ndiff , ndiff ) );
+                    const auto adiff = _mm_sub_ps( _mm_loadu_ps( &buf.albedo[ch][q] ) , ap4[ch] );
+                    da = _mm_add_ps( da , _mm_mul_ps( adiff , adiff ) );
+                }
+                const auto zdiff = _mm_sub_ps( _mm_loadu_ps( &buf.depth[q] ) , zp4 );
+
+                auto d = _mm_add_ps( dc , _mm_mul_ps( dn , inv_normal4 ) );
+                d = _mm_add_ps( d , _mm_mul_ps( da , inv_albedo4 ) );
+                d = _mm_add_ps( d , _mm_mul_ps( _mm_mul_ps( zdiff , zdiff ) , inv_depth4 ) );
+
+                auto w = fast_exp( _mm_sub_ps( _mm_setzero_ps() , d ) );
+                w = _mm_mul_ps( w , _mm_load_ps( spatial_row + 4 * c ) );
+                w = _mm_mul_ps( w , _mm_loadu_ps( &buf.valid[q] ) );
+
+                sum_w4 = _mm_add_ps( sum_w4 , w );
+                for( auto ch = 0 ; ch < 3 ; ++ch )
+                    sum_c4[ch] = _mm_add_ps( sum_c4[ch] , _mm_mul_ps( w , _mm_loadu_ps( &buf.demod[ch][q] ) ) );
+            }
+        }
+
+        sum_w = horizontal_sum( sum_w4 );
+        for( auto ch = 0 ; ch < 3 ; ++ch )
+            sum_c[ch] = horizontal_sum( sum_c4[ch] );
+    }else
+#endif
+    {
+        for( auto dy = -DENOISE_RADIUS ; dy <= DENOISE_RADIUS ; ++dy ){
+            for( auto dx = -DENOISE_RADIUS ; dx <= DENOISE_RADIUS ; ++dx ){
+                const auto q = p + dy * buf.stride + dx;
+
+                auto dc = 0.0f , dn = 0.0f , da = 0.0f;
+                for( auto ch = 0 ; ch < 3 ; ++ch ){
+                    dc += ( buf.guide[ch][q] - gp[ch] ) * ( buf.guide[ch][q] - gp[ch] );
+                    dn += ( buf.normal[ch][q] - np[ch] ) * ( buf.normal[ch][q] - np[ch] );
+                    da += ( buf.albedo[ch][q] - ap[ch] ) * ( buf.albedo[ch][q] - ap[ch] );
+                }
+                const auto vq = buf.variance[q];
+                dc = std::max( 0.0f , dc / 3.0f - ( vp + std::min( vp , vq ) ) ) / ( 1e-4f + k2 * ( vp + vq ) );
+                const auto zdiff = buf.depth[q] - zp;
+
+                const auto d = dc + dn * inv_normal + da * inv_albedo + zdiff * zdiff * inv_depth;
+                const auto w = std::exp( -d ) * spatial.w[dy + DENOISE_RADIUS][dx + DENOISE_RADIUS] * buf.valid[q];
+
+                sum_w += w;
+                for( auto ch = 0 ; ch < 3 ; ++ch )
+                    sum_c[ch] += w * buf.demod[ch][q];
+            }
+        }
+    }
+
+    // the pixel itself always has a positive weight, the sum can't be zero.
+    const auto inv_w = 1.0f / sum_w;
+    Spectrum ret;
+    for( auto ch = 0 ; ch < 3 ; ++ch )
+        ret[ch] = sum_c[ch] * inv_w * std::max( ap[ch] , DENOISE_MIN_ALBEDO );
+    return ret;
+}
+
+void DenoiseImage( int width , int height , const Spectrum* color , const PixelFeatures* features , Spectrum* output , unsigned thread_cnt , bool simd ){
+    if( width <= 0 || height <= 0 )
+        return;
+
+    DenoiseBuffers buf;
+    buf.stride = width + 2 * DENOISE_PADDING;
+    const auto size = (size_t)buf.stride * ( height + 2 * DENOISE_PADDING );
+    buf.valid.assign( size , 0.0f );
+    buf.variance.assign( size , 0.0f );
+    buf.depth.assign( size , 0.0f );
+    for( auto ch = 0 ; ch < 3 ; ++ch ){
+        buf.guide[ch].assign( size , 0.0f );
+        buf.demod[ch].assign( size , 0.0f );
+        buf.albedo[ch].assign( size , 0.0f );
+        buf.normal[ch].assign( size , 0.0f );
+    }
+
+    // average features over samples and estimate the variance of each pixel.
+    std::vector<float> pixel_variance( (size_t)width * height );
+    for( auto y = 0 ; y < height ; ++y ){
+        for( auto x = 0 ; x < width ; ++x ){
+            const auto  id = y * width + x;
+            const auto  i = buf.Index( x , y );
+            const auto& f = features[id];
+            const auto  inv_cnt = f.sample_cnt ? 1.0f / (float)f.sample_cnt : 0.0f;
+
+            buf.valid[i] = 1.0f;
+            buf.depth[i] = f.depth * inv_cnt;
+            for( auto ch = 0 ; ch < 3 ; ++ch ){
+                const auto albedo = f.sample_cnt ? f.albedo[ch] * inv_cnt : 1.0f;
+                buf.albedo[ch][i] = albedo;
+                buf.normal[ch][i] = f.normal[ch] * inv_cnt;
+                buf.demod[ch][i] = color[id][ch] / std::max( albedo , DENOISE_MIN_ALBEDO );
+            }
+
+            // variance of the mean is unknown with a single sample, the pixel is assumed to be very noisy then.
+            const auto mean = f.luminance * inv_cnt;
+            pixel_variance[id] = f.sample_cnt > 1 ? std::max( 0.0f , f.luminance_sqr * inv_cnt - mean * mean ) / (float)( f.sample_cnt - 1 ) : mean * mean;
+        }
+    }
+
+    // the guide color is averaged over 3x3 pixels, which makes color weights robust to noise like patches in non-local means.
+    for( auto y = 0 ; y < height ; ++y ){
+        for( auto x = 0 ; x < width ; ++x ){
+            float guide[3] = { 0.0f , 0.0f , 0.0f };
+            auto variance = 0.0f;
+            auto cnt = 0;
+            for( auto dy = std::max( 0 , y - 1 ) ; dy <= std::min( height - 1 , y + 1 ) ; ++dy ){
+                for( auto dx = std::max( 0 , x - 1 ) ; dx <= std::min( width - 1 , x + 1 ) ; ++dx ){
+                    const auto id = dy * width + dx;
+                    for( auto ch = 0 ; ch < 3 ; ++ch )
+                        guide[ch] += color[id][ch];
+                    variance += pixel_variance[id];
+                    ++cnt;
+                }
+            }
+
+            const auto i = buf.Index( x , y );
+            for( auto ch = 0 ; ch < 3 ; ++ch )
+                buf.guide[ch][i] = guide[ch] / cnt;
+            buf.variance[i] = variance / ( cnt * cnt );
+        }
+    }
+
+    SpatialWeights spatial;
+    for( auto dy = -DENOISE_RADIUS ; dy <= DENOISE_RADIUS ; ++dy ){
+        for( auto k = 0 ; k < DENOISE_CHUNK_CNT * 4 ; ++k ){
+            const auto dx = k - DENOISE_RADIUS;
+            spatial.w[dy + DENOISE_RADIUS][k] = dx <= DENOISE_RADIUS ?
+                std::exp( -(float)( dx * dx + dy * dy ) / ( 2.0f * DENOISE_SIGMA_SPATIAL * DENOISE_SIGMA_SPATIAL ) ) : 0.0f;
+        }
+    }
+
+    // tiles are picked by threads one after another until all of them are filtered.
+    const auto tile_x = ( width + DENOISE_TILE_SIZE - 1 ) / DENOISE_TILE_SIZE;
+    const auto tile_y = ( height + DENOISE_TILE_SIZE - 1 ) / DENOISE_TILE_SIZE;
+    const auto tile_cnt = tile_x * tile_y;
+    std::atomic<int> next_tile( 0 );
+    const auto worker = [&](){
+        for( auto tile = next_tile++ ; tile < tile_cnt ; tile = next_tile++ ){
+            const auto x0 = ( tile % tile_x ) * DENOISE_TILE_SIZE;
+            const auto y0 = ( tile / tile_x ) * DENOISE_TILE_SIZE;
+            const auto x1 = std::min( width , x0 + DENOISE_TILE_SIZE );
+            const auto y1 = std::min( height , y0 + DENOISE_TILE_SIZE );
+            for( auto y = y0 ; y < y1 ; ++y )
+                for( auto x = x0 ; x < x1 ; ++x )
+                    output[y * width + x] = filterPixel( buf , spatial , x , y , simd );
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for( auto i = 1u ; i < std::min( thread_cnt , (unsigned)tile_cnt ) ; ++i )
+        threads.push_back( std::thread( worker ) );
+    worker();
+    for( auto& thread : threads )
+        thread.join();
+}
@@ -0,0 +1,62 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "spectrum/spectrum.h"
+#include "math/vector3.h"
+
+//! @brief  Auxiliary features of a pixel for denoising, all of them are sums over the samples taken in the pixel.
+struct PixelFeatures{
+    Spectrum    albedo;                 /**< Albedo at the first hit. */
+    Vector      normal;                 /**< Shading normal at the first hit, zero if the camera ray hits nothing. */
+    float       depth = 0.0f;           /**< Distance to the first hit, zero if the camera ray hits nothing. */
+    float       luminance = 0.0f;       /**< Intensity of radiance. */
+    float       luminance_sqr = 0.0f;   /**< Squared intensity of radiance. */
+    unsigned    sample_cnt = 0;         /**< Number of samples. */
+
+    //! @brief  Accumulate features of other samples.
+    SORT_FORCEINLINE PixelFeatures& operator += ( const PixelFeatures& features ){
+        albedo += features.albedo;
+        normal += features.normal;
+        depth += features.depth;
+        luminance += features.luminance;
+        luminance_sqr += features.luminance_sqr;
+        sample_cnt += features.sample_cnt;
+        return *this;
+    }
+};
+
+//! @brief  Denoise an image with a cross bilateral filter guided by auxiliary features.
+/**
+ * The weight of each neighbor is driven by the difference in color, normalized by the variance of both pixels like
+ * non-local means filtering, and differences of albedo, normal and depth, which preserve texture and geometric details
+ * that noisy color can't tell. Color is divided by albedo before filtering so that textures are not blurred, it is
+ * multiplied back afterward.
+ *
+ * Pixels are filtered in tiles on multiple threads, neighbors of a pixel are evaluated with SIMD instructions if they are
+ * available.
+ *
+ * @param   width       Width of the image.
+ * @param   height      Height of the image.
+ * @param   color       Color of each pixel, averaged over all samples.
+ * @param   features    Auxiliary features of each pixel.
+ * @param   output      Denoised color of each pixel, it can't be the same as the input color.
+ * @param   thread_cnt  Number of threads filtering the image.
+ * @param   simd        Whether to use SIMD instructions, the scalar version is the reference implementation.
+ */
+void DenoiseImage( int width , int height , const Spectrum* color , const PixelFeatures* features , Spectrum* output , unsigned thread_cnt , bool simd = true );
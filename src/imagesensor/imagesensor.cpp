@@ -0,0 +1,135 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <thread>
+#include <algorithm>
+#include "imagesensor.h"
+#include "core/globalconfig.h"
+#include "core/profile.h"
+#include "integrator/integrator.h"
+
+void SplatBuffer::Initialize( int w , int h ){
+    m_tileNumX = ( w + SPLAT_TILE_MASK ) >> SPLAT_TILE_SHIFT;
+    const auto tile_num_y = ( h + SPLAT_TILE_MASK ) >> SPLAT_TILE_SHIFT;
+    m_tiles.clear();
+    m_tiles.resize( m_tileNumX * tile_num_y );
+}
+
+ImageSensor::ImageSensor( int w , int h ) : m_width(w) , m_height(h) , m_rendertarget( w , h ) {
+    // thread ids range from zero, which is the main thread, to the number of threads minus one.
+    m_splatBuffers.resize( std::max( 1u , g_threadCnt ) );
+    for( auto& buffer : m_splatBuffers )
+        buffer.Initialize( w , h );
+
+    if( g_denoise )
+        m_features = std::make_unique<PixelFeatures[]>( w * h );
+}
+
+void ImageSensor::PostProcess(){
+    if( !m_features )
+        return;
+
+    SORT_PROFILE("Denoising");
+
+    const auto pixel_cnt = m_width * m_height;
+    auto color = std::make_unique<Spectrum[]>( pixel_cnt );
+    auto denoised = std::make_unique<Spectrum[]>( pixel_cnt );
+    for( auto y = 0 ; y < m_height ; ++y )
+        for( auto x = 0 ; x < m_width ; ++x )
+            color[ y * m_width + x ] = m_rendertarget.GetColor( x , y );
+
+    DenoiseImage( m_width , m_height , color.get() , m_features.get() , denoised.get() , std::max( 1u , g_threadCnt ) );
+
+    for( auto y = 0 ; y < m_height ; ++y )
+        for( auto x = 0 ; x < m_width ; ++x )
+            m_rendertarget.SetColor( x , y , denoised[ y * m_width + x ] );
+}
+
+void ImageSensor::MergeSplats(){
+    SORT_PROFILE("Merging splat buffers");
+
+    const auto tile_cnt = m_splatBuffers[0].GetTileCount();
+    const auto tile_num_x = m_splatBuffers[0].GetTileNumX();
+
+    // each tile of the image is merged by only one thread, there is no contention at all.
+    const auto merge = [&]( int first , int step ){
+        for( auto tile = first ; tile < tile_cnt ; tile += step ){
+            const auto tl_x = ( tile % tile_num_x ) << SPLAT_TILE_SHIFT;
+            const auto tl_y = ( tile / tile_num_x ) << SPLAT_TILE_SHIFT;
+            const auto w = std::min( SPLAT_TILE_SIZE , m_width - tl_x );
+            const auto h = std::min( SPLAT_TILE_SIZE , m_height - tl_y );
+
+            for( auto& buffer : m_splatBuffers ){
+                const auto data = buffer.TakeTile( tile );
+                if( !data )
+                    continue;
+
+                for( auto y = 0 ; y < h ; ++y ){
+                    for( auto x = 0 ; x < w ; ++x ){
+                        const auto& color = data[ ( y << SPLAT_TILE_SHIFT ) + x ];
+                        if( color.IsBlack() )
+                            continue;
+                        m_rendertarget.SetColor( tl_x + x , tl_y + y , m_rendertarget.GetColor( tl_x + x , tl_y + y ) + color );
+                    }
+                }
+            }
+        }
+    };
+
+    const auto thread_cnt = std::max( 1 , std::min( (int)g_threadCnt , tile_cnt ) );
+    std::vector<std::thread> threads;
+    for( auto i = 1 ; i < thread_cnt ; ++i )
+        threads.push_back( std::thread( merge , i , thread_cnt ) );
+    merge( 0 , thread_cnt );
+    for( auto& thread : threads )
+        thread.join();
+}
+
+void ImageSensor::EnableAOVs( Integrator* integrator ){
+    m_aovLayout.RegisterBuiltin();
+    if( integrator )
+        integrator->RegisterAOVs( m_aovLayout );
+
+    m_aovs = std::make_unique<float[]>( m_width * m_height * m_aovLayout.GetChannelCount() );
+}
+
+void ImageSensor::StoreAOVs( const Vector2i& top_left , const Vector2i& size , const float* aovs ){
+    if( !m_aovs )
+        return;
+
+    const auto channel_cnt = m_aovLayout.GetChannelCount();
+    for( auto y = 0 ; y < size.y ; ++y ){
+        const auto src = aovs + y * size.x * channel_cnt;
+        const auto dst = m_aovs.get() + ( ( top_left.y + y ) * m_width + top_left.x ) * channel_cnt;
+        for( auto i = 0u ; i < size.x * channel_cnt ; ++i )
+            dst[i] += src[i];
+    }
+}
+
+bool ImageSensor::OutputAOVs( const std::string& filename ) const{
+    if( !m_aovs )
+        return false;
+
+    SORT_PROFILE("Saving AOVs");
+
+    auto color = std::make_unique<Spectrum[]>( m_width * m_height );
+    for( auto y = 0 ; y < m_height ; ++y )
+        for( auto x = 0 ; x < m_width ; ++x )
+            color[ y * m_width + x ] = m_rendertarget.GetColor( x , y );
+
+    return SaveMultiLayerEXR( filename , m_width , m_height , color.get() , m_aovLayout , m_aovs.get() );
+}
@@ -17,18 +17,75 @@
 
 #pragma once
 
+#include <vector>
+#include <memory>
 #include "spectrum/spectrum.h"
 #include "texture/rendertarget.h"
 #include "task/render_task.h"
 #include "core/thread.h"
-#include <mutex>
+#include "denoiser.h"
+#include "aov.h"
+
+class Integrator;
+
+// splat buffers are split into tiles of 32x32 pixels
+#define SPLAT_TILE_SHIFT    5
+#define SPLAT_TILE_SIZE     ( 1 << SPLAT_TILE_SHIFT )
+#define SPLAT_TILE_MASK     ( SPLAT_TILE_SIZE - 1 )
+
+//! @brief  Buffer accumulating radiance splatted to arbitrary pixels by a single thread.
+/**
+ * Light tracing and camera connections in bi-directional path tracing could splat radiance to any pixel. Each thread
+ * owns its buffer so that splatting doesn't need any lock. Tiles of the buffer are only allocated once they are touched,
+ * a thread splatting to a small part of the image doesn't hold memory of the whole image.
+ */
+class SplatBuffer{
+public:
+    //! @brief  Initialize the buffer, no tile is allocated.
+    //!
+    //! @param  w       Width of the image.
+    //! @param  h       Height of the image.
+    void    Initialize( int w , int h );
+
+    //! @brief  Accumulate radiance to a pixel.
+    //!
+    //! @param  x       Horizontal coordinate of the pixel.
+    //! @param  y       Vertical coordinate of the pixel.
+    //! @param  color   Radiance to be accumulated.
+    SORT_FORCEINLINE void Add( int x , int y , const Spectrum& color ){
+        auto& tile = m_tiles[ ( y >> SPLAT_TILE_SHIFT ) * m_tileNumX + ( x >> SPLAT_TILE_SHIFT ) ];
+        if( !tile )
+            tile = std::make_unique<Spectrum[]>( SPLAT_TILE_SIZE * SPLAT_TILE_SIZE );
+        tile[ ( ( y & SPLAT_TILE_MASK ) << SPLAT_TILE_SHIFT ) + ( x & SPLAT_TILE_MASK ) ] += color;
+    }
+
+    //! @brief  Take a tile out of the buffer, the tile is empty in the buffer afterward.
+    //!
+    //! @param  index   Index of the tile.
+    //! @return         Radiance in the tile, nullptr if nothing is splatted in it.
+    std::unique_ptr<Spectrum[]> TakeTile( int index ){
+        return std::move( m_tiles[index] );
+    }
+
+    //! @brief  Number of tiles in a row.
+    SORT_FORCEINLINE int GetTileNumX() const {
+        return m_tileNumX;
+    }
+
+    //! @brief  Total number of tiles.
+    SORT_FORCEINLINE int GetTileCount() const {
+        return (int)m_tiles.size();
+    }
+
+private:
+    int                                         m_tileNumX = 0;     /**< Number of tiles in a row. */
+    std::vector<std::unique_ptr<Spectrum[]>>    m_tiles;            /**< Tiles of the buffer, null for untouched tiles. */
+};
 
 // generate output
 class ImageSensor{
 public:
-    ImageSensor( int w , int h ) : m_width(w) , m_height(h) , m_rendertarget( w , h ) {
-        m_mutex = std::make_unique<spinlock_mutex[]>( m_width * m_height );
-    }
+    ImageSensor( int w , int h );
     virtual ~ImageSensor(){}
 
     // pre process
@@ -38,6 +95,7 @@ public:
     virtual void FinishTile( int tile_x , int tile_y , const Render_Task& rt ){}
 
     // store pixel information
+    // each pixel is only touched by the task rendering its tile, there is no need for locks.
     virtual void StorePixel( int x , int y , const Spectrum& color , const Render_Task& rt ) = 0;
 
     // get width
@@ -50,22 +108,54 @@ public:
         return m_height;
     }
 
-    // post process
-    virtual void PostProcess(){}
+    // post process, the image is denoised here if needed
+    virtual void PostProcess();
+
+    // store auxiliary features of a pixel, they are only kept when denoising is enabled
+    // similar to 'StorePixel', each pixel is only touched by the task rendering its tile.
+    SORT_FORCEINLINE void StoreFeatures( int x , int y , const PixelFeatures& features ){
+        if( m_features )
+            m_features[ y * m_width + x ] += features;
+    }
 
-    // add radiance
+    // add radiance, it goes to the splat buffer of the current thread until merged
     virtual void UpdatePixel(int x, int y, const Spectrum& color){
-        std::lock_guard<spinlock_mutex> lock(m_mutex[y * m_width + x]);
-        Spectrum _color = m_rendertarget.GetColor(x, y);
-        m_rendertarget.SetColor(x, y, _color + color);
+        m_splatBuffers[ThreadId()].Add( x , y , color );
     }
 
+    // merge all splat buffers into the render target in parallel, this needs to happen when no thread is splatting
+    void MergeSplats();
+
+    // start collecting AOVs, the built-in ones are registered first, followed by the ones produced by the integrator
+    void EnableAOVs( Integrator* integrator );
+
+    // get the layout of AOVs of a pixel, it is empty if AOVs are not collected
+    SORT_FORCEINLINE const AOV_Layout& GetAOVLayout() const {
+        return m_aovLayout;
+    }
+
+    // store AOVs of a tile, they are sums over all samples taken by the tile
+    // similar to 'StorePixel', each pixel is only touched by the task rendering its tile.
+    void StoreAOVs( const Vector2i& top_left , const Vector2i& size , const float* aovs );
+
+    // save the image along with all AOVs in a multi-layer EXR file, nothing is saved if AOVs are not collected
+    bool OutputAOVs( const std::string& filename ) const;
+
 protected:
     const int m_width;
     const int m_height;
 
-    // the mutex
-    std::unique_ptr<spinlock_mutex[]>   m_mutex;
+    // splat buffer of each thread
+    std::vector<SplatBuffer>    m_splatBuffers;
+
+    // auxiliary features of each pixel for denoising, null if denoising is disabled
+    std::unique_ptr<PixelFeatures[]>    m_features;
+
+    // layout of AOVs of a pixel
+    AOV_Layout                  m_aovLayout;
+
+    // AOVs of each pixel, null if AOVs are not collected
+    std::unique_ptr<float[]>    m_aovs;
 
     // the render target
     RenderTarget m_rendertarget;
@@ -20,12 +20,17 @@
 #include "core/path.h"
 
 void RenderTargetImage::StorePixel( int x , int y , const Spectrum& color , const Render_Task& rt ){
-    std::lock_guard<spinlock_mutex> lock(m_mutex[y*m_width + x]);
     Spectrum _color = m_rendertarget.GetColor(x, y);
     m_rendertarget.SetColor(x, y, color + _color);
 }
 
 void RenderTargetImage::PostProcess(){
     ImageSensor::PostProcess();
-    m_rendertarget.Output(GetFilePathInExeFolder(g_outputFileName));
+
+    // AOVs are saved as extra layers of the same file.
+    const auto filename = GetFilePathInExeFolder(g_outputFileName);
+    if( m_aovs )
+        OutputAOVs(filename);
+    else
+        m_rendertarget.Output(filename);
 }
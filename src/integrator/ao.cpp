@@ -42,6 +42,9 @@ Spectrum AmbientOcclusion::Li( const Ray& r , const PixelSample& ps , const Scen
     if( false == scene.GetIntersect( r , ip ) )
         return 0.0f;
 
+    // there is no material in ambient occlusion, the albedo of the first hit is left white.
+    RecordFirstHit( 1.0f , ip.normal , ip.t );
+
     Vector nn = faceForward( ip.normal , r.m_Dir ) ? -ip.normal : ip.normal;
     Vector tn = normalize(cross( nn , ip.tangent ));
     Vector sn = normalize(cross( tn , nn ));
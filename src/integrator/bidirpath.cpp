@@ -37,113 +37,48 @@ IMPLEMENT_RTTI( BidirPathTracing );
 Spectrum BidirPathTracing::Li( const Ray& ray , const PixelSample& ps , const Scene& scene ) const{
     SORT_STATS(++sPrimaryRayCount);
 
-    // pick a light randomly
-    float pdf;
-    const auto light = scene.SampleLight( sort_canonical() , &pdf );
-    if( light == 0 || pdf == 0.0f )
-        return 0.0f;
-
-    Spectrum li;
-
-    auto    light_emission_pdf = 0.0f;
-    auto    light_pdfa = 0.0f;
-    Ray     light_ray;
-    auto    cosAtLight = 1.0f;
-    LightSample light_sample(true);
-    const auto le = light->sample_l( light_sample , light_ray , &light_emission_pdf , &light_pdfa , &cosAtLight );
-
     //-----------------------------------------------------------------------------------------------------
     // Trace light path from light source
-    std::vector<BDPT_Vertex> light_path;
-    auto    wi = light_ray;
-    double  vc = (light->IsDelta())?0.0f: MIS(cosAtLight / light_emission_pdf);
-    double  vcm = MIS(light_pdfa / light_emission_pdf);
-    auto    throughput = le * cosAtLight / (light_emission_pdf * pdf);
-    auto    rr = 1.0f;
-    while ((int)light_path.size() < max_recursive_depth){
-        SORT_STATS(++sTotalLengthPathFromLight);
-
-        BDPT_Vertex vert;
-        if (!scene.GetIntersect(wi, vert.inter))
-            break;
-
-        const auto distSqr = vert.inter.t * vert.inter.t;
-        const auto cosIn = absDot( wi.m_Dir , vert.inter.normal );
-        if( light_path.size() > 0 || ( light_path.size() == 0 && !light->IsInfinite() ) )
-            vcm *= MIS( distSqr );
-        vcm /= MIS( cosIn );
-        vc /= MIS( cosIn );
-
-        rr = 1.0f;
-        if (throughput.GetIntensity() < 0.01f)
-            rr = 0.5f;
-
-        vert.p = vert.inter.intersect;
-        vert.n = vert.inter.normal;
-        vert.wi = -wi.m_Dir;
-
-        vert.se = SORT_MALLOC(ScatteringEvent)(vert.inter, SE_EVALUATE_ALL_NO_SSS);
-        vert.inter.primitive->GetMaterial()->UpdateScatteringEvent(*vert.se);
-
-        vert.throughput = throughput;
-        vert.vcm = vcm;
-        vert.vc = vc;
-        vert.rr = rr;
-        vert.depth = (unsigned)(light_path.size() + 1);
-
-        light_path.push_back(vert);
-
-        //-----------------------------------------------------------------------------------------------------
-        // Path evaluation: light tracing
-        _ConnectCamera( vert , (unsigned)light_path.size() , light , scene );
-
-        // russian roulette
-        if (sort_canonical() > rr)
-            break;
-
-        float bsdf_pdf;
-        const auto bsdf_value = vert.se->Sample_BSDF( vert.wi , vert.wo , BsdfSample(true) , bsdf_pdf );
-        bsdf_pdf *= rr;
-
-        if( 0.0f == bsdf_pdf )
-            break;
-
-        const auto cosOut = absDot(vert.wo, vert.n);
-        throughput *= bsdf_value / bsdf_pdf;
-
-        if (throughput.IsBlack())
-            break;
+    const Light*    light = nullptr;
+    float           pdf = 0.0f;
+    auto            light_path = _AllocatePath();
+    auto            lps = 0u;
+    if( !_TraceLightPath( scene , light_path , lps , light , pdf , true ) )
+        return 0.0f;
 
-        const auto rev_bsdf_pdfw = vert.se->Pdf_BSDF( vert.wo , vert.wi ) * rr;
-        vc = MIS(cosOut/bsdf_pdf) * ( MIS(rev_bsdf_pdfw) * vc + vcm ) ;
-        vcm = MIS(1.0f/bsdf_pdf);
+    // shadow rays of all connections at an eye vertex are traced together
+    static thread_local ShadowRayBatch batch;
 
-        wi = Ray(vert.inter.intersect, vert.wo, 0, 0.001f);
-    }
+    Spectrum li;
 
     //-----------------------------------------------------------------------------------------------------
     // Trace light path from eye point
-    const auto lps = (const unsigned)light_path.size();
     const auto total_pixel = g_resultResollutionWidth * g_resultResollutionHeight;
-    wi = ray;
-    throughput = 1.0f;
+    auto    wi = ray;
+    Spectrum throughput = 1.0f;
     auto light_path_len = 0;
-    vc = 0.0f;
-    vcm = MIS(total_pixel / ray.m_fPdfW);
-    rr = 1.0f;
+    double  vc = 0.0f;
+    double  vcm = MIS(total_pixel / ray.m_fPdfW);
+    double  vm = 0.0f;
+    auto    rr = 1.0f;
+    Point   prev_p;
+    Vector  prev_n;
     while (light_path_len <= (int)max_recursive_depth){
         SORT_STATS(++sTotalLengthPathFromEye);
 
         BDPT_Vertex vert;
         vert.depth = light_path_len;
-        if (!scene.GetIntersect(wi, vert.inter)){
+        auto inter = SORT_MALLOC(SurfaceInteraction)();
+        vert.inter = inter;
+        if (!scene.GetIntersect(wi, *inter)){
             // the following code needs to be modified
             if (scene.GetSkyLight() == light){
                 if( vert.depth <= max_recursive_depth && vert.depth > 0 ){
                     float emissionPdf;
                     float directPdfA;
-                    Spectrum _li = light->Le( vert.inter, -wi.m_Dir , &directPdfA , &emissionPdf ) * throughput / light->PickPDF();
-                    const auto weight = (float)(1.0f / (1.0f + MIS(directPdfA) * vcm + MIS(emissionPdf) * vc));
+                    Spectrum _li = light->Le( *inter, -wi.m_Dir , &directPdfA , &emissionPdf ) * throughput / pdf;
+                    const auto pick_ratio = scene.LightProbability( prev_p , prev_n , light ) / pdf;
+                    const auto weight = (float)(1.0f / (1.0f + MIS(directPdfA * pick_ratio) * vcm + MIS(emissionPdf) * vc));
                     li += _li * weight;
                 }
             }
@@ -154,23 +89,25 @@ Spectrum BidirPathTracing::Li( const Ray& ray , const PixelSample& ps , const Sc
             break;
         }
 
-        const auto distSqr = vert.inter.t * vert.inter.t;
-        const auto cosIn = absDot( wi.m_Dir , vert.inter.normal );
+        const auto distSqr = inter->t * inter->t;
+        const auto cosIn = absDot( wi.m_Dir , inter->normal );
         vcm *= MIS( distSqr );
         vcm /= MIS( cosIn );
         vc /= MIS( cosIn );
+        vm /= MIS( cosIn );
 
         //-----------------------------------------------------------------------------------------------------
         // Path evaluation: it hits a light source
-        if (vert.inter.primitive->GetLight() == light){
+        if (inter->primitive->GetLight() == light){
             if( vert.depth > 0 && vert.depth <= max_recursive_depth ){
                 float emissionPdf;
                 float directPdfA;
-                Spectrum _li = vert.inter.Le(-wi.m_Dir , &directPdfA , &emissionPdf ) * throughput / pdf;
-                li += _li / (float)( 1.0f + MIS( directPdfA ) * vcm + MIS( emissionPdf ) * vc );
+                Spectrum _li = inter->Le(-wi.m_Dir , &directPdfA , &emissionPdf ) * throughput / pdf;
+                const auto pick_ratio = scene.LightProbability( prev_p , prev_n , light ) / pdf;
+                li += _li / (float)( 1.0f + MIS( directPdfA * pick_ratio ) * vcm + MIS( emissionPdf ) * vc );
             }
             else if( vert.depth == 0 )
-                li += vert.inter.Le(-wi.m_Dir) / pdf;
+                li += inter->Le(-wi.m_Dir) / pdf;
         }
         if( light_tracing_only )
             return li;
@@ -179,26 +116,37 @@ Spectrum BidirPathTracing::Li( const Ray& ray , const PixelSample& ps , const Sc
         if (throughput.GetIntensity() < 0.01f )
             rr = 0.5f;
 
-        vert.p = vert.inter.intersect;
-        vert.n = vert.inter.normal;
+        vert.p = inter->intersect;
+        vert.n = inter->normal;
         vert.wi = -wi.m_Dir;
+        prev_p = vert.p;
+        prev_n = vert.n;
 
-        vert.se = SORT_MALLOC(ScatteringEvent)( vert.inter , SE_EVALUATE_ALL_NO_SSS );
-        vert.inter.primitive->GetMaterial()->UpdateScatteringEvent(*vert.se);
+        vert.se = SORT_MALLOC(ScatteringEvent)( *inter , SE_EVALUATE_ALL_NO_SSS );
+        inter->primitive->GetMaterial()->UpdateScatteringEvent(*vert.se);
+        if( vert.depth == 0 )
+            RecordFirstHit( *vert.se , wi , *inter );
 
         vert.throughput = throughput;
         vert.vc = vc;
         vert.vcm = vcm;
+        vert.vm = vm;
         vert.rr = rr;
 
         //-----------------------------------------------------------------------------------------------------
         // Path evaluation: connect light sample first
-        li += _ConnectLight(vert, light, scene) / pdf;
+        _ConnectLight( vert , scene , batch );
 
         //-----------------------------------------------------------------------------------------------------
         // Path evaluation: connect vertices
         for (unsigned j = 0; j < lps; ++j)
-            li += _ConnectVertices( light_path[j] , vert , light , scene );
+            _ConnectVertices( light_path[j] , vert , batch );
+
+        li += batch.Resolve( scene );
+
+        //-----------------------------------------------------------------------------------------------------
+        // Path evaluation: merge vertices
+        li += _MergeVertices( vert );
 
         ++light_path_len;
 
@@ -206,38 +154,135 @@ Spectrum BidirPathTracing::Li( const Ray& ray , const PixelSample& ps , const Sc
         if (sort_canonical() > rr)
             break;
 
-        float bsdf_pdf;
-        const auto bsdf_value = vert.se->Sample_BSDF( vert.wi , vert.wo , BsdfSample(true) , bsdf_pdf );
+        if( !_SampleScattering( vert , throughput , vc , vcm , vm ) )
+            break;
+
+        wi = Ray(vert.p, vert.wo, 0, 0.001f);
+    }
+
+    return li;
+}
+
+BDPT_Vertex* BidirPathTracing::_AllocatePath() const{
+    // placement new on the array only constructs the first vertex, each of them is constructed one by one instead.
+    auto path = GetStaticAllocator().Allocate<BDPT_Vertex>( max_recursive_depth );
+    for( auto i = 0 ; i < max_recursive_depth ; ++i )
+        new ( path + i ) BDPT_Vertex();
+    return path;
+}
+
+bool BidirPathTracing::_TraceLightPath( const Scene& scene , BDPT_Vertex* light_path , unsigned& light_path_len , const Light*& light , float& pdf , bool connect_camera ) const{
+    light_path_len = 0;
+
+    // pick a light randomly
+    light = scene.SampleLight( sort_canonical() , &pdf );
+    if( light == 0 || pdf == 0.0f )
+        return false;
+
+    auto    light_emission_pdf = 0.0f;
+    auto    light_pdfa = 0.0f;
+    Ray     light_ray;
+    auto    cosAtLight = 1.0f;
+    LightSample light_sample(true);
+    const auto le = light->sample_l( light_sample , light_ray , &light_emission_pdf , &light_pdfa , &cosAtLight );
+
+    auto    wi = light_ray;
+    double  vc = (light->IsDelta())?0.0f: MIS(cosAtLight / light_emission_pdf);
+    double  vcm = MIS(light_pdfa / light_emission_pdf);
+    double  vm = vc * m_misVcWeightFactor;
+    Spectrum throughput = le * cosAtLight / (light_emission_pdf * pdf);
+    while ((int)light_path_len < max_recursive_depth){
+        SORT_STATS(++sTotalLengthPathFromLight);
 
-        if( 0.0f == bsdf_pdf )
+        auto inter = SORT_MALLOC(SurfaceInteraction)();
+        if (!scene.GetIntersect(wi, *inter))
             break;
 
-        bsdf_pdf *= rr;
-        const auto cosOut = absDot(vert.wo, vert.n);
-        throughput *= bsdf_value / bsdf_pdf;
+        const auto distSqr = inter->t * inter->t;
+        const auto cosIn = absDot( wi.m_Dir , inter->normal );
+        if( light_path_len > 0 || !light->IsInfinite() )
+            vcm *= MIS( distSqr );
+        vcm /= MIS( cosIn );
+        vc /= MIS( cosIn );
+        vm /= MIS( cosIn );
+
+        // next event estimation picks lights based on their contribution to the shading point, instead of their power.
+        if( 0 == light_path_len )
+            vcm *= MIS( scene.LightProbability( inter->intersect , inter->normal , light ) / pdf );
+
+        auto rr = 1.0f;
+        if (throughput.GetIntensity() < 0.01f)
+            rr = 0.5f;
+
+        // the vertex is filled in place, there is no need to copy it
+        auto& vert = light_path[light_path_len++];
+        vert.p = inter->intersect;
+        vert.n = inter->normal;
+        vert.wi = -wi.m_Dir;
+        vert.inter = inter;
+
+        vert.se = SORT_MALLOC(ScatteringEvent)(*inter, SE_EVALUATE_ALL_NO_SSS);
+        inter->primitive->GetMaterial()->UpdateScatteringEvent(*vert.se);
+
+        vert.throughput = throughput;
+        vert.vcm = vcm;
+        vert.vc = vc;
+        vert.vm = vm;
+        vert.rr = rr;
+        vert.depth = (int)light_path_len;
+
+        //-----------------------------------------------------------------------------------------------------
+        // Path evaluation: light tracing
+        if( connect_camera )
+            _ConnectCamera( vert , (int)light_path_len , light , scene );
 
-        if (throughput.IsBlack())
+        // russian roulette
+        if (sort_canonical() > rr)
             break;
 
-        const auto rev_bsdf_pdfw = vert.se->Pdf_BSDF( vert.wo , vert.wi ) * rr;
-        vc = MIS( cosOut / bsdf_pdf ) * ( MIS( rev_bsdf_pdfw ) * vc + vcm );
-        vcm = MIS( 1.0f / bsdf_pdf );
+        if( !_SampleScattering( vert , throughput , vc , vcm , vm ) )
+            break;
 
-        wi = Ray(vert.inter.intersect, vert.wo, 0, 0.001f);
+        wi = Ray(vert.p, vert.wo, 0, 0.001f);
     }
 
-    return li;
+    return true;
 }
 
-void BidirPathTracing::RequestSample( Sampler* sampler , PixelSample* ps , unsigned ps_num ){
-    Integrator::RequestSample( sampler, ps , ps_num );
-    sample_per_pixel = ps_num;
+bool BidirPathTracing::_SampleScattering( BDPT_Vertex& vert , Spectrum& throughput , double& vc , double& vcm , double& vm ) const{
+    float bsdf_pdf;
+    const auto bsdf_value = vert.se->Sample_BSDF( vert.wi , vert.wo , BsdfSample(true) , bsdf_pdf );
+
+    if( 0.0f == bsdf_pdf )
+        return false;
+
+    bsdf_pdf *= vert.rr;
+    const auto cosOut = absDot(vert.wo, vert.n);
+    throughput *= bsdf_value / bsdf_pdf;
+
+    if (throughput.IsBlack())
+        return false;
+
+    const auto rev_bsdf_pdfw = vert.se->Pdf_BSDF( vert.wo , vert.wi ) * vert.rr;
+
+    // directions sampled from delta lobes can't be generated by any other technique, the pdfs in both directions cancel out.
+    if( 0.0f == rev_bsdf_pdfw && 0.0f == vert.se->Pdf_BSDF( vert.wi , vert.wo ) ){
+        vcm = 0.0f;
+        vc *= MIS( cosOut );
+        vm *= MIS( cosOut );
+        return true;
+    }
+
+    vm = MIS( cosOut / bsdf_pdf ) * ( MIS( rev_bsdf_pdfw ) * vm + vcm * m_misVcWeightFactor + 1.0f );
+    vc = MIS( cosOut / bsdf_pdf ) * ( MIS( rev_bsdf_pdfw ) * vc + vcm + m_misVmWeightFactor );
+    vcm = MIS( 1.0f / bsdf_pdf );
+    return true;
 }
 
 // connect vertices
-Spectrum BidirPathTracing::_ConnectVertices( const BDPT_Vertex& p0 , const BDPT_Vertex& p1 , const Light* light , const Scene& scene ) const{
+void BidirPathTracing::_ConnectVertices( const BDPT_Vertex& p0 , const BDPT_Vertex& p1 , ShadowRayBatch& batch ) const{
     if( p0.depth + p1.depth >= max_recursive_depth )
-        return 0.0f;
+        return;
 
     const auto delta = p0.p - p1.p;
     const auto invDistcSqr = 1.0f / delta.SquaredLength();
@@ -247,7 +292,7 @@ Spectrum BidirPathTracing::_ConnectVertices( const BDPT_Vertex& p0 , const BDPT_
     const auto cosAtP1 = absDot( p1.n , n_delta );
     const Spectrum g = p1.se->Evaluate_BSDF( p1.wi , n_delta ) * p0.se->Evaluate_BSDF( p0.wi , -n_delta ) * invDistcSqr;
     if( g.IsBlack() )
-        return 0.0f;
+        return;
 
     const auto p0_bsdf_pdfw     = p0.se->Pdf_BSDF( p0.wi , -n_delta ) * p0.rr;
     const auto p0_bsdf_rev_pdfw = p0.se->Pdf_BSDF( -n_delta , p0.wi ) * p0.rr;
@@ -257,31 +302,28 @@ Spectrum BidirPathTracing::_ConnectVertices( const BDPT_Vertex& p0 , const BDPT_
     const auto p0_a = p1_bsdf_pdfw * cosAtP0 * invDistcSqr;
     const auto p1_a = p0_bsdf_pdfw * cosAtP1 * invDistcSqr;
 
-    const double mis_0 = MIS( p0_a ) * ( p0.vcm + p0.vc * MIS( p0_bsdf_rev_pdfw ) );
-    const double mis_1 = MIS( p1_a ) * ( p1.vcm + p1.vc * MIS( p1_bsdf_rev_pdfw ) );
+    const double mis_0 = MIS( p0_a ) * ( m_misVmWeightFactor + p0.vcm + p0.vc * MIS( p0_bsdf_rev_pdfw ) );
+    const double mis_1 = MIS( p1_a ) * ( m_misVmWeightFactor + p1.vcm + p1.vc * MIS( p1_bsdf_rev_pdfw ) );
 
     const auto weight = (float)(1.0f / (mis_0 + 1.0f + mis_1));
 
     const auto li = p0.throughput * p1.throughput * g * weight;
     if( li.IsBlack() )
-        return li;
+        return;
 
-    Visibility visibility( scene );
-    visibility.ray = Ray( p1.p , n_delta  , 0 , 0.001f , delta.Length() - 0.001f );
-#ifndef ENABLE_TRANSPARENT_SHADOW
-    if( visibility.IsVisible() == false )
-        return 0.0f;
-    return li;
-#else
-    const auto attenuation = visibility.GetAttenuation();
-    return attenuation.IsBlack() ? Spectrum( 0.0f ) : li * attenuation;
-#endif
+    batch.Push( Ray( p1.p , n_delta  , 0 , 0.001f , delta.Length() - 0.001f ) , li );
 }
 
 // connect light sample
-Spectrum BidirPathTracing::_ConnectLight(const BDPT_Vertex& eye_vertex , const Light* light , const Scene& scene ) const{
+void BidirPathTracing::_ConnectLight( const BDPT_Vertex& eye_vertex , const Scene& scene , ShadowRayBatch& batch ) const{
     if( eye_vertex.depth >= max_recursive_depth )
-        return 0.0f;
+        return;
+
+    // pick a light based on its contribution to the eye vertex
+    float light_pick_pdf;
+    const auto light = scene.SampleLight( eye_vertex.p , eye_vertex.n , sort_canonical() , &light_pick_pdf );
+    if( nullptr == light || 0.0f == light_pick_pdf )
+        return;
 
     // drop the light vertex, take a new sample here
     const LightSample sample(true);
@@ -290,39 +332,28 @@ Spectrum BidirPathTracing::_ConnectLight(const BDPT_Vertex& eye_vertex , const L
     float directPdfW;
     float emissionPdfW;
     float cosAtLight;
-    auto  li = light->sample_l(eye_vertex.inter.intersect, &sample, wi, 0 , &directPdfW, &emissionPdfW , &cosAtLight , visibility);
+    auto  li = light->sample_l(eye_vertex.p, &sample, wi, 0 , &directPdfW, &emissionPdfW , &cosAtLight , visibility);
 
     if( 0.0f == directPdfW )
-        return 0.0f;
+        return;
     
     const auto cosAtEyeVertex = absDot(eye_vertex.n, wi);
-    li *= eye_vertex.throughput * eye_vertex.se->Evaluate_BSDF( eye_vertex.wi , wi ) / directPdfW;
+    li *= eye_vertex.throughput * eye_vertex.se->Evaluate_BSDF( eye_vertex.wi , wi ) / ( directPdfW * light_pick_pdf );
 
     if (li.IsBlack())
-        return 0.0f;
-
-#ifndef ENABLE_TRANSPARENT_SHADOW
-    if( visibility.IsVisible() == false )
-        return 0.0f;
-#else
-    const auto attenuation = visibility.GetAttenuation();
-    if( attenuation.IsBlack() )
-        return 0.0f;
-#endif
+        return;
 
     const auto eye_bsdf_pdfw = eye_vertex.se->Pdf_BSDF( eye_vertex.wi , wi ) * eye_vertex.rr;
     const auto eye_bsdf_rev_pdfw = eye_vertex.se->Pdf_BSDF( wi , eye_vertex.wi ) * eye_vertex.rr;
 
-    const double mis0 = light->IsDelta()?0.0f:MIS(eye_bsdf_pdfw / directPdfW);
-    const double mis1 = MIS( cosAtEyeVertex * emissionPdfW / ( cosAtLight * directPdfW ) ) * ( eye_vertex.vcm + eye_vertex.vc * MIS( eye_bsdf_rev_pdfw ) );
+    // the other strategies pick lights based on their power
+    const auto pick_ratio = light->PickPDF() / light_pick_pdf;
+    const double mis0 = light->IsDelta()?0.0f:MIS(pick_ratio * eye_bsdf_pdfw / directPdfW);
+    const double mis1 = MIS( pick_ratio * cosAtEyeVertex * emissionPdfW / ( cosAtLight * directPdfW ) ) * ( m_misVmWeightFactor + eye_vertex.vcm + eye_vertex.vc * MIS( eye_bsdf_rev_pdfw ) );
 
     const auto weight = (float)(1.0f / (mis0 + mis1 + 1.0f));
 
-#ifndef ENABLE_TRANSPARENT_SHADOW
-    return li * weight;
-#else
-    return li * weight * attenuation;
-#endif
+    batch.Push( visibility.ray , li * weight );
 }
 
 void BidirPathTracing::_ConnectCamera(const BDPT_Vertex& light_vertex, int len , const Light* light , const Scene& scene ) const{
@@ -337,9 +368,9 @@ void BidirPathTracing::_ConnectCamera(const BDPT_Vertex& light_vertex, int len ,
     float cosAtCamera;
     Spectrum we;
     Point eye_point;
-    const auto coord = camera->GetScreenCoord(light_vertex.inter, &camera_pdfW, &camera_pdfA , cosAtCamera , &we , &eye_point , &visibility );
+    const auto coord = camera->GetScreenCoord(*light_vertex.inter, &camera_pdfW, &camera_pdfA , cosAtCamera , &we , &eye_point , &visibility );
 
-    const auto delta = light_vertex.inter.intersect - eye_point;
+    const auto delta = light_vertex.p - eye_point;
     const auto invSqrLen = 1.0f / delta.SquaredLength();
     const auto n_delta = delta * sqrt(invSqrLen);
 
@@ -367,7 +398,7 @@ void BidirPathTracing::_ConnectCamera(const BDPT_Vertex& light_vertex, int len ,
 
     const auto total_pixel = (float)(g_resultResollutionWidth * g_resultResollutionHeight);
     const auto gterm = cosAtCamera * invSqrLen;    // the other cos in the g-term is hidden in the 'bsdf_value'.
-    auto radiance = light_vertex.throughput * bsdf_value * we * gterm / (float)( sample_per_pixel * total_pixel * camera_pdfA );
+    auto radiance = light_vertex.throughput * bsdf_value * we * gterm / (float)( g_samplePerPixel * total_pixel * camera_pdfA );
 
 #ifdef ENABLE_TRANSPARENT_SHADOW
     radiance *= attenuation;
@@ -376,7 +407,7 @@ void BidirPathTracing::_ConnectCamera(const BDPT_Vertex& light_vertex, int len ,
     if( !light_tracing_only ){
         const float lightvert_pdfA = camera_pdfW * absDot( light_vertex.n, n_delta ) * invSqrLen ;
         const float bsdf_rev_pdfw = light_vertex.se->Pdf_BSDF( -n_delta , light_vertex.wi ) * light_vertex.rr;
-        const double mis0 = ( light_vertex.vcm + light_vertex.vc * MIS( bsdf_rev_pdfw ) ) * MIS( lightvert_pdfA / total_pixel );
+        const double mis0 = ( m_misVmWeightFactor + light_vertex.vcm + light_vertex.vc * MIS( bsdf_rev_pdfw ) ) * MIS( lightvert_pdfA / total_pixel );
         const float weight = (float)(1.0f / (1.0f + mis0));
 
         radiance *= weight;
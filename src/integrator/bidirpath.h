@@ -24,24 +24,27 @@
 #include "scatteringevent/scatteringevent.h"
 
 class   Light;
+class   ShadowRayBatch;
 
+// A vertex of a sub-path, it only keeps what connecting and weighting sub-paths need. Both the intersection and the
+// scattering event live in the memory pool, which also keeps the reference to the intersection in the scattering
+// event valid when vertices are copied.
 struct BDPT_Vertex{
-    Point               p;                  // the position of the vertex
-    Vector              n;                  // the normal of the vertex
-    Vector              wi;                 // in direction
-    Vector              wo;                 // out direction
-    ScatteringEvent*    se = nullptr;       // scattering event
-    float               rr = 0.0f;          // russian roulette
-    Spectrum            throughput;         // through put
-    SurfaceInteraction  inter;              // intersection
+    Point                       p;                  // the position of the vertex
+    Vector                      n;                  // the normal of the vertex
+    Vector                      wi;                 // in direction
+    Vector                      wo;                 // out direction
+    Spectrum                    throughput;         // through put
+    float                       rr = 0.0f;          // russian roulette
+    int                         depth = 0;          // depth of the vertex
+    const SurfaceInteraction*   inter = nullptr;    // intersection
+    ScatteringEvent*            se = nullptr;       // scattering event
 
     // For further detail, please refer to the paper "Implementing Vertex Connection and Merging"
     // MIS factors
     double      vc = 0.0f;
     double      vcm = 0.0f;
-
-    // depth of the vertex
-    int         depth = 0;
+    double      vm = 0.0f;
 };
 
 struct Pending_Sample{
@@ -72,10 +75,6 @@ public:
     //! @return                 The radiance along the opposite direction that the ray points to.
     Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene) const override;
 
-
-    //! @brief  The samples generated in this interface is not well used in this integrator for now.
-    void RequestSample( Sampler* sampler , PixelSample* ps , unsigned ps_num ) override;
-
     //! @brief      Serializing data from stream
     //!
     //! @param      Stream where the serialization data comes from. Depending on different situation, it could come from different places.
@@ -86,21 +85,11 @@ public:
 
 protected:
     bool    light_tracing_only = false;     // only do light tracing
-    int     sample_per_pixel = 1;           // light sample per pixel
 
-    // compute G term
-    Spectrum    _Gterm( const BDPT_Vertex& p0 , const BDPT_Vertex& p1 ) const;
-
-    // connect light sample
-    Spectrum    _ConnectLight(const BDPT_Vertex& eye_vertex, const Light* light , const Scene& scene ) const;
+    // MIS factors of vertex merging, they are always zero in bi-directional path tracing since there is no merging.
+    double  m_misVmWeightFactor = 0.0f;
+    double  m_misVcWeightFactor = 0.0f;
 
-    // connect camera point
-    void        _ConnectCamera(const BDPT_Vertex& light_vertex , int len , const Light* light , const Scene& scene ) const;
-
-    // connect vertices
-    Spectrum    _ConnectVertices( const BDPT_Vertex& light_vertex , const BDPT_Vertex& eye_vertex , const Light* light , const Scene& scene ) const;
-
-private:
     // use multiple importance sampling to sample direct illumination
     bool    m_bMIS = true;
 
@@ -112,5 +101,33 @@ private:
         return m_bMIS ? t * t : 1.0f;
     }
 
+    // allocate storage of a sub-path in the memory pool, it holds up to 'max_recursive_depth' vertices
+    BDPT_Vertex*    _AllocatePath() const;
+
+    // trace a light path from a randomly picked light, returns false if there is no light picked
+    // 'light_path' needs to hold 'max_recursive_depth' vertices, 'light_path_len' is the number of vertices traced
+    bool        _TraceLightPath( const Scene& scene , BDPT_Vertex* light_path , unsigned& light_path_len , const Light*& light , float& pdf , bool connect_camera ) const;
+
+    // sample the next direction of a path, it updates the through put and MIS factors, returns false if the path is terminated
+    bool        _SampleScattering( BDPT_Vertex& vert , Spectrum& throughput , double& vc , double& vcm , double& vm ) const;
+
+    // compute G term
+    Spectrum    _Gterm( const BDPT_Vertex& p0 , const BDPT_Vertex& p1 ) const;
+
+    // connect light sample, the light is picked based on its contribution to the eye vertex, the shadow ray is queued in the batch
+    void        _ConnectLight( const BDPT_Vertex& eye_vertex , const Scene& scene , ShadowRayBatch& batch ) const;
+
+    // connect camera point
+    void        _ConnectCamera(const BDPT_Vertex& light_vertex , int len , const Light* light , const Scene& scene ) const;
+
+    // connect vertices, the shadow ray is queued in the batch along with the unoccluded contribution
+    void        _ConnectVertices( const BDPT_Vertex& light_vertex , const BDPT_Vertex& eye_vertex , ShadowRayBatch& batch ) const;
+
+    // merge an eye vertex with nearby light vertices, there is no merging in bi-directional path tracing
+    virtual Spectrum _MergeVertices( const BDPT_Vertex& eye_vertex ) const {
+        return 0.0f;
+    }
+
+private:
     SORT_STATS_ENABLE( "Bi-directional Path Tracing" )
 };
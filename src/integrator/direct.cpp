@@ -22,6 +22,7 @@
 #include "light/light.h"
 #include "core/memory.h"
 #include "sampler/sampler.h"
+#include "scatteringevent/scatteringevent.h"
 
 SORT_STATS_DECLARE_COUNTER(sPrimaryRayCount)
 
@@ -42,12 +43,28 @@ Spectrum DirectLight::Li( const Ray& r , const PixelSample& ps , const Scene& sc
 
     auto li = ip.Le( -r.m_Dir );
 
-    // evaluate direct light
+    ScatteringEvent se( ip , SE_EVALUATE_ALL_NO_SSS );
+    ip.primitive->GetMaterial()->UpdateScatteringEvent( se );
+    RecordFirstHit( se , r , ip );
+
+    // evaluate direct light, shadow rays of all lights are traced in one batch
+    static thread_local ShadowRayBatch batch;
     auto light_num = scene.LightNum();
-    for( auto i = 0u ; i < light_num ; ++i ){
-        const auto light = scene.GetLight(i);
-        li += EvaluateDirect( r , scene , light , ip , LightSample(true) , BsdfSample(true) , true );
+    if( light_num <= m_lightSampleCnt ){
+        for( auto i = 0u ; i < light_num ; ++i ){
+            const auto light = scene.GetLight(i);
+            EvaluateDirect( se , r , scene , light , LightSample(true) , BsdfSample(true) , batch );
+        }
+    }else{
+        // Evaluating all lights is too expensive with lots of lights, a few of them are picked based on their contribution instead.
+        for( auto i = 0u ; i < m_lightSampleCnt ; ++i ){
+            auto light_pdf = 0.0f;
+            const auto light = scene.SampleLight( ip.intersect , ip.normal , sort_canonical() , &light_pdf );
+            if( light_pdf > 0.0f )
+                EvaluateDirect( se , r , scene , light , LightSample(true) , BsdfSample(true) , batch , 1.0f / ( light_pdf * m_lightSampleCnt ) );
+        }
     }
+    li += batch.Resolve( scene );
 
     return li;
 }
\ No newline at end of file
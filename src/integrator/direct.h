@@ -44,5 +44,8 @@ public:
     }
 
 private:
+    /**< All lights are evaluated if there are not more lights than this, otherwise this number of lights are picked. */
+    unsigned    m_lightSampleCnt = 8;
+
     SORT_STATS_ENABLE( "Direct Illumination" )
 };
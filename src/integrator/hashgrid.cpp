@@ -0,0 +1,57 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "hashgrid.h"
+
+void HashGrid::Build( const std::vector<Point>& positions , float radius ){
+    m_positions = positions;
+    m_radiusSq = radius * radius;
+    m_invCellSize = 1.0f / ( radius * 2.0f );
+
+    m_bbox = BBox();
+    for( const auto& p : positions )
+        m_bbox.Union( p );
+
+    m_indices.resize( positions.size() );
+    m_cellEnds.assign( positions.size() , 0u );
+    if( positions.empty() )
+        return;
+
+    const auto cellOf = [&]( const Point& p ){
+        const auto delta = ( p - m_bbox.m_Min ) * m_invCellSize;
+        return hashCell( (int)std::floor( delta.x ) , (int)std::floor( delta.y ) , (int)std::floor( delta.z ) );
+    };
+
+    // count the points in each cell, the offset after the last point of each cell is then known.
+    for( const auto& p : positions )
+        ++m_cellEnds[cellOf( p )];
+
+    auto sum = 0u;
+    for( auto& end : m_cellEnds ){
+        sum += end;
+        end = sum;
+    }
+
+    // fill cells backward, each cell end is decremented to its beginning in the end.
+    for( auto i = (int)positions.size() - 1 ; i >= 0 ; --i )
+        m_indices[--m_cellEnds[cellOf( positions[i] )]] = (unsigned)i;
+
+    // restore the cell ends.
+    for( auto i = 0u ; i + 1 < m_cellEnds.size() ; ++i )
+        m_cellEnds[i] = m_cellEnds[i + 1];
+    m_cellEnds.back() = (unsigned)positions.size();
+}
@@ -0,0 +1,92 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include "math/bbox.h"
+
+//! @brief  Hashed uniform grid for finding points within a fixed radius.
+/**
+ * The cell size is twice the query radius so that any query only needs to visit the 2x2x2 cells closest to it.
+ * Cells are hashed into a table with as many entries as points, which keeps the memory bounded regardless of the
+ * extent of the points. Points are sorted by their hashed cells so that each cell is a contiguous range of indices.
+ */
+class HashGrid{
+public:
+    //! @brief  Build the grid.
+    //!
+    //! @param  positions   Positions of the points.
+    //! @param  radius      The radius of range queries.
+    void    Build( const std::vector<Point>& positions , float radius );
+
+    //! @brief  Visit all points within the radius of a position.
+    //!
+    //! @param  p           The center of the query.
+    //! @param  func        Functor taking the index of each point found.
+    template<class Func>
+    void    Query( const Point& p , Func&& func ) const {
+        if( m_indices.empty() )
+            return;
+
+        const auto  delta = ( p - m_bbox.m_Min ) * m_invCellSize;
+        const int   px = (int)std::floor( delta.x );
+        const int   py = (int)std::floor( delta.y );
+        const int   pz = (int)std::floor( delta.z );
+
+        // the neighbor cells on the closer side along each axis.
+        const int   pxo = px + ( delta.x - px < 0.5f ? -1 : 1 );
+        const int   pyo = py + ( delta.y - py < 0.5f ? -1 : 1 );
+        const int   pzo = pz + ( delta.z - pz < 0.5f ? -1 : 1 );
+
+        unsigned visited[8];
+        auto visited_cnt = 0u;
+        for( auto i = 0u ; i < 8u ; ++i ){
+            const auto cell = hashCell( ( i & 1 ) ? pxo : px , ( i & 2 ) ? pyo : py , ( i & 4 ) ? pzo : pz );
+
+            // different cells could be hashed into the same entry, it should only be visited once.
+            auto duplicated = false;
+            for( auto k = 0u ; k < visited_cnt && !duplicated ; ++k )
+                duplicated = visited[k] == cell;
+            if( duplicated )
+                continue;
+            visited[visited_cnt++] = cell;
+
+            const auto begin = cell == 0 ? 0u : m_cellEnds[cell - 1];
+            const auto end = m_cellEnds[cell];
+            for( auto j = begin ; j < end ; ++j ){
+                const auto index = m_indices[j];
+                if( ( m_positions[index] - p ).SquaredLength() <= m_radiusSq )
+                    func( index );
+            }
+        }
+    }
+
+private:
+    BBox                    m_bbox;                 /**< Bounding box of all points. */
+    float                   m_radiusSq = 0.0f;      /**< Squared radius of range queries. */
+    float                   m_invCellSize = 0.0f;   /**< Reciprocal of the cell size. */
+    std::vector<Point>      m_positions;            /**< Positions of the points. */
+    std::vector<unsigned>   m_indices;              /**< Indices of points sorted by their hashed cells. */
+    std::vector<unsigned>   m_cellEnds;             /**< Offset after the last point of each hashed cell. */
+
+    //! @brief  Hash a cell into the table.
+    unsigned hashCell( int x , int y , int z ) const {
+        return (unsigned)( ( (unsigned)x * 73856093u ) ^ ( (unsigned)y * 19349663u ) ^ ( (unsigned)z * 83492791u ) ) % (unsigned)m_cellEnds.size();
+    }
+};
@@ -27,8 +27,10 @@
 #include "core/primitive.h"
 #include "stream/stream.h"
 #include "core/scene.h"
+#include "imagesensor/aov.h"
 
 class   Ray;
+class   AOV_Layout;
 
 //! @brief  Integrator is for esitimating radiance in rendering equation.
 /**
@@ -53,12 +55,82 @@ public:
     //! @return         The spectrum of the radiance along the opposite direction of the ray.
     virtual Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene) const = 0;
 
+    //! @brief  Evaluate the radiance of a batch of camera rays.
+    //!
+    //! This is only called for integrators with non-zero batch size. The default implementation simply evaluates
+    //! each ray one by one. It is up to the integrator to clear the managed memory pool within the batch, the
+    //! caller only clears it before the batch starts. Pixel samples are not available in batch evaluation since
+    //! they are not used by any integrator for now. The first hit of each camera ray goes to the record of the same
+    //! index in 'g_firstHits', if it is not nullptr.
+    //!
+    //! @param  rays            Camera rays to be evaluated.
+    //! @param  cnt             Number of camera rays in the batch.
+    //! @param  scene           The rendering scene.
+    //! @param  radiance        The radiance along the opposite direction of each camera ray.
+    virtual void        LiBatch( const Ray* rays , unsigned cnt , const Scene& scene , Spectrum* radiance ) const {
+        const auto first_hits = g_firstHits;
+        for( auto i = 0u ; i < cnt ; ++i ){
+            g_firstHits = first_hits ? first_hits + i : nullptr;
+            radiance[i] = Li( rays[i] , pixel_sample , scene );
+        }
+        g_firstHits = first_hits;
+    }
+
+    //! @brief  Number of camera rays the integrator would like to evaluate together.
+    //!
+    //! Integrators returning zero are fed with one camera ray at a time through 'Li', which is the case for most of them.
+    //!
+    //! @return                 Number of camera rays in a batch, zero means no batch evaluation.
+    virtual unsigned    GetBatchSize() const {
+        return 0;
+    }
+
     //! @brief Pre-process before rendering.
     //!
     //! By default , nothing is done in pre-process some integrator, such as Photon Mapping use pre-process step to
     //! generate some neccessary infomation by latter stage.
     virtual void PreProcess(const Scene& scene) {}
 
+    //! @brief  Number of iterations the rendering is split into.
+    //!
+    //! Samples of each pixel are evenly distributed among iterations, all tiles of an iteration are rendered before
+    //! the next iteration starts. Integrators gathering global data in each iteration, like the light vertices merged
+    //! in vertex connection and merging, render in multiple iterations. Most integrators render in a single one.
+    virtual unsigned GetIterationCount() const {
+        return 1;
+    }
+
+    //! @brief  Number of tasks preparing each iteration, they are executed in parallel before rendering the iteration.
+    virtual unsigned GetIterationTaskCount() const {
+        return 0;
+    }
+
+    //! @brief  Prepare an iteration, this is called by multiple tasks in parallel.
+    //!
+    //! @param  scene       The rendering scene.
+    //! @param  iteration   Index of the iteration.
+    //! @param  task_id     Index of the task preparing the iteration.
+    virtual void PrepareIteration( const Scene& scene , unsigned iteration , unsigned task_id ) {}
+
+    //! @brief  Start an iteration, this is called once all tasks preparing the iteration are done.
+    //!
+    //! @param  scene       The rendering scene.
+    //! @param  iteration   Index of the iteration.
+    virtual void BeginIteration( const Scene& scene , unsigned iteration ) {}
+
+    //! @brief  Finish an iteration, this is called once all tiles of the iteration are rendered.
+    //!
+    //! @param  scene       The rendering scene.
+    //! @param  iteration   Index of the iteration.
+    virtual void EndIteration( const Scene& scene , unsigned iteration ) {}
+
+    //! @brief  Register the AOVs produced by the integrator, this is only called if AOVs are collected.
+    //!
+    //! AOVs are recorded through 'RecordAOV' while evaluating 'Li', they are not available in batch evaluation.
+    //!
+    //! @param  layout      Layout of AOVs of a pixel.
+    virtual void RegisterAOVs( AOV_Layout& layout ) {}
+
     //! @brief  Some integrator have a post process step.
     virtual void PostProcess() {}
 
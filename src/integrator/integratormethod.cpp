@@ -24,11 +24,48 @@
 #include "material/material.h"
 #include "light/light.h"
 #include "medium/phasefunction.h"
+#include "sampler/sequence.h"
 
 SORT_FORCEINLINE float MisFactor( float f, float g ){
     return (f*f) / (f*f + g*g);
 }
 
+void ShadowRayBatch::Push( const Ray& ray , const Spectrum& contribution ){
+    m_rays.push_back( ray );
+    m_contributions.push_back( contribution );
+}
+
+Spectrum ShadowRayBatch::Resolve( const Scene& scene ){
+    const auto cnt = (unsigned)m_rays.size();
+    if( 0 == cnt )
+        return 0.0f;
+
+    Spectrum radiance;
+#ifndef ENABLE_TRANSPARENT_SHADOW
+    if( m_capacity < cnt ){
+        m_capacity = cnt;
+        m_occluded = std::make_unique<bool[]>( m_capacity );
+    }
+
+    scene.IsOccluded( m_rays.data() , cnt , m_occluded.get() );
+    for( auto i = 0u ; i < cnt ; ++i ){
+        if( !m_occluded[i] )
+            radiance += m_contributions[i];
+    }
+#else
+    m_attenuation.resize( cnt );
+
+    scene.GetAttenuation( m_rays.data() , cnt , m_attenuation.data() );
+    for( auto i = 0u ; i < cnt ; ++i )
+        radiance += m_attenuation[i] * m_contributions[i];
+#endif
+
+    m_rays.clear();
+    m_contributions.clear();
+
+    return radiance;
+}
+
 Spectrum    EvaluateDirect( const ScatteringEvent& se , const Ray& r , const Scene& scene , const Light* light , const LightSample& ls ,const BsdfSample& bs ){
     const auto& ip = se.GetInteraction();
     Spectrum radiance;
@@ -97,6 +134,46 @@ Spectrum    EvaluateDirect( const ScatteringEvent& se , const Ray& r , const Sce
     return radiance;
 }
 
+void    EvaluateDirect( const ScatteringEvent& se , const Ray& r , const Scene& scene , const Light* light , const LightSample& ls ,const BsdfSample& bs , ShadowRayBatch& batch , float weight ){
+    const auto& ip = se.GetInteraction();
+    Visibility visibility(scene);
+    float light_pdf;
+    float bsdf_pdf;
+    const auto wo = -r.m_Dir;
+    Vector wi;
+    const auto li = light->sample_l( ip.intersect , &ls , wi , 0 , &light_pdf , 0 , 0 , visibility );
+    if( light_pdf > 0.0f && !li.IsBlack() ){
+        const auto f = se.Evaluate_BSDF( wo , wi );
+        if( !f.IsBlack() ){
+            if( light->IsDelta() ){
+                batch.Push( visibility.ray , li * f * weight / light_pdf );
+            }else{
+                bsdf_pdf = se.Pdf_BSDF( wo , wi );
+                const auto mis_weight = MisFactor( light_pdf , bsdf_pdf );
+                batch.Push( visibility.ray , li * f * mis_weight * weight / light_pdf );
+            }
+        }
+    }
+
+    if( !light->IsDelta() ){
+        const auto f = se.Sample_BSDF( wo , wi , bs , bsdf_pdf );
+        if( !f.IsBlack() && bsdf_pdf != 0.0f ){
+            const auto light_pdf = light->Pdf( ip.intersect , wi );
+            if( light_pdf <= 0.0f )
+                return;
+            const auto mis_weight = MisFactor( bsdf_pdf , light_pdf );
+
+            Spectrum li;
+            SurfaceInteraction _ip;
+            if( false == light->Le( Ray( ip.intersect , wi ) , &_ip , li ) )
+                return;
+
+            if( !li.IsBlack() )
+                batch.Push( Ray( ip.intersect , wi , 0 , 0.001f , _ip.t - 0.001f ) , li * f * mis_weight * weight / bsdf_pdf );
+        }
+    }
+}
+
 Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene& scene, const Light* light, const LightSample& ls, const BsdfSample& bs, const MaterialBase* material , const MediumStack& ms ) {
     const auto& ip = se.GetInteraction();
     Spectrum radiance;
@@ -210,9 +287,9 @@ Spectrum    EvaluateDirect(const Point& ip, const PhaseFunction* ph, const Vecto
 
 // This is only used by SSS for now, since it is a smooth BRDF, there is no need to do MIS.
 Spectrum SampleOneLight( const ScatteringEvent& se , const Ray& r, const SurfaceInteraction& inter, const Scene& scene, const MaterialBase* material, const MediumStack& ms) {
-    // Uniformly choose a light, this may not be the optimal solution in case of more lights, need more research in this topic later.
+    // pick a light based on its contribution to the shading point.
     float light_pick_pdf = 0.0f;
-    const auto light = scene.SampleLight( sort_canonical() , &light_pick_pdf );
+    const auto light = scene.SampleLight( inter.intersect , inter.normal , sort_canonical() , &light_pick_pdf );
     if( nullptr == light )
         return 0.0f;
 
@@ -255,4 +332,20 @@ Spectrum    EvaluateDirect( const Ray& r , const Scene& scene , const Light* lig
     ScatteringEvent se( ip , replaceSSS ? SE_EVALUATE_ALL_NO_SSS : SE_EVALUATE_ALL );
     ip.primitive->GetMaterial()->UpdateScatteringEvent( se );
     return EvaluateDirect( se , r , scene , light , ls , bs );
+}
+
+void RecordFirstHit( const ScatteringEvent& se , const Ray& r , const SurfaceInteraction& inter ){
+    if( !g_firstHits )
+        return;
+
+    // the sampler is unbound while sampling the BSDF so that no dimension of the pixel sample is taken.
+    const auto sampler = g_sequenceSampler;
+    g_sequenceSampler = nullptr;
+
+    Vector wi;
+    auto pdf = 0.0f;
+    const auto f = se.Sample_BSDF( -r.m_Dir , wi , BsdfSample( true ) , pdf );
+    g_sequenceSampler = sampler;
+
+    RecordFirstHit( pdf > 0.0f ? ( f / pdf ).Clamp( 0.0f , 1.0f ) : Spectrum( 0.0f ) , inter.normal , inter.t );
 }
\ No newline at end of file
@@ -17,21 +17,62 @@
 
 #pragma once
 
+#include <vector>
 #include "integrator.h"
+#include "math/ray.h"
 
 struct	SurfaceInteraction;
 class	Light;
 class   MediumStack;
 
+//! @brief  A batch of shadow rays to be traced together.
+/**
+ * Integrators evaluating lots of shadow rays at a shading point, like evaluating all lights or virtual point lights,
+ * can queue the shadow rays along with their unoccluded contributions here. All shadow rays are traced in one batch
+ * when resolving the total contribution. It is not meant to be used with mediums.
+ */
+class ShadowRayBatch{
+public:
+    //! @brief  Queue a shadow ray.
+    //!
+    //! @param  ray             The shadow ray, its maximum distance should be set correctly.
+    //! @param  contribution    The contribution of the ray if it is not occluded at all.
+    void        Push( const Ray& ray , const Spectrum& contribution );
+
+    //! @brief  Trace all shadow rays and accumulate their contributions. The batch will be empty afterward.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    //! @return                 The total contribution of all shadow rays taking occlusion into account.
+    Spectrum    Resolve( const Scene& scene );
+
+private:
+    std::vector<Ray>        m_rays;             /**< Shadow rays to be traced. */
+    std::vector<Spectrum>   m_contributions;    /**< Unoccluded contribution of each shadow ray. */
+#ifndef ENABLE_TRANSPARENT_SHADOW
+    std::unique_ptr<bool[]> m_occluded;         /**< Occlusion of each shadow ray. */
+    unsigned                m_capacity = 0;     /**< Capacity of occlusion results. */
+#else
+    std::vector<Spectrum>   m_attenuation;      /**< Attenuation of each shadow ray. */
+#endif
+};
+
 // evaluate direct lighting
 Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene& scene, const Light* light, const LightSample& ls, const BsdfSample& bs, const MaterialBase* material, const MediumStack& ms);
 Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene& scene, const Light* light, const LightSample& ls, const BsdfSample& bs);
 
+// same as above, except that the shadow rays are queued in the batch, whose contribution is only known after it is resolved,
+// the contributions are scaled by 'weight', which is usually the reciprocal of the probability of picking the light.
+void        EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene& scene, const Light* light, const LightSample& ls, const BsdfSample& bs, ShadowRayBatch& batch, float weight = 1.0f);
+
 Spectrum    EvaluateDirect(const Point& ip, const PhaseFunction* ph, const Vector& wo, const Scene& scene, const Light* light, MediumStack ms);
 
-// uniformly evaluate direct illumination from one light
+// evaluate direct illumination from one light picked based on its contribution to the shading point
 Spectrum    SampleOneLight( const ScatteringEvent& se , const Ray& r, const SurfaceInteraction& inter, const Scene& scene, const MaterialBase* material, const MediumStack& ms);
 
 // helper function to evaluate light contribution
 Spectrum    EvaluateDirect( const Ray& r , const Scene& scene , const Light* light , const SurfaceInteraction& ip ,
-                            const LightSample& ls , const BsdfSample& bs , bool replaceSSS = false );
\ No newline at end of file
+                            const LightSample& ls , const BsdfSample& bs , bool replaceSSS = false );
+
+// record the first hit of the camera ray being evaluated, for integrators that don't sample a direction at the first hit.
+// the albedo is estimated with one random sample of the BSDF, which leaves the sequence of the pixel sample untouched.
+void        RecordFirstHit( const ScatteringEvent& se , const Ray& r , const SurfaceInteraction& inter );
\ No newline at end of file
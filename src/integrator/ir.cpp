@@ -15,81 +15,204 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <atomic>
+#include <cfloat>
+#include <numeric>
+#include <algorithm>
 #include "ir.h"
 #include "integratormethod.h"
 #include "math/interaction.h"
 #include "core/scene.h"
+#include "core/memory.h"
+#include "core/globalconfig.h"
+#include "core/thread.h"
 #include "light/light.h"
 #include "scatteringevent/scatteringevent.h"
 
 SORT_STATS_DECLARE_COUNTER(sPrimaryRayCount)
 SORT_STATS_DEFINE_COUNTER(sVPLCount)
+SORT_STATS_DEFINE_COUNTER(sLightcutSize)
+SORT_STATS_DEFINE_COUNTER(sLightcutCount)
 
 SORT_STATS_COUNTER("Instant Radiosity", "Primary Ray Count" , sPrimaryRayCount);
 SORT_STATS_COUNTER("Instant Radiosity", "Virtual Point Lights Count" , sVPLCount);
+SORT_STATS_AVG_COUNT("Instant Radiosity", "Average Lightcut Size" , sLightcutSize , sLightcutCount);
 
 IMPLEMENT_RTTI( InstantRadiosity );
 
+// Maximum number of clusters in a cut, refinement stops once it is reached regardless of the error.
+static constexpr unsigned LIGHTCUT_MAX_SIZE = 1000;
+
+// Number of light paths traced by a thread at a time.
+static constexpr unsigned LIGHT_PATH_CHUNK_SIZE = 64;
+
+void VPL_Set::Append( const VPL_Set& set ){
+    intersect.insert( intersect.end() , set.intersect.begin() , set.intersect.end() );
+    position.insert( position.end() , set.position.begin() , set.position.end() );
+    wi.insert( wi.end() , set.wi.begin() , set.wi.end() );
+    power.insert( power.end() , set.power.begin() , set.power.end() );
+    depth.insert( depth.end() , set.depth.begin() , set.depth.end() );
+}
+
+void VPL_Set::BuildTree(){
+    nodes.clear();
+    if( 0 == GetCount() )
+        return;
+
+    // a binary tree with one virtual point light in each leaf has exactly this many nodes.
+    nodes.reserve( 2 * GetCount() - 1 );
+
+    std::vector<unsigned> indices( GetCount() );
+    std::iota( indices.begin() , indices.end() , 0u );
+    buildNode( indices , 0 , GetCount() );
+}
+
+unsigned VPL_Set::buildNode( std::vector<unsigned>& indices , unsigned begin , unsigned end ){
+    const auto index = (unsigned)nodes.size();
+    nodes.emplace_back();
+
+    if( end - begin == 1 ){
+        const auto vpl = indices[begin];
+        auto& node = nodes[index];
+        node.bbox = BBox( position[vpl] , position[vpl] );
+        node.power = power[vpl];
+        node.intensity = power[vpl].GetIntensity();
+        node.representative = vpl;
+        node.min_depth = node.max_depth = depth[vpl];
+        return index;
+    }
+
+    // split the virtual point lights in half along the longest axis, so that close ones are clustered together.
+    BBox bbox;
+    for( auto i = begin ; i < end ; ++i )
+        bbox.Union( position[indices[i]] );
+    const auto axis = bbox.MaxAxisId();
+    const auto mid = ( begin + end ) / 2;
+    std::nth_element( indices.begin() + begin , indices.begin() + mid , indices.begin() + end , [&]( unsigned i0 , unsigned i1 ){
+        return position[i0][axis] < position[i1][axis];
+    } );
+
+    const auto left = buildNode( indices , begin , mid );
+    const auto right = buildNode( indices , mid , end );
+
+    const auto& l = nodes[left];
+    const auto& r = nodes[right];
+    auto& node = nodes[index];
+    node.bbox = Union( l.bbox , r.bbox );
+    node.power = l.power + r.power;
+    node.intensity = l.intensity + r.intensity;
+    node.child[0] = left;
+    node.child[1] = right;
+    node.min_depth = std::min( l.min_depth , r.min_depth );
+    node.max_depth = std::max( l.max_depth , r.max_depth );
+
+    // the representative is picked proportional to intensity, evaluating the cluster with it alone is then unbiased.
+    node.representative = ( sort_canonical() * node.intensity < l.intensity ) ? l.representative : r.representative;
+    return index;
+}
+
 // Preprocess
 void InstantRadiosity::PreProcess( const Scene& scene )
 {
     SORT_PROFILE("Instant Radiosity (LPV distribution stage)");
 
-    m_pVirtualLightSources = std::make_unique<std::list<VirtualLightSource>[]>(m_nLightPathSet);
-
-    for( int k = 0 ; k < m_nLightPathSet ; ++k ){
-        for( int i = 0 ; i < m_nLightPaths ; ++i ){
-            // pick a light first
-            float light_pick_pdf;
-            const Light* light = scene.SampleLight( sort_canonical() , &light_pick_pdf );
-
-            // sample a ray from the light source
-            float   light_emission_pdf = 0.0f;
-            float   light_pdfa = 0.0f;
-            Ray     ray;
-            float   cosAtLight = 1.0f;
-            Spectrum le = light->sample_l( LightSample(true) , ray , &light_emission_pdf , &light_pdfa , &cosAtLight );
-
-            Spectrum throughput = le * cosAtLight / ( light_pick_pdf * light_emission_pdf );
-
-            int current_depth = 0;
-            SurfaceInteraction intersect;
-            while( true ){
-                if (false == scene.GetIntersect(ray, intersect))
-                    break;
-
-                VirtualLightSource ls;
-                ls.power = throughput;
-                ls.intersect = intersect;
-                ls.wi = -ray.m_Dir;
-                ls.depth = ++current_depth;
-                m_pVirtualLightSources[k].push_back( ls );
-
-                float bsdf_pdf;
-                Vector wo;
-                
-                ScatteringEvent se( intersect , SE_EVALUATE_ALL_NO_SSS );
-                intersect.primitive->GetMaterial()->UpdateScatteringEvent(se);
-                Spectrum bsdf_value = se.Sample_BSDF( ls.wi , wo, BsdfSample(true) , bsdf_pdf );
-
-                if( bsdf_pdf == 0.0f )
-                    break;
-
-                // apply russian roulette
-                float continueProperbility = std::min( 1.0f , throughput.GetIntensity() );
-                if( sort_canonical() > continueProperbility )
-                    break;
-                throughput /= continueProperbility;
-
-                // update throughput
-                throughput *= bsdf_value / bsdf_pdf;
-
-                // update next ray
-                ray = Ray(intersect.intersect, wo, 0, 0.001f);
+    m_fMinSqrDist = m_fMinDist * m_fMinDist;
+
+    m_vplSets.clear();
+    m_vplSets.resize( m_nLightPathSet );
+
+    // light paths of a set are split into chunks traced by helper threads, virtual point lights of each chunk are
+    // merged in order afterward. Along with paths keyed by their index, the sets don't depend on thread scheduling.
+    const auto thread_cnt = std::max( 1u , g_threadCnt );
+    const auto path_cnt = (unsigned)m_nLightPaths;
+    const auto total_path_cnt = (unsigned)m_nLightPathSet * path_cnt;
+    const auto chunk_per_set = ( path_cnt + LIGHT_PATH_CHUNK_SIZE - 1 ) / LIGHT_PATH_CHUNK_SIZE;
+    const auto chunk_cnt = (unsigned)m_nLightPathSet * chunk_per_set;
+    std::vector<VPL_Set> chunk_sets( chunk_cnt );
+    std::atomic<unsigned> next_chunk( 0u );
+    RunHelperThreads( thread_cnt , [&]( unsigned tid ){
+        for( auto c = next_chunk++ ; c < chunk_cnt ; c = next_chunk++ ){
+            const auto k = c / chunk_per_set;
+            const auto first = ( c % chunk_per_set ) * LIGHT_PATH_CHUNK_SIZE;
+            const auto last = std::min( path_cnt , first + LIGHT_PATH_CHUNK_SIZE );
+            for( auto i = first ; i < last ; ++i ){
+                SORT_CLEAR_MEMPOOL();
+
+                // keyed by the path, virtual point lights don't depend on which thread traces it.
+                sort_seed( k * path_cnt + i );
+                _traceLightPath( scene , chunk_sets[c] );
             }
         }
+        SORT_CLEAR_MEMPOOL();
+    } );
+
+    for( auto c = 0u ; c < chunk_cnt ; ++c ){
+        m_vplSets[c / chunk_per_set].Append( chunk_sets[c] );
+        SORT_STATS(sVPLCount+=chunk_sets[c].GetCount());
+    }
+
+    // light trees of different sets are built in parallel, each set picks representatives with its own key.
+    std::atomic<unsigned> next_set( 0u );
+    RunHelperThreads( thread_cnt , [&]( unsigned tid ){
+        for( auto k = next_set++ ; k < m_vplSets.size() ; k = next_set++ ){
+            sort_seed( total_path_cnt + k );
+            m_vplSets[k].BuildTree();
+        }
+    } );
+}
 
-        SORT_STATS(sVPLCount+=m_pVirtualLightSources[k].size());
+void InstantRadiosity::_traceLightPath( const Scene& scene , VPL_Set& set ) const{
+    // pick a light first
+    float light_pick_pdf;
+    const Light* light = scene.SampleLight( sort_canonical() , &light_pick_pdf );
+    if( nullptr == light || 0.0f == light_pick_pdf )
+        return;
+
+    // sample a ray from the light source
+    float   light_emission_pdf = 0.0f;
+    float   light_pdfa = 0.0f;
+    Ray     ray;
+    float   cosAtLight = 1.0f;
+    Spectrum le = light->sample_l( LightSample(true) , ray , &light_emission_pdf , &light_pdfa , &cosAtLight );
+    if( 0.0f == light_emission_pdf )
+        return;
+
+    Spectrum throughput = le * cosAtLight / ( light_pick_pdf * light_emission_pdf );
+
+    int current_depth = 0;
+    SurfaceInteraction intersect;
+    while( true ){
+        if (false == scene.GetIntersect(ray, intersect))
+            break;
+
+        const auto wi = -ray.m_Dir;
+        set.intersect.push_back( intersect );
+        set.position.push_back( intersect.intersect );
+        set.wi.push_back( wi );
+        set.power.push_back( throughput );
+        set.depth.push_back( ++current_depth );
+
+        float bsdf_pdf;
+        Vector wo;
+
+        ScatteringEvent se( intersect , SE_EVALUATE_ALL_NO_SSS );
+        intersect.primitive->GetMaterial()->UpdateScatteringEvent(se);
+        Spectrum bsdf_value = se.Sample_BSDF( wi , wo, BsdfSample(true) , bsdf_pdf );
+
+        if( bsdf_pdf == 0.0f )
+            break;
+
+        // apply russian roulette
+        float continueProperbility = std::min( 1.0f , throughput.GetIntensity() );
+        if( sort_canonical() > continueProperbility )
+            break;
+        throughput /= continueProperbility;
+
+        // update throughput
+        throughput *= bsdf_value / bsdf_pdf;
+
+        // update next ray
+        ray = Ray(intersect.intersect, wo, 0, 0.001f);
     }
 }
 
@@ -112,10 +235,21 @@ Spectrum InstantRadiosity::_li( const Ray& r , const Scene& scene , bool ignoreL
 
     // evaluate light path less than two vertices
     Spectrum radiance = ignoreLe?0.0f:ip.Le( -r.m_Dir );
+
+    ScatteringEvent se( ip , SE_EVALUATE_ALL_NO_SSS );
+    ip.primitive->GetMaterial()->UpdateScatteringEvent(se);
+
+    // gather rays are evaluated recursively, they are not camera rays.
+    if( !ignoreLe )
+        RecordFirstHit( se , r , ip );
+
+    // shadow rays of both direct and indirect illumination are traced in one batch
+    static thread_local ShadowRayBatch batch;
+
     unsigned light_num = scene.LightNum();
     for( unsigned i = 0 ; i < light_num ; ++i ){
         const auto light = scene.GetLight(i);
-        radiance += EvaluateDirect( r , scene , light , ip , LightSample(true) , BsdfSample(true) , true );
+        EvaluateDirect( se , r , scene , light , LightSample(true) , BsdfSample(true) , batch );
     }
 
     if( first_intersect_dist )
@@ -123,50 +257,73 @@ Spectrum InstantRadiosity::_li( const Ray& r , const Scene& scene , bool ignoreL
 
     // pick a virtual light source randomly
     const unsigned lps_id = std::min( m_nLightPathSet - 1 , (int)(sort_canonical() * m_nLightPathSet) );
-    std::list<VirtualLightSource> vps = m_pVirtualLightSources[lps_id];
-
-    ScatteringEvent se( ip , SE_EVALUATE_ALL_NO_SSS );
-    ip.primitive->GetMaterial()->UpdateScatteringEvent(se);
-
-    // evaluate indirect illumination
-    Spectrum indirectIllum;
-    std::list<VirtualLightSource>::const_iterator it = vps.begin();
-    while( it != vps.end() ){
-        if( r.m_Depth + it->depth > max_recursive_depth ){
-            ++it;
-            continue;
+    const auto& vpls = m_vplSets[lps_id];
+
+    // evaluate indirect illumination with a cut through the light tree
+    if( !vpls.nodes.empty() ){
+        struct Cluster{
+            unsigned    node;           // node of the cluster in the light tree
+            float       bound;          // upper bound of the error of the cluster
+            Spectrum    estimate;       // unoccluded contribution estimated by the representative
+            Ray         shadow_ray;     // shadow ray of the representative
+        };
+        static thread_local std::vector<Cluster> cut;
+        const auto cmp = []( const Cluster& c0 , const Cluster& c1 ){ return c0.bound < c1.bound; };
+
+        const auto wo = -r.m_Dir;
+        Spectrum total;
+        const auto push_cluster = [&]( unsigned index ){
+            const auto& node = vpls.nodes[index];
+
+            // clusters with all virtual point lights too deep are dropped, the ones partially too deep are always refined.
+            if( r.m_Depth + node.min_depth > max_recursive_depth )
+                return;
+
+            Cluster cluster;
+            cluster.node = index;
+            if( 0 == node.child[0] )
+                cluster.bound = 0.0f;
+            else if( r.m_Depth + node.max_depth > max_recursive_depth )
+                cluster.bound = FLT_MAX;
+            else
+                cluster.bound = _errorBound( ip.intersect , ip.normal , node );
+
+            const auto rep_intensity = vpls.power[node.representative].GetIntensity();
+            if( rep_intensity > 0.0f )
+                cluster.estimate = _evaluateVPL( se , wo , vpls , node.representative , cluster.shadow_ray ) * ( node.intensity / rep_intensity );
+
+            total += cluster.estimate;
+            cut.push_back( cluster );
+            std::push_heap( cut.begin() , cut.end() , cmp );
+        };
+
+        cut.clear();
+        push_cluster( 0 );
+
+        // refine the cluster with the largest error until all of them are small enough compared with the total.
+        while( !cut.empty() && cut.size() < LIGHTCUT_MAX_SIZE ){
+            if( cut.front().bound <= m_fLightcutError * total.GetIntensity() )
+                break;
+
+            std::pop_heap( cut.begin() , cut.end() , cmp );
+            const auto cluster = cut.back();
+            cut.pop_back();
+            total -= cluster.estimate;
+
+            const auto& node = vpls.nodes[cluster.node];
+            push_cluster( node.child[0] );
+            push_cluster( node.child[1] );
         }
 
-        const auto  delta = ip.intersect - it->intersect.intersect;
-        const auto  sqrLen = delta.SquaredLength();
-        const auto  len = sqrt( sqrLen );
-        const auto  n_delta = delta / len;
-
-        ScatteringEvent se1( it->intersect , SE_EVALUATE_ALL_NO_SSS );
-        it->intersect.primitive->GetMaterial()->UpdateScatteringEvent(se1);
-
-        const auto    gterm = 1.0f / std::max( m_fMinSqrDist , sqrLen );
-        const auto    f0 = se.Evaluate_BSDF( -r.m_Dir , -n_delta );
-        const auto    f1 = se1.Evaluate_BSDF( n_delta , it->wi );
-
-        Spectrum    contr = gterm * f0 * f1 * it->power;
-        if( !contr.IsBlack() ){
-            Visibility vis(scene);
-            vis.ray = Ray( it->intersect.intersect , n_delta , 0 , 0.001f , len - 0.001f );
-
-#ifndef ENABLE_TRANSPARENT_SHADOW
-            if( vis.IsVisible() )
-                indirectIllum += contr;
-#else
-            const auto attenuation = vis.GetAttenuation();
-            if( !attenuation.IsBlack() )
-                indirectIllum += contr * attenuation;
-#endif
-        }
+        SORT_STATS(++sLightcutCount);
+        SORT_STATS(sLightcutSize += (StatsInt)cut.size());
 
-        ++it;
+        for( const auto& cluster : cut ){
+            if( !cluster.estimate.IsBlack() )
+                batch.Push( cluster.shadow_ray , cluster.estimate / (float)m_nLightPaths );
+        }
     }
-    radiance += indirectIllum / (float)m_nLightPaths;
+    radiance += batch.Resolve( scene );
 
     if( m_fMinDist > 0.0f ){
         Vector  wi;
@@ -187,4 +344,58 @@ Spectrum InstantRadiosity::_li( const Ray& r , const Scene& scene , bool ignoreL
     }
 
     return radiance;
-}
\ No newline at end of file
+}
+
+Spectrum InstantRadiosity::_evaluateVPL( const ScatteringEvent& se , const Vector& wo , const VPL_Set& set , unsigned vpl , Ray& shadow_ray ) const{
+    const auto  delta = se.GetInteraction().intersect - set.position[vpl];
+    const auto  sqrLen = delta.SquaredLength();
+    const auto  len = sqrt( sqrLen );
+    const auto  n_delta = delta / len;
+
+    const auto  f0 = se.Evaluate_BSDF( wo , -n_delta );
+    if( f0.IsBlack() )
+        return 0.0f;
+
+    const auto& intersect = set.intersect[vpl];
+    ScatteringEvent se1( intersect , SE_EVALUATE_ALL_NO_SSS );
+    intersect.primitive->GetMaterial()->UpdateScatteringEvent(se1);
+
+    const auto  gterm = 1.0f / std::max( m_fMinSqrDist , sqrLen );
+    const auto  f1 = se1.Evaluate_BSDF( n_delta , set.wi[vpl] );
+
+    shadow_ray = Ray( set.position[vpl] , n_delta , 0 , 0.001f , len - 0.001f );
+    return gterm * f0 * f1 * set.power[vpl];
+}
+
+float InstantRadiosity::_errorBound( const Point& p , const Vector& n , const VPL_Set::Node& node ) const{
+    // bound of the geometry term, from the closest point in the bounding box.
+    auto sqr_dist = 0.0f;
+    for( auto i = 0 ; i < 3 ; ++i ){
+        const auto d = std::max( 0.0f , std::max( node.bbox.m_Min[i] - p[i] , p[i] - node.bbox.m_Max[i] ) );
+        sqr_dist += d * d;
+    }
+    const auto max_sqr_dist = std::max( m_fMinSqrDist , sqr_dist );
+    if( max_sqr_dist <= 0.0f )
+        return FLT_MAX;
+    const auto gterm = 1.0f / max_sqr_dist;
+
+    // bound of the cosine at the shading point, the bounding box is transformed to a frame whose z axis is the normal.
+    Vector t , b;
+    coordinateSystem( n , t , b );
+    BBox local;
+    for( auto i = 0 ; i < 8 ; ++i ){
+        const Point corner( ( i & 1 ) ? node.bbox.m_Max.x : node.bbox.m_Min.x ,
+                            ( i & 2 ) ? node.bbox.m_Max.y : node.bbox.m_Min.y ,
+                            ( i & 4 ) ? node.bbox.m_Max.z : node.bbox.m_Min.z );
+        const auto d = corner - p;
+        local.Union( Point( dot( d , t ) , dot( d , b ) , dot( d , n ) ) );
+    }
+    const auto min_x = ( local.m_Min.x <= 0.0f && local.m_Max.x >= 0.0f ) ? 0.0f : std::min( fabs( local.m_Min.x ) , fabs( local.m_Max.x ) );
+    const auto min_y = ( local.m_Min.y <= 0.0f && local.m_Max.y >= 0.0f ) ? 0.0f : std::min( fabs( local.m_Min.y ) , fabs( local.m_Max.y ) );
+    const auto max_z = std::max( fabs( local.m_Min.z ) , fabs( local.m_Max.z ) );
+    const auto len = sqrt( min_x * min_x + min_y * min_y + max_z * max_z );
+    const auto cos_bound = len > 0.0f ? max_z / len : 1.0f;
+
+    // materials at both ends are assumed to be no brighter than a white lambert surface.
+    return node.intensity * gterm * cos_bound * INV_PI * INV_PI;
+}
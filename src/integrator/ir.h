@@ -17,15 +17,59 @@
 
 #pragma once
 
-#include <list>
+#include <vector>
 #include "integrator.h"
 #include "math/interaction.h"
+#include "math/bbox.h"
 
-struct VirtualLightSource{
-    SurfaceInteraction  intersect;
-    Vector              wi;
-    Spectrum            power;
-    int                 depth;
+class ScatteringEvent;
+
+//! @brief  Virtual point lights generated from one set of light paths.
+/**
+ * Virtual point lights are stored in structure of arrays so that walking through positions or powers during clustering
+ * doesn't touch the rest of the data. They are organized in a binary light tree, each node of which is a cluster of
+ * virtual point lights represented by one of them.
+ */
+struct VPL_Set{
+    //! @brief  Node of the light tree.
+    struct Node{
+        BBox        bbox;                       /**< Bounding box of the virtual point lights in the cluster. */
+        Spectrum    power;                      /**< Total power of the virtual point lights in the cluster. */
+        float       intensity = 0.0f;           /**< Intensity of the total power. */
+        unsigned    representative = 0;         /**< The virtual point light representing the cluster. */
+        unsigned    child[2] = { 0u , 0u };     /**< Index of the children, zero for leaves. */
+        int         min_depth = 0;              /**< Minimum depth of the virtual point lights in the cluster. */
+        int         max_depth = 0;              /**< Maximum depth of the virtual point lights in the cluster. */
+    };
+
+    std::vector<SurfaceInteraction>     intersect;  /**< Intersection where each virtual point light is. */
+    std::vector<Point>                  position;   /**< Position of each virtual point light. */
+    std::vector<Vector>                 wi;         /**< Direction pointing to the previous vertex in the light path. */
+    std::vector<Spectrum>               power;      /**< Power of each virtual point light. */
+    std::vector<int>                    depth;      /**< Depth of each virtual point light in its light path. */
+    std::vector<Node>                   nodes;      /**< Nodes of the light tree, the first one is the root. */
+
+    //! @brief  Number of virtual point lights in the set.
+    SORT_FORCEINLINE unsigned GetCount() const {
+        return (unsigned)position.size();
+    }
+
+    //! @brief  Append all virtual point lights in another set.
+    //!
+    //! @param  set         The set holding virtual point lights to be appended, its light tree is ignored.
+    void    Append( const VPL_Set& set );
+
+    //! @brief  Build the light tree.
+    void    BuildTree();
+
+private:
+    //! @brief  Build a sub-tree of the light tree.
+    //!
+    //! @param  indices     Indices of virtual point lights, the ones in the sub-tree will be reordered.
+    //! @param  begin       The first virtual point light in the sub-tree.
+    //! @param  end         One after the last virtual point light in the sub-tree.
+    //! @return             Index of the root of the sub-tree.
+    unsigned    buildNode( std::vector<unsigned>& indices , unsigned begin , unsigned end );
 };
 
 //! @brief  Instant radiosity integrator.
@@ -34,6 +78,14 @@ struct VirtualLightSource{
  * First pass generates virtual light sources along the path tracing from light sources.
  * Second pass will use those virtual light source to evaluate indirect illuimination.
  * Direct illumination is handled the same way in directlight integrator.
+ *
+ * Instead of evaluating all virtual point lights at each shading point, a cut through the light tree is picked so that
+ * the upper bound of the error of each cluster in the cut is below a fraction of the total estimated illumination.
+ * Each cluster is then evaluated with its representative only.
+ *
+ * Please refer to the following paper for further detail,
+ * Lightcuts: A Scalable Approach to Illumination
+ * https://www.cs.cornell.edu/~kb/projects/lightcuts/
  */
 class   InstantRadiosity : public Integrator{
 public:
@@ -50,6 +102,7 @@ public:
     //! @brief  Preprocess before second phase happens.
     //!
     //! In preprocessing stage, numbers of virtual light sources are generated along the path tracing from light sources.
+    //! Light paths are traced in parallel, the light tree of each set is built afterward.
     //!
     //! @param  scene           The scene to be evaluated.
     void PreProcess( const Scene& scene ) override;
@@ -62,6 +115,7 @@ public:
         stream >> m_nLightPathSet;
         stream >> m_nLightPaths;
         stream >> m_fMinDist;
+        stream >> m_fLightcutError;
     }
 
 private:
@@ -75,10 +129,37 @@ private:
     float   m_fMinDist      = 1.0f;
     float   m_fMinSqrDist   = 1.0f;
 
+    /**< maximum error of a cluster in a cut relative to the total estimated illumination. */
+    float   m_fLightcutError = 0.02f;
+
     /**< container for light sources. */
-    std::unique_ptr<std::list<VirtualLightSource>[]>    m_pVirtualLightSources;
+    std::vector<VPL_Set>    m_vplSets;
 
     Spectrum _li( const Ray& ray , const Scene& scene , bool ignoreLe = false , float* first_intersect_dist = 0 ) const;
 
+    //! @brief  Trace a light path and generate virtual point lights along it.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    //! @param  set             Where the virtual point lights are appended to.
+    void        _traceLightPath( const Scene& scene , VPL_Set& set ) const;
+
+    //! @brief  Evaluate the unoccluded contribution of a virtual point light.
+    //!
+    //! @param  se              Scattering event at the shading point.
+    //! @param  wo              Direction pointing away from the shading point to the viewer.
+    //! @param  set             The set that the virtual point light belongs to.
+    //! @param  vpl             Index of the virtual point light.
+    //! @param  shadow_ray      The shadow ray from the virtual point light to the shading point.
+    //! @return                 The unoccluded contribution.
+    Spectrum    _evaluateVPL( const ScatteringEvent& se , const Vector& wo , const VPL_Set& set , unsigned vpl , Ray& shadow_ray ) const;
+
+    //! @brief  Upper bound of the contribution of a cluster of virtual point lights.
+    //!
+    //! @param  p               Position of the shading point.
+    //! @param  n               Normal at the shading point.
+    //! @param  node            The cluster of virtual point lights.
+    //! @return                 The upper bound of the contribution intensity.
+    float       _errorBound( const Point& p , const Vector& n , const VPL_Set::Node& node ) const;
+
     SORT_STATS_ENABLE( "Instant Radiosity" )
 };
@@ -0,0 +1,302 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include "pathguiding.h"
+#include "math/utils.h"
+
+SORT_STATS_DEFINE_COUNTER(sPathGuidingSTreeLeafCount)
+SORT_STATS_DEFINE_COUNTER(sPathGuidingRecordCount)
+
+SORT_STATS_COUNTER("Path Guiding", "Spatial Leaf Count", sPathGuidingSTreeLeafCount);
+SORT_STATS_COUNTER("Path Guiding", "Training Record Count", sPathGuidingRecordCount);
+
+// Number of records a spatial region needs to take in the first iteration before it is split in half.
+static constexpr float      STREE_SPLIT_THRESHOLD = 12000.0f;
+// Fraction of total energy above which a directional quadrant is subdivided.
+static constexpr float      DTREE_SPLIT_THRESHOLD = 0.01f;
+// Maximum depth of the directional quad-tree.
+static constexpr unsigned   DTREE_MAX_DEPTH = 20;
+// Number of records a recorder buffers before splatting them into the training distribution.
+static constexpr unsigned   RECORD_CHUNK_SIZE = 4096;
+
+// Map a direction to the unit square with cylindrical coordinates.
+static Vector2f dirToCanonical( const Vector& wi ){
+    const auto cos_theta = std::max( -1.0f , std::min( 1.0f , wi.y ) );
+    auto phi = std::atan2( wi.z , wi.x );
+    if( phi < 0.0f )
+        phi += TWO_PI;
+    return Vector2f( ( cos_theta + 1.0f ) * 0.5f , std::min( phi * INV_TWOPI , 0.99999994f ) );
+}
+
+// Map a point in the unit square back to a direction.
+static Vector canonicalToDir( const Vector2f& p ){
+    const auto cos_theta = 2.0f * p.x - 1.0f;
+    const auto sin_theta = std::sqrt( std::max( 0.0f , 1.0f - cos_theta * cos_theta ) );
+    const auto phi = TWO_PI * p.y;
+    return Vector( sin_theta * std::cos( phi ) , cos_theta , sin_theta * std::sin( phi ) );
+}
+
+void GuidingRecorder::AddVertex( const Point& p , const Vector& wi , float pdf , const Spectrum& throughput ){
+    m_path.push_back( { p , wi , pdf , throughput , Spectrum( 0.0f ) } );
+}
+
+void GuidingRecorder::AddRadiance( const Spectrum& radiance ){
+    for( auto& vertex : m_path )
+        vertex.radiance += radiance;
+}
+
+void GuidingRecorder::FinishPath(){
+    for( const auto& vertex : m_path ){
+        Spectrum li;
+        for( auto i = 0 ; i < RGBSPECTRUM_SAMPLE ; ++i )
+            li[i] = vertex.throughput[i] > 0.0f ? vertex.radiance[i] / vertex.throughput[i] : 0.0f;
+
+        const auto radiance = li.GetIntensity() / vertex.pdf;
+        if( radiance > 0.0f && !IsInf( radiance ) && !IsNan( radiance ) )
+            m_records.push_back( { vertex.position , vertex.direction , radiance } );
+    }
+    m_path.clear();
+
+    if( m_records.size() >= RECORD_CHUNK_SIZE )
+        Flush();
+}
+
+void GuidingRecorder::Flush(){
+    if( m_records.empty() )
+        return;
+    m_guiding->Record( m_records );
+    m_records.clear();
+}
+
+DTree::DTree(){
+    m_nodes.resize( 1 );
+}
+
+void DTree::Record( const Vector& wi , float radiance ){
+    auto p = dirToCanonical( wi );
+    auto node = 0u;
+    while( true ){
+        const auto x = p.x >= 0.5f ? 1u : 0u;
+        const auto y = p.y >= 0.5f ? 1u : 0u;
+        const auto q = x + 2 * y;
+
+        m_nodes[node].energy[q] += radiance;
+        if( 0 == m_nodes[node].child[q] )
+            break;
+
+        p = Vector2f( p.x * 2.0f - x , p.y * 2.0f - y );
+        node = m_nodes[node].child[q];
+    }
+    ++m_sampleCnt;
+}
+
+Vector DTree::Sample( float u , float v , float& pdf ) const{
+    Vector2f    origin( 0.0f , 0.0f );
+    auto        size = 1.0f;
+    auto        node = 0u;
+    pdf = 1.0f;
+    while( true ){
+        const auto& n = m_nodes[node];
+        const auto total = n.energy[0] + n.energy[1] + n.energy[2] + n.energy[3];
+
+        // nothing is recorded in the node, directions inside it are uniformly sampled.
+        if( total <= 0.0f )
+            break;
+
+        // pick the column first, then the quadrant in the column, both proportional to the energy.
+        const auto px = ( n.energy[0] + n.energy[2] ) / total;
+        auto x = 0u;
+        if( u < px ){
+            u /= px;
+        }else{
+            u = ( u - px ) / ( 1.0f - px );
+            x = 1u;
+        }
+
+        const auto py = n.energy[x] / ( n.energy[x] + n.energy[x + 2] );
+        auto y = 0u;
+        if( v < py ){
+            v /= py;
+        }else{
+            v = ( v - py ) / ( 1.0f - py );
+            y = 1u;
+        }
+
+        const auto q = x + 2 * y;
+        pdf *= 4.0f * n.energy[q] / total;
+
+        size *= 0.5f;
+        origin += Vector2f( (float)x , (float)y ) * size;
+
+        if( 0 == n.child[q] )
+            break;
+        node = n.child[q];
+    }
+
+    u = std::min( u , 0.99999994f );
+    v = std::min( v , 0.99999994f );
+    pdf *= INV_FOUR_PI;
+    return canonicalToDir( origin + Vector2f( u , v ) * size );
+}
+
+float DTree::Pdf( const Vector& wi ) const{
+    auto p = dirToCanonical( wi );
+    auto node = 0u;
+    auto pdf = 1.0f;
+    while( true ){
+        const auto& n = m_nodes[node];
+        const auto total = n.energy[0] + n.energy[1] + n.energy[2] + n.energy[3];
+        if( total <= 0.0f )
+            break;
+
+        const auto x = p.x >= 0.5f ? 1u : 0u;
+        const auto y = p.y >= 0.5f ? 1u : 0u;
+        const auto q = x + 2 * y;
+
+        pdf *= 4.0f * n.energy[q] / total;
+        if( 0 == n.child[q] || 0.0f == pdf )
+            break;
+
+        p = Vector2f( p.x * 2.0f - x , p.y * 2.0f - y );
+        node = n.child[q];
+    }
+    return pdf * INV_FOUR_PI;
+}
+
+void DTree::Refine( const DTree& tree , float threshold , unsigned max_depth ){
+    const auto total = tree.GetEnergy();
+
+    // keep the structure if nothing is learned.
+    if( total <= 0.0f ){
+        m_nodes = tree.m_nodes;
+        Clear();
+        return;
+    }
+
+    m_nodes.assign( 1 , DTree_Node() );
+    m_sampleCnt = 0;
+    refineNode( tree , 0 , 1.0f , 1.0f / total , 0 , 1 , threshold , max_depth );
+}
+
+void DTree::refineNode( const DTree& tree , int src , float energy , float inv_total , unsigned node , unsigned depth , float threshold , unsigned max_depth ){
+    for( auto q = 0u ; q < 4u ; ++q ){
+        // quadrants that don't exist in the other tree are assumed to have uniformly distributed energy.
+        const auto e = src >= 0 ? tree.m_nodes[src].energy[q] * inv_total : energy * 0.25f;
+        if( e <= threshold || depth >= max_depth )
+            continue;
+
+        const auto child = (unsigned)m_nodes.size();
+        m_nodes.emplace_back();
+        m_nodes[node].child[q] = child;
+
+        const auto src_child = ( src >= 0 && tree.m_nodes[src].child[q] ) ? (int)tree.m_nodes[src].child[q] : -1;
+        refineNode( tree , src_child , e , inv_total , child , depth + 1 , threshold , max_depth );
+    }
+}
+
+void DTree::Clear(){
+    for( auto& node : m_nodes )
+        node.energy[0] = node.energy[1] = node.energy[2] = node.energy[3] = 0.0f;
+    m_sampleCnt = 0;
+}
+
+float DTree::GetEnergy() const{
+    const auto& root = m_nodes[0];
+    return root.energy[0] + root.energy[1] + root.energy[2] + root.energy[3];
+}
+
+void PathGuiding::Initialize( const BBox& bbox ){
+    m_bbox = bbox;
+    m_nodes.assign( 1 , STree_Node() );
+}
+
+const DTree* PathGuiding::GetDistribution( const Point& p ) const{
+    if( m_nodes.empty() )
+        return nullptr;
+
+    const auto& tree = m_nodes[locate( p )].sampling;
+    return tree.GetEnergy() > 0.0f ? &tree : nullptr;
+}
+
+void PathGuiding::Record( const std::vector<GuidingRecord>& records ){
+    // locating the regions only reads the spatial tree, only splatting into the training distributions is serialized.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for( const auto& record : records )
+        m_nodes[locate( record.position )].training.Record( record.direction , record.radiance );
+    SORT_STATS(sPathGuidingRecordCount += (StatsInt)records.size());
+}
+
+void PathGuiding::Update( std::vector<GuidingRecorder>& recorders , unsigned iteration ){
+    // splat what is left in the recorders of all training threads.
+    for( auto& recorder : recorders )
+        recorder.Flush();
+
+    // split spatial regions with enough records, the threshold grows since later iterations take more samples.
+    const auto threshold = STREE_SPLIT_THRESHOLD * std::sqrt( std::pow( 2.0f , (float)iteration ) );
+    for( auto i = 0u ; i < m_nodes.size() ; ++i ){
+        if( m_nodes[i].child[0] || m_nodes[i].training.GetSampleCount() <= threshold )
+            continue;
+
+        // both halves inherit the learned distribution of the region.
+        STree_Node child;
+        child.axis = ( m_nodes[i].axis + 1 ) % 3;
+        child.training = m_nodes[i].training;
+        child.training.ScaleSampleCount( 0.5f );
+
+        const auto index = (unsigned)m_nodes.size();
+        m_nodes[i].child[0] = index;
+        m_nodes[i].child[1] = index + 1;
+        m_nodes[i].training = DTree();
+        m_nodes[i].sampling = DTree();
+        m_nodes.push_back( child );
+        m_nodes.push_back( child );
+    }
+
+    // the learned distribution is used for sampling in the next iteration, a refined one starts collecting radiance.
+    StatsInt leaf_cnt = 0;
+    for( auto& node : m_nodes ){
+        if( node.child[0] )
+            continue;
+        node.sampling = node.training;
+        node.training.Refine( node.sampling , DTREE_SPLIT_THRESHOLD , DTREE_MAX_DEPTH );
+        ++leaf_cnt;
+    }
+    SORT_STATS(sPathGuidingSTreeLeafCount = leaf_cnt);
+}
+
+unsigned PathGuiding::locate( const Point& p ) const{
+    float c[3];
+    for( auto i = 0u ; i < 3u ; ++i ){
+        const auto extent = std::max( m_bbox.m_Max[i] - m_bbox.m_Min[i] , 1e-6f );
+        c[i] = saturate( ( p[i] - m_bbox.m_Min[i] ) / extent );
+    }
+
+    auto node = 0u;
+    while( m_nodes[node].child[0] ){
+        const auto axis = m_nodes[node].axis;
+        if( c[axis] < 0.5f ){
+            c[axis] *= 2.0f;
+            node = m_nodes[node].child[0];
+        }else{
+            c[axis] = c[axis] * 2.0f - 1.0f;
+            node = m_nodes[node].child[1];
+        }
+    }
+    return node;
+}
@@ -0,0 +1,226 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include "math/bbox.h"
+#include "math/vector2.h"
+#include "spectrum/spectrum.h"
+#include "core/stats.h"
+
+//! @brief  Incident radiance arriving at a point from a direction, recorded while training the guiding distribution.
+struct GuidingRecord{
+    Point       position;           /**< Where the radiance arrives. */
+    Vector      direction;          /**< Direction the radiance comes from, pointing away from the position. */
+    float       radiance = 0.0f;    /**< Intensity of the incident radiance divided by the pdf of picking the direction. */
+};
+
+class PathGuiding;
+
+//! @brief  Collect incident radiance along paths for training the guiding distribution.
+/**
+ * Each training thread owns its recorder so that nothing is shared while tracing paths. Vertices of the current path
+ * are kept until the path is done, every contribution found later along the path is added to all of them. Once the
+ * path is finished, the radiance arriving at each vertex is recovered by dividing its accumulated contribution by the
+ * throughput of the path up to the vertex.
+ *
+ * Records are only buffered in small chunks, a full chunk is splatted into the training distribution right away so
+ * that the memory taken by a recorder doesn't grow with the number of paths traced in a training pass.
+ */
+class GuidingRecorder{
+public:
+    //! @brief  Create a recorder training a guiding distribution.
+    //!
+    //! @param  guiding     The distribution collecting the recorded radiance.
+    explicit GuidingRecorder( PathGuiding& guiding ) : m_guiding( &guiding ) {}
+
+    //! @brief  Add a vertex to the current path.
+    //!
+    //! @param  p           Position of the vertex.
+    //! @param  wi          The sampled direction at the vertex.
+    //! @param  pdf         Pdf of sampling the direction, w.r.t solid angle.
+    //! @param  throughput  Throughput of the path after scattering at the vertex.
+    void    AddVertex( const Point& p , const Vector& wi , float pdf , const Spectrum& throughput );
+
+    //! @brief  Add a contribution of the path to all existing vertices.
+    //!
+    //! @param  radiance    The contribution, the throughput of the path is already applied.
+    void    AddRadiance( const Spectrum& radiance );
+
+    //! @brief  Finish the current path and turn its vertices into records.
+    void    FinishPath();
+
+    //! @brief  Splat all buffered records into the training distribution, the recorder will be empty afterward.
+    void    Flush();
+
+private:
+    //! @brief  A vertex of the path that is being traced.
+    struct GuidingVertex{
+        Point       position;       /**< Position of the vertex. */
+        Vector      direction;      /**< Sampled direction at the vertex. */
+        float       pdf;            /**< Pdf of sampling the direction. */
+        Spectrum    throughput;     /**< Throughput of the path after scattering at the vertex. */
+        Spectrum    radiance;       /**< Contribution of the path found after the vertex. */
+    };
+
+    PathGuiding*                m_guiding;  /**< The distribution collecting the recorded radiance. */
+    std::vector<GuidingVertex>  m_path;     /**< Vertices of the path that is being traced. */
+    std::vector<GuidingRecord>  m_records;  /**< Records of finished paths that are not splatted yet. */
+};
+
+//! @brief  Quad-tree approximating the distribution of incident radiance over all directions.
+/**
+ * Directions are mapped to the unit square with cylindrical coordinates, which preserves area so that the pdf w.r.t
+ * solid angle is simply the pdf in the square divided by 4 * PI. Each node keeps the radiance arriving from each of its
+ * four quadrants, a direction is sampled by walking down the tree and picking quadrants proportional to their energy.
+ */
+class DTree{
+public:
+    //! @brief  A tree with a single node covering all directions.
+    DTree();
+
+    //! @brief  Record incident radiance from a direction.
+    //!
+    //! @param  wi          Direction that the radiance comes from.
+    //! @param  radiance    Incident radiance divided by the pdf of picking the direction.
+    void        Record( const Vector& wi , float radiance );
+
+    //! @brief  Sample a direction proportional to the recorded radiance.
+    //!
+    //! @param  u           A canonical random number.
+    //! @param  v           A canonical random number.
+    //! @param  pdf         Pdf of sampling the direction, w.r.t solid angle.
+    //! @return             The sampled direction.
+    Vector      Sample( float u , float v , float& pdf ) const;
+
+    //! @brief  Pdf of sampling a direction by 'Sample'.
+    //!
+    //! @param  wi          The direction to be evaluated.
+    //! @return             Pdf of sampling the direction, w.r.t solid angle.
+    float       Pdf( const Vector& wi ) const;
+
+    //! @brief  Rebuild the structure of the tree based on the energy recorded in another tree, the energy is cleared.
+    //!
+    //! Quadrants holding more than a fraction of the total energy are subdivided, the others are collapsed.
+    //!
+    //! @param  tree        The tree holding recorded energy.
+    //! @param  threshold   Fraction of total energy above which a quadrant is subdivided.
+    //! @param  max_depth   Maximum depth of the tree.
+    void        Refine( const DTree& tree , float threshold , unsigned max_depth );
+
+    //! @brief  Clear the recorded energy, keeping the structure of the tree.
+    void        Clear();
+
+    //! @brief  Total recorded energy in the tree.
+    float       GetEnergy() const;
+
+    //! @brief  Number of records taken by the tree.
+    unsigned    GetSampleCount() const {
+        return m_sampleCnt;
+    }
+
+    //! @brief  Scale the number of records taken by the tree, used when its spatial region is split.
+    void        ScaleSampleCount( float scale ){
+        m_sampleCnt = (unsigned)( m_sampleCnt * scale );
+    }
+
+private:
+    //! @brief  Node of the quad-tree.
+    struct DTree_Node{
+        float       energy[4] = { 0.0f , 0.0f , 0.0f , 0.0f };  /**< Recorded energy in each quadrant. */
+        unsigned    child[4] = { 0u , 0u , 0u , 0u };           /**< Index of the child of each quadrant, zero for leaves. */
+    };
+
+    std::vector<DTree_Node>     m_nodes;            /**< Nodes of the tree, the first one is the root. */
+    unsigned                    m_sampleCnt = 0;    /**< Number of records taken by the tree. */
+
+    //! @brief  Populate the children of a node based on the energy in another tree.
+    //!
+    //! @param  tree        The tree holding recorded energy.
+    //! @param  src         Index of the corresponding node in the other tree, negative if the node doesn't exist there.
+    //! @param  energy      Fraction of total energy in the node, only used when it doesn't exist in the other tree.
+    //! @param  inv_total   Reciprocal of the total energy in the other tree.
+    //! @param  node        Index of the node to be populated.
+    //! @param  depth       Depth of the node.
+    //! @param  threshold   Fraction of total energy above which a quadrant is subdivided.
+    //! @param  max_depth   Maximum depth of the tree.
+    void        refineNode( const DTree& tree , int src , float energy , float inv_total , unsigned node , unsigned depth , float threshold , unsigned max_depth );
+};
+
+//! @brief  Learned distribution of incident radiance in the scene for guiding paths.
+/**
+ * This is a practical path guiding solution, a binary tree subdivides the bounding box of the scene, each of its leaves
+ * holds a quad-tree approximating the distribution of incident radiance in the region. The distribution is trained
+ * progressively, in each iteration radiance is recorded in a new set of quad-trees, which are used for sampling in the
+ * next iteration. The spatial tree is refined with more samples and each quad-tree is refined based on the energy
+ * recorded in the previous iteration.
+ *
+ * Only indirect illumination is learned since direct illumination is already well handled by light sampling.
+ *
+ * Please refer to the following paper for further detail,
+ * Practical Path Guiding for Efficient Light-Transport Simulation
+ * https://tom94.net/data/publications/mueller17practical/mueller17practical.pdf
+ */
+class PathGuiding{
+public:
+    //! @brief  Initialize the distribution with a single spatial region.
+    //!
+    //! @param  bbox        Bounding box of the scene.
+    void            Initialize( const BBox& bbox );
+
+    //! @brief  Get the guiding distribution at a point.
+    //!
+    //! @param  p           The point to be guided.
+    //! @return             The distribution of incident radiance, nullptr if nothing is learned around the point.
+    const DTree*    GetDistribution( const Point& p ) const;
+
+    //! @brief  Splat recorded radiance into the distribution collecting radiance in the current iteration.
+    //!
+    //! It is safe to call it from multiple threads while training since the spatial tree doesn't change until 'Update'.
+    //!
+    //! @param  records     The records to be splatted.
+    void            Record( const std::vector<GuidingRecord>& records );
+
+    //! @brief  Train the distribution with recorded radiance and refine it for the next iteration.
+    //!
+    //! @param  recorders   Recorders of all training threads, they will be empty afterward.
+    //! @param  iteration   Index of the training iteration, starting from zero.
+    void            Update( std::vector<GuidingRecorder>& recorders , unsigned iteration );
+
+private:
+    //! @brief  Node of the spatial binary tree.
+    struct STree_Node{
+        unsigned    axis = 0;                   /**< Axis of splitting, interior nodes split the region in half. */
+        unsigned    child[2] = { 0u , 0u };     /**< Index of the children, zero for leaves. */
+        DTree       sampling;                   /**< Distribution used for sampling, only valid in leaves. */
+        DTree       training;                   /**< Distribution collecting radiance, only valid in leaves. */
+    };
+
+    BBox                        m_bbox;     /**< Bounding box of the spatial tree. */
+    std::vector<STree_Node>     m_nodes;    /**< Nodes of the spatial tree, the first one is the root. */
+    std::mutex                  m_mutex;    /**< Mutex protecting the training distributions while recording. */
+
+    //! @brief  Find the leaf node of the spatial tree containing a point.
+    //!
+    //! @param  p           The point to be located.
+    //! @return             Index of the leaf node.
+    unsigned        locate( const Point& p ) const;
+
+    SORT_STATS_ENABLE( "Path Guiding" )
+};
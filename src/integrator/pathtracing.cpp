@@ -15,6 +15,7 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <atomic>
 #include "pathtracing.h"
 #include "math/interaction.h"
 #include "scatteringevent/bssrdf/bssrdf.h"
@@ -27,30 +28,197 @@
 #include "scatteringevent/scatteringevent.h"
 #include "medium/medium.h"
 #include "medium/phasefunction.h"
+#include "core/globalconfig.h"
+#include "core/memory.h"
+#include "core/thread.h"
 
 SORT_STATS_DEFINE_COUNTER(sTotalPathLength)
 SORT_STATS_DECLARE_COUNTER(sPrimaryRayCount)
+SORT_STATS_DEFINE_COUNTER(sRRSVertexCount)
+SORT_STATS_DEFINE_COUNTER(sRRSTerminatedCount)
+SORT_STATS_DEFINE_COUNTER(sRRSSplitCount)
 
 SORT_STATS_COUNTER("Path Tracing", "Primary Ray Count" , sPrimaryRayCount);
 SORT_STATS_AVG_COUNT("Path Tracing", "Average Length of Path", sTotalPathLength , sPrimaryRayCount);    // This also counts the case where ray hits sky
+SORT_STATS_COUNTER("Russian Roulette and Splitting", "Vertex Count", sRRSVertexCount);
+SORT_STATS_COUNTER("Russian Roulette and Splitting", "Terminated Path Count", sRRSTerminatedCount);
+SORT_STATS_COUNTER("Russian Roulette and Splitting", "Split Path Count", sRRSSplitCount);
 
 IMPLEMENT_RTTI( PathTracing );
 
+// Probability of sampling the BSDF instead of the guiding distribution when both are available.
+static constexpr float GUIDING_BSDF_RATIO = 0.5f;
+// Range of the expected number of continuations of a path at a vertex.
+static constexpr float RRS_MIN_FACTOR = 0.05f;
+static constexpr float RRS_MAX_FACTOR = 8.0f;
+// Paths are only split with enough expected continuations, splitting slightly more than once doesn't pay for the overhead.
+static constexpr float RRS_SPLIT_THRESHOLD = 2.0f;
+
 Spectrum PathTracing::Li( const Ray& ray , const PixelSample& ps , const Scene& scene) const{
 	MediumStack ms;
-	scene.RestoreMediumStack(ray.m_Ori, ms);
+	scene.RestoreCameraMediumStack(ray.m_Ori, ms);
 
     return li( ray , ps , scene , 0 , false , 0 , false , ms );
 }
 
-Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene& scene , int bounces , bool indirectOnly , int bssrdfBounces , bool replaceSSS , MediumStack& ms ) const{
+void PathTracing::RegisterAOVs( AOV_Layout& layout ){
+    m_directAOV = layout.Register( "direct" , "RGB" );
+    m_indirectAOV = layout.Register( "indirect" , "RGB" );
+}
+
+void PathTracing::PreProcess( const Scene& scene ){
+    m_guiding = nullptr;
+    m_rrsCache = nullptr;
+
+    // roulette and splitting is trained with guided paths so that it learns the way paths are actually traced.
+    if( m_pathGuiding )
+        trainGuiding( scene );
+    if( m_rrs )
+        trainRRS( scene );
+}
+
+void PathTracing::trainGuiding( const Scene& scene ){
+    SORT_PROFILE("Path guiding training");
+
+    // nothing is learned before the first pass, paths are not guided until then.
+    m_guiding = std::make_unique<PathGuiding>();
+    m_guiding->Initialize( scene.GetBBox() );
+
+    const auto camera = scene.GetCamera();
+    const auto width = (unsigned)g_resultResollutionWidth;
+    const auto height = (unsigned)g_resultResollutionHeight;
+    const auto thread_cnt = std::max( 1u , g_threadCnt );
+
+    // each thread records radiance on its own, the records are splatted in chunks.
+    std::vector<GuidingRecorder> recorders( thread_cnt , GuidingRecorder( *m_guiding ) );
+    for( auto pass = 0u ; pass < m_guidingTrainingPasses ; ++pass ){
+        const auto spp = 1u << pass;
+        std::atomic<unsigned> next_row( 0u );
+        auto worker = [&]( unsigned tid ){
+            auto& recorder = recorders[tid];
+            for( auto y = next_row++ ; y < height ; y = next_row++ ){
+                for( auto x = 0u ; x < width ; ++x ){
+                    // training passes are keyed from the top of the index space, rendering iterations never get there.
+                    sort_seed( (int)x , (int)y , ~pass );
+
+                    for( auto k = 0u ; k < spp ; ++k ){
+                        SORT_CLEAR_MEMPOOL();
+
+                        PixelSample ps;
+                        ps.img_u = sort_canonical();
+                        ps.img_v = sort_canonical();
+                        ps.dof_u = sort_canonical();
+                        ps.dof_v = sort_canonical();
+
+                        const auto r = camera->GenerateRay( (float)x , (float)y , ps );
+                        MediumStack ms;
+                        scene.RestoreCameraMediumStack( r.m_Ori , ms );
+                        li( r , ps , scene , 0 , false , 0 , false , ms , &recorder );
+                        recorder.FinishPath();
+                    }
+                }
+            }
+        };
+        RunHelperThreads( thread_cnt , worker );
+
+        // the distribution learned so far guides the paths in the following pass.
+        m_guiding->Update( recorders , pass );
+    }
+}
+
+void PathTracing::trainRRS( const Scene& scene ){
+    SORT_PROFILE("Russian roulette and splitting training");
+
+    auto cache = std::make_unique<RRSCache>();
+    cache->Initialize( scene.GetBBox() );
+
+    const auto camera = scene.GetCamera();
+    const auto width = (unsigned)g_resultResollutionWidth;
+    const auto height = (unsigned)g_resultResollutionHeight;
+    const auto thread_cnt = std::max( 1u , g_threadCnt );
+    const auto spp = std::max( 2u , m_rrsTrainingSpp );
+
+    // each thread records paths and the statistics of pixels on its own, they are only merged after the pass.
+    struct PixelStats{
+        double  variance = 0.0;
+        double  cost = 0.0;
+    };
+    std::vector<RRSRecorder>    recorders( thread_cnt , RRSRecorder( *cache ) );
+    std::vector<PixelStats>     stats( thread_cnt );
+    std::atomic<unsigned> next_row( 0u );
+    auto worker = [&]( unsigned tid ){
+        auto& recorder = recorders[tid];
+        for( auto y = next_row++ ; y < height ; y = next_row++ ){
+            for( auto x = 0u ; x < width ; ++x ){
+                // the pass right after the training passes of path guiding.
+                sort_seed( (int)x , (int)y , ~m_guidingTrainingPasses );
+
+                auto sum = 0.0 , sum_sqr = 0.0;
+                for( auto k = 0u ; k < spp ; ++k ){
+                    SORT_CLEAR_MEMPOOL();
+
+                    PixelSample ps;
+                    ps.img_u = sort_canonical();
+                    ps.img_v = sort_canonical();
+                    ps.dof_u = sort_canonical();
+                    ps.dof_v = sort_canonical();
+
+                    const auto r = camera->GenerateRay( (float)x , (float)y , ps );
+                    MediumStack ms;
+                    scene.RestoreCameraMediumStack( r.m_Ori , ms );
+                    li( r , ps , scene , 0 , false , 0 , false , ms , nullptr , &recorder );
+
+                    stats[tid].cost += recorder.GetCost();
+                    const auto intensity = recorder.FinishPath().GetIntensity();
+                    if( IsInf( intensity ) || IsNan( intensity ) )
+                        continue;
+                    sum += intensity;
+                    sum_sqr += intensity * intensity;
+                }
+                stats[tid].variance += std::max( 0.0 , ( sum_sqr - sum * sum / spp ) / ( spp - 1 ) );
+            }
+        }
+    };
+    RunHelperThreads( thread_cnt , worker );
+
+    PixelStats total;
+    for( const auto& s : stats ){
+        total.variance += s.variance;
+        total.cost += s.cost;
+    }
+    const auto pixel_cnt = std::max( 1.0 , (double)width * height );
+    const auto pixel_variance = (float)( total.variance / pixel_cnt );
+    const auto pixel_cost = (float)( total.cost / ( pixel_cnt * spp ) );
+    cache->Update( recorders , pixel_variance , pixel_cost );
+
+    slog( INFO , INTEGRATOR , "Russian roulette and splitting training pass, %d spp, pixel variance %f, %f vertices per path." , spp , pixel_variance , pixel_cost );
+
+    if( cache->IsValid() )
+        m_rrsCache = std::move( cache );
+}
+
+Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene& scene , int bounces , bool indirectOnly , int bssrdfBounces , bool replaceSSS , MediumStack& ms , GuidingRecorder* recorder , RRSRecorder* rrs_recorder ) const{
     SORT_PROFILE("Path tracing");
     SORT_STATS(++sPrimaryRayCount);
 
     Spectrum    L = 0.0f;
     Spectrum    throughput = 1.0f;
+    int         local_bounce = 0;
+
+    // only the outermost call records AOVs, contributions of nested calls are accumulated by it.
+    const auto record_aov = 0 == bounces;
+
+    // all vertices recorded so far receive the contribution for guiding training.
+    const auto accumulate = [&]( const Spectrum& radiance ){
+        L += radiance;
+        if( recorder )
+            recorder->AddRadiance( radiance );
+        if( rrs_recorder )
+            rrs_recorder->AddRadiance( radiance );
+        if( record_aov )
+            RecordAOV( 0 == local_bounce ? m_directAOV : m_indirectAOV , radiance );
+    };
 
-    int local_bounce = 0;
     auto    r = ray;
     while(true){
         // This introduces bias in the algorithm. 'max_recursive_depth' could be set very large to reduce the side-effect.
@@ -58,12 +226,14 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
             return L;
 
         SORT_STATS(++sTotalPathLength);
+        if( rrs_recorder )
+            rrs_recorder->AddCost();
 
         // get the intersection between the ray and the scene if it's a light , accumulate the radiance and break
         SurfaceInteraction inter;
         if( !scene.GetIntersect( r , inter ) ){
-            if( 0 == local_bounce )
-                return !indirectOnly ? scene.Le( r ) : 0.0f;
+            if( 0 == local_bounce && !indirectOnly )
+                accumulate( scene.Le( r ) );
             break;
         }
 
@@ -84,10 +254,11 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
             if ( UNLIKELY(pdf == 0.0f) )
                 break;
 
-            // evaluate direct light illumination
+            // evaluate direct light illumination, there is no surface normal inside medium.
             float light_pdf = 0.0f;
-            const auto  light = scene.SampleLight(sort_canonical(), &light_pdf);
-            L += throughput * EvaluateDirect(pMi->intersect, &hg, -r.m_Dir, scene, light, ms) / light_pdf;
+            const auto  light = scene.SampleLight(pMi->intersect, Vector(), sort_canonical(), &light_pdf);
+            if( light_pdf > 0.0f )
+                accumulate( throughput * EvaluateDirect(pMi->intersect, &hg, -r.m_Dir, scene, light, ms) / light_pdf );
 
             // update path weight
             throughput *= pf / pdf;
@@ -114,7 +285,7 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
         }
 
         if( local_bounce == 0 && !indirectOnly ) 
-            L += inter.Le(-r.m_Dir);
+            accumulate( inter.Le(-r.m_Dir) );
         
         // make sure there is intersected primitive
         sAssert( nullptr != inter.primitive , INTEGRATOR );
@@ -130,17 +301,23 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
         ScatteringEvent se(inter, seFlag);
         material->UpdateScatteringEvent(se);
 
+        // the albedo of the first hit is estimated by the direction sampled to continue the path, if there is one.
+        const auto record_first_hit = record_aov && 0 == local_bounce;
+        if( record_first_hit )
+            RecordFirstHit( 1.0f , inter.normal , inter.t );
+
         SE_Flag scattering_type_flag;
         auto pdf_scattering_type = se.SampleScatteringType(scattering_type_flag);
+        auto rrs_decided = false;
 
         if( scattering_type_flag & SE_EVALUATE_BXDF ){
             // evaluate the light
             auto        light_pdf = 0.0f;
             const auto  light_sample = LightSample(true);
             const auto  bsdf_sample = BsdfSample(true);
-            const auto  light = scene.SampleLight( light_sample.t , &light_pdf );
+            const auto  light = scene.SampleLight( inter.intersect , inter.normal , light_sample.t , &light_pdf );
             if( light_pdf > 0.0f )
-                L += throughput * EvaluateDirect( se , r , scene, light , light_sample , bsdf_sample , material , ms ) / light_pdf / pdf_scattering_type;
+                accumulate( throughput * EvaluateDirect( se , r , scene, light , light_sample , bsdf_sample , material , ms ) / light_pdf / pdf_scattering_type );
         }else{
             BSSRDFIntersections bssrdf_inter;
             float               bssrdf_pdf = 0.0f;
@@ -164,7 +341,7 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
                     total_bssrdf += SampleOneLight( se , r , intersection , scene , material , ms ) * pInter->weight;
                 }
                 
-                L += total_bssrdf * throughput / pdf_scattering_type / bssrdf_pdf;
+                accumulate( total_bssrdf * throughput / pdf_scattering_type / bssrdf_pdf );
             }
         }
 
@@ -176,28 +353,92 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
 
         throughput /= pdf_scattering_type;
         if( scattering_type_flag & SE_EVALUATE_BXDF ){
-            // sample the next direction using bsdf
+            // sample the next direction using bsdf, or the guiding distribution if there is one around.
+            const auto  guide = m_guiding ? m_guiding->GetDistribution( inter.intersect ) : nullptr;
+            const auto  sample_direction = [&]( Vector& wi , float& path_pdf , bool& is_delta ) -> Spectrum {
+                is_delta = false;
+                if( guide )
+                    return sampleGuided( se , *guide , -r.m_Dir , wi , path_pdf , is_delta );
+
+                const auto f = se.Sample_BSDF( -r.m_Dir , wi , BsdfSample(true) , path_pdf );
+                if( recorder && path_pdf > 0.0f )
+                    is_delta = 0.0f == se.Pdf_BSDF( -r.m_Dir , wi );
+                return f;
+            };
+
+            // as long as the ray is passing through the surface, it is necessary to update the medium stack.
+            const auto  update_medium_stack = [&]( const Vector& wi , MediumStack& stack ){
+                const auto interaction_flag = update_interaction_flag(dot(wi,inter.gnormal), dot(-r.m_Dir,inter.gnormal));
+                if (SE_Interaction::SE_REFLECTION != interaction_flag) {
+                    MediumInteraction mi;
+                    mi.intersect = inter.intersect;
+                    material->UpdateMediumStack(mi, interaction_flag, stack);
+                }
+            };
+
+            if( rrs_recorder )
+                rrs_recorder->AddVertex( inter.intersect , throughput );
+
+            // the expected efficiency of the rest of the path decides how many times it continues from the vertex.
+            const auto rrs_factor = m_rrsCache ? m_rrsCache->GetFactor( inter.intersect , throughput ) : 0.0f;
+            if( rrs_factor > 0.0f ){
+                rrs_decided = true;
+                SORT_STATS(++sRRSVertexCount);
+
+                const auto q = clamp( rrs_factor , RRS_MIN_FACTOR , RRS_MAX_FACTOR );
+                if( q < 1.0f ){
+                    if( sort_canonical() >= q ){
+                        SORT_STATS(++sRRSTerminatedCount);
+                        break;
+                    }
+                    throughput /= q;
+                }else if( q >= RRS_SPLIT_THRESHOLD ){
+                    // the number of branches is rounded randomly so that there are q of them on average.
+                    const auto branches = (unsigned)( q + sort_canonical() );
+                    throughput /= q;
+                    SORT_STATS(sRRSSplitCount += branches - 1);
+
+                    // extra branches are traced recursively, they are all indirect illumination.
+                    sAssert( nullptr == recorder && nullptr == rrs_recorder , INTEGRATOR );
+                    for( auto i = 1u ; i < branches ; ++i ){
+                        Vector  wi;
+                        float   path_pdf = 0.0f;
+                        bool    is_delta = false;
+                        const auto f = sample_direction( wi , path_pdf , is_delta );
+                        if( f.IsBlack() || path_pdf == 0.0f )
+                            continue;
+
+                        MediumStack branch_ms = ms;
+                        update_medium_stack( wi , branch_ms );
+
+                        const auto radiance = li( Ray( inter.intersect , wi , 0 , 0.0001f ) , ps , scene , bounces + 1 , true , bssrdfBounces , false , branch_ms ) * throughput * f / path_pdf;
+                        L += radiance;
+                        if( record_aov )
+                            RecordAOV( m_indirectAOV , radiance );
+                    }
+                }
+            }
+
             float       path_pdf;
             Vector      wi;
-            Spectrum f;
-            BsdfSample  _bsdf_sample = BsdfSample(true);
-            f = se.Sample_BSDF( -r.m_Dir , wi , _bsdf_sample , path_pdf);
+            bool        is_delta = false;
+            const auto  f = sample_direction( wi , path_pdf , is_delta );
+            if( record_first_hit )
+                RecordFirstHit( path_pdf > 0.0f ? ( f / path_pdf ).Clamp( 0.0f , 1.0f ) : Spectrum( 0.0f ) , inter.normal , inter.t );
             if( ( f.IsBlack() || path_pdf == 0.0f ) )
                 break;
 
-            // as long as the ray is passing through the surface, it is necessary to update the medium stack.
-            const auto interaction_flag = update_interaction_flag(dot(wi,inter.gnormal), dot(-r.m_Dir,inter.gnormal));
-            if (SE_Interaction::SE_REFLECTION != interaction_flag) {
-                MediumInteraction mi;
-                mi.intersect = inter.intersect;
-                material->UpdateMediumStack(mi, interaction_flag, ms);
-            }
+            update_medium_stack( wi , ms );
 
             // update path weight
             throughput *= f / path_pdf;
 
             if( 0.0f == throughput.GetIntensity() )
                 break;
+
+            // directions sampled from delta lobes can't be learned by the guiding distribution.
+            if( recorder && !is_delta )
+                recorder->AddVertex( inter.intersect , wi , path_pdf , throughput );
             
             r.m_Ori = inter.intersect;
             r.m_Dir = wi;
@@ -237,12 +478,12 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
                     }
                 }
                 
-                L += total_bssrdf * throughput / bssrdf_pdf;
+                accumulate( total_bssrdf * throughput / bssrdf_pdf );
             }
             return L;
         }
 
-        if( bounces > 3 && throughput.GetMaxComponent() < 0.1f ){
+        if( !rrs_decided && bounces > 3 && throughput.GetMaxComponent() < 0.1f ){
             auto continueProperbility = std::max( 0.05f , 1.0f - throughput.GetMaxComponent() );
             if( sort_canonical() < continueProperbility )
                 break;
@@ -257,3 +498,28 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
 
     return L;
 }
+
+Spectrum PathTracing::sampleGuided( const ScatteringEvent& se , const DTree& guide , const Vector& wo , Vector& wi , float& pdf , bool& is_delta ) const{
+    is_delta = false;
+    if( sort_canonical() < GUIDING_BSDF_RATIO ){
+        const auto f = se.Sample_BSDF( wo , wi , BsdfSample(true) , pdf );
+        if( pdf == 0.0f )
+            return f;
+
+        // directions sampled from delta lobes can't be picked by the guiding distribution at all.
+        if( 0.0f == se.Pdf_BSDF( wo , wi ) ){
+            is_delta = true;
+            pdf *= GUIDING_BSDF_RATIO;
+            return f;
+        }
+
+        pdf = GUIDING_BSDF_RATIO * pdf + ( 1.0f - GUIDING_BSDF_RATIO ) * guide.Pdf( wi );
+        return f;
+    }
+
+    float guide_pdf = 0.0f , u , v;
+    sort_canonical2D( u , v );
+    wi = guide.Sample( u , v , guide_pdf );
+    pdf = GUIDING_BSDF_RATIO * se.Pdf_BSDF( wo , wi ) + ( 1.0f - GUIDING_BSDF_RATIO ) * guide_pdf;
+    return se.Evaluate_BSDF( wo , wi );
+}
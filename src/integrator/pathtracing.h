@@ -17,12 +17,25 @@
 
 #pragma once
 
+#include <memory>
 #include "integrator.h"
+#include "pathguiding.h"
+#include "rrs.h"
+#include "imagesensor/aov.h"
+
+class ScatteringEvent;
 
 //! @brief  The core of path tracing algorithm, the most commonly used algorithm in SORT.
 /**
  * A path tracing algorithm works by tracing rays recursively to converge to the correct approximation of rendering equation.
  * It doesn't solve all corner cases well, but it is a pretty solid algorithm.
+ *
+ * Path guiding can be optionally enabled, a distribution of incident radiance is learned in a few training passes before
+ * rendering, it is then combined with BSDF importance sampling by one-sample multiple importance sampling.
+ *
+ * Efficiency-aware Russian roulette and splitting can be optionally enabled too, a coarse pass before rendering learns
+ * how much each region of the scene contributes to the image and what it costs, which replaces the fixed heuristic of
+ * Russian roulette in deciding whether a path is terminated or split at a vertex.
  */
 class   PathTracing : public Integrator{
 public:
@@ -36,22 +49,47 @@ public:
     //! @return                 The radiance along the opposite direction that the ray points to.
     Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene) const override;
 
+    //! @brief  Train the guiding distribution and the cache of Russian roulette and splitting if they are enabled.
+    //!
+    //! @param  scene           The scene to be rendered.
+    void        PreProcess( const Scene& scene ) override;
+
+    //! @brief  Register the split of direct and indirect illumination.
+    //!
+    //! @param  layout          Layout of AOVs of a pixel.
+    void        RegisterAOVs( AOV_Layout& layout ) override;
+
     //! @brief      Serializing data from stream
     //!
     //! @param      Stream where the serialization data comes from. Depending on different situation, it could come from different places.
     void    Serialize( IStreamBase& stream ) override {
         Integrator::Serialize( stream );
         stream >> m_maxBouncesInBSSRDFPath;
+        stream >> m_pathGuiding;
+        stream >> m_guidingTrainingPasses;
+        stream >> m_rrs;
+        stream >> m_rrsTrainingSpp;
     }
 
     SORT_STATS_ENABLE( "Path Tracing" )
 
-private:
+protected:
     // Maximum bounces supported in BSSRDF path.
     // BSSRDF solutions usually makes aggressive approximations resulting in less accuracy, multiple BSSRDF bounces will even make it worse.
     // Most importantly, it kills the performance and introduces quite some fireflies with bounces more than 2.
     int     m_maxBouncesInBSSRDFPath;
 
+    bool                            m_pathGuiding = false;          /**< Whether to guide paths with learned incident radiance. */
+    unsigned                        m_guidingTrainingPasses = 4;    /**< Number of passes training the guiding distribution, samples double in each pass. */
+    std::unique_ptr<PathGuiding>    m_guiding;                      /**< The learned guiding distribution, only available after training. */
+
+    bool                            m_rrs = false;                  /**< Whether to terminate and split paths driven by their expected efficiency. */
+    unsigned                        m_rrsTrainingSpp = 4;           /**< Number of samples per pixel in the pass training the cache. */
+    std::unique_ptr<RRSCache>       m_rrsCache;                     /**< The learned cache of Russian roulette and splitting, only available after training. */
+
+    AOV_Id                          m_directAOV = AOV_INVALID;      /**< AOV of emission and direct illumination at the first hit. */
+    AOV_Id                          m_indirectAOV = AOV_INVALID;    /**< AOV of illumination after the first bounce. */
+
     //! @brief  Evaluate the radiance along a specific direction.
     //!
     //! @param  ray             The ray to be tested with.
@@ -62,6 +100,29 @@ private:
     //! @param  bssrdfBounces   Bounces on BSSRDF surfaces in the path.
     //! @param  replaceSSS      Whether to replace SSS with lambert.
     //! @param  ms              Medium stack during radiance evaluation.
+    //! @param  recorder        Recorder of incident radiance along the path, only available during guiding training.
+    //! @param  rrs_recorder    Recorder of reflected radiance along the path, only available during training of Russian roulette and splitting.
     //! @return                 The radiance along the opposite direction that the ray points to.
-    Spectrum    li( const Ray& ray , const PixelSample& ps , const Scene& scene , int bounces , bool indirectOnly , int bssrdfBounces , bool replaceSSS , MediumStack& ms ) const;
+    Spectrum    li( const Ray& ray , const PixelSample& ps , const Scene& scene , int bounces , bool indirectOnly , int bssrdfBounces , bool replaceSSS , MediumStack& ms , GuidingRecorder* recorder = nullptr , RRSRecorder* rrs_recorder = nullptr ) const;
+
+    //! @brief  Learn the guiding distribution in a few passes, samples double in each pass.
+    //!
+    //! @param  scene           The scene to be rendered.
+    void        trainGuiding( const Scene& scene );
+
+    //! @brief  Learn the cache of Russian roulette and splitting in a coarse pass.
+    //!
+    //! @param  scene           The scene to be rendered.
+    void        trainRRS( const Scene& scene );
+
+    //! @brief  Sample the next direction with both the BSDF and the guiding distribution by one-sample MIS.
+    //!
+    //! @param  se              The scattering event at the surface.
+    //! @param  guide           The guiding distribution at the surface.
+    //! @param  wo              The exitant direction.
+    //! @param  wi              The sampled incident direction.
+    //! @param  pdf             Pdf of sampling the direction with the combined strategy.
+    //! @param  is_delta        Whether the direction is sampled from a delta lobe.
+    //! @return                 The BSDF value along the sampled direction.
+    Spectrum    sampleGuided( const ScatteringEvent& se , const DTree& guide , const Vector& wo , Vector& wi , float& pdf , bool& is_delta ) const;
 };
@@ -0,0 +1,132 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include "rrs.h"
+#include "math/utils.h"
+
+SORT_STATS_DEFINE_COUNTER(sRRSRecordCount)
+SORT_STATS_DEFINE_COUNTER(sRRSValidCellCount)
+
+SORT_STATS_COUNTER("Russian Roulette and Splitting", "Training Record Count", sRRSRecordCount);
+SORT_STATS_COUNTER("Russian Roulette and Splitting", "Trained Cell Count", sRRSValidCellCount);
+
+// Number of cells along the longest axis of the scene.
+static constexpr unsigned   RRS_GRID_RES = 64;
+// Cells with fewer records than this are not trusted.
+static constexpr unsigned   RRS_MIN_RECORD_CNT = 16;
+
+RRSRecorder::RRSRecorder( const RRSCache& cache ) : m_cache( &cache ) , m_cells( cache.GetCellCount() ) {
+}
+
+void RRSRecorder::AddVertex( const Point& p , const Spectrum& throughput ){
+    m_path.push_back( { p , throughput , Spectrum( 0.0f ) , m_cost } );
+}
+
+void RRSRecorder::AddRadiance( const Spectrum& radiance ){
+    m_radiance += radiance;
+    for( auto& vertex : m_path )
+        vertex.radiance += radiance;
+}
+
+Spectrum RRSRecorder::FinishPath(){
+    for( const auto& vertex : m_path ){
+        Spectrum lr;
+        for( auto i = 0 ; i < RGBSPECTRUM_SAMPLE ; ++i )
+            lr[i] = vertex.throughput[i] > 0.0f ? vertex.radiance[i] / vertex.throughput[i] : 0.0f;
+
+        const auto estimate = lr.GetIntensity();
+        if( IsInf( estimate ) || IsNan( estimate ) )
+            continue;
+
+        auto& cell = m_cells[m_cache->Locate( vertex.position )];
+        cell.moment += estimate * estimate;
+        cell.cost += (float)( m_cost - vertex.cost );
+        ++cell.count;
+    }
+    m_path.clear();
+
+    const auto radiance = m_radiance;
+    m_radiance = 0.0f;
+    m_cost = 0;
+    return radiance;
+}
+
+void RRSRecorder::Flush( std::vector<RRSCellStats>& cells ){
+    StatsInt record_cnt = 0;
+    for( auto i = 0u ; i < m_cells.size() ; ++i ){
+        cells[i].moment += m_cells[i].moment;
+        cells[i].cost += m_cells[i].cost;
+        cells[i].count += m_cells[i].count;
+        record_cnt += m_cells[i].count;
+        m_cells[i] = RRSCellStats();
+    }
+    SORT_STATS(sRRSRecordCount += record_cnt);
+}
+
+void RRSCache::Initialize( const BBox& bbox ){
+    m_bbox = bbox;
+    m_pixelEfficiency = 0.0f;
+
+    // cells are roughly cubes, no matter what the shape of the scene is.
+    const auto max_extent = std::max( bbox.m_Max[bbox.MaxAxisId()] - bbox.m_Min[bbox.MaxAxisId()] , 1e-6f );
+    for( auto i = 0 ; i < 3 ; ++i )
+        m_res[i] = std::max( 1u , (unsigned)std::ceil( RRS_GRID_RES * ( bbox.m_Max[i] - bbox.m_Min[i] ) / max_extent ) );
+    m_cells.assign( m_res[0] * m_res[1] * m_res[2] , RRSCellStats() );
+    m_factors.assign( m_cells.size() , 0.0f );
+}
+
+void RRSCache::Update( std::vector<RRSRecorder>& recorders , float pixel_variance , float pixel_cost ){
+    // sum the grids of all training threads, this happens between passes so there is no contention at all.
+    for( auto& recorder : recorders )
+        recorder.Flush( m_cells );
+
+    StatsInt valid_cnt = 0;
+    for( auto i = 0u ; i < m_cells.size() ; ++i ){
+        const auto& cell = m_cells[i];
+        if( cell.count < RRS_MIN_RECORD_CNT ){
+            m_factors[i] = 0.0f;
+            continue;
+        }
+
+        // the vertex itself is always traced, which avoids dividing by zero for paths leaving the scene.
+        const auto cost = 1.0f + cell.cost / cell.count;
+        m_factors[i] = std::sqrt( cell.moment / cell.count / cost );
+        ++valid_cnt;
+    }
+    SORT_STATS(sRRSValidCellCount = valid_cnt);
+
+    // a noise free image has nothing to gain from roulette or splitting.
+    m_pixelEfficiency = pixel_variance > 0.0f ? std::sqrt( std::max( pixel_cost , 1.0f ) / pixel_variance ) : 0.0f;
+}
+
+float RRSCache::GetFactor( const Point& p , const Spectrum& throughput ) const{
+    if( !IsValid() )
+        return 0.0f;
+    return throughput.GetIntensity() * m_factors[Locate( p )] * m_pixelEfficiency;
+}
+
+unsigned RRSCache::Locate( const Point& p ) const{
+    unsigned index[3];
+    for( auto i = 0 ; i < 3 ; ++i ){
+        const auto extent = std::max( m_bbox.m_Max[i] - m_bbox.m_Min[i] , 1e-6f );
+        const auto c = saturate( ( p[i] - m_bbox.m_Min[i] ) / extent );
+        index[i] = std::min( (unsigned)( c * m_res[i] ) , m_res[i] - 1 );
+    }
+    return ( index[2] * m_res[1] + index[1] ) * m_res[0] + index[0];
+}
@@ -0,0 +1,158 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include "math/bbox.h"
+#include "spectrum/spectrum.h"
+#include "core/stats.h"
+
+//! @brief  Statistics of the vertices recorded in a cell of the cache while training it.
+struct RRSCellStats{
+    float       moment = 0.0f;      /**< Sum of the squared estimates of radiance reflected at the vertices. */
+    float       cost = 0.0f;        /**< Sum of the number of vertices traced after the vertices. */
+    unsigned    count = 0;          /**< Number of vertices recorded in the cell. */
+};
+
+class RRSCache;
+
+//! @brief  Collect the reflected radiance and the cost of paths for training the cache.
+/**
+ * Similar to the recorder of path guiding, each training thread owns its recorder. Vertices are kept until the path
+ * is done, every contribution found after a vertex is added to it and divided by the throughput of the path at the
+ * vertex once the path is finished. The estimate is accumulated right away in the recorder's own copy of the grid of the
+ * cache, nothing is kept for finished paths.
+ */
+class RRSRecorder{
+public:
+    //! @brief  Create a recorder training a cache.
+    //!
+    //! @param  cache       The cache to be trained, the layout of its grid shouldn't change while recording.
+    explicit RRSRecorder( const RRSCache& cache );
+
+    //! @brief  Add a vertex to the current path, right before the path continues from it.
+    //!
+    //! @param  p           Position of the vertex.
+    //! @param  throughput  Throughput of the path up to the vertex, scattering at the vertex excluded.
+    void    AddVertex( const Point& p , const Spectrum& throughput );
+
+    //! @brief  Add a contribution of the path to all existing vertices.
+    //!
+    //! @param  radiance    The contribution, the throughput of the path is already applied.
+    void    AddRadiance( const Spectrum& radiance );
+
+    //! @brief  Count a vertex traced by the path, it is part of the cost of all existing vertices.
+    void    AddCost(){
+        ++m_cost;
+    }
+
+    //! @brief  Finish the current path and accumulate the estimates of its vertices in the grid.
+    //!
+    //! @return             Contribution of the whole path.
+    Spectrum FinishPath();
+
+    //! @brief  Number of vertices traced by the current path so far.
+    unsigned GetCost() const {
+        return m_cost;
+    }
+
+    //! @brief  Add the accumulated statistics to a grid, the grid of the recorder will be empty afterward.
+    //!
+    //! @param  cells       The grid that the statistics are added to, it has the same layout as the one of the cache.
+    void    Flush( std::vector<RRSCellStats>& cells );
+
+private:
+    //! @brief  A vertex of the path that is being traced.
+    struct RRSVertex{
+        Point       position;       /**< Position of the vertex. */
+        Spectrum    throughput;     /**< Throughput of the path up to the vertex. */
+        Spectrum    radiance;       /**< Contribution of the path found after the vertex. */
+        unsigned    cost;           /**< Number of vertices traced before the vertex. */
+    };
+
+    const RRSCache*             m_cache;        /**< The cache to be trained. */
+    std::vector<RRSVertex>      m_path;         /**< Vertices of the path that is being traced. */
+    std::vector<RRSCellStats>   m_cells;        /**< Statistics accumulated in each cell of the grid. */
+    Spectrum                    m_radiance;     /**< Contribution of the current path. */
+    unsigned                    m_cost = 0;     /**< Number of vertices traced by the current path. */
+};
+
+//! @brief  Spatial cache deciding how many times a path continues from a vertex.
+/**
+ * This is an efficiency-aware Russian roulette and splitting solution. The bounding box of the scene is divided into a
+ * uniform grid, each cell keeps the second moment of the radiance reflected at vertices inside it and the number of
+ * vertices traced after them, both learned in a coarse pass before rendering. Along with the variance and the cost of
+ * pixel estimates learned in the same pass, the number of continuations maximizing the efficiency, which is the
+ * reciprocal of variance times cost, is
+ *
+ *      q = throughput * sqrt( E[Lr^2] / Cost(x) ) / sqrt( Var[I] / Cost(I) )
+ *
+ * Paths with q less than one are terminated with probability ( 1 - q ), paths with q larger than one are split into q
+ * branches, both keep the estimate unbiased by dividing the throughput with q. Unlike the original method, variance and
+ * cost of pixels are averaged over the whole image since the integrator has no knowledge of the pixel of a path.
+ *
+ * Please refer to the following papers for further detail,
+ * Adjoint-Driven Russian Roulette and Splitting in Light Transport Simulation, Vorba and Krivanek, SIGGRAPH 2016
+ * EARS: Efficiency-Aware Russian Roulette and Splitting, Rath et al., SIGGRAPH 2022
+ */
+class RRSCache{
+public:
+    //! @brief  Initialize the cache with no record.
+    //!
+    //! @param  bbox        Bounding box of the scene.
+    void        Initialize( const BBox& bbox );
+
+    //! @brief  Train the cache with the statistics accumulated by recorders.
+    //!
+    //! @param  recorders       Recorders of all training threads, they will be empty afterward.
+    //! @param  pixel_variance  Variance of the estimate of a pixel with a single sample, averaged over all pixels.
+    //! @param  pixel_cost      Number of vertices traced by a single sample of a pixel, averaged over all samples.
+    void        Update( std::vector<RRSRecorder>& recorders , float pixel_variance , float pixel_cost );
+
+    //! @brief  Get the expected number of continuations of a path at a vertex.
+    //!
+    //! @param  p           Position of the vertex.
+    //! @param  throughput  Throughput of the path up to the vertex.
+    //! @return             The expected number of continuations, zero if nothing is learned around the vertex.
+    float       GetFactor( const Point& p , const Spectrum& throughput ) const;
+
+    //! @brief  Whether the cache is trained and can drive the decisions.
+    bool        IsValid() const {
+        return m_pixelEfficiency > 0.0f;
+    }
+
+    //! @brief  Number of cells in the grid.
+    unsigned    GetCellCount() const {
+        return (unsigned)m_cells.size();
+    }
+
+    //! @brief  Find the cell containing a point.
+    //!
+    //! @param  p           The point to be located.
+    //! @return             Index of the cell.
+    unsigned    Locate( const Point& p ) const;
+
+private:
+    BBox                        m_bbox;                     /**< Bounding box of the grid. */
+    unsigned                    m_res[3] = { 1 , 1 , 1 };   /**< Number of cells along each axis. */
+    std::vector<RRSCellStats>   m_cells;                    /**< Statistics of the cells of the grid. */
+    std::vector<float>          m_factors;                  /**< sqrt( E[Lr^2] / Cost(x) ) of each cell, zero if there are too few records. */
+    float                       m_pixelEfficiency = 0.0f;   /**< sqrt( Cost(I) / Var[I] ) of the image, zero if it is not trained. */
+
+    SORT_STATS_ENABLE( "Russian Roulette and Splitting" )
+};
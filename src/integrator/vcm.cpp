@@ -0,0 +1,144 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include "vcm.h"
+#include "core/scene.h"
+#include "core/memory.h"
+#include "core/globalconfig.h"
+#include "core/profile.h"
+
+IMPLEMENT_RTTI( VertexConnectionMerging );
+
+void VertexConnectionMerging::PreProcess( const Scene& scene ){
+    const auto& bbox = scene.GetBBox();
+    m_baseRadius = m_radiusFactor * ( bbox.m_Max - bbox.m_Min ).Length() * 0.5f;
+    m_taskLightVertices.resize( GetIterationTaskCount() );
+
+    // light paths traced in the first iteration already depend on the merging radius.
+    updateRadius( 0 );
+}
+
+unsigned VertexConnectionMerging::GetIterationCount() const{
+    return g_samplePerPixel;
+}
+
+unsigned VertexConnectionMerging::GetIterationTaskCount() const{
+    return std::max( 1u , g_threadCnt );
+}
+
+void VertexConnectionMerging::PrepareIteration( const Scene& scene , unsigned iteration , unsigned task_id ){
+    SORT_PROFILE("Tracing light paths for vertex merging");
+
+    // there is one light path for each pixel in an iteration.
+    const auto total_pixel = (unsigned)( g_resultResollutionWidth * g_resultResollutionHeight );
+    const auto task_cnt = (unsigned)m_taskLightVertices.size();
+    const auto begin = (unsigned)( (unsigned long long)total_pixel * task_id / task_cnt );
+    const auto end = (unsigned)( (unsigned long long)total_pixel * ( task_id + 1 ) / task_cnt );
+
+    auto& light_vertices = m_taskLightVertices[task_id];
+    light_vertices.clear();
+
+    for( auto i = begin ; i < end ; ++i ){
+        SORT_CLEAR_MEMPOOL();
+
+        const Light* light = nullptr;
+        float pdf = 0.0f;
+        auto light_path = _AllocatePath();
+        auto light_path_len = 0u;
+        if( !_TraceLightPath( scene , light_path , light_path_len , light , pdf , false ) )
+            continue;
+
+        // vertices on specular surfaces are kept too, merging with them is rejected by the eye vertex's BSDF.
+        for( auto j = 0u ; j < light_path_len ; ++j ){
+            const auto& vert = light_path[j];
+            VCM_LightVertex light_vertex;
+            light_vertex.p = vert.p;
+            light_vertex.wi = vert.wi;
+            light_vertex.throughput = vert.throughput;
+            light_vertex.vcm = vert.vcm;
+            light_vertex.vm = vert.vm;
+            light_vertex.rr = vert.rr;
+            light_vertex.depth = vert.depth;
+            light_vertices.push_back( light_vertex );
+        }
+    }
+    SORT_CLEAR_MEMPOOL();
+}
+
+void VertexConnectionMerging::BeginIteration( const Scene& scene , unsigned iteration ){
+    SORT_PROFILE("Building hash grid for vertex merging");
+
+    m_lightVertices.clear();
+    for( auto& light_vertices : m_taskLightVertices ){
+        m_lightVertices.insert( m_lightVertices.end() , light_vertices.begin() , light_vertices.end() );
+        light_vertices.clear();
+    }
+
+    std::vector<Point> positions( m_lightVertices.size() );
+    for( auto i = 0u ; i < m_lightVertices.size() ; ++i )
+        positions[i] = m_lightVertices[i].p;
+
+    const auto radius = m_baseRadius / std::pow( (float)( iteration + 1 ) , 0.5f * ( 1.0f - m_radiusAlpha ) );
+    m_grid.Build( positions , radius );
+}
+
+void VertexConnectionMerging::EndIteration( const Scene& scene , unsigned iteration ){
+    m_lightVertices.clear();
+    updateRadius( iteration + 1 );
+}
+
+void VertexConnectionMerging::updateRadius( unsigned iteration ){
+    const auto radius = m_baseRadius / std::pow( (float)( iteration + 1 ) , 0.5f * ( 1.0f - m_radiusAlpha ) );
+
+    // all light paths of an iteration are merged, there is one light path for each pixel.
+    const auto total_pixel = (double)( g_resultResollutionWidth * g_resultResollutionHeight );
+    const auto eta_vcm = PI * radius * radius * total_pixel;
+    m_misVmWeightFactor = MIS( eta_vcm );
+    m_misVcWeightFactor = MIS( 1.0 / eta_vcm );
+    m_vmNormalization = (float)( 1.0 / eta_vcm );
+}
+
+Spectrum VertexConnectionMerging::_MergeVertices( const BDPT_Vertex& eye_vertex ) const{
+    Spectrum li;
+    m_grid.Query( eye_vertex.p , [&]( unsigned index ){
+        const auto& light_vertex = m_lightVertices[index];
+        if( light_vertex.depth + eye_vertex.depth > max_recursive_depth )
+            return;
+
+        // density estimation needs the BSDF without the cosine factor, which is already in the throughput of the light vertex.
+        const auto cos_light = absDot( eye_vertex.n , light_vertex.wi );
+        if( cos_light <= 0.0f )
+            return;
+
+        const auto bsdf_value = eye_vertex.se->Evaluate_BSDF( eye_vertex.wi , light_vertex.wi ) / cos_light;
+        if( bsdf_value.IsBlack() )
+            return;
+
+        // the reverse pdf takes the russian roulette of the light vertex since it would govern if the light path continued.
+        const auto eye_bsdf_pdfw = eye_vertex.se->Pdf_BSDF( eye_vertex.wi , light_vertex.wi ) * eye_vertex.rr;
+        const auto eye_bsdf_rev_pdfw = eye_vertex.se->Pdf_BSDF( light_vertex.wi , eye_vertex.wi ) * light_vertex.rr;
+
+        const double mis_light = light_vertex.vcm * m_misVcWeightFactor + light_vertex.vm * MIS( eye_bsdf_pdfw );
+        const double mis_eye = eye_vertex.vcm * m_misVcWeightFactor + eye_vertex.vm * MIS( eye_bsdf_rev_pdfw );
+        const auto weight = (float)( 1.0f / ( mis_light + 1.0f + mis_eye ) );
+
+        li += light_vertex.throughput * bsdf_value * weight;
+    } );
+
+    return li * eye_vertex.throughput * m_vmNormalization;
+}
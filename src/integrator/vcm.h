@@ -0,0 +1,121 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "bidirpath.h"
+#include "hashgrid.h"
+
+//! @brief  Vertex connection and merging integrator.
+/**
+ * Bi-directional path tracing can't find specular-diffuse-specular paths, like caustics seen through glass, since
+ * there is no way to connect a diffuse vertex with a specular one. Vertex connection and merging combines bi-directional
+ * path tracing with progressive photon mapping, an eye vertex is also merged with nearby light vertices, which handles
+ * such paths in a consistent way. All techniques are combined by multiple importance sampling.
+ *
+ * Rendering is split into iterations with one sample per pixel each. Light paths are traced in parallel tasks before
+ * each iteration, their vertices are organized in a hash grid for merging. The merging radius shrinks progressively
+ * over iterations so that the bias vanishes.
+ *
+ * Please refer to the following paper for further detail,
+ * Light Transport Simulation with Vertex Connection and Merging
+ * http://www.iliyan.com/publications/VertexMerging
+ */
+class VertexConnectionMerging : public BidirPathTracing{
+public:
+    DEFINE_RTTI( VertexConnectionMerging , Integrator );
+
+    //! @brief  Initialize the merging radius of the first iteration.
+    //!
+    //! @param  scene           The scene to be rendered.
+    void        PreProcess( const Scene& scene ) override;
+
+    //! @brief  Each iteration renders one sample per pixel.
+    unsigned    GetIterationCount() const override;
+
+    //! @brief  Number of tasks tracing light paths before each iteration.
+    unsigned    GetIterationTaskCount() const override;
+
+    //! @brief  Trace a share of the light paths of an iteration and keep their vertices.
+    //!
+    //! @param  scene           The rendering scene.
+    //! @param  iteration       Index of the iteration.
+    //! @param  task_id         Index of the task tracing the light paths.
+    void        PrepareIteration( const Scene& scene , unsigned iteration , unsigned task_id ) override;
+
+    //! @brief  Build the hash grid of all light vertices of the iteration.
+    //!
+    //! @param  scene           The rendering scene.
+    //! @param  iteration       Index of the iteration.
+    void        BeginIteration( const Scene& scene , unsigned iteration ) override;
+
+    //! @brief  Release the light vertices and shrink the merging radius for the next iteration.
+    //!
+    //! @param  scene           The rendering scene.
+    //! @param  iteration       Index of the iteration.
+    void        EndIteration( const Scene& scene , unsigned iteration ) override;
+
+    //! @brief  Light vertices are splatted to the whole image, there is no way to support live refresh.
+    bool        NeedRefreshTile() const override{
+        return false;
+    }
+
+    //! @brief      Serializing data from stream
+    //!
+    //! @param      Stream where the serialization data comes from. Depending on different situation, it could come from different places.
+    void    Serialize( IStreamBase& stream ) override {
+        Integrator::Serialize( stream );
+        stream >> m_radiusFactor;
+        stream >> m_radiusAlpha;
+    }
+
+protected:
+    //! @brief  Merge an eye vertex with nearby light vertices.
+    //!
+    //! @param  eye_vertex      The eye vertex to be merged.
+    //! @return                 The radiance contribution of merging.
+    Spectrum    _MergeVertices( const BDPT_Vertex& eye_vertex ) const override;
+
+private:
+    //! @brief  Light vertex kept for merging, scattering event is not needed here.
+    struct VCM_LightVertex{
+        Point       p;              /**< Position of the vertex. */
+        Vector      wi;             /**< Direction pointing to the previous vertex in the light path. */
+        Spectrum    throughput;     /**< Throughput of the light path up to the vertex. */
+        double      vcm = 0.0f;     /**< MIS factor shared by all techniques. */
+        double      vm = 0.0f;      /**< MIS factor of vertex merging. */
+        float       rr = 0.0f;      /**< Russian roulette at the vertex. */
+        int         depth = 0;      /**< Depth of the vertex. */
+    };
+
+    float       m_radiusFactor = 0.003f;    /**< Initial merging radius relative to the size of the scene. */
+    float       m_radiusAlpha = 0.75f;      /**< Controls how fast the merging radius shrinks over iterations. */
+    float       m_baseRadius = 0.0f;        /**< Merging radius of the first iteration. */
+    float       m_vmNormalization = 0.0f;   /**< Normalization factor of density estimation in vertex merging. */
+
+    /**< Light vertices traced by each task preparing the iteration. */
+    std::vector<std::vector<VCM_LightVertex>>   m_taskLightVertices;
+    /**< Light vertices of all tasks in the iteration. */
+    std::vector<VCM_LightVertex>                m_lightVertices;
+    /**< Hash grid of the light vertices for range queries. */
+    HashGrid                                    m_grid;
+
+    //! @brief  Update the merging radius and the MIS factors of an iteration.
+    //!
+    //! @param  iteration       Index of the iteration.
+    void        updateRadius( unsigned iteration );
+};
@@ -0,0 +1,356 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include "wavefrontpath.h"
+#include "math/interaction.h"
+#include "scatteringevent/bssrdf/bssrdf.h"
+#include "core/scene.h"
+#include "integratormethod.h"
+#include "core/profile.h"
+#include "scatteringevent/bsdf/lambert.h"
+#include "scatteringevent/scatteringevent.h"
+#include "medium/medium.h"
+#include "medium/phasefunction.h"
+
+SORT_STATS_DEFINE_COUNTER(sWavefrontBatchCount)
+SORT_STATS_DEFINE_COUNTER(sWavefrontPathCount)
+SORT_STATS_DECLARE_COUNTER(sTotalPathLength)
+SORT_STATS_DECLARE_COUNTER(sPrimaryRayCount)
+
+SORT_STATS_COUNTER("Wavefront Path Tracing", "Batch Count" , sWavefrontBatchCount);
+SORT_STATS_AVG_COUNT("Wavefront Path Tracing", "Average Paths per Batch", sWavefrontPathCount , sWavefrontBatchCount);
+
+IMPLEMENT_RTTI( WavefrontPathTracing );
+
+namespace {
+    //! @brief  State of a path that is alive across stages.
+    struct WavefrontPath{
+        Ray                     ray;                            /**< The ray to be traced next. */
+        Spectrum                L;                              /**< Radiance accumulated so far. */
+        Spectrum                throughput = 1.0f;              /**< Throughput of the path. */
+        MediumStack             ms;                             /**< Medium stack of the path. */
+        SurfaceInteraction      inter;                          /**< Intersection of the current bounce. */
+        const MaterialBase*     material = nullptr;             /**< Material of the intersection. */
+        ScatteringEvent*        se = nullptr;                   /**< Scattering event, it only lives within one bounce. */
+        int                     bounces = 0;                    /**< Number of bounces so far. */
+    };
+
+    //! @brief  Sorting key of a path, paths sharing similar keys are processed next to each other.
+    struct WavefrontKey{
+        uintptr_t   key;
+        unsigned    id;
+
+        bool operator < ( const WavefrontKey& other ) const {
+            return key < other.key;
+        }
+    };
+
+    //! @brief  Insert two zero bits after each of the lower ten bits.
+    SORT_FORCEINLINE unsigned expandBits( unsigned v ){
+        v = ( v * 0x00010001u ) & 0xFF0000FFu;
+        v = ( v * 0x00000101u ) & 0x0F00F00Fu;
+        v = ( v * 0x00000011u ) & 0xC30C30C3u;
+        v = ( v * 0x00000005u ) & 0x49249249u;
+        return v;
+    }
+
+    //! @brief  Sorting key of a ray, direction octant goes first, followed by 27 bits morton code of the origin.
+    SORT_FORCEINLINE unsigned rayKey( const Ray& ray , const BBox& bbox ){
+        const auto octant = ( ray.m_Dir.x < 0.0f ? 1u : 0u ) | ( ray.m_Dir.y < 0.0f ? 2u : 0u ) | ( ray.m_Dir.z < 0.0f ? 4u : 0u );
+
+        unsigned grid[3];
+        for( auto k = 0 ; k < 3 ; ++k ){
+            const auto delta = bbox.Delta( k );
+            const auto t = delta > 0.0f ? ( ray.m_Ori[k] - bbox.m_Min[k] ) / delta : 0.0f;
+            grid[k] = (unsigned)( std::min( std::max( t , 0.0f ) , 1.0f ) * 511.0f );
+        }
+
+        return ( octant << 27 ) | ( expandBits( grid[0] ) << 2 ) | ( expandBits( grid[1] ) << 1 ) | expandBits( grid[2] );
+    }
+}
+
+Spectrum WavefrontPathTracing::Li( const Ray& ray , const PixelSample& ps , const Scene& scene ) const{
+    Spectrum radiance;
+    LiBatch( &ray , 1 , scene , &radiance );
+    return radiance;
+}
+
+void WavefrontPathTracing::LiBatch( const Ray* rays , unsigned cnt , const Scene& scene , Spectrum* radiance ) const{
+    SORT_PROFILE("Wavefront path tracing");
+    SORT_STATS(++sWavefrontBatchCount);
+    SORT_STATS(sWavefrontPathCount += cnt);
+
+    const auto& bbox = scene.GetBBox();
+
+    // generate stage, each camera ray spawns a path
+    std::vector<WavefrontPath> paths( cnt );
+    std::vector<WavefrontKey>  active( cnt );
+    for( auto i = 0u ; i < cnt ; ++i ){
+        SORT_STATS(++sPrimaryRayCount);
+
+        auto& path = paths[i];
+        path.ray = rays[i];
+        scene.RestoreCameraMediumStack( path.ray.m_Ori , path.ms );
+        active[i].id = i;
+    }
+
+    std::vector<WavefrontKey> hits;
+    hits.reserve( cnt );
+
+    // the lack of multiple bounces between different BSSRDF surfaces does introduce a bias.
+    // paths in the batch never start from a BSSRDF surface, those spawned from BSSRDF surfaces are evaluated in 'li'.
+    const auto replaceSSS = ( m_maxBouncesInBSSRDFPath < 1 );
+
+    for( auto local_bounce = 0 ; !active.empty() ; ++local_bounce ){
+        // the scattering events only live in one bounce, so is the managed memory
+        SORT_CLEAR_MEMPOOL();
+
+        // sort rays by direction and origin so that similar rays traverse the acceleration structure together
+        for( auto& a : active )
+            a.key = rayKey( paths[a.id].ray , bbox );
+        std::sort( active.begin() , active.end() );
+
+        // intersection stage
+        hits.clear();
+        for( const auto& a : active ){
+            auto& path = paths[a.id];
+
+            // This introduces bias in the algorithm. 'max_recursive_depth' could be set very large to reduce the side-effect.
+            if( path.bounces >= max_recursive_depth )
+                continue;
+
+            SORT_STATS(++sTotalPathLength);
+
+            if( !scene.GetIntersect( path.ray , path.inter ) ){
+                if( 0 == local_bounce )
+                    path.L = scene.Le( path.ray );
+                continue;
+            }
+
+            hits.push_back( a );
+        }
+
+        // medium stage, paths scattered inside mediums are continued right away
+        active.clear();
+        auto hit_cnt = 0u;
+        for( const auto& h : hits ){
+            auto& path = paths[h.id];
+            auto& r = path.ray;
+
+            MediumInteraction* pMi = nullptr;
+            const auto medium_attenuation = path.ms.Sample( r , path.inter.t , pMi );
+
+            // update the through put based on the medium attenuation due to particle scattering and absorption.
+            path.throughput *= medium_attenuation;
+
+            if( !pMi ){
+                // make sure there is intersected primitive
+                sAssert( nullptr != path.inter.primitive , INTEGRATOR );
+
+                path.material = path.inter.primitive->GetMaterial();
+                sAssert( nullptr != path.material , INTEGRATOR );
+
+                // the material address is good enough to group hit points sharing the same material
+                hits[hit_cnt].id = h.id;
+                hits[hit_cnt++].key = reinterpret_cast<uintptr_t>( path.material );
+                continue;
+            }
+
+            // temporary hard-coded phase function for now
+            IsotropicPhaseFunction hg;
+
+            Vector wi;
+            float pdf = 0.0f;
+            const auto pf = hg.Sample( -r.m_Dir , wi , pdf );
+
+            if ( UNLIKELY(pdf == 0.0f) )
+                continue;
+
+            // evaluate direct light illumination, there is no surface normal inside medium.
+            float light_pdf = 0.0f;
+            const auto  light = scene.SampleLight( pMi->intersect , Vector() , sort_canonical() , &light_pdf );
+            if( light_pdf > 0.0f )
+                path.L += path.throughput * EvaluateDirect( pMi->intersect , &hg , -r.m_Dir , scene , light , path.ms ) / light_pdf;
+
+            // update path weight
+            path.throughput *= pf / pdf;
+
+            if( 0.0f == path.throughput.GetIntensity() )
+                continue;
+
+            r.m_Ori = pMi->intersect;
+            r.m_Dir = wi;
+            r.m_fMin = 0.0f;    // no need for bias anymore since there is no geometry
+
+            // apply russian roulette in volume scattering too
+            if( path.bounces > 3 && path.throughput.GetMaxComponent() < 0.1f ){
+                auto continueProperbility = std::max( 0.05f , 1.0f - path.throughput.GetMaxComponent() );
+                if( sort_canonical() < continueProperbility )
+                    continue;
+                path.throughput /= 1 - continueProperbility;
+            }
+
+            ++path.bounces;
+            active.push_back( h );
+        }
+        hits.resize( hit_cnt );
+
+        // sort the hit points by material, stable sorting keeps the spatial coherency within the same material
+        std::stable_sort( hits.begin() , hits.end() );
+
+        // shading stage, this is where the materials are parsed
+        for( const auto& h : hits ){
+            auto& path = paths[h.id];
+
+            if( local_bounce == 0 )
+                path.L += path.inter.Le( -path.ray.m_Dir );
+
+            // Parse the material and populate the results into a scatteringEvent.
+            SE_Flag seFlag = replaceSSS ? SE_Flag( SE_EVALUATE_ALL | SE_REPLACE_BSSRDF ) : SE_EVALUATE_ALL;
+            path.se = SORT_MALLOC(ScatteringEvent)( path.inter , seFlag );
+            path.material->UpdateScatteringEvent( *path.se );
+
+            // the albedo of the first hit is estimated by the direction sampled to continue the path, if there is one.
+            if( local_bounce == 0 )
+                RecordFirstHit( 1.0f , path.inter.normal , path.inter.t , h.id );
+        }
+
+        // next event estimation and continuation stage
+        for( const auto& h : hits ){
+            auto& path = paths[h.id];
+            auto& r = path.ray;
+            const auto& se = *path.se;
+            const auto material = path.material;
+            auto& ms = path.ms;
+
+            SE_Flag scattering_type_flag;
+            auto pdf_scattering_type = se.SampleScatteringType( scattering_type_flag );
+
+            if( scattering_type_flag & SE_EVALUATE_BXDF ){
+                // evaluate the light
+                auto        light_pdf = 0.0f;
+                const auto  light_sample = LightSample(true);
+                const auto  bsdf_sample = BsdfSample(true);
+                const auto  light = scene.SampleLight( path.inter.intersect , path.inter.normal , light_sample.t , &light_pdf );
+                if( light_pdf > 0.0f )
+                    path.L += path.throughput * EvaluateDirect( se , r , scene, light , light_sample , bsdf_sample , material , ms ) / light_pdf / pdf_scattering_type;
+            }else{
+                BSSRDFIntersections bssrdf_inter;
+                float               bssrdf_pdf = 0.0f;
+                se.Sample_BSSRDF( scene, -r.m_Dir, se.GetInteraction().intersect, bssrdf_inter , bssrdf_pdf);
+
+                // Accumulate the contribution from direct illumination
+                if( bssrdf_inter.cnt > 0 ){
+                    Spectrum total_bssrdf;
+
+                    for( auto i = 0u ; i < bssrdf_inter.cnt ; ++i ){
+                        const auto& pInter = bssrdf_inter.intersections[i];
+                        const auto& intersection = pInter->intersection;
+
+                        // Create a temporary lambert model to account the cos factor, same as the one in path tracing.
+                        ScatteringEvent se(pInter->intersection);
+                        se.AddBxdf( SORT_MALLOC(Lambert)( WHITE_SPECTRUM , FULL_WEIGHT , DIR_UP ) );
+
+                        total_bssrdf += SampleOneLight( se , r , intersection , scene , material , ms ) * pInter->weight;
+                    }
+
+                    path.L += total_bssrdf * path.throughput / pdf_scattering_type / bssrdf_pdf;
+                }
+            }
+
+            // pick another time for the next path
+            pdf_scattering_type = se.SampleScatteringType( scattering_type_flag );
+
+            if( pdf_scattering_type == 0.0f )
+                continue;
+
+            path.throughput /= pdf_scattering_type;
+            if( scattering_type_flag & SE_EVALUATE_BXDF ){
+                // sample the next direction using bsdf
+                float       path_pdf;
+                Vector      wi;
+                const auto  f = se.Sample_BSDF( -r.m_Dir , wi , BsdfSample(true) , path_pdf );
+                if( local_bounce == 0 )
+                    RecordFirstHit( path_pdf > 0.0f ? ( f / path_pdf ).Clamp( 0.0f , 1.0f ) : Spectrum( 0.0f ) , path.inter.normal , path.inter.t , h.id );
+                if( ( f.IsBlack() || path_pdf == 0.0f ) )
+                    continue;
+
+                // as long as the ray is passing through the surface, it is necessary to update the medium stack.
+                const auto interaction_flag = update_interaction_flag( dot( wi , path.inter.gnormal ) , dot( -r.m_Dir , path.inter.gnormal ) );
+                if( SE_Interaction::SE_REFLECTION != interaction_flag ){
+                    MediumInteraction mi;
+                    mi.intersect = path.inter.intersect;
+                    material->UpdateMediumStack( mi , interaction_flag , ms );
+                }
+
+                // update path weight
+                path.throughput *= f / path_pdf;
+
+                if( 0.0f == path.throughput.GetIntensity() )
+                    continue;
+
+                r.m_Ori = path.inter.intersect;
+                r.m_Dir = wi;
+                r.m_fMin = 0.0001f;
+            }else{
+                // Paths leaving BSSRDF surfaces branch into multiple paths, they are evaluated depth-first.
+                BSSRDFIntersections bssrdf_inter;
+                float               bssrdf_pdf = 0.0f;
+                se.Sample_BSSRDF( scene, -r.m_Dir, se.GetInteraction().intersect, bssrdf_inter , bssrdf_pdf);
+
+                if( bssrdf_inter.cnt > 0 ){
+                    Spectrum total_bssrdf;
+
+                    for( auto i = 0u ; i < bssrdf_inter.cnt ; ++i ){
+                        const auto& pInter = bssrdf_inter.intersections[i];
+                        const auto& intersection = pInter->intersection;
+
+                        ScatteringEvent se(pInter->intersection, SE_Flag( SE_EVALUATE_ALL | SE_REPLACE_BSSRDF ));
+                        se.AddBxdf( SORT_MALLOC(Lambert)( WHITE_SPECTRUM , FULL_WEIGHT , DIR_UP ) );
+
+                        // Counts the light from indirect illumination recursively
+                        float pdf = 0.0f;
+                        Vector wi;
+                        Spectrum f = se.Sample_BSDF( -r.m_Dir, wi, BsdfSample(true), pdf);
+                        if (!f.IsBlack() && pdf > 0.0f && !pInter->weight.IsBlack()) {
+                            MediumStack ms_copy = ms;
+                            total_bssrdf += li(Ray(intersection.intersect, wi, 0, 0.0001f), PixelSample(), scene, path.bounces + 1, true, 1, true, ms_copy) * f * pInter->weight / pdf;
+                        }
+                    }
+
+                    path.L += total_bssrdf * path.throughput / bssrdf_pdf;
+                }
+                continue;
+            }
+
+            if( path.bounces > 3 && path.throughput.GetMaxComponent() < 0.1f ){
+                auto continueProperbility = std::max( 0.05f , 1.0f - path.throughput.GetMaxComponent() );
+                if( sort_canonical() < continueProperbility )
+                    continue;
+                path.throughput /= 1 - continueProperbility;
+            }
+
+            ++path.bounces;
+            active.push_back( h );
+        }
+    }
+
+    for( auto i = 0u ; i < cnt ; ++i )
+        radiance[i] = paths[i].L;
+}
@@ -0,0 +1,81 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "pathtracing.h"
+
+//! @brief  Wavefront path tracing.
+/**
+ * Instead of tracing one path all the way to its end before starting the next one, this integrator keeps a batch of
+ * paths alive at the same time and pushes all of them through the same stage before moving to the next one. Each
+ * bounce is split into the following stages,
+ *   - Sort the active rays by direction octant and origin so that rays visiting the same part of the acceleration
+ *     structure are traced next to each other.
+ *   - Intersect all active rays with the scene.
+ *   - Sort the hit points by material so that shading is done on coherent batches.
+ *   - Shade the hit points, which parses the materials and populates scattering events.
+ *   - Next event estimation and path continuation.
+ *
+ * The estimator itself is exactly the same with the one in PathTracing, only the order of evaluation is different. So the
+ * results of the two integrators should match statistically. Paths spawned from BSSRDF surfaces are still evaluated in a
+ * depth-first manner since they are relatively rare and each of them branches into multiple paths.
+ */
+class   WavefrontPathTracing : public PathTracing{
+public:
+    DEFINE_RTTI( WavefrontPathTracing , Integrator );
+
+    //! @brief  Evaluate the radiance along a specific direction.
+    //!
+    //! This is only for compatibility, a batch with only one path will be evaluated.
+    //!
+    //! @param  ray             The ray to be tested with.
+    //! @param  ps              Pixel sample used to evaluate Monte Carlo method.
+    //! @param  scene           The scene to be evaluated.
+    //! @return                 The radiance along the opposite direction that the ray points to.
+    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene) const override;
+
+    //! @brief  Evaluate the radiance of a batch of camera rays.
+    //!
+    //! @param  rays            Camera rays to be evaluated.
+    //! @param  cnt             Number of camera rays in the batch.
+    //! @param  scene           The scene to be evaluated.
+    //! @param  radiance        The radiance along the opposite direction of each camera ray.
+    void        LiBatch( const Ray* rays , unsigned cnt , const Scene& scene , Spectrum* radiance ) const override;
+
+    //! @brief  Number of paths to be evaluated together.
+    //!
+    //! @return                 The number of paths in a batch.
+    unsigned    GetBatchSize() const override {
+        return m_batchSize;
+    }
+
+    //! @brief      Serializing data from stream
+    //!
+    //! @param      Stream where the serialization data comes from. Depending on different situation, it could come from different places.
+    void    Serialize( IStreamBase& stream ) override {
+        PathTracing::Serialize( stream );
+        stream >> m_batchSize;
+        m_batchSize = std::max( 1u , m_batchSize );
+    }
+
+    SORT_STATS_ENABLE( "Wavefront Path Tracing" )
+
+private:
+    /**< Number of paths to be evaluated together. */
+    unsigned    m_batchSize = 4096;
+};
@@ -45,6 +45,7 @@ Spectrum WhittedRT::Li( const Ray& r , const PixelSample& ps , const Scene& scen
     // no support for SSS in this integrator.
     ScatteringEvent se( ip , SE_EVALUATE_ALL_NO_SSS );
     ip.primitive->GetMaterial()->UpdateScatteringEvent(se);
+    RecordFirstHit( se , r , ip );
 
     // lights
     Visibility visibility(scene);
@@ -79,6 +79,19 @@ Spectrum AreaLight::Power() const{
     return m_shape->SurfaceArea() * intensity.GetIntensity() * TWO_PI;
 }
 
+bool AreaLight::GetBounds( LightBounds& bounds ) const{
+    sAssert( m_shape != nullptr, LIGHT );
+    bounds.bbox = m_shape->GetBBox();
+    bounds.phi = Power().GetIntensity();
+
+    // Area lights are either rectangles or disks, both of them only emit on the side where the normal points to.
+    bounds.axis = normalize( m_light2world.TransformNormal( DIR_UP ) );
+    bounds.cos_theta_o = 1.0f;
+    bounds.cos_theta_e = 0.0f;
+    bounds.two_sided = false;
+    return true;
+}
+
 Spectrum AreaLight::Le( const SurfaceInteraction& intersect , const Vector& wo , float* directPdfA , float* emissionPdf ) const{
     const float cos = satDot( wo , intersect.normal );
     if( cos == 0.0f )
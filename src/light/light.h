@@ -19,6 +19,7 @@
 
 #include "spectrum/spectrum.h"
 #include "math/transform.h"
+#include "math/bbox.h"
 #include "core/scene.h"
 #include "math/vector3.h"
 
@@ -66,6 +67,21 @@ private:
     const Scene& m_scene;
 };
 
+//! @brief  Spatial and directional bounds of the emission of a light, or a cluster of lights.
+/**
+ * The emission is bounded by a cone of normals, whose axis is 'axis' and whose half angle is acos(cos_theta_o),
+ * and the spread of emission around each normal, whose half angle is acos(cos_theta_e). Light BVH uses it to
+ * estimate how much a light, or a cluster of lights, could contribute to a shading point.
+ */
+struct LightBounds{
+    BBox        bbox;                   /**< Bounding box of the emitters. */
+    float       phi = 0.0f;             /**< Approximation of the total power of the emitters. */
+    Vector      axis = DIR_UP;          /**< Axis of the cone bounding normals of the emitters. */
+    float       cos_theta_o = 1.0f;     /**< Cosine of the half angle of the cone bounding normals. */
+    float       cos_theta_e = 0.0f;     /**< Cosine of the spread of emission around each normal. */
+    bool        two_sided = false;      /**< Whether emitters emit on both sides of their surfaces. */
+};
+
 //! @brief  Base interface for lights.
 class   Light{
 public:
@@ -102,6 +118,17 @@ public:
         return false;
     }
 
+    //! @brief  Get spatial and directional bounds of the emission of the light.
+    //!
+    //! Lights that can't be bounded, like sky light and distant light, are not organized in light BVH. They are
+    //! sampled separately.
+    //!
+    //! @param  bounds      The bounds of the light.
+    //! @return             Whether the light can be bounded.
+    virtual bool        GetBounds( LightBounds& bounds ) const {
+        return false;
+    }
+
     //! @brief  Get the shape of light, if there is one.
     //!
     //! Some light source has shape attached to it, like area light.
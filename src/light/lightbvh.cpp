@@ -0,0 +1,381 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include "lightbvh.h"
+#include "core/profile.h"
+
+SORT_STATS_DEFINE_COUNTER(sLightBvhNodeCount)
+SORT_STATS_DEFINE_COUNTER(sLightBvhDepth)
+SORT_STATS_DEFINE_COUNTER(sLightBvhBoundedLightCount)
+SORT_STATS_DEFINE_COUNTER(sLightBvhInfiniteLightCount)
+
+SORT_STATS_COUNTER("Light BVH", "Node Count", sLightBvhNodeCount);
+SORT_STATS_COUNTER("Light BVH", "BVH Depth", sLightBvhDepth);
+SORT_STATS_COUNTER("Light BVH", "Bounded Light Count", sLightBvhBoundedLightCount);
+SORT_STATS_COUNTER("Light BVH", "Infinite Light Count", sLightBvhInfiniteLightCount);
+
+// bit trails are stored in 64 bits integers, deeper nodes are not allowed.
+static constexpr unsigned   LIGHT_BVH_MAX_DEPTH = 64;
+// number of buckets along each axis to evaluate the split cost.
+static constexpr unsigned   LIGHT_BVH_BUCKET_CNT = 12;
+// the largest float that is smaller than one.
+static constexpr float      ONE_MINUS_EPSILON = 0.99999994f;
+
+// cos( a - b ) clamped to one if a is smaller than b.
+SORT_STATIC_FORCEINLINE float cosSubClamped( float sin_a , float cos_a , float sin_b , float cos_b ){
+    return cos_a > cos_b ? 1.0f : cos_a * cos_b + sin_a * sin_b;
+}
+
+// sin( a - b ) clamped to zero if a is smaller than b.
+SORT_STATIC_FORCEINLINE float sinSubClamped( float sin_a , float cos_a , float sin_b , float cos_b ){
+    return cos_a > cos_b ? 0.0f : sin_a * cos_b - cos_a * sin_b;
+}
+
+// rotate a vector around an axis, the axis needs to be normalized.
+SORT_STATIC_FORCEINLINE Vector rotate( const Vector& v , const Vector& axis , float theta ){
+    const auto cos_theta = cos( theta );
+    const auto sin_theta = sin( theta );
+    return v * cos_theta + cross( axis , v ) * sin_theta + axis * ( dot( axis , v ) * ( 1.0f - cos_theta ) );
+}
+
+// The importance of a cluster of lights to a shading point. It is a conservative approximation of the light received at
+// the shading point, assuming the lights could be anywhere in the bounding box and face any direction inside the cone.
+static float importance( const LightBounds& bounds , const Point& p , const Vector& n ){
+    const auto center = ( bounds.bbox.m_Min + bounds.bbox.m_Max ) * 0.5f;
+    const auto radius_sqr = ( bounds.bbox.m_Max - bounds.bbox.m_Min ).SquaredLength() * 0.25f;
+
+    // clamp the distance so that it doesn't explode when the shading point is close to or inside the bounding box.
+    const auto delta = p - center;
+    const auto dist_sqr = std::max( delta.SquaredLength() , radius_sqr );
+    const auto inv_dist = 1.0f / sqrt( std::max( dist_sqr , FLT_MIN ) );
+
+    // angle between the axis of the cone and the direction from the center to the shading point.
+    auto cos_theta_w = dot( delta , bounds.axis ) * inv_dist;
+    if( bounds.two_sided )
+        cos_theta_w = fabs( cos_theta_w );
+    const auto sin_theta_w = ssqrt( 1.0f - SQR( cos_theta_w ) );
+
+    // the cone bounding the bounding box viewed from the shading point.
+    const auto cos_theta_b = delta.SquaredLength() < radius_sqr ? -1.0f : ssqrt( 1.0f - radius_sqr / dist_sqr );
+    const auto sin_theta_b = ssqrt( 1.0f - SQR( cos_theta_b ) );
+
+    // the minimum angle between the emission direction and the direction to the shading point.
+    const auto sin_theta_o = ssqrt( 1.0f - SQR( bounds.cos_theta_o ) );
+    const auto cos_theta_x = cosSubClamped( sin_theta_w , cos_theta_w , sin_theta_o , bounds.cos_theta_o );
+    const auto sin_theta_x = sinSubClamped( sin_theta_w , cos_theta_w , sin_theta_o , bounds.cos_theta_o );
+    const auto cos_theta = cosSubClamped( sin_theta_x , cos_theta_x , sin_theta_b , cos_theta_b );
+    if( cos_theta <= bounds.cos_theta_e )
+        return 0.0f;
+
+    auto ret = bounds.phi * cos_theta / dist_sqr;
+
+    // the cosine factor at the shading point, both sides are accepted since the surface could be transmissive.
+    if( n.x != 0.0f || n.y != 0.0f || n.z != 0.0f ){
+        const auto cos_theta_i = fabs( dot( delta , n ) ) * inv_dist;
+        const auto sin_theta_i = ssqrt( 1.0f - SQR( cos_theta_i ) );
+        ret *= cosSubClamped( sin_theta_i , cos_theta_i , sin_theta_b , cos_theta_b );
+    }
+
+    return std::max( ret , 0.0f );
+}
+
+// Merge the bounds of two clusters of lights.
+static LightBounds unionBounds( const LightBounds& b0 , const LightBounds& b1 ){
+    if( b0.phi == 0.0f )
+        return b1;
+    if( b1.phi == 0.0f )
+        return b0;
+
+    LightBounds ret;
+    ret.bbox = Union( b0.bbox , b1.bbox );
+    ret.phi = b0.phi + b1.phi;
+    ret.cos_theta_e = std::min( b0.cos_theta_e , b1.cos_theta_e );
+    ret.two_sided = b0.two_sided || b1.two_sided;
+
+    // merge the cones bounding normals
+    const auto theta_0 = acos( clamp( b0.cos_theta_o , -1.0f , 1.0f ) );
+    const auto theta_1 = acos( clamp( b1.cos_theta_o , -1.0f , 1.0f ) );
+    const auto theta_d = acos( clamp( dot( b0.axis , b1.axis ) , -1.0f , 1.0f ) );
+    if( std::min( theta_d + theta_1 , PI ) <= theta_0 ){
+        ret.axis = b0.axis;
+        ret.cos_theta_o = b0.cos_theta_o;
+        return ret;
+    }
+    if( std::min( theta_d + theta_0 , PI ) <= theta_1 ){
+        ret.axis = b1.axis;
+        ret.cos_theta_o = b1.cos_theta_o;
+        return ret;
+    }
+
+    const auto theta_o = ( theta_0 + theta_d + theta_1 ) * 0.5f;
+    const auto rotation_axis = cross( b0.axis , b1.axis );
+    if( theta_o >= PI || rotation_axis.SquaredLength() == 0.0f ){
+        ret.axis = b0.axis;
+        ret.cos_theta_o = -1.0f;
+        return ret;
+    }
+
+    ret.axis = normalize( rotate( b0.axis , normalize( rotation_axis ) , theta_o - theta_0 ) );
+    ret.cos_theta_o = cos( theta_o );
+    return ret;
+}
+
+// The cost of a cluster of lights, it considers the power, the solid angle of emission and the surface area of the cluster.
+// The bounding box is padded so that clusters of point lights, whose bounding boxes could be flat, are still comparable.
+static float splitCost( const LightBounds& bounds , float axis_ratio , float padding ){
+    if( bounds.phi == 0.0f )
+        return 0.0f;
+
+    const auto theta_o = acos( clamp( bounds.cos_theta_o , -1.0f , 1.0f ) );
+    const auto theta_e = acos( clamp( bounds.cos_theta_e , -1.0f , 1.0f ) );
+    const auto theta_w = std::min( theta_o + theta_e , PI );
+    const auto sin_theta_o = ssqrt( 1.0f - SQR( bounds.cos_theta_o ) );
+    const auto m_omega = TWO_PI * ( 1.0f - bounds.cos_theta_o ) +
+                         HALF_PI * ( 2.0f * theta_w * sin_theta_o - cos( theta_o - 2.0f * theta_w ) - 2.0f * theta_o * sin_theta_o + bounds.cos_theta_o );
+    auto bbox = bounds.bbox;
+    bbox.Expend( padding );
+    return bounds.phi * m_omega * axis_ratio * bbox.SurfaceArea();
+}
+
+void LightBvh::Build( const std::vector<Light*>& lights ){
+    SORT_PROFILE("Build Light BVH");
+
+    m_boundedLights.clear();
+    m_infiniteLights.clear();
+    m_nodes.clear();
+    m_lightToBitTrail.clear();
+
+    std::vector<LightBvh_Primitive> primitives;
+    for( const auto light : lights ){
+        LightBounds bounds;
+        if( !light->GetBounds( bounds ) ){
+            m_infiniteLights.push_back( light );
+            continue;
+        }
+
+        // lights without any power will never be picked
+        if( bounds.phi <= 0.0f )
+            continue;
+
+        LightBvh_Primitive primitive;
+        primitive.bounds = bounds;
+        primitive.centroid = ( bounds.bbox.m_Min + bounds.bbox.m_Max ) * 0.5f;
+        primitive.index = (unsigned)m_boundedLights.size();
+        primitives.push_back( primitive );
+        m_boundedLights.push_back( light );
+    }
+
+    if( !primitives.empty() ){
+        m_nodes.reserve( 2 * primitives.size() - 1 );
+        buildNode( primitives , 0 , (unsigned)primitives.size() , 0 , 0 );
+    }
+
+    SORT_STATS(sLightBvhNodeCount = (StatsInt)m_nodes.size());
+    SORT_STATS(sLightBvhBoundedLightCount = (StatsInt)m_boundedLights.size());
+    SORT_STATS(sLightBvhInfiniteLightCount = (StatsInt)m_infiniteLights.size());
+}
+
+LightBounds LightBvh::buildNode( std::vector<LightBvh_Primitive>& primitives , unsigned start , unsigned end , uint64_t bit_trail , unsigned depth ){
+    SORT_STATS(sLightBvhDepth = std::max( sLightBvhDepth , (StatsInt)depth + 1 ));
+
+    const auto node_index = (unsigned)m_nodes.size();
+    m_nodes.push_back( LightBvh_Node() );
+
+    if( end - start == 1 ){
+        const auto& primitive = primitives[start];
+        auto& node = m_nodes[node_index];
+        node.bounds = primitive.bounds;
+        node.index = primitive.index;
+        node.is_leaf = true;
+        m_lightToBitTrail[m_boundedLights[primitive.index]] = bit_trail;
+        return node.bounds;
+    }
+
+    BBox node_bbox , centroid_bbox;
+    for( auto i = start ; i < end ; ++i ){
+        node_bbox.Union( primitives[i].bounds.bbox );
+        centroid_bbox.Union( primitives[i].centroid );
+    }
+
+    // pick the best split among all buckets along all axes.
+    auto min_cost = FLT_MAX;
+    auto min_cost_axis = -1;
+    auto min_cost_bucket = 0u;
+    const auto max_extent = std::max( node_bbox.Delta( 0 ) , std::max( node_bbox.Delta( 1 ) , node_bbox.Delta( 2 ) ) );
+    const auto padding = 0.01f * max_extent;
+    for( auto axis = 0 ; axis < 3 ; ++axis ){
+        const auto extent = centroid_bbox.Delta( axis );
+        if( extent <= 0.0f )
+            continue;
+
+        LightBounds buckets[LIGHT_BVH_BUCKET_CNT];
+        const auto bucket_id = [&]( const LightBvh_Primitive& primitive ){
+            const auto b = (unsigned)( LIGHT_BVH_BUCKET_CNT * ( primitive.centroid[axis] - centroid_bbox.m_Min[axis] ) / extent );
+            return std::min( b , LIGHT_BVH_BUCKET_CNT - 1 );
+        };
+        for( auto i = start ; i < end ; ++i ){
+            auto& bucket = buckets[bucket_id( primitives[i] )];
+            bucket = unionBounds( bucket , primitives[i].bounds );
+        }
+
+        // clusters that are thin along the split axis are penalized.
+        const auto axis_ratio = max_extent / std::max( node_bbox.Delta( axis ) , FLT_MIN );
+        for( auto i = 1u ; i < LIGHT_BVH_BUCKET_CNT ; ++i ){
+            LightBounds b0 , b1;
+            for( auto j = 0u ; j < i ; ++j )
+                b0 = unionBounds( b0 , buckets[j] );
+            for( auto j = i ; j < LIGHT_BVH_BUCKET_CNT ; ++j )
+                b1 = unionBounds( b1 , buckets[j] );
+
+            const auto cost = splitCost( b0 , axis_ratio , padding ) + splitCost( b1 , axis_ratio , padding );
+            if( cost < min_cost ){
+                min_cost = cost;
+                min_cost_axis = axis;
+                min_cost_bucket = i;
+            }
+        }
+    }
+
+    auto mid = ( start + end ) / 2;
+    if( min_cost_axis >= 0 ){
+        const auto axis = min_cost_axis;
+        const auto extent = centroid_bbox.Delta( axis );
+        const auto middle = std::partition( primitives.begin() + start , primitives.begin() + end , [&]( const LightBvh_Primitive& primitive ){
+            const auto b = (unsigned)( LIGHT_BVH_BUCKET_CNT * ( primitive.centroid[axis] - centroid_bbox.m_Min[axis] ) / extent );
+            return std::min( b , LIGHT_BVH_BUCKET_CNT - 1 ) < min_cost_bucket;
+        });
+        mid = (unsigned)( middle - primitives.begin() );
+    }
+
+    // Fall back to splitting in the middle if the lights can't be separated or the tree is getting too deep. Splitting in
+    // the middle from half of the maximum depth guarantees no node will be deeper than what bit trails can hold.
+    if( mid == start || mid == end || depth >= LIGHT_BVH_MAX_DEPTH / 2 ){
+        mid = ( start + end ) / 2;
+        std::nth_element( primitives.begin() + start , primitives.begin() + mid , primitives.begin() + end ,
+                          [&]( const LightBvh_Primitive& p0 , const LightBvh_Primitive& p1 ){
+            const auto axis = centroid_bbox.MaxAxisId();
+            return p0.centroid[axis] < p1.centroid[axis];
+        });
+    }
+
+    sAssert( depth < LIGHT_BVH_MAX_DEPTH , LIGHT );
+
+    const auto b0 = buildNode( primitives , start , mid , bit_trail , depth + 1 );
+    const auto second_child = (unsigned)m_nodes.size();
+    const auto b1 = buildNode( primitives , mid , end , bit_trail | ( 1ull << depth ) , depth + 1 );
+
+    auto& node = m_nodes[node_index];
+    node.bounds = unionBounds( b0 , b1 );
+    node.index = second_child;
+    node.is_leaf = false;
+    return node.bounds;
+}
+
+float LightBvh::boundedLightProbability() const{
+    if( m_nodes.empty() )
+        return 0.0f;
+    return 1.0f / (float)( m_infiniteLights.size() + 1 );
+}
+
+const Light* LightBvh::Sample( const Point& p , const Vector& n , float u , float* pdf ) const{
+    const auto p_bounded = boundedLightProbability();
+    const auto infinite_cnt = (unsigned)m_infiniteLights.size();
+
+    if( pdf )
+        *pdf = 0.0f;
+
+    // pick an infinite light uniformly
+    if( u >= p_bounded ){
+        if( 0 == infinite_cnt )
+            return nullptr;
+        const auto p_infinite = 1.0f - p_bounded;
+        const auto index = std::min( (unsigned)( ( u - p_bounded ) / p_infinite * infinite_cnt ) , infinite_cnt - 1 );
+        if( pdf )
+            *pdf = p_infinite / infinite_cnt;
+        return m_infiniteLights[index];
+    }
+
+    // walk down the tree, stochastically pick a child at each level
+    u = std::min( u / p_bounded , ONE_MINUS_EPSILON );
+    auto prob = p_bounded;
+    auto node_index = 0u;
+    while( !m_nodes[node_index].is_leaf ){
+        const auto c0 = node_index + 1;
+        const auto c1 = m_nodes[node_index].index;
+        const auto i0 = importance( m_nodes[c0].bounds , p , n );
+        const auto i1 = importance( m_nodes[c1].bounds , p , n );
+        if( i0 == 0.0f && i1 == 0.0f )
+            return nullptr;
+
+        const auto p0 = i0 / ( i0 + i1 );
+        if( u < p0 ){
+            node_index = c0;
+            u = std::min( u / p0 , ONE_MINUS_EPSILON );
+            prob *= p0;
+        }else{
+            node_index = c1;
+            u = std::min( ( u - p0 ) / ( 1.0f - p0 ) , ONE_MINUS_EPSILON );
+            prob *= 1.0f - p0;
+        }
+    }
+
+    // a single light in the tree is not tested at all above.
+    if( 0 == node_index && importance( m_nodes[0].bounds , p , n ) == 0.0f )
+        return nullptr;
+
+    if( pdf )
+        *pdf = prob;
+    return m_boundedLights[m_nodes[node_index].index];
+}
+
+float LightBvh::Pdf( const Point& p , const Vector& n , const Light* light ) const{
+    const auto it = m_lightToBitTrail.find( light );
+    if( it == m_lightToBitTrail.end() ){
+        const auto infinite = std::find( m_infiniteLights.begin() , m_infiniteLights.end() , light );
+        if( infinite == m_infiniteLights.end() )
+            return 0.0f;
+        return ( 1.0f - boundedLightProbability() ) / (float)m_infiniteLights.size();
+    }
+
+    // follow the same path as the one taken to pick the light
+    auto bit_trail = it->second;
+    auto prob = boundedLightProbability();
+    auto node_index = 0u;
+    while( !m_nodes[node_index].is_leaf ){
+        const auto c0 = node_index + 1;
+        const auto c1 = m_nodes[node_index].index;
+        const auto i0 = importance( m_nodes[c0].bounds , p , n );
+        const auto i1 = importance( m_nodes[c1].bounds , p , n );
+        if( i0 == 0.0f && i1 == 0.0f )
+            return 0.0f;
+
+        if( bit_trail & 1 ){
+            prob *= i1 / ( i0 + i1 );
+            node_index = c1;
+        }else{
+            prob *= i0 / ( i0 + i1 );
+            node_index = c0;
+        }
+        bit_trail >>= 1;
+    }
+
+    if( 0 == node_index && importance( m_nodes[0].bounds , p , n ) == 0.0f )
+        return 0.0f;
+
+    return prob;
+}
@@ -0,0 +1,107 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include "light.h"
+#include "core/stats.h"
+
+//! @brief  Bounding volume hierarchy of lights for many-light importance sampling.
+/**
+ * Picking a light purely based on its power works poorly in scenes with lots of lights, most of the lights barely
+ * contribute to a shading point because they are either far away or facing the other way. Light BVH organizes lights
+ * in a binary tree, each node bounds the positions, the power and the emission directions of lights under it. A light
+ * is picked by walking down the tree from the root, one of the two children is stochastically picked at each level
+ * based on how much each child could contribute to the shading point.
+ *
+ * Infinite lights, like sky light and distant light, can't be bounded. They are picked uniformly with a probability
+ * proportional to their number, taking the whole tree as one extra candidate.
+ *
+ * The probability of picking any light at any shading point can be evaluated exactly, which is necessary for multiple
+ * importance sampling.
+ *
+ * Please refer to the following paper for further detail,
+ * Importance Sampling of Many Lights with Adaptive Tree Splitting
+ * https://fpsunflower.github.io/ckulla/data/many-lights-hpg2018.pdf
+ */
+class LightBvh{
+public:
+    //! @brief  Build the light BVH.
+    //!
+    //! @param  lights      All lights in the scene.
+    void            Build( const std::vector<Light*>& lights );
+
+    //! @brief  Pick a light based on its contribution to a shading point.
+    //!
+    //! @param  p           The shading point.
+    //! @param  n           Normal at the shading point, zero vector if there is no surface, like a point in medium.
+    //! @param  u           A canonical random number.
+    //! @param  pdf         The probability of picking the light.
+    //! @return             The picked light, nullptr if no light could contribute to the shading point.
+    const Light*    Sample( const Point& p , const Vector& n , float u , float* pdf ) const;
+
+    //! @brief  Get the probability of picking a light at a shading point.
+    //!
+    //! @param  p           The shading point.
+    //! @param  n           Normal at the shading point, zero vector if there is no surface, like a point in medium.
+    //! @param  light       The light to be evaluated.
+    //! @return             The probability of picking the light by 'Sample' with the same shading point.
+    float           Pdf( const Point& p , const Vector& n , const Light* light ) const;
+
+private:
+    //! @brief  Node of light BVH.
+    struct LightBvh_Node{
+        LightBounds     bounds;             /**< Bounds of all lights under the node. */
+        unsigned        index = 0;          /**< Offset of the second child for interior nodes, index of the light for leaf nodes. */
+        bool            is_leaf = false;    /**< Whether the node is a leaf node. */
+    };
+
+    //! @brief  A light with its bounds, used during construction.
+    struct LightBvh_Primitive{
+        LightBounds     bounds;             /**< Bounds of the light. */
+        Point           centroid;           /**< Center of the bounding box of the light. */
+        unsigned        index = 0;          /**< Index of the light in the bounded light list. */
+    };
+
+    /**< Lights in the tree. */
+    std::vector<const Light*>                       m_boundedLights;
+    /**< Lights that can't be organized in the tree. */
+    std::vector<const Light*>                       m_infiniteLights;
+    /**< Nodes in depth first order, the first child of an interior node is always right after it. */
+    std::vector<LightBvh_Node>                      m_nodes;
+    /**< Path from the root to each light, the i-th bit indicates which child to take at the i-th level. */
+    std::unordered_map<const Light*, uint64_t>      m_lightToBitTrail;
+
+    //! @brief  Split lights recursively and populate the nodes.
+    //!
+    //! @param  primitives  Lights to be organized.
+    //! @param  start       Offset of the first light in the node.
+    //! @param  end         Offset after the last light in the node.
+    //! @param  bit_trail   Path from the root to the node.
+    //! @param  depth       Depth of the node, zero for root node.
+    //! @return             Bounds of the node.
+    LightBounds     buildNode( std::vector<LightBvh_Primitive>& primitives , unsigned start , unsigned end , uint64_t bit_trail , unsigned depth );
+
+    //! @brief  Probability of picking the light BVH instead of an infinite light.
+    //!
+    //! @return             The probability of picking a light in the tree.
+    float           boundedLightProbability() const;
+
+    SORT_STATS_ENABLE( "Light BVH" )
+};
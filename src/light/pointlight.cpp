@@ -76,3 +76,16 @@ Spectrum PointLight::sample_l( const LightSample& ls , Ray& r , float* pdfW , fl
 
     return intensity;
 }
+
+bool PointLight::GetBounds( LightBounds& bounds ) const{
+    const auto light_pos = Point( m_light2world.matrix.m[3] , m_light2world.matrix.m[7] , m_light2world.matrix.m[11] );
+    bounds.bbox = BBox( light_pos , light_pos );
+    bounds.phi = Power().GetIntensity();
+
+    // point light emits in all directions.
+    bounds.axis = DIR_UP;
+    bounds.cos_theta_o = -1.0f;
+    bounds.cos_theta_e = 0.0f;
+    bounds.two_sided = false;
+    return true;
+}
@@ -99,4 +99,18 @@ Spectrum SpotLight::sample_l( const LightSample& ls , Ray& r , float* pdfW , flo
         return 0.0f;
 
     return intensity * d * d;
-}
\ No newline at end of file
+}
+
+bool SpotLight::GetBounds( LightBounds& bounds ) const{
+    const auto light_dir = Vector3f( m_light2world.matrix.m[1] , m_light2world.matrix.m[5] , m_light2world.matrix.m[9] );
+    const auto light_pos = Point( m_light2world.matrix.m[3] , m_light2world.matrix.m[7] , m_light2world.matrix.m[11] );
+    bounds.bbox = BBox( light_pos , light_pos );
+    bounds.phi = Power().GetIntensity();
+
+    // the full intensity is within the falloff start, and it fades out completely at the total range.
+    bounds.axis = normalize( light_dir );
+    bounds.cos_theta_o = cos_falloff_start;
+    bounds.cos_theta_e = cos( acos( clamp( cos_total_range , -1.0f , 1.0f ) ) - acos( clamp( cos_falloff_start , -1.0f , 1.0f ) ) );
+    bounds.two_sided = false;
+    return true;
+}
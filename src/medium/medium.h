@@ -137,4 +137,45 @@ public:
 
     /**< Number of mediums in the stack currently. */
     unsigned         m_mediumCnt = 0;
-};
\ No newline at end of file
+};
+
+// Up to this number of medium boundaries can be recorded along a shadow ray in one single traversal.
+#define MEDIUM_BOUNDARY_MAX_CNT     32
+
+//! @brief  Surfaces with volume attached that a shadow ray passes through.
+/**
+ * Transparency of surfaces along a shadow ray can be accumulated in any order, this is not true for the medium stack though.
+ * Boundaries of mediums are recorded in whatever order they are found during a single traversal, they are sorted afterward
+ * so that the medium stack can be updated in the order of the intersections along the ray.
+ */
+struct MediumBoundaries {
+    //! @brief  A surface with volume attached.
+    struct Boundary {
+        float                   t = 0.0f;           /**< Distance from the origin of the ray to the surface. */
+        float                   cos_theta = 0.0f;   /**< Cosine between the ray direction and the geometric normal. */
+        const MaterialBase*     material = nullptr; /**< Material of the surface. */
+    };
+
+    //! @brief  Record a boundary.
+    //!
+    //! @param  t           Distance from the origin of the ray to the surface.
+    //! @param  cos_theta   Cosine between the ray direction and the geometric normal.
+    //! @param  material    Material of the surface.
+    SORT_FORCEINLINE void Add( const float t , const float cos_theta , const MaterialBase* material ){
+        if( m_boundaryCnt == MEDIUM_BOUNDARY_MAX_CNT ){
+            m_overflow = true;
+            return;
+        }
+        auto& boundary = m_boundaries[m_boundaryCnt++];
+        boundary.t = t;
+        boundary.cos_theta = cos_theta;
+        boundary.material = material;
+    }
+
+    /**< Boundaries recorded, they are not sorted. */
+    Boundary    m_boundaries[MEDIUM_BOUNDARY_MAX_CNT];
+    /**< Number of boundaries recorded. */
+    unsigned    m_boundaryCnt = 0;
+    /**< Whether there are more boundaries than what can be recorded. */
+    bool        m_overflow = false;
+};
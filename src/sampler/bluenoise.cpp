@@ -0,0 +1,133 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "bluenoise.h"
+
+IMPLEMENT_RTTI( BlueNoiseSampler );
+
+static constexpr int        MASK_BITS = 6;
+static constexpr int        MASK_RES = 1 << MASK_BITS;
+static constexpr int        MASK_SIZE = MASK_RES * MASK_RES;
+static constexpr unsigned   MASK_SEED = 0x6a09e667u;
+
+// Generate the blue noise mask with void-and-cluster method, each texel is a rotation in 32 bits fixed point.
+static std::vector<unsigned> generate_mask(){
+    // gaussian filter on the torus, it measures how crowded the neighborhood of a texel is.
+    constexpr float sigma = 1.5f;
+    std::vector<float> filter( MASK_SIZE );
+    for( auto y = 0 ; y < MASK_RES ; ++y ){
+        for( auto x = 0 ; x < MASK_RES ; ++x ){
+            const auto dx = (float)std::min( x , MASK_RES - x );
+            const auto dy = (float)std::min( y , MASK_RES - y );
+            filter[y * MASK_RES + x] = std::exp( -( dx * dx + dy * dy ) / ( 2.0f * sigma * sigma ) );
+        }
+    }
+
+    struct Pattern{
+        std::vector<bool>   points = std::vector<bool>( MASK_SIZE , false );
+        std::vector<float>  energy = std::vector<float>( MASK_SIZE , 0.0f );
+
+        void toggle( int i , const std::vector<float>& filter ){
+            points[i] = !points[i];
+            const auto sign = points[i] ? 1.0f : -1.0f;
+            const auto px = i & ( MASK_RES - 1 ) , py = i >> MASK_BITS;
+            for( auto y = 0 ; y < MASK_RES ; ++y )
+                for( auto x = 0 ; x < MASK_RES ; ++x )
+                    energy[y * MASK_RES + x] += sign * filter[( ( y - py ) & ( MASK_RES - 1 ) ) * MASK_RES + ( ( x - px ) & ( MASK_RES - 1 ) )];
+        }
+        // the point with the most crowded neighborhood.
+        int tightest_cluster() const{
+            auto ret = -1;
+            for( auto i = 0 ; i < MASK_SIZE ; ++i )
+                if( points[i] && ( ret < 0 || energy[i] > energy[ret] ) )
+                    ret = i;
+            return ret;
+        }
+        // the empty texel with the emptiest neighborhood.
+        int largest_void() const{
+            auto ret = -1;
+            for( auto i = 0 ; i < MASK_SIZE ; ++i )
+                if( !points[i] && ( ret < 0 || energy[i] < energy[ret] ) )
+                    ret = i;
+            return ret;
+        }
+    };
+
+    // a fixed seed makes the mask, and hence the rendered image, deterministic.
+    Pattern initial;
+    auto lcg = MASK_SEED;
+    auto initial_cnt = 0;
+    while( initial_cnt < MASK_SIZE / 10 ){
+        lcg = lcg * 1664525u + 1013904223u;
+        const auto i = (int)( lcg >> ( 32 - 2 * MASK_BITS ) );
+        if( !initial.points[i] ){
+            initial.toggle( i , filter );
+            ++initial_cnt;
+        }
+    }
+
+    // spread the initial points evenly by moving the point in the tightest cluster to the largest void.
+    while( true ){
+        const auto cluster = initial.tightest_cluster();
+        initial.toggle( cluster , filter );
+        const auto v = initial.largest_void();
+        initial.toggle( v , filter );
+        if( v == cluster )
+            break;
+    }
+
+    std::vector<int> rank( MASK_SIZE , 0 );
+
+    // points of the initial pattern are ranked by removing them from the tightest cluster one by one.
+    auto pattern = initial;
+    for( auto cnt = initial_cnt ; cnt > 0 ; --cnt ){
+        const auto cluster = pattern.tightest_cluster();
+        pattern.toggle( cluster , filter );
+        rank[cluster] = cnt - 1;
+    }
+
+    // the rest are ranked by filling the largest void one by one.
+    pattern = initial;
+    for( auto cnt = initial_cnt ; cnt < MASK_SIZE ; ++cnt ){
+        const auto v = pattern.largest_void();
+        pattern.toggle( v , filter );
+        rank[v] = cnt;
+    }
+
+    // ranks are uniformly distributed in [0,1), which is exactly what a rotation needs.
+    std::vector<unsigned> mask( MASK_SIZE );
+    for( auto i = 0 ; i < MASK_SIZE ; ++i )
+        mask[i] = (unsigned)( ( rank[i] + 0.5 ) / MASK_SIZE * 4294967296.0 );
+    return mask;
+}
+
+float BlueNoiseSampler::sample( unsigned dimension ) const{
+    static const auto mask = generate_mask();
+
+    // every pixel takes the same point, the seed only depends on the dimension.
+    const auto v = sobol2D( m_index , dimension , hash_combine( MASK_SEED , dimension >> 1 ) );
+
+    const auto offset = hash_combine( dimension , MASK_SEED );
+    const auto x = ( (unsigned)m_x + offset ) & ( MASK_RES - 1 );
+    const auto y = ( (unsigned)m_y + ( offset >> MASK_BITS ) ) & ( MASK_RES - 1 );
+
+    // unsigned overflow wraps the rotated number back to [0,1).
+    return fixed_to_canonical( v + mask[y * MASK_RES + x] );
+}
@@ -0,0 +1,43 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "sobol.h"
+
+//! @brief  Blue noise dithered Sobol sampler.
+/**
+ * All pixels share the same scrambled Sobol point set, each pixel rotates it by a value from a blue noise mask, known as
+ * Cranley-Patterson rotation. Neighboring pixels take very different rotations, which pushes the error of the image to
+ * high frequency. It is a lot less noticeable than white noise at low sample counts, and easier to denoise. Each pair of
+ * dimensions reads the mask with its own toroidal offset, so dimensions are not rotated by the same value.
+ *
+ * The mask is a 64x64 tile generated once by the void-and-cluster method, 'The void-and-cluster method for dither
+ * array generation', Robert Ulichney, SPIE 1993. Please refer to 'Blue-noise Dithered Sampling', Georgiev and Fajardo,
+ * SIGGRAPH 2016 Talks, for further detail.
+ */
+class BlueNoiseSampler : public SobolSampler{
+public:
+    DEFINE_RTTI( BlueNoiseSampler , SequenceSampler );
+
+protected:
+    //! @brief  Evaluate a dimension of the current sample.
+    //!
+    //! @param  dimension   The dimension to be evaluated.
+    //! @return             A canonical number in [0,1).
+    float sample( unsigned dimension ) const override;
+};
@@ -40,8 +40,7 @@ public:
         if( auto_generate )
         {
             t = sort_canonical();
-            u = sort_canonical();
-            v = sort_canonical();
+            sort_canonical2D( u , v );
         }else
         {
             t = 0.0f;
@@ -63,8 +62,7 @@ public:
     BsdfSample(bool auto_generate=false){
         if( auto_generate ){
             t = sort_canonical();
-            u = sort_canonical();
-            v = sort_canonical();
+            sort_canonical2D( u , v );
         }else{
             t = 0.0f;
             v = 0.0f;
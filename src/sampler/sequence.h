@@ -0,0 +1,124 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "core/define.h"
+#include "core/rtti.h"
+
+//! @brief  Hash two integers into one, it is used to derive independent scrambling seeds.
+SORT_STATIC_FORCEINLINE unsigned hash_combine( unsigned a , unsigned b ){
+    auto h = a ^ ( b + 0x9e3779b9u + ( a << 6 ) + ( a >> 2 ) );
+    h ^= h >> 16; h *= 0x7feb352du;
+    h ^= h >> 15; h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+//! @brief  Reverse the bits of an integer.
+SORT_STATIC_FORCEINLINE unsigned reverse_bits( unsigned v ){
+    v = ( ( v >> 1 ) & 0x55555555u ) | ( ( v & 0x55555555u ) << 1 );
+    v = ( ( v >> 2 ) & 0x33333333u ) | ( ( v & 0x33333333u ) << 2 );
+    v = ( ( v >> 4 ) & 0x0f0f0f0fu ) | ( ( v & 0x0f0f0f0fu ) << 4 );
+    v = ( ( v >> 8 ) & 0x00ff00ffu ) | ( ( v & 0x00ff00ffu ) << 8 );
+    return ( v >> 16 ) | ( v << 16 );
+}
+
+//! @brief  Owen scrambling of a 32 bits fixed point number in [0,1).
+//!
+//! Each bit is flipped depending only on the seed and the bits above it, which keeps the stratification of a (t,s)
+//! sequence. It is the hash based approximation from 'Practical Hash-based Owen Scrambling', Brent Burley, JCGT 2020.
+//!
+//! @param  v       Bits of the number, the highest bit is the first digit after the binary point.
+//! @param  seed    Seed of the scrambling.
+//! @return         The scrambled number.
+SORT_STATIC_FORCEINLINE unsigned nested_uniform_scramble( unsigned v , unsigned seed ){
+    // Laine-Karras permutation works on reversed bits, lower bits only depend on higher bits there.
+    v = reverse_bits( v );
+    v += seed;
+    v ^= v * 0x6c50b47cu;
+    v ^= v * 0xb82f1e52u;
+    v ^= v * 0xc7afe638u;
+    v ^= v * 0x8d22f6e6u;
+    return reverse_bits( v );
+}
+
+//! @brief  Convert a 32 bits fixed point number to a canonical number, which is strictly less than one.
+SORT_STATIC_FORCEINLINE float fixed_to_canonical( unsigned v ){
+    constexpr float one_minus_epsilon = 0.99999994f;
+    const auto f = v * ( 1.0f / 4294967296.0f );
+    return f < one_minus_epsilon ? f : one_minus_epsilon;
+}
+
+//! @brief  Dimension-indexed sampler generating well distributed canonical numbers for samples of a pixel.
+/**
+ * Each sample of a pixel is a point in a high dimensional space, every random decision made while evaluating the sample
+ * takes the next dimension of the point. Two consecutive dimensions starting at an even one are stratified together, a
+ * pair of numbers for sampling a 2D domain should be taken through 'Get2D', which skips a dimension if needed.
+ *
+ * Integrators don't talk to the sampler directly. While a sampler is bound to a thread, 'sort_canonical' and
+ * 'sort_canonical2D' take numbers from it instead of the random number generator. This way every decision, including
+ * the ones made deep in light and BSDF sampling, draws from the sequence without passing the sampler around.
+ */
+class SequenceSampler{
+public:
+    //! @brief  Empty virtual destructor.
+    virtual ~SequenceSampler() {}
+
+    //! @brief  Start a new sample of a pixel, dimensions are counted from zero again.
+    //!
+    //! @param  x           Horizontal coordinate of the pixel.
+    //! @param  y           Vertical coordinate of the pixel.
+    //! @param  index       Index of the sample in the pixel.
+    void        StartSample( int x , int y , unsigned index );
+
+    //! @brief  Take the canonical number of the next dimension.
+    //!
+    //! @return             A canonical number in [0,1).
+    SORT_FORCEINLINE float Get1D(){
+        return sample( m_dimension++ );
+    }
+
+    //! @brief  Take a pair of canonical numbers stratified together.
+    //!
+    //! @param  u           The first canonical number.
+    //! @param  v           The second canonical number.
+    SORT_FORCEINLINE void Get2D( float& u , float& v ){
+        m_dimension += m_dimension & 1;
+        u = sample( m_dimension );
+        v = sample( m_dimension + 1 );
+        m_dimension += 2;
+    }
+
+protected:
+    int         m_x = 0;            /**< Horizontal coordinate of the pixel. */
+    int         m_y = 0;            /**< Vertical coordinate of the pixel. */
+    unsigned    m_index = 0;        /**< Index of the sample in the pixel. */
+    unsigned    m_pixelSeed = 0;    /**< Hash of the pixel coordinate. */
+    unsigned    m_dimension = 0;    /**< The next dimension to be taken. */
+
+    //! @brief  Evaluate a dimension of the current sample.
+    //!
+    //! @param  dimension   The dimension to be evaluated.
+    //! @return             A canonical number in [0,1).
+    virtual float sample( unsigned dimension ) const = 0;
+};
+
+//! @brief  The sampler bound to the current thread, nullptr if canonical numbers are generated randomly.
+//!
+//! Render tasks bind their own sampler while evaluating a camera ray, nothing is shared among threads.
+extern thread_local SequenceSampler* g_sequenceSampler;
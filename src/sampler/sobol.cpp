@@ -0,0 +1,51 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "sobol.h"
+
+IMPLEMENT_RTTI( SobolSampler );
+
+// Generator matrix of the second dimension of Sobol sequence, the first dimension is simply the bit reversal.
+static const struct SobolMatrix{
+    unsigned v[32];
+    SobolMatrix(){
+        v[0] = 1u << 31;
+        for( auto i = 1 ; i < 32 ; ++i )
+            v[i] = v[i-1] ^ ( v[i-1] >> 1 );
+    }
+} sobol_matrix;
+
+unsigned SobolSampler::sobol2D( unsigned index , unsigned dimension , unsigned seed ){
+    // points are shuffled in an order keeping the stratification of any power of two consecutive samples.
+    index = nested_uniform_scramble( index , seed );
+
+    unsigned v = 0;
+    if( 0 == ( dimension & 1 ) ){
+        v = reverse_bits( index );
+    }else{
+        for( auto i = 0 ; index ; index >>= 1 , ++i )
+            if( index & 1 )
+                v ^= sobol_matrix.v[i];
+    }
+
+    return nested_uniform_scramble( v , hash_combine( seed , ( dimension & 1 ) + 1 ) );
+}
+
+float SobolSampler::sample( unsigned dimension ) const{
+    const auto seed = hash_combine( m_pixelSeed , dimension >> 1 );
+    return fixed_to_canonical( sobol2D( m_index , dimension , seed ) );
+}
@@ -0,0 +1,49 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "sequence.h"
+
+//! @brief  Scrambled Sobol sampler.
+/**
+ * Only the first two dimensions of Sobol sequence are used, they are the best stratified 2D point set available. Higher
+ * dimensions are padded with independently shuffled and scrambled copies of them, each pair of dimensions shuffles the
+ * sample index with its own seed so that there is no correlation between pairs. Seeds also depend on the pixel, every
+ * pixel has its own well stratified point set and the error shows up as white noise.
+ *
+ * Please refer to 'Practical Hash-based Owen Scrambling', Brent Burley, JCGT 2020, for further detail.
+ */
+class SobolSampler : public SequenceSampler{
+public:
+    DEFINE_RTTI( SobolSampler , SequenceSampler );
+
+protected:
+    //! @brief  Evaluate a dimension of the current sample.
+    //!
+    //! @param  dimension   The dimension to be evaluated.
+    //! @return             A canonical number in [0,1).
+    float sample( unsigned dimension ) const override;
+
+    //! @brief  Evaluate a dimension of a shuffled and scrambled 2D Sobol point.
+    //!
+    //! @param  index       Index of the point.
+    //! @param  dimension   Dimension of the point, only the lowest bit matters.
+    //! @param  seed        Seed shuffling the index and scrambling the point.
+    //! @return             The dimension of the point in 32 bits fixed point.
+    static unsigned sobol2D( unsigned index , unsigned dimension , unsigned seed );
+};
@@ -95,6 +95,13 @@ public:
         return SHAPE_DISK;
     }
 
+    //! @brief      Get the radius of the disk.
+    //!
+    //! @return     The radius of the disk in its local space.
+    float GetRadius() const{
+        return radius;
+    }
+
 private:
     float radius = 1.0f;    /**< The radius of the disk. */
 };
@@ -97,6 +97,14 @@ const BBox& Line::GetBBox() const{
     return *m_bbox;
 }
 
+BBox Line::GetSubBBox( float s0 , float s1 ) const{
+    BBox bbox;
+    bbox.Union( GetCenterPoint( s0 ) );
+    bbox.Union( GetCenterPoint( s1 ) );
+    bbox.Expend( std::max( GetRadius( s0 ) , GetRadius( s1 ) ) );
+    return bbox;
+}
+
 float Line::SurfaceArea() const{
     return m_length * ( m_w0 + m_w1 ) * PI;
 }
@@ -107,6 +115,7 @@ bool Line::GetIntersect(const BBox& box) const{
 
 void Line::SetTransform( const Transform& transform ){
     m_transform = transform;
+    m_bbox = nullptr;
 
     m_gp0 = transform.TransformPoint( m_p0 );
     m_gp1 = transform.TransformPoint( m_p1 );
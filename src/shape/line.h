@@ -121,6 +121,32 @@ public:
         return m_matId;
     }
 
+    //! @brief      Get a point on the center line of the line in world space.
+    //!
+    //! @param s        Parametric position along the line, 0 for one side and 1 for the other.
+    //! @return         The point on the center line.
+    Point           GetCenterPoint( float s ) const {
+        return m_gp0 + ( m_gp1 - m_gp0 ) * s;
+    }
+
+    //! @brief      Get radius of the line at a specific position.
+    //!
+    //! @param s        Parametric position along the line, 0 for one side and 1 for the other.
+    //! @return         The radius of the line at the position.
+    float           GetRadius( float s ) const {
+        return m_w0 + ( m_w1 - m_w0 ) * s;
+    }
+
+    //! @brief      Get bounding box of part of the line in world space.
+    //!
+    //! Long line segments that are not aligned with any axis are poorly bounded by their bounding boxes. Spatial
+    //! data structures can bound pieces of them separately instead.
+    //!
+    //! @param s0       Parametric position where the part starts.
+    //! @param s1       Parametric position where the part ends.
+    //! @return         The bounding box of the part of the line.
+    BBox            GetSubBBox( float s0 , float s1 ) const;
+
     //! @brief Set transform for the shape.
     //!
     //! Vertices of line in local space is pre-transformed into world space. The purpose of doing this is not
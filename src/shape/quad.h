@@ -98,6 +98,20 @@ public:
         return SHAPE_QUAD;
     }
 
+    //! @brief      Get the size of the quad along x axis.
+    //!
+    //! @return     The size of the quad along x axis in its local space.
+    float GetSizeX() const{
+        return sizeX;
+    }
+
+    //! @brief      Get the size of the quad along y axis.
+    //!
+    //! @return     The size of the quad along y axis, which is the z axis of its local space.
+    float GetSizeY() const{
+        return sizeY;
+    }
+
 protected:
     float sizeX = 1.0f;     /**< The size of the quad along x axis. */
     float sizeY = 1.0f;     /**< The size of the quad along y axis. */
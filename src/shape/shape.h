@@ -121,6 +121,11 @@ public:
     //! @return     The bounding box of the shape.
     virtual const   BBox&   GetBBox() const = 0;
 
+    //! @brief      Drop the cached bounding box.
+    //!
+    //! This needs to be called whenever the shape is moved, so that the bounding box will be re-evaluated next time it is needed.
+    void    InvalidateBBox() { m_bbox = nullptr; }
+
     //! @brief      Get the surface area of the shape.
     //!
     //! Get the surface area of the shape. This function is heavily used in the case of picking a area light
@@ -132,7 +137,12 @@ public:
     //! @brief      Set transform for the shape.
     //!
     //! @param transform    The new transform of the shape to be set.
-    virtual void    SetTransform( const Transform& transform ) { m_transform = transform; }
+    virtual void    SetTransform( const Transform& transform ) { m_transform = transform; m_bbox = nullptr; }
+
+    //! @brief      Get transform of the shape.
+    //!
+    //! @return     The transform from local space to world space.
+    const Transform& GetTransform() const { return m_transform; }
 
     //! @brief      Get the type of the shape
     //!
@@ -76,11 +76,12 @@ bool Sphere::GetIntersect( const Ray& ray , SurfaceInteraction* intersect ) cons
     const auto max_t = ( -_b + delta ) * 0.5f;
 
     const auto limit = intersect ? intersect->t : FLT_MAX;
-    if( min_t > limit || max_t <= 0.0f )
+    if( min_t > limit || max_t <= r.m_fMin )
         return false;
 
+    // the nearer intersection is skipped if it is not within the range of the ray, the farther one could still be.
     float t;
-    if( min_t > 0.0f )
+    if( min_t > r.m_fMin )
         t = min_t;
     else if( max_t > limit )
         return false;
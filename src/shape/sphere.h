@@ -97,6 +97,13 @@ public:
         return SHAPE_SPHERE;
     }
 
+    //! @brief      Get the radius of the sphere.
+    //!
+    //! @return     The radius of the sphere in its local space.
+    float GetRadius() const{
+        return radius;
+    }
+
 private:
     float radius = 1.0f;    /**< Radius of the sphere. */
 };
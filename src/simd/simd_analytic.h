@@ -0,0 +1,509 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "core/define.h"
+#include "math/ray.h"
+#include "math/interaction.h"
+#include "core/primitive.h"
+#include "shape/sphere.h"
+#include "shape/disk.h"
+#include "shape/quad.h"
+#include "medium/medium.h"
+
+// Reference implementation is disabled by default, it is only for debugging purposes.
+// #define SIMD_ANALYTIC_REFERENCE_IMPLEMENTATION
+
+#if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
+    static_assert( false , "More than one SIMD version is defined before including simd_analytic.h." );
+#endif
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+
+#ifdef SIMD_SSE_IMPLEMENTATION
+    #define Simd_Analytic_Shape     Analytic_Shape4
+    #define Simd_Sphere             Sphere4
+    #define Simd_Disk               Disk4
+    #define Simd_Quad               Quad4
+#endif
+
+#ifdef SIMD_AVX_IMPLEMENTATION
+    #define Simd_Analytic_Shape     Analytic_Shape8
+    #define Simd_Sphere             Sphere8
+    #define Simd_Disk               Disk8
+    #define Simd_Quad               Quad8
+#endif
+
+//! @brief  Common data of packets of analytic shapes, like sphere, disk and quad.
+/**
+ * Analytic shapes are all defined in their own local space, it is the transformation from world space to local space
+ * that differs from one shape to another most of the time. Rays are transformed into local space of all shapes in a
+ * packet at once, the rest of the intersection is usually just a few instructions.
+ */
+struct alignas(SIMD_ALIGNMENT) Simd_Analytic_Shape{
+    /**< Transformation from world space to the local space of the shapes. */
+    simd_data  m_mat_00, m_mat_01, m_mat_02, m_mat_03;
+    simd_data  m_mat_10, m_mat_11, m_mat_12, m_mat_13;
+    simd_data  m_mat_20, m_mat_21, m_mat_22, m_mat_23;
+
+    simd_data  m_mask;                     /**< Mask marks which shape is valid. */
+
+    /**< Pointers to original primitive. */
+    const Primitive*    m_ori_pri[SIMD_CHANNEL] = { nullptr };
+
+    //! @brief  Push a primitive in the data structure.
+    //!
+    //! @param  primitive   The original primitive.
+    //! @return             Whether the data structure is full.
+    bool PushPrimitive( const Primitive* primitive ){
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+            if( nullptr != m_ori_pri[i] )
+                continue;
+            m_ori_pri[i] = primitive;
+            return i == SIMD_CHANNEL - 1;
+        }
+        return true;
+    }
+
+    //! @brief  Reset the data for reuse
+    void Reset(){
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+            m_ori_pri[i] = nullptr;
+    }
+
+protected:
+    //! @brief  Pack the transformation and the mask of all shapes in the packet.
+    //!
+    //! @return     Whether there is valid shape inside.
+    bool packTransform(){
+        if( !m_ori_pri[0] )
+            return false;
+
+        bool    mask[SIMD_CHANNEL] = { false };
+        float   mat[12][SIMD_CHANNEL] = { { 0.0f } };
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+            if( nullptr == m_ori_pri[i] )
+                continue;
+
+            const auto& world2local = m_ori_pri[i]->GetShape()->GetTransform().invMatrix;
+            for( auto k = 0 ; k < 12 ; ++k )
+                mat[k][i] = world2local.m[k];
+
+            mask[i] = true;
+        }
+
+        m_mat_00 = simd_set_ps( mat[0] );
+        m_mat_01 = simd_set_ps( mat[1] );
+        m_mat_02 = simd_set_ps( mat[2] );
+        m_mat_03 = simd_set_ps( mat[3] );
+        m_mat_10 = simd_set_ps( mat[4] );
+        m_mat_11 = simd_set_ps( mat[5] );
+        m_mat_12 = simd_set_ps( mat[6] );
+        m_mat_13 = simd_set_ps( mat[7] );
+        m_mat_20 = simd_set_ps( mat[8] );
+        m_mat_21 = simd_set_ps( mat[9] );
+        m_mat_22 = simd_set_ps( mat[10] );
+        m_mat_23 = simd_set_ps( mat[11] );
+
+        m_mask = simd_set_mask( mask );
+
+        return true;
+    }
+
+    //! @brief  Transform a ray into the local space of all shapes in the packet.
+    //!
+    //! @param  ray_simd    Resolved simd ray data.
+    //! @param  ori_x       Origin of the ray in local space.
+    //! @param  ori_y       Origin of the ray in local space.
+    //! @param  ori_z       Origin of the ray in local space.
+    //! @param  dir_x       Direction of the ray in local space.
+    //! @param  dir_y       Direction of the ray in local space.
+    //! @param  dir_z       Direction of the ray in local space.
+    SORT_FORCEINLINE void transformRay( const Simd_Ray_Data& ray_simd , simd_data& ori_x , simd_data& ori_y , simd_data& ori_z , simd_data& dir_x , simd_data& dir_y , simd_data& dir_z ) const{
+        ori_x = simd_add_ps( simd_mad_ps( m_mat_02, ray_ori_z(ray_simd), simd_mad_ps( m_mat_01, ray_ori_y(ray_simd), simd_mul_ps( m_mat_00, ray_ori_x(ray_simd)) ) ) , m_mat_03 );
+        ori_y = simd_add_ps( simd_mad_ps( m_mat_12, ray_ori_z(ray_simd), simd_mad_ps( m_mat_11, ray_ori_y(ray_simd), simd_mul_ps( m_mat_10, ray_ori_x(ray_simd)) ) ) , m_mat_13 );
+        ori_z = simd_add_ps( simd_mad_ps( m_mat_22, ray_ori_z(ray_simd), simd_mad_ps( m_mat_21, ray_ori_y(ray_simd), simd_mul_ps( m_mat_20, ray_ori_x(ray_simd)) ) ) , m_mat_23 );
+
+        dir_x = simd_mad_ps( m_mat_02, ray_dir_z(ray_simd), simd_mad_ps( m_mat_01, ray_dir_y(ray_simd), simd_mul_ps( m_mat_00, ray_dir_x(ray_simd) )));
+        dir_y = simd_mad_ps( m_mat_12, ray_dir_z(ray_simd), simd_mad_ps( m_mat_11, ray_dir_y(ray_simd), simd_mul_ps( m_mat_10, ray_dir_x(ray_simd) )));
+        dir_z = simd_mad_ps( m_mat_22, ray_dir_z(ray_simd), simd_mad_ps( m_mat_21, ray_dir_y(ray_simd), simd_mul_ps( m_mat_20, ray_dir_x(ray_simd) )));
+    }
+
+    //! @brief  Fill the part of the intersection shared by all analytic shapes.
+    //!
+    //! @param  ray         Ray in world space.
+    //! @param  i           Index of the shape in the packet.
+    //! @param  t           Distance from the ray origin to the intersection.
+    //! @param  ret         The intersection to be filled.
+    SORT_FORCEINLINE void setupIntersection( const Ray& ray , int i , float t , SurfaceInteraction* ret ) const{
+        ret->t = t;
+        ret->intersect = ray( t );
+        ret->view = -ray.m_Dir;
+        ret->primitive = m_ori_pri[i];
+    }
+};
+
+//! @brief  Packet of spheres.
+struct alignas(SIMD_ALIGNMENT) Simd_Sphere : public Simd_Analytic_Shape{
+    simd_data  m_radius_sq;                 /**< Squared radius of the spheres. */
+
+    //! @brief  Pack sphere information into SIMD compatible data.
+    //!
+    //! @return     Whether there is valid sphere inside.
+    bool PackData(){
+        if( !packTransform() )
+            return false;
+
+        float radius_sq[SIMD_CHANNEL] = { 0.0f };
+        for( auto i = 0 ; i < SIMD_CHANNEL && nullptr != m_ori_pri[i] ; ++i ){
+            const auto radius = static_cast<const Sphere*>( m_ori_pri[i]->GetShape() )->GetRadius();
+            radius_sq[i] = radius * radius;
+        }
+        m_radius_sq = simd_set_ps( radius_sq );
+
+        return true;
+    }
+
+    //! @brief  Intersect a ray with all spheres in the packet.
+    //!
+    //! A ray could hit a sphere twice, the nearest intersection within the range of the ray is the first one. The other one
+    //! is only reported when both of them are within the range of the ray.
+    //!
+    //! @param  ray         Ray to be tested against.
+    //! @param  ray_simd    Resolved simd ray data.
+    //! @param  mask        The mask of valid nearest intersections.
+    //! @param  t_simd      Distance from the ray origin to the nearest intersections.
+    //! @param  mask_far    The mask of valid farther intersections.
+    //! @param  t_far       Distance from the ray origin to the farther intersections.
+    //! @return             Whether there is any intersection.
+    SORT_FORCEINLINE bool Intersect( const Ray& ray , const Simd_Ray_Data& ray_simd , simd_data& mask , simd_data& t_simd , simd_data& mask_far , simd_data& t_far ) const{
+        simd_data ori_x , ori_y , ori_z , dir_x , dir_y , dir_z;
+        transformRay( ray_simd , ori_x , ori_y , ori_z , dir_x , dir_y , dir_z );
+
+        // The 2.0 factor of 'b' is skipped because it is canceled out.
+        const simd_data a = simd_mad_ps( dir_z , dir_z , simd_mad_ps( dir_y , dir_y , simd_mul_ps( dir_x , dir_x ) ) );
+        const simd_data b = simd_mad_ps( dir_z , ori_z , simd_mad_ps( dir_y , ori_y , simd_mul_ps( dir_x , ori_x ) ) );
+        const simd_data c = simd_sub_ps( simd_mad_ps( ori_z , ori_z , simd_mad_ps( ori_y , ori_y , simd_mul_ps( ori_x , ori_x ) ) ) , m_radius_sq );
+
+        const simd_data zeros = simd_zero();
+        const simd_data discriminant = simd_sub_ps( simd_sqr_ps( b ) , simd_mul_ps( a , c ) );
+        mask = simd_and_ps( m_mask , simd_cmpge_ps( discriminant , zeros ) );
+        if( 0 == simd_movemask_ps( mask ) )
+            return false;
+
+        const simd_data sqrt_dist = simd_sqrt_ps( discriminant );
+        const simd_data inv_a = simd_div_ps( simd_set_ps1( 1.0f ) , a );
+        const simd_data t0 = simd_mul_ps( simd_sub_ps( simd_sub_ps( zeros , b ) , sqrt_dist ) , inv_a );
+        const simd_data t1 = simd_mul_ps( simd_sub_ps( sqrt_dist , b ) , inv_a );
+
+        const simd_data ray_min_t = simd_set_ps1( ray.m_fMin );
+        const simd_data ray_max_t = simd_set_ps1( ray.m_fMax );
+        const simd_data mask0 = simd_and_ps( mask , simd_and_ps( simd_cmpgt_ps( t0 , ray_min_t ) , simd_cmplt_ps( t0 , ray_max_t ) ) );
+        const simd_data mask1 = simd_and_ps( mask , simd_and_ps( simd_cmpgt_ps( t1 , ray_min_t ) , simd_cmplt_ps( t1 , ray_max_t ) ) );
+
+        mask = simd_or_ps( mask0 , mask1 );
+        if( 0 == simd_movemask_ps( mask ) )
+            return false;
+
+        t_simd = simd_pick_ps( mask0 , t0 , simd_pick_ps( mask1 , t1 , simd_infinites ) );
+        mask_far = simd_and_ps( mask0 , mask1 );
+        t_far = simd_pick_ps( mask_far , t1 , simd_infinites );
+        return true;
+    }
+
+    //! @brief  Fill the intersection with one of the spheres in the packet.
+    //!
+    //! @param  ray         Ray in world space.
+    //! @param  i           Index of the sphere in the packet.
+    //! @param  t           Distance from the ray origin to the intersection.
+    //! @param  ret         The intersection to be filled.
+    void SetupIntersection( const Ray& ray , int i , float t , SurfaceInteraction* ret ) const{
+        const auto& transform = m_ori_pri[i]->GetShape()->GetTransform();
+        const auto p = transform.invMatrix( ray )( t );
+
+        const auto n = normalize( Vector( p.x , p.y , p.z ) );
+        Vector v0 , v1;
+        coordinateSystem( n , v0 , v1 );
+
+        setupIntersection( ray , i , t , ret );
+        ret->normal = transform.TransformNormal( n );
+        ret->gnormal = ret->normal;
+        ret->tangent = transform.TransformVector( v0 );
+    }
+};
+
+static_assert( sizeof( Simd_Sphere ) % SIMD_ALIGNMENT == 0 , "Incorrect size of Simd_Sphere." );
+
+//! @brief  Packet of disks.
+struct alignas(SIMD_ALIGNMENT) Simd_Disk : public Simd_Analytic_Shape{
+    simd_data  m_radius_sq;                 /**< Squared radius of the disks. */
+
+    //! @brief  Pack disk information into SIMD compatible data.
+    //!
+    //! @return     Whether there is valid disk inside.
+    bool PackData(){
+        if( !packTransform() )
+            return false;
+
+        float radius_sq[SIMD_CHANNEL] = { 0.0f };
+        for( auto i = 0 ; i < SIMD_CHANNEL && nullptr != m_ori_pri[i] ; ++i ){
+            const auto radius = static_cast<const Disk*>( m_ori_pri[i]->GetShape() )->GetRadius();
+            radius_sq[i] = radius * radius;
+        }
+        m_radius_sq = simd_set_ps( radius_sq );
+
+        return true;
+    }
+
+    //! @brief  Intersect a ray with all disks in the packet.
+    //!
+    //! @param  ray         Ray to be tested against.
+    //! @param  ray_simd    Resolved simd ray data.
+    //! @param  mask        The mask of valid intersections.
+    //! @param  t_simd      Distance from the ray origin to the intersections.
+    //! @param  mask_far    A disk can't be intersected twice, it is always zero.
+    //! @param  t_far       A disk can't be intersected twice, it is left untouched.
+    //! @return             Whether there is any intersection.
+    SORT_FORCEINLINE bool Intersect( const Ray& ray , const Simd_Ray_Data& ray_simd , simd_data& mask , simd_data& t_simd , simd_data& mask_far , simd_data& t_far ) const{
+        simd_data ori_x , ori_y , ori_z , dir_x , dir_y , dir_z;
+        transformRay( ray_simd , ori_x , ori_y , ori_z , dir_x , dir_y , dir_z );
+
+        // Rays parallel to the disks lead to infinite or NaN distances, both of them are rejected below.
+        const simd_data t = simd_div_ps( simd_sub_ps( simd_zero() , ori_y ) , dir_y );
+        const simd_data ray_min_t = simd_set_ps1( ray.m_fMin );
+        const simd_data ray_max_t = simd_set_ps1( ray.m_fMax );
+        mask = simd_and_ps( m_mask , simd_and_ps( simd_cmpgt_ps( t , ray_min_t ) , simd_cmplt_ps( t , ray_max_t ) ) );
+        if( 0 == simd_movemask_ps( mask ) )
+            return false;
+
+        const simd_data inter_x = simd_mad_ps( t , dir_x , ori_x );
+        const simd_data inter_z = simd_mad_ps( t , dir_z , ori_z );
+        const simd_data sq_length = simd_mad_ps( inter_z , inter_z , simd_mul_ps( inter_x , inter_x ) );
+        mask = simd_and_ps( mask , simd_cmple_ps( sq_length , m_radius_sq ) );
+        if( 0 == simd_movemask_ps( mask ) )
+            return false;
+
+        t_simd = simd_pick_ps( mask , t , simd_infinites );
+        mask_far = simd_zero();
+        return true;
+    }
+
+    //! @brief  Fill the intersection with one of the disks in the packet.
+    //!
+    //! @param  ray         Ray in world space.
+    //! @param  i           Index of the disk in the packet.
+    //! @param  t           Distance from the ray origin to the intersection.
+    //! @param  ret         The intersection to be filled.
+    void SetupIntersection( const Ray& ray , int i , float t , SurfaceInteraction* ret ) const{
+        const auto& transform = m_ori_pri[i]->GetShape()->GetTransform();
+        setupIntersection( ray , i , t , ret );
+        ret->normal = transform.TransformNormal( DIR_UP );
+        ret->gnormal = ret->normal;
+        ret->tangent = transform.TransformVector( Vector( 0.0f , 0.0f , 1.0f ) );
+    }
+};
+
+static_assert( sizeof( Simd_Disk ) % SIMD_ALIGNMENT == 0 , "Incorrect size of Simd_Disk." );
+
+//! @brief  Packet of quads.
+struct alignas(SIMD_ALIGNMENT) Simd_Quad : public Simd_Analytic_Shape{
+    simd_data  m_half_x , m_half_y;         /**< Half size of the quads along their two axes. */
+
+    //! @brief  Pack quad information into SIMD compatible data.
+    //!
+    //! @return     Whether there is valid quad inside.
+    bool PackData(){
+        if( !packTransform() )
+            return false;
+
+        float half_x[SIMD_CHANNEL] = { 0.0f } , half_y[SIMD_CHANNEL] = { 0.0f };
+        for( auto i = 0 ; i < SIMD_CHANNEL && nullptr != m_ori_pri[i] ; ++i ){
+            const auto quad = static_cast<const Quad*>( m_ori_pri[i]->GetShape() );
+            half_x[i] = quad->GetSizeX() * 0.5f;
+            half_y[i] = quad->GetSizeY() * 0.5f;
+        }
+        m_half_x = simd_set_ps( half_x );
+        m_half_y = simd_set_ps( half_y );
+
+        return true;
+    }
+
+    //! @brief  Intersect a ray with all quads in the packet.
+    //!
+    //! @param  ray         Ray to be tested against.
+    //! @param  ray_simd    Resolved simd ray data.
+    //! @param  mask        The mask of valid intersections.
+    //! @param  t_simd      Distance from the ray origin to the intersections.
+    //! @param  mask_far    A quad can't be intersected twice, it is always zero.
+    //! @param  t_far       A quad can't be intersected twice, it is left untouched.
+    //! @return             Whether there is any intersection.
+    SORT_FORCEINLINE bool Intersect( const Ray& ray , const Simd_Ray_Data& ray_simd , simd_data& mask , simd_data& t_simd , simd_data& mask_far , simd_data& t_far ) const{
+        simd_data ori_x , ori_y , ori_z , dir_x , dir_y , dir_z;
+        transformRay( ray_simd , ori_x , ori_y , ori_z , dir_x , dir_y , dir_z );
+
+        // Rays parallel to the quads lead to infinite or NaN distances, both of them are rejected below.
+        const simd_data zeros = simd_zero();
+        const simd_data t = simd_div_ps( simd_sub_ps( zeros , ori_y ) , dir_y );
+        const simd_data ray_min_t = simd_set_ps1( ray.m_fMin );
+        const simd_data ray_max_t = simd_set_ps1( ray.m_fMax );
+        mask = simd_and_ps( m_mask , simd_and_ps( simd_cmpgt_ps( t , ray_min_t ) , simd_cmplt_ps( t , ray_max_t ) ) );
+        if( 0 == simd_movemask_ps( mask ) )
+            return false;
+
+        const simd_data inter_x = simd_mad_ps( t , dir_x , ori_x );
+        const simd_data inter_z = simd_mad_ps( t , dir_z , ori_z );
+        const simd_data mask_x = simd_and_ps( simd_cmple_ps( inter_x , m_half_x ) , simd_cmpge_ps( inter_x , simd_sub_ps( zeros , m_half_x ) ) );
+        const simd_data mask_z = simd_and_ps( simd_cmple_ps( inter_z , m_half_y ) , simd_cmpge_ps( inter_z , simd_sub_ps( zeros , m_half_y ) ) );
+        mask = simd_and_ps( mask , simd_and_ps( mask_x , mask_z ) );
+        if( 0 == simd_movemask_ps( mask ) )
+            return false;
+
+        t_simd = simd_pick_ps( mask , t , simd_infinites );
+        mask_far = zeros;
+        return true;
+    }
+
+    //! @brief  Fill the intersection with one of the quads in the packet.
+    //!
+    //! @param  ray         Ray in world space.
+    //! @param  i           Index of the quad in the packet.
+    //! @param  t           Distance from the ray origin to the intersection.
+    //! @param  ret         The intersection to be filled.
+    void SetupIntersection( const Ray& ray , int i , float t , SurfaceInteraction* ret ) const{
+        const auto& transform = m_ori_pri[i]->GetShape()->GetTransform();
+        setupIntersection( ray , i , t , ret );
+        ret->normal = transform.TransformNormal( DIR_UP );
+        ret->gnormal = ret->normal;
+        ret->tangent = transform.TransformVector( Vector( 0.0f , 0.0f , 1.0f ) );
+    }
+};
+
+static_assert( sizeof( Simd_Quad ) % SIMD_ALIGNMENT == 0 , "Incorrect size of Simd_Quad." );
+
+//! @brief  With the power of SIMD, this utility function helps intersect a ray with four/eight analytic shapes at the cost of one.
+//!
+//! @param  ray         Ray to be tested against.
+//! @param  ray_simd    Resolved simd ray data.
+//! @param  shape_simd  Data structure holds four/eight spheres, disks or quads.
+//! @param  ret         The result of intersection. It can't be nullptr.
+//! @return             Whether there is any intersection that is valid.
+template<class T>
+SORT_FORCEINLINE bool intersectAnalytic_SIMD( const Ray& ray , const Simd_Ray_Data& ray_simd , const T& shape_simd , SurfaceInteraction* ret ){
+#ifndef SIMD_ANALYTIC_REFERENCE_IMPLEMENTATION
+    sAssert( nullptr != ret , SPATIAL_ACCELERATOR );
+
+    simd_data mask , t_simd , mask_far , t_far;
+    if( !shape_simd.Intersect( ray , ray_simd , mask , t_simd , mask_far , t_far ) )
+        return false;
+
+    mask = simd_and_ps( mask , simd_cmplt_ps( t_simd , simd_set_ps1( ret->t ) ) );
+    if( 0 == simd_movemask_ps( mask ) )
+        return false;
+
+    // find the closest result
+    const simd_data t_min = simd_minreduction_ps( t_simd );
+    const auto res_i = __bsf( simd_movemask_ps( simd_cmpeq_ps( t_simd , t_min ) ) );
+
+    shape_simd.SetupIntersection( ray , res_i , t_simd[res_i] , ret );
+    return true;
+#else
+    bool ret_val = false;
+    for( auto i = 0u ; i < SIMD_CHANNEL && nullptr != shape_simd.m_ori_pri[i] ; ++i )
+        ret_val |= shape_simd.m_ori_pri[i]->GetIntersect( ray , ret );
+    return ret_val;
+#endif
+}
+
+//! @brief  With the power of SIMD, this utility function helps intersect a ray with four/eight analytic shapes at the cost of one.
+//!
+//! This function stops as long as there is an intersection, it is for shadow ray occlusion detection.
+//!
+//! @param  ray         Ray to be tested against.
+//! @param  ray_simd    Resolved simd ray data.
+//! @param  shape_simd  Data structure holds four/eight spheres, disks or quads.
+//! @return             Whether there is any intersection that is valid.
+template<class T>
+SORT_FORCEINLINE bool intersectAnalyticFast_SIMD( const Ray& ray , const Simd_Ray_Data& ray_simd , const T& shape_simd ){
+#ifndef SIMD_ANALYTIC_REFERENCE_IMPLEMENTATION
+    simd_data mask , t_simd , mask_far , t_far;
+    return shape_simd.Intersect( ray , ray_simd , mask , t_simd , mask_far , t_far );
+#else
+    bool ret = false;
+    for( auto i = 0u ; i < SIMD_CHANNEL && ( nullptr != shape_simd.m_ori_pri[i] ) && !ret ; ++i )
+        ret |= shape_simd.m_ori_pri[i]->GetIntersect( ray , nullptr );
+    return ret;
+#endif
+}
+
+//! @brief  With the power of SIMD, this utility function accumulates the transparency of all intersections between a ray and four/eight analytic shapes.
+//!
+//! All intersections within the range of the ray are taken into account, including both intersections of a ray passing through a sphere.
+//!
+//! @param  ray         Ray to be tested against.
+//! @param  ray_simd    Resolved simd ray data.
+//! @param  shape_simd  Data structure holds four/eight spheres, disks or quads.
+//! @param  attenuation The attenuation to be accumulated.
+//! @param  boundaries  Surfaces with volume attached along the ray are recorded here if it is not nullptr.
+//! @return             Whether the ray is fully blocked.
+template<class T>
+SORT_FORCEINLINE bool intersectAnalyticShadow_SIMD( const Ray& ray , const Simd_Ray_Data& ray_simd , const T& shape_simd , Spectrum& attenuation ,
+                                                    MediumBoundaries* boundaries = nullptr ){
+    simd_data mask , t_simd , mask_far , t_far;
+    if( !shape_simd.Intersect( ray , ray_simd , mask , t_simd , mask_far , t_far ) )
+        return false;
+
+    const auto evaluate = [&]( int res_i , float t ){
+        const auto material = shape_simd.m_ori_pri[res_i]->GetMaterial();
+        sAssert( nullptr != material , SPATIAL_ACCELERATOR );
+
+        if( LIKELY(!material->HasTransparency()) ){
+            attenuation = 0.0f;
+            return true;
+        }
+
+        SurfaceInteraction intersection;
+        shape_simd.SetupIntersection( ray , res_i , t , &intersection );
+        attenuation *= material->EvaluateTransparency( intersection );
+        if( attenuation.IsBlack() )
+            return true;
+
+        if( boundaries && material->HasVolumeAttached() )
+            boundaries->Add( t , dot( ray.m_Dir , intersection.gnormal ) , material );
+        return false;
+    };
+
+    auto resolved_mask = simd_movemask_ps( mask );
+    while( resolved_mask ){
+        const auto res_i = __bsf( resolved_mask );
+        resolved_mask &= resolved_mask - 1;
+        if( evaluate( res_i , t_simd[res_i] ) )
+            return true;
+    }
+
+    resolved_mask = simd_movemask_ps( mask_far );
+    while( resolved_mask ){
+        const auto res_i = __bsf( resolved_mask );
+        resolved_mask &= resolved_mask - 1;
+        if( evaluate( res_i , t_far[res_i] ) )
+            return true;
+    }
+
+    return false;
+}
+
+#endif // SIMD_BVH_IMPLEMENTATION
@@ -21,6 +21,7 @@
 #include "math/ray.h"
 #include "shape/line.h"
 #include "core/primitive.h"
+#include "medium/medium.h"
 
 // Reference implementation is disabled by default, it is only for debugging purposes.
 // #define SIMD_LINE_REFERENCE_IMPLEMENTATION
@@ -54,74 +55,77 @@ struct alignas(SIMD_ALIGNMENT) Simd_Line{
 
     simd_data  m_mask;                     /**< Mask marks which line is valid. */
 
+    simd_data  m_ymin , m_ymax;            /**< Range along each line in line local space that the packet is responsible for. */
+
+    /**< Oriented bounding box of all lines in the packet, it is aligned with the strand the lines belong to. */
+    Vector     m_obb_axis[3];
+    float      m_obb_min[3] , m_obb_max[3];
+
     /**< Pointers to original primitive. */
     const Line*         m_ori_line[SIMD_CHANNEL] = { nullptr };
     const Primitive*    m_ori_pri[SIMD_CHANNEL] = { nullptr };
 
+    /**< Pieces of the original lines in the packet, in parametric space of the lines. */
+    float               m_s0[SIMD_CHANNEL] = { 0.0f };
+    float               m_s1[SIMD_CHANNEL] = { 0.0f };
+
 #ifdef SIMD_AVX_IMPLEMENTATION
     char                padding[16];
 #endif
 
     //! @brief  Push a line in the data structure.
     //!
+    //! A line could be split into several pieces, each piece goes to a different packet. Any intersection
+    //! between a ray and the line is only reported by the packet holding the piece where the intersection is.
+    //!
     //! @param  pri     The original primitive.
+    //! @param  s0      Parametric position where the piece of the line starts.
+    //! @param  s1      Parametric position where the piece of the line ends.
     //! @return         Whether the data structure is full.
-    bool PushLine( const Primitive* primitive ){
-#ifdef SIMD_SSE_IMPLEMENTATION
+    bool PushLine( const Primitive* primitive , float s0 = 0.0f , float s1 = 1.0f ){
         const Line* line = dynamic_cast<const Line*>(primitive->GetShape());
-        if( m_ori_pri[0] == nullptr ){
-            m_ori_pri[0] = primitive;
-            m_ori_line[0] = line;
-            return false;
-        }else if( m_ori_pri[1] == nullptr ){
-            m_ori_pri[1] = primitive;
-            m_ori_line[1] = line;
-            return false;
-        }else if( m_ori_pri[2] == nullptr ){
-            m_ori_pri[2] = primitive;
-            m_ori_line[2] = line;
-            return false;
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+            if( nullptr != m_ori_pri[i] )
+                continue;
+            m_ori_pri[i] = primitive;
+            m_ori_line[i] = line;
+            m_s0[i] = s0;
+            m_s1[i] = s1;
+            return i == SIMD_CHANNEL - 1;
         }
-        m_ori_pri[3] = primitive;
-        m_ori_line[3] = line;
         return true;
-#endif
+    }
 
-#ifdef SIMD_AVX_IMPLEMENTATION
-        const Line* line = dynamic_cast<const Line*>(primitive->GetShape());
-        if( m_ori_pri[0] == nullptr ){
-            m_ori_pri[0] = primitive;
-            m_ori_line[0] = line;
-            return false;
-        }else if( m_ori_pri[1] == nullptr ){
-            m_ori_pri[1] = primitive;
-            m_ori_line[1] = line;
-            return false;
-        }else if( m_ori_pri[2] == nullptr ){
-            m_ori_pri[2] = primitive;
-            m_ori_line[2] = line;
-            return false;
-        }else if( m_ori_pri[3] == nullptr ){
-            m_ori_pri[3] = primitive;
-            m_ori_line[3] = line;
-            return false;
-        }else if( m_ori_pri[4] == nullptr ){
-            m_ori_pri[4] = primitive;
-            m_ori_line[4] = line;
-            return false;
-        }else if( m_ori_pri[5] == nullptr ){
-            m_ori_pri[5] = primitive;
-            m_ori_line[5] = line;
-            return false;
-        }else if( m_ori_pri[6] == nullptr ){
-            m_ori_pri[6] = primitive;
-            m_ori_line[6] = line;
-            return false;
+    //! @brief  Whether a ray intersects the oriented bounding box of the packet.
+    //!
+    //! Lines in hair are thin and long, most of them are not aligned with any axis, which makes bounding boxes a very
+    //! poor approximation of them. Testing the box aligned with the strand rejects most rays at a fraction of the cost
+    //! of the ray line intersection.
+    //!
+    //! @param  ray     Ray to be tested against.
+    //! @return         Whether the ray intersects the oriented bounding box.
+    bool IntersectOBB( const Ray& ray ) const{
+        auto tmin = ray.m_fMin;
+        auto tmax = ray.m_fMax;
+        for( auto i = 0 ; i < 3 ; ++i ){
+            const auto& axis = m_obb_axis[i];
+            const auto o = axis.x * ray.m_Ori.x + axis.y * ray.m_Ori.y + axis.z * ray.m_Ori.z;
+            const auto d = axis.x * ray.m_Dir.x + axis.y * ray.m_Dir.y + axis.z * ray.m_Dir.z;
+            if( fabs( d ) < 1e-8f ){
+                if( o < m_obb_min[i] || o > m_obb_max[i] )
+                    return false;
+                continue;
+            }
+
+            const auto inv_d = 1.0f / d;
+            const auto t0 = ( m_obb_min[i] - o ) * inv_d;
+            const auto t1 = ( m_obb_max[i] - o ) * inv_d;
+            tmin = std::max( tmin , std::min( t0 , t1 ) );
+            tmax = std::min( tmax , std::max( t0 , t1 ) );
+            if( tmin > tmax )
+                return false;
         }
-        m_ori_pri[7] = primitive;
-        m_ori_line[7] = line;
         return true;
-#endif
     }
 
     //! @brief  Pack line information into SIMD compatible data.
@@ -137,6 +141,7 @@ struct alignas(SIMD_ALIGNMENT) Simd_Line{
         float   mat_00[SIMD_CHANNEL] , mat_01[SIMD_CHANNEL] , mat_02[SIMD_CHANNEL] , mat_03[SIMD_CHANNEL];
         float   mat_10[SIMD_CHANNEL] , mat_11[SIMD_CHANNEL] , mat_12[SIMD_CHANNEL] , mat_13[SIMD_CHANNEL];
         float   mat_20[SIMD_CHANNEL] , mat_21[SIMD_CHANNEL] , mat_22[SIMD_CHANNEL] , mat_23[SIMD_CHANNEL];
+        float   ymin[SIMD_CHANNEL] = { 0.0f } , ymax[SIMD_CHANNEL] = { 0.0f };
         for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
 			if( nullptr == m_ori_pri[i] ){
 				mask[i] = false;
@@ -171,6 +176,10 @@ struct alignas(SIMD_ALIGNMENT) Simd_Line{
             mat_22[i] = line->m_world2Line.matrix.m[10];
             mat_23[i] = line->m_world2Line.matrix.m[11];
 
+            // the whole line is covered if it is not split, there is no need to check the range at all.
+            ymin[i] = m_s0[i] > 0.0f ? m_s0[i] * line->m_length : -FLT_MAX;
+            ymax[i] = m_s1[i] < 1.0f ? m_s1[i] * line->m_length : FLT_MAX;
+
             mask[i] = true;
         }
 
@@ -199,6 +208,11 @@ struct alignas(SIMD_ALIGNMENT) Simd_Line{
 
         m_mask = simd_set_mask( mask );
 
+        m_ymin = simd_set_ps( ymin );
+        m_ymax = simd_set_ps( ymax );
+
+        packOBB();
+
         return true;
     }
 
@@ -214,6 +228,57 @@ struct alignas(SIMD_ALIGNMENT) Simd_Line{
         m_ori_line[0] = m_ori_line[1] = m_ori_line[2] = m_ori_line[3] = m_ori_line[4] = m_ori_line[5] = m_ori_line[6] = m_ori_line[7] = nullptr;
 #endif
     }
+
+private:
+    //! @brief  Evaluate the oriented bounding box of all lines in the packet.
+    //!
+    //! The box is aligned with the average direction of the lines. Since lines in a packet are usually consecutive
+    //! pieces of one strand, the box is a lot tighter than the axis aligned one.
+    void packOBB(){
+        Vector dir;
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+            if( nullptr == m_ori_line[i] )
+                continue;
+            const auto d = m_ori_line[i]->GetCenterPoint( m_s1[i] ) - m_ori_line[i]->GetCenterPoint( m_s0[i] );
+            dir += dot( dir , d ) < 0.0f ? -d : d;
+        }
+
+        if( dir.SquaredLength() > 0.0f ){
+            m_obb_axis[1] = normalize( dir );
+            coordinateSystem( m_obb_axis[1] , m_obb_axis[0] , m_obb_axis[2] );
+        }else{
+            // fall back to an axis aligned bounding box in case of degenerated lines
+            m_obb_axis[0] = Vector( 1.0f , 0.0f , 0.0f );
+            m_obb_axis[1] = Vector( 0.0f , 1.0f , 0.0f );
+            m_obb_axis[2] = Vector( 0.0f , 0.0f , 1.0f );
+        }
+
+        for( auto k = 0 ; k < 3 ; ++k ){
+            m_obb_min[k] = FLT_MAX;
+            m_obb_max[k] = -FLT_MAX;
+        }
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+            if( nullptr == m_ori_line[i] )
+                continue;
+            const auto line = m_ori_line[i];
+            const auto radius = std::max( line->GetRadius( m_s0[i] ) , line->GetRadius( m_s1[i] ) );
+            const Point end_points[2] = { line->GetCenterPoint( m_s0[i] ) , line->GetCenterPoint( m_s1[i] ) };
+            for( const auto& p : end_points ){
+                for( auto k = 0 ; k < 3 ; ++k ){
+                    const auto proj = m_obb_axis[k].x * p.x + m_obb_axis[k].y * p.y + m_obb_axis[k].z * p.z;
+                    m_obb_min[k] = std::min( m_obb_min[k] , proj - radius );
+                    m_obb_max[k] = std::max( m_obb_max[k] , proj + radius );
+                }
+            }
+        }
+
+        // The ray line intersection happens in a different space, a bit of padding avoids false rejections due to precision.
+        for( auto k = 0 ; k < 3 ; ++k ){
+            const auto padding = 1e-3f * ( m_obb_max[k] - m_obb_min[k] ) + 1e-5f * std::max( fabs( m_obb_min[k] ) , fabs( m_obb_max[k] ) );
+            m_obb_min[k] -= padding;
+            m_obb_max[k] += padding;
+        }
+    }
 };
 
 static_assert( sizeof( Simd_Line ) % SIMD_ALIGNMENT == 0 , "Incorrect size of Simd_Line." );
@@ -230,6 +295,9 @@ static_assert( sizeof( Simd_Line ) % SIMD_ALIGNMENT == 0 , "Incorrect size of Si
 //! @param  inter_z     Intersection in local line space.
 //! @return             Whether there is intersection between the ray and the four lines.
 SORT_FORCEINLINE bool intersectLine_Inner( const Ray& ray , const Simd_Ray_Data& ray_simd, const Simd_Line& line_simd , simd_data& mask , simd_data& t_simd , simd_data& inter_x , simd_data& inter_y , simd_data& inter_z ){
+    if( !line_simd.IntersectOBB( ray ) )
+        return false;
+
     mask = line_simd.m_mask;
 
     const simd_data _ray_ori_x = simd_add_ps( simd_mad_ps( line_simd.m_mat_02, ray_ori_z(ray_simd), simd_mad_ps( line_simd.m_mat_01, ray_ori_y(ray_simd), simd_mul_ps( line_simd.m_mat_00, ray_ori_x(ray_simd)) ) ) , line_simd.m_mat_03 );
@@ -266,6 +334,11 @@ SORT_FORCEINLINE bool intersectLine_Inner( const Ray& ray , const Simd_Ray_Data&
     inter_y = simd_pick_ps( mask0 , inter_y0 , inter_y1 );
     const simd_data mask1 = simd_and_ps( simd_cmplt_ps( inter_y , line_simd.m_length ) , simd_cmpgt_ps( inter_y , zeros ) );
     mask = simd_and_ps( mask , mask1 );
+
+    // Only intersections inside the pieces of the lines held by this packet count, no intersection will be reported twice
+    // even if a line is split into multiple pieces in different packets.
+    const simd_data mask2 = simd_and_ps( simd_cmpge_ps( inter_y , line_simd.m_ymin ) , simd_cmplt_ps( inter_y , line_simd.m_ymax ) );
+    mask = simd_and_ps( mask , mask2 );
     cm = simd_movemask_ps(mask);
     if (0 == cm)
         return false;
@@ -364,4 +437,70 @@ SORT_FORCEINLINE bool intersectLineFast_SIMD( const Ray& ray , const Simd_Ray_Da
 #endif
 }
 
+//! @brief  With the power of SIMD, this utility function accumulates the transparency of all intersections between a ray and four lines.
+//!
+//! All intersections within the range of the ray are taken into account, instead of just the nearest one.
+//!
+//! @param  ray         Ray to be tested against.
+//! @param  ray_simd    Resolved simd ray data.
+//! @param  line_simd   Data structure holds four lines.
+//! @param  attenuation The attenuation to be accumulated.
+//! @param  boundaries  Surfaces with volume attached along the ray are recorded here if it is not nullptr.
+//! @return             Whether the ray is fully blocked.
+SORT_FORCEINLINE bool intersectLineShadow_SIMD( const Ray& ray , const Simd_Ray_Data& ray_simd, const Simd_Line& line_simd , Spectrum& attenuation ,
+                                                MediumBoundaries* boundaries = nullptr ){
+#ifndef SIMD_LINE_REFERENCE_IMPLEMENTATION
+    simd_data mask , t_simd , inter_x , inter_y , inter_z;
+    if( !intersectLine_Inner( ray , ray_simd , line_simd , mask , t_simd , inter_x , inter_y , inter_z ) )
+        return false;
+
+    auto resolved_mask = simd_movemask_ps( mask );
+    while( resolved_mask ){
+        const auto res_i = __bsf( resolved_mask );
+        resolved_mask = resolved_mask & ( resolved_mask - 1 );
+
+        const auto primitive = line_simd.m_ori_pri[res_i];
+        const auto material = primitive->GetMaterial();
+        sAssert( nullptr != material , SPATIAL_ACCELERATOR );
+
+        if( LIKELY(!material->HasTransparency()) ){
+            attenuation = 0.0f;
+            return true;
+        }
+
+        // transparent hair is rare, it is not worth duplicating the intersection setup here.
+        SurfaceInteraction intersection;
+        if( primitive->GetIntersect( ray , &intersection ) ){
+            attenuation *= material->EvaluateTransparency( intersection );
+            if( attenuation.IsBlack() )
+                return true;
+
+            if( boundaries && material->HasVolumeAttached() )
+                boundaries->Add( intersection.t , dot( ray.m_Dir , intersection.gnormal ) , material );
+        }
+    }
+    return false;
+#else
+    for( auto i = 0u ; i < SIMD_CHANNEL && nullptr != line_simd.m_ori_pri[i] ; ++i ){
+        SurfaceInteraction intersection;
+        if( !line_simd.m_ori_pri[i]->GetIntersect( ray , &intersection ) )
+            continue;
+
+        const auto material = line_simd.m_ori_pri[i]->GetMaterial();
+        if( !material->HasTransparency() ){
+            attenuation = 0.0f;
+            return true;
+        }
+
+        attenuation *= material->EvaluateTransparency( intersection );
+        if( attenuation.IsBlack() )
+            return true;
+
+        if( boundaries && material->HasVolumeAttached() )
+            boundaries->Add( intersection.t , dot( ray.m_Dir , intersection.gnormal ) , material );
+    }
+    return false;
+#endif
+}
+
 #endif // SIMD_SSE_IMPLEMENTATION || SIMD_AVX_IMPLEMENTATION
@@ -57,7 +57,7 @@ struct alignas(SIMD_ALIGNMENT) Simd_Ray_Data{
 	simd_data  scale_z;      /**< Scaling along each axis in local coordinate. */
 };
 
-void resolveRayData( const Ray& ray , Simd_Ray_Data& simd_ray_data ){
+SORT_STATIC_FORCEINLINE void resolveRayData( const Ray& ray , Simd_Ray_Data& simd_ray_data ){
     constexpr float delta = 0.00001f;
     const auto dir_x = fabs(ray.m_Dir[0]) < delta ? sign(ray.m_Dir[0]) * delta : ray.m_Dir[0];
     const auto dir_y = fabs(ray.m_Dir[1]) < delta ? sign(ray.m_Dir[1]) * delta : ray.m_Dir[1];
@@ -26,6 +26,7 @@
 #include "core/primitive.h"
 #include "shape/triangle.h"
 #include "entity/visual.h"
+#include "medium/medium.h"
 
 // Reference implementation is disabled by default, it is only for debugging purposes.
 // #define SIMD_TRI_REFERENCE_IMPLEMENTATION
@@ -51,11 +52,27 @@
  * And since it is quite performance sensitive code, everything is inlined and there is no polymorphisms to keep it
  * as simple as possible. However, since there will be extra data kept in the system, it will also insignificantly 
  * incur more cost in term of memory usage.
+ *
+ * With SORT_PRECOMPUTED_TRIANGLE defined, each triangle is stored as the affine transformation from world space to its
+ * barycentric space instead of its three vertices. A ray triangle intersection test is then just one ray plane test plus
+ * two dot products. It takes twelve floats per triangle instead of nine and it is not watertight, for which reason it is
+ * disabled by default.
+ *
+ * Please refer to the following paper for further detail,
+ * Fast Ray-Triangle Intersections by Coordinate Transformation
+ * http://jcgt.org/published/0005/03/03/
  */
 struct alignas(SIMD_ALIGNMENT) Simd_Triangle{
+#ifdef SORT_PRECOMPUTED_TRIANGLE
+    /**< Transformation from world space to barycentric space of the triangle, the third row is along the normal. */
+    simd_data  m_mat_00 , m_mat_01 , m_mat_02 , m_mat_03;
+    simd_data  m_mat_10 , m_mat_11 , m_mat_12 , m_mat_13;
+    simd_data  m_mat_20 , m_mat_21 , m_mat_22 , m_mat_23;
+#else
     simd_data  m_p0_x , m_p0_y , m_p0_z ;  /**< Position of point 0 of the triangle. */
     simd_data  m_p1_x , m_p1_y , m_p1_z ;  /**< Position of point 1 of the triangle. */
     simd_data  m_p2_x , m_p2_y , m_p2_z ;  /**< Position of point 2 of the triangle. */
+#endif
     simd_data  m_mask;
 
     /**< Pointers to original primitives. */
@@ -136,7 +153,11 @@ struct alignas(SIMD_ALIGNMENT) Simd_Triangle{
             return false;
 
         bool	mask[SIMD_CHANNEL] = { false };
+#ifdef SORT_PRECOMPUTED_TRIANGLE
+        float   mat[12][SIMD_CHANNEL] = { { 0.0f } };
+#else
         float   p0_x[SIMD_CHANNEL] , p0_y[SIMD_CHANNEL] , p0_z[SIMD_CHANNEL] , p1_x[SIMD_CHANNEL] , p1_y[SIMD_CHANNEL] , p1_z[SIMD_CHANNEL] , p2_x[SIMD_CHANNEL] , p2_y[SIMD_CHANNEL] , p2_z[SIMD_CHANNEL];
+#endif
         for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
 			if (nullptr == m_ori_pri[i]) {
 				mask[i] = false;
@@ -154,6 +175,25 @@ struct alignas(SIMD_ALIGNMENT) Simd_Triangle{
             const auto& mv1 = mem->m_vertices[id1];
             const auto& mv2 = mem->m_vertices[id2];
 
+#ifdef SORT_PRECOMPUTED_TRIANGLE
+            // The rows are the inverse of the matrix whose columns are the two edges and the normal, degenerated triangles are skipped.
+            const auto e1 = mv1.m_position - mv0.m_position;
+            const auto e2 = mv2.m_position - mv0.m_position;
+            const auto n = cross( e1 , e2 );
+            const auto sq_length = n.SquaredLength();
+            if( sq_length == 0.0f )
+                continue;
+
+            const auto inv_sq_length = 1.0f / sq_length;
+            const Vector rows[3] = { cross( e2 , n ) * inv_sq_length , cross( n , e1 ) * inv_sq_length , n * inv_sq_length };
+            const auto p0 = Vector( mv0.m_position.x , mv0.m_position.y , mv0.m_position.z );
+            for( auto k = 0 ; k < 3 ; ++k ){
+                mat[4 * k][i] = rows[k].x;
+                mat[4 * k + 1][i] = rows[k].y;
+                mat[4 * k + 2][i] = rows[k].z;
+                mat[4 * k + 3][i] = -dot( rows[k] , p0 );
+            }
+#else
             p0_x[i] = mv0.m_position.x;
             p0_y[i] = mv0.m_position.y;
             p0_z[i] = mv0.m_position.z;
@@ -165,10 +205,25 @@ struct alignas(SIMD_ALIGNMENT) Simd_Triangle{
             p2_x[i] = mv2.m_position.x;
             p2_y[i] = mv2.m_position.y;
             p2_z[i] = mv2.m_position.z;
+#endif
 
             mask[i] = true;
         }
 
+#ifdef SORT_PRECOMPUTED_TRIANGLE
+        m_mat_00 = simd_set_ps( mat[0] );
+        m_mat_01 = simd_set_ps( mat[1] );
+        m_mat_02 = simd_set_ps( mat[2] );
+        m_mat_03 = simd_set_ps( mat[3] );
+        m_mat_10 = simd_set_ps( mat[4] );
+        m_mat_11 = simd_set_ps( mat[5] );
+        m_mat_12 = simd_set_ps( mat[6] );
+        m_mat_13 = simd_set_ps( mat[7] );
+        m_mat_20 = simd_set_ps( mat[8] );
+        m_mat_21 = simd_set_ps( mat[9] );
+        m_mat_22 = simd_set_ps( mat[10] );
+        m_mat_23 = simd_set_ps( mat[11] );
+#else
         m_p0_x = simd_set_ps( p0_x );
         m_p0_y = simd_set_ps( p0_y );
         m_p0_z = simd_set_ps( p0_z );
@@ -178,6 +233,7 @@ struct alignas(SIMD_ALIGNMENT) Simd_Triangle{
         m_p2_x = simd_set_ps( p2_x );
         m_p2_y = simd_set_ps( p2_y );
         m_p2_z = simd_set_ps( p2_z );
+#endif
         m_mask = simd_set_mask( mask );
 
         return true;
@@ -212,6 +268,47 @@ template< bool quick_quit >
 SORT_FORCEINLINE bool intersectTriangleInner_SIMD(const Ray& ray, const Simd_Ray_Data& ray_simd, const Simd_Triangle& tri_simd, simd_data& t_simd, simd_data& u_simd, simd_data& v_simd, simd_data& mask) {
     mask = tri_simd.m_mask;
 
+#ifdef SORT_PRECOMPUTED_TRIANGLE
+    // step 0 : the distance to the plane of the triangles along the normal, rays parallel to the triangles lead to invalid 't'
+    //          that are rejected by the range test.
+    const simd_data ori_z = simd_add_ps( simd_mad_ps( tri_simd.m_mat_22, ray_ori_z(ray_simd), simd_mad_ps( tri_simd.m_mat_21, ray_ori_y(ray_simd), simd_mul_ps( tri_simd.m_mat_20, ray_ori_x(ray_simd)) ) ) , tri_simd.m_mat_23 );
+    const simd_data dir_z = simd_mad_ps( tri_simd.m_mat_22, ray_dir_z(ray_simd), simd_mad_ps( tri_simd.m_mat_21, ray_dir_y(ray_simd), simd_mul_ps( tri_simd.m_mat_20, ray_dir_x(ray_simd) )));
+    t_simd = simd_div_ps( simd_sub_ps( simd_zero() , ori_z ) , dir_z );
+
+    const simd_data ray_min_t = simd_set_ps1(ray.m_fMin);
+    const simd_data ray_max_t = simd_set_ps1(ray.m_fMax);
+    mask = simd_and_ps(simd_and_ps(mask, simd_cmpgt_ps(t_simd, ray_min_t)), simd_cmple_ps(t_simd, ray_max_t));
+    auto c = simd_movemask_ps(mask);
+    if (0 == c)
+        return false;
+
+    // step 1 : barycentric coordinates of the intersections on the planes.
+    const simd_data ori_x = simd_add_ps( simd_mad_ps( tri_simd.m_mat_02, ray_ori_z(ray_simd), simd_mad_ps( tri_simd.m_mat_01, ray_ori_y(ray_simd), simd_mul_ps( tri_simd.m_mat_00, ray_ori_x(ray_simd)) ) ) , tri_simd.m_mat_03 );
+    const simd_data dir_x = simd_mad_ps( tri_simd.m_mat_02, ray_dir_z(ray_simd), simd_mad_ps( tri_simd.m_mat_01, ray_dir_y(ray_simd), simd_mul_ps( tri_simd.m_mat_00, ray_dir_x(ray_simd) )));
+    const simd_data u = simd_mad_ps( t_simd , dir_x , ori_x );
+
+    const simd_data ori_y = simd_add_ps( simd_mad_ps( tri_simd.m_mat_12, ray_ori_z(ray_simd), simd_mad_ps( tri_simd.m_mat_11, ray_ori_y(ray_simd), simd_mul_ps( tri_simd.m_mat_10, ray_ori_x(ray_simd)) ) ) , tri_simd.m_mat_13 );
+    const simd_data dir_y = simd_mad_ps( tri_simd.m_mat_12, ray_dir_z(ray_simd), simd_mad_ps( tri_simd.m_mat_11, ray_dir_y(ray_simd), simd_mul_ps( tri_simd.m_mat_10, ray_dir_x(ray_simd) )));
+    const simd_data v = simd_mad_ps( t_simd , dir_y , ori_y );
+
+    const simd_data zeros = simd_zero();
+    const simd_data ones = simd_set_ps1(1.0f);
+    mask = simd_and_ps(mask, simd_and_ps(simd_and_ps(simd_cmpge_ps(u, zeros), simd_cmpge_ps(v, zeros)), simd_cmple_ps(simd_add_ps(u, v), ones)));
+    c = simd_movemask_ps(mask);
+    if (0 == c)
+        return false;
+
+    if (quick_quit)
+        return true;
+
+    // mask out the invalid values
+    t_simd = simd_pick_ps( mask, t_simd, simd_infinites);
+
+    u_simd = u;
+    v_simd = v;
+
+    return true;
+#else
     // step 0 : translate the vertices to ray coordinate system
     simd_data p0[3], p1[3], p2[3];
     p0[0] = simd_sub_ps(tri_simd.m_p0_x, ray_ori_x(ray_simd));
@@ -296,6 +393,7 @@ SORT_FORCEINLINE bool intersectTriangleInner_SIMD(const Ray& ray, const Simd_Ray
     v_simd = simd_mul_ps(e2, rcp_det);
 
     return true;
+#endif
 }
 
 //! @brief  A helper function setup the result of intersection.
@@ -402,6 +500,72 @@ SORT_FORCEINLINE bool intersectTriangleFast_SIMD(const Ray& ray, const Simd_Ray_
 #endif
 }
 
+//! @brief  With the power of SSE/AVX, this utility function accumulates the transparency of all intersections between a ray and four/eight triangles.
+//!
+//! Unlike the above functions, all intersections within the range of the ray are taken into account, instead of just the nearest one.
+//! It is for transparent shadow evaluation in one single traversal, the order of intersections doesn't matter in this case.
+//!
+//! @param  ray         Ray to be tested against.
+//! @param  simd_ray    Resolved simd ray data.
+//! @param  tri_simd    Data structure holds four/eight triangles.
+//! @param  attenuation The attenuation to be accumulated.
+//! @param  boundaries  Surfaces with volume attached along the ray are recorded here if it is not nullptr.
+//! @return             Whether the ray is fully blocked.
+SORT_FORCEINLINE bool intersectTriangleShadow_SIMD(const Ray& ray, const Simd_Ray_Data& ray_simd , const Simd_Triangle& tri_simd , Spectrum& attenuation ,
+                                                   MediumBoundaries* boundaries = nullptr ) {
+#ifndef SIMD_TRI_REFERENCE_IMPLEMENTATION
+    simd_data   u_simd, v_simd, t_simd, mask;
+    const auto intersected = intersectTriangleInner_SIMD<false>(ray, ray_simd, tri_simd, t_simd, u_simd, v_simd, mask);
+    if (!intersected)
+        return false;
+
+    auto resolved_mask = simd_movemask_ps(mask);
+    while (resolved_mask) {
+        const auto res_i = __bsf(resolved_mask);
+        resolved_mask = resolved_mask & (resolved_mask - 1);
+
+        const auto material = tri_simd.m_ori_pri[res_i]->GetMaterial();
+        sAssert( nullptr != material , SPATIAL_ACCELERATOR );
+
+        // there is no need to setup the intersection if the triangle is opaque.
+        if (!material->HasTransparency()) {
+            attenuation = 0.0f;
+            return true;
+        }
+
+        SurfaceInteraction intersection;
+        setupIntersection(tri_simd, ray, t_simd, u_simd, v_simd, res_i, &intersection);
+        attenuation *= material->EvaluateTransparency(intersection);
+        if (attenuation.IsBlack())
+            return true;
+
+        if (boundaries && material->HasVolumeAttached())
+            boundaries->Add(intersection.t, dot(ray.m_Dir, intersection.gnormal), material);
+    }
+    return false;
+#else
+    for( auto i = 0u ; i < SIMD_CHANNEL && nullptr != tri_simd.m_ori_pri[i] ; ++i ){
+        SurfaceInteraction intersection;
+        if( !tri_simd.m_ori_pri[i]->GetIntersect( ray , &intersection ) )
+            continue;
+
+        const auto material = tri_simd.m_ori_pri[i]->GetMaterial();
+        if( !material->HasTransparency() ){
+            attenuation = 0.0f;
+            return true;
+        }
+
+        attenuation *= material->EvaluateTransparency(intersection);
+        if( attenuation.IsBlack() )
+            return true;
+
+        if( boundaries && material->HasVolumeAttached() )
+            boundaries->Add( intersection.t , dot( ray.m_Dir , intersection.gnormal ) , material );
+    }
+    return false;
+#endif
+}
+
 //! @brief  Unlike the above function, this helper function will populate all results in the BSSRDFIntersection data structure.
 //!         It is for BSSRDF intersection tests.
 //!
@@ -22,6 +22,7 @@
 //  - Nan != Nan     ( SIMD, 0xffffffff )     ( Non-SIMD, false )
 
 #include <float.h>
+#include <string.h>
 #include "core/define.h"
 
 #if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
@@ -168,6 +169,11 @@ SORT_STATIC_FORCEINLINE simd_data   simd_minreduction_ps( const simd_data& s ){
     const __m128 t_min = _mm_min_ps( get_sse_data(s) , _mm_shuffle_ps( get_sse_data(s) , get_sse_data(s) , _MM_SHUFFLE(2, 3, 0, 1) ) );
     return _mm_min_ps( t_min , _mm_shuffle_ps(t_min, t_min, _MM_SHUFFLE(1, 0, 3, 2) ) );
 }
+SORT_STATIC_FORCEINLINE simd_data   simd_load_u8_ps( const unsigned char d[] ){
+    int packed;
+    memcpy( &packed , d , sizeof( packed ) );
+    return _mm_cvtepi32_ps( _mm_cvtepu8_epi32( _mm_cvtsi32_si128( packed ) ) );
+}
 
 #endif // SIMD_SSE_IMPLEMENTATION
 #endif // SSE_ENABLED
@@ -310,6 +316,13 @@ SORT_STATIC_FORCEINLINE simd_data   simd_minreduction_ps( const simd_data& s ){
     simd_data_avx reduced_data = _mm256_min_ps(shuffled, avx_data);
     return simd_set_ps1( reduced_data[0] < reduced_data[4] ? reduced_data[0] : reduced_data[4] );
 }
+SORT_STATIC_FORCEINLINE simd_data   simd_load_u8_ps( const unsigned char d[] ){
+    // AVX alone has no 256 bits integer conversion, each half is converted with SSE4.1 instead.
+    const __m128i packed = _mm_loadl_epi64( (const __m128i*)d );
+    const __m128i lo = _mm_cvtepu8_epi32( packed );
+    const __m128i hi = _mm_cvtepu8_epi32( _mm_srli_si128( packed , 4 ) );
+    return _mm256_cvtepi32_ps( _mm256_insertf128_si256( _mm256_castsi128_si256( lo ) , hi , 1 ) );
+}
 
 #endif
 
@@ -40,7 +40,8 @@ void SchedulTasks( Scene& scene , IStreamBase& stream ){
     auto loading_task       = SCHEDULE_TASK<Loading_Task>( "Loading" , DEFAULT_TASK_PRIORITY, {} , scene, stream);
     auto sac_task           = SCHEDULE_TASK<SpatialAccelerationConstruction_Task>( "Spatial Data Structure Construction" , DEFAULT_TASK_PRIORITY, {loading_task} , scene);
     auto savc_task          = SCHEDULE_TASK<SpatialAccelerationVolConstruction_Task>( "Spatial Data Structure (Volume) Construction" , DEFAULT_TASK_PRIORITY, {loading_task} , scene);
-    auto pre_render_task    = SCHEDULE_TASK<PreRender_Task>( "Pre rendering pass" , DEFAULT_TASK_PRIORITY, {sac_task, savc_task} , scene);
+    auto sasc_task          = SCHEDULE_TASK<SpatialAccelerationSSSConstruction_Task>( "Spatial Data Structure (SSS) Construction" , DEFAULT_TASK_PRIORITY, {loading_task} , scene);
+    auto pre_render_task    = SCHEDULE_TASK<PreRender_Task>( "Pre rendering pass" , DEFAULT_TASK_PRIORITY, {sac_task, savc_task, sasc_task} , scene);
 
     // Push render task into the queue
     const auto tilesize = (int)g_tileSize;
@@ -57,7 +58,7 @@ void SchedulTasks( Scene& scene , IStreamBase& stream ){
     int cur_dir_len = 1;
     const Vector2i dir[4] = { Vector2i( 0 , -1 ) , Vector2i( -1 , 0 ) , Vector2i( 0 , 1 ) , Vector2i( 1 , 0 ) };
 
-    unsigned int priority = DEFAULT_TASK_PRIORITY;
+    std::vector<std::pair<Vector2i, Vector2i>> tiles;
     while (true){
         // only process node inside the image region
         if (cur_pos.x >= 0 && cur_pos.x < tile_num.x && cur_pos.y >= 0 && cur_pos.y < tile_num.y ){
@@ -65,7 +66,7 @@ void SchedulTasks( Scene& scene , IStreamBase& stream ){
             Vector2i size( (tilesize < (width - tl.x)) ? tilesize : (width - tl.x) ,
                            (tilesize < (height - tl.y)) ? tilesize : (height - tl.y) );
 
-            SCHEDULE_TASK<Render_Task>( "render task" , priority-- , {pre_render_task} , tl , size , scene );
+            tiles.push_back( std::make_pair( tl , size ) );
         }
 
         // turn to the next direction
@@ -80,6 +81,28 @@ void SchedulTasks( Scene& scene , IStreamBase& stream ){
         if( (cur_pos.x < 0 || cur_pos.x >= tile_num.x ) && (cur_pos.y < 0 || cur_pos.y >= tile_num.y ) )
             break;
     }
+
+    // all tiles of an iteration are rendered before the next iteration gets prepared.
+    const auto iteration_cnt = g_integrator ? std::max( 1u , g_integrator->GetIterationCount() ) : 1u;
+    const auto iteration_task_cnt = g_integrator ? g_integrator->GetIterationTaskCount() : 0u;
+    const Task* prev_task = pre_render_task;
+    for( auto iteration = 0u ; iteration < iteration_cnt ; ++iteration ){
+        unsigned int priority = DEFAULT_TASK_PRIORITY;
+
+        Task::Task_Container preparation_tasks;
+        for( auto i = 0u ; i < iteration_task_cnt ; ++i )
+            preparation_tasks.insert( SCHEDULE_TASK<PrepareIteration_Task>( "prepare iteration" , priority , {prev_task} , scene , iteration , i ) );
+        if( preparation_tasks.empty() )
+            preparation_tasks.insert( prev_task );
+
+        auto begin_task = SCHEDULE_TASK<BeginIteration_Task>( "begin iteration" , priority , preparation_tasks , scene , iteration );
+
+        Task::Task_Container render_tasks;
+        for( const auto& tile : tiles )
+            render_tasks.insert( SCHEDULE_TASK<Render_Task>( "render task" , priority-- , {begin_task} , tile.first , tile.second , scene , iteration ) );
+
+        prev_task = SCHEDULE_TASK<EndIteration_Task>( "end iteration" , priority , render_tasks , scene , iteration );
+    }
 }
 
 int RunSORT( int argc , char** argv ){
@@ -144,6 +167,9 @@ int RunSORT( int argc , char** argv ){
     SORT_STATS(sSamplePerPixel = g_samplePerPixel);
     SORT_STATS(sThreadCnt = g_threadCnt);
 
+    // Radiance splatted by all threads is merged before post processing
+    g_imageSensor->MergeSplats();
+
     // Post process for image sensor
     g_imageSensor->PostProcess();
 
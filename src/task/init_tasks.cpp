@@ -48,3 +48,9 @@ void SpatialAccelerationVolConstruction_Task::Execute() {
 	sAssert(g_acceleratorVol, SPATIAL_ACCELERATOR );
 	g_acceleratorVol->Build(m_scene.GetPrimitivesVol(), m_scene.GetBBoxVol());
 }
+
+void SpatialAccelerationSSSConstruction_Task::Execute(){
+    SORT_STATS( TIMING_EVENT_STAT( "Spatial acceleration (SSS) structure construction" , sPreprocessTimeMS ) );
+
+    m_scene.BuildAcceleratorsSSS();
+}
@@ -73,3 +73,21 @@ private:
 	/**< The scene description to be filled with during loading. */
 	class Scene&      m_scene;
 };
+
+//! @brief  Spatial acceleration data structure construction pass, this is for primitives of materials with sub-surface scattering.
+class SpatialAccelerationSSSConstruction_Task : public Task{
+public:
+    //! @brief Constructor.
+    //!
+    //! @param  scene     Scene to be filled during loading.
+    SpatialAccelerationSSSConstruction_Task( class Scene& scene, const char* name ,
+                 unsigned int priority , const Task::Task_Container& dependencies ) :
+        Task( name , DEFAULT_TASK_PRIORITY, dependencies  ) , m_scene(scene) {}
+
+    //! @brief  Build the accelerators of each material with sub-surface scattering.
+    void        Execute() override;
+
+private:
+    /**< The scene description to be filled with during loading. */
+    class Scene&      m_scene;
+};
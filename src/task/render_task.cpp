@@ -15,6 +15,7 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <algorithm>
 #include "render_task.h"
 #include "integrator/integrator.h"
 #include "sampler/sampler.h"
@@ -22,14 +23,52 @@
 #include "core/globalconfig.h"
 #include "core/scene.h"
 #include "core/profile.h"
+#include "core/timer.h"
+#include "core/rand.h"
 #include "sampler/random.h"
 #include "medium/medium.h"
 
-Render_Task::Render_Task(const Vector2i& ori , const Vector2i& size , const Scene& scene ,
+// Features of a valid camera ray guiding the denoiser.
+static PixelFeatures sampleFeatures( const FirstHit& hit , const Spectrum& li ){
+    PixelFeatures features;
+    features.albedo = hit.albedo;
+    features.normal = hit.normal;
+    features.depth = hit.depth;
+    features.luminance = li.GetIntensity();
+    features.luminance_sqr = features.luminance * features.luminance;
+    features.sample_cnt = 1;
+    return features;
+}
+
+// Add AOVs of a valid camera ray to its pixel, the built-in ones come from its first hit.
+static void accumulateAOVs( float* pixel , float* sample , const FirstHit& hit , float time , unsigned channel_cnt ){
+    g_aovSample = sample;
+    RecordAOV( AOV_ALBEDO , hit.albedo );
+    RecordAOV( AOV_NORMAL , hit.normal );
+    RecordAOV( AOV_DEPTH , hit.depth );
+    RecordAOV( AOV_SAMPLE_COUNT , 1.0f );
+    RecordAOV( AOV_TIME , time );
+    g_aovSample = nullptr;
+
+    for( auto i = 0u ; i < channel_cnt ; ++i )
+        pixel[i] += sample[i];
+}
+
+Render_Task::Render_Task(const Vector2i& ori , const Vector2i& size , const Scene& scene , unsigned iteration ,
             const char* name , unsigned int priority , const Task::Task_Container& dependencies ) :
-            Task( name , priority , dependencies ), m_coord(ori), m_size(size), m_scene(scene){
+            Task( name , priority , dependencies ), m_coord(ori), m_size(size), m_scene(scene), m_iteration(iteration){
+    // samples of each pixel are evenly distributed among iterations.
+    const auto iteration_cnt = g_integrator ? std::max( 1u , g_integrator->GetIterationCount() ) : 1u;
+    m_samplePerPixel = g_samplePerPixel / iteration_cnt + ( m_iteration < g_samplePerPixel % iteration_cnt ? 1 : 0 );
+    // samples of a pixel in later iterations continue the sequence, instead of repeating it.
+    m_sampleOffset = m_iteration * ( g_samplePerPixel / iteration_cnt ) + std::min( m_iteration , g_samplePerPixel % iteration_cnt );
+    m_isLastIteration = m_iteration + 1 == iteration_cnt;
+
     m_sampler = std::make_unique<RandomSampler>();
-    m_pixelSamples = std::make_unique<PixelSample[]>(g_samplePerPixel);
+    m_pixelSamples = std::make_unique<PixelSample[]>(m_samplePerPixel);
+
+    // there is no sequence sampler for 'Random', canonical numbers are generated randomly then.
+    m_sequenceSampler = MakeUniqueInstance<SequenceSampler>( g_samplerType );
 }
 
 void Render_Task::Execute(){
@@ -38,53 +77,228 @@ void Render_Task::Execute(){
     auto camera = m_scene.GetCamera();
 
     // request samples
-    g_integrator->RequestSample( m_sampler.get() , m_pixelSamples.get() , g_samplePerPixel);
+    g_integrator->RequestSample( m_sampler.get() , m_pixelSamples.get() , m_samplePerPixel);
 
     Vector2i rb = m_coord + m_size;
 
-    for( int i = m_coord.y ; i < rb.y ; i++ ){
-        for( int j = m_coord.x ; j < rb.x ; j++ ){
-            // generate samples to be used later
-            g_integrator->GenerateSample( m_sampler.get() , m_pixelSamples.get(), g_samplePerPixel, m_scene );
-
-            // the radiance
-            Spectrum radiance;
-
-            auto valid_pixel_cnt = g_samplePerPixel;
-            for( unsigned k = 0 ; k < g_samplePerPixel; ++k ){
-                // clear managed memory after each pixel
-                SORT_CLEAR_MEMPOOL();
-
-                // generate rays
-                auto r = camera->GenerateRay( (float)j , (float)i , m_pixelSamples[k] );
-                // accumulate the radiance
-                auto li = g_integrator->Li( r , m_pixelSamples[k] , m_scene );
-                if( g_clammping > 0.0f )
-                    li = li.Clamp( 0.0f , g_clammping );
+    // each iteration only takes its share of samples of the pixel.
+    const auto iteration_weight = (float)m_samplePerPixel / (float)g_samplePerPixel;
+
+    // AOVs of the tile are accumulated locally, they are stored once the tile is done.
+    const auto aov_cnt = g_imageSensor->GetAOVLayout().GetChannelCount();
+    auto aovs = aov_cnt ? std::make_unique<float[]>( m_size.x * m_size.y * aov_cnt ) : nullptr;
+    auto sample_aovs = aov_cnt ? std::make_unique<float[]>( aov_cnt ) : nullptr;
+
+    const auto batch_size = g_integrator->GetBatchSize();
+    if( batch_size > 0 ){
+        executeInBatches( batch_size , aovs.get() );
+    }else{
+        for( int i = m_coord.y ; i < rb.y ; i++ ){
+            for( int j = m_coord.x ; j < rb.x ; j++ ){
+                // random numbers of the pixel don't depend on which thread renders the tile, re-rendering is deterministic.
+                sort_seed( j , i , m_iteration );
+
+                // generate samples to be used later
+                g_integrator->GenerateSample( m_sampler.get() , m_pixelSamples.get(), m_samplePerPixel, m_scene );
+
+                // the radiance
+                Spectrum radiance;
+                PixelFeatures features;
+
+                const auto pixel_aovs = aovs ? aovs.get() + ( ( i - m_coord.y ) * m_size.x + j - m_coord.x ) * aov_cnt : nullptr;
+
+                auto valid_pixel_cnt = m_samplePerPixel;
+                for( unsigned k = 0 ; k < m_samplePerPixel; ++k ){
+                    // clear managed memory after each pixel
+                    SORT_CLEAR_MEMPOOL();
+
+                    // AOVs recorded by the integrator go to the buffer of the sample, they are dropped if the sample is invalid.
+                    Timer timer;
+                    if( pixel_aovs ){
+                        std::fill( sample_aovs.get() , sample_aovs.get() + aov_cnt , 0.0f );
+                        g_aovSample = sample_aovs.get();
+                    }
+
+                    // the integrator records the first hit while shading it.
+                    FirstHit first_hit;
+                    if( g_denoise || pixel_aovs )
+                        g_firstHits = &first_hit;
+
+                    // every random decision of the camera ray takes the next dimension of the sample.
+                    if( m_sequenceSampler ){
+                        auto& ps = m_pixelSamples[k];
+                        m_sequenceSampler->StartSample( j , i , m_sampleOffset + k );
+                        m_sequenceSampler->Get2D( ps.img_u , ps.img_v );
+                        m_sequenceSampler->Get2D( ps.dof_u , ps.dof_v );
+                        g_sequenceSampler = m_sequenceSampler.get();
+                    }
+
+                    // generate rays
+                    auto r = camera->GenerateRay( (float)j , (float)i , m_pixelSamples[k] );
+                    // accumulate the radiance
+                    auto li = g_integrator->Li( r , m_pixelSamples[k] , m_scene );
+                    if( g_clammping > 0.0f )
+                        li = li.Clamp( 0.0f , g_clammping );
+
+                    g_aovSample = nullptr;
+                    g_firstHits = nullptr;
+                    g_sequenceSampler = nullptr;
+                    const auto time = pixel_aovs ? timer.GetPreciseElapsedTime() : 0.0f;
                 
-                sAssert( li.IsValid() , GENERAL );
+                    sAssert( li.IsValid() , GENERAL );
                 
-                if( li.IsValid() )
-                    radiance += li;
-                else
-                    --valid_pixel_cnt;
-            }
+                    if( li.IsValid() ){
+                        radiance += li;
+                        if( g_denoise )
+                            features += sampleFeatures( first_hit , li );
+                        if( pixel_aovs )
+                            accumulateAOVs( pixel_aovs , sample_aovs.get() , first_hit , time , aov_cnt );
+                    }else{
+                        --valid_pixel_cnt;
+                    }
+                }
 
-            if( valid_pixel_cnt > 0 )
-                radiance /= (float)valid_pixel_cnt;
+                if( valid_pixel_cnt > 0 )
+                    radiance *= iteration_weight / (float)valid_pixel_cnt;
             
-            // store the pixel
-            g_imageSensor->StorePixel( j , i , radiance , *this );
+                // store the pixel
+                g_imageSensor->StorePixel( j , i , radiance , *this );
+                if( g_denoise )
+                    g_imageSensor->StoreFeatures( j , i , features );
+            }
         }
     }
 
-    if( g_integrator->NeedRefreshTile() ){
+    if( aovs )
+        g_imageSensor->StoreAOVs( m_coord , m_size , aovs.get() );
+
+    if( g_integrator->NeedRefreshTile() && m_isLastIteration ){
         auto x_off = m_coord.x / g_tileSize;
         auto y_off = (g_resultResollutionHeight - 1 - m_coord.y ) / g_tileSize ;
         g_imageSensor->FinishTile( x_off, y_off, *this );
     }
 }
 
+void Render_Task::executeInBatches( unsigned batch_size , float* aovs ){
+    auto camera = m_scene.GetCamera();
+
+    const auto pixel_cnt = m_size.x * m_size.y;
+    auto radiance = std::make_unique<Spectrum[]>(pixel_cnt);
+    auto valid_cnt = std::make_unique<unsigned[]>(pixel_cnt);
+    auto features = g_denoise ? std::make_unique<PixelFeatures[]>(pixel_cnt) : nullptr;
+
+    // integrators only record first hits in batch evaluation, the time of a batch is evenly shared by its rays.
+    const auto aov_cnt = g_imageSensor->GetAOVLayout().GetChannelCount();
+    auto sample_aovs = aovs ? std::make_unique<float[]>( aov_cnt ) : nullptr;
+
+    const auto iteration_weight = (float)m_samplePerPixel / (float)g_samplePerPixel;
+
+    // batches of the tile draw from a single sequence, it is keyed by the top-left pixel of the tile.
+    sort_seed( m_coord.x , m_coord.y , m_iteration );
+
+    std::vector<Ray>            rays;
+    std::vector<unsigned>       owners;
+    std::vector<Spectrum>       li;
+    std::vector<FirstHit>       first_hits;
+    rays.reserve( batch_size );
+    owners.reserve( batch_size );
+
+    // evaluate all camera rays in the batch and accumulate the results in the pixels they belong to
+    auto flush = [&](){
+        if( rays.empty() )
+            return;
+
+        // clear managed memory before each batch
+        SORT_CLEAR_MEMPOOL();
+
+        li.resize( rays.size() );
+        if( features || aovs ){
+            first_hits.assign( rays.size() , FirstHit() );
+            g_firstHits = first_hits.data();
+        }
+        Timer timer;
+        g_integrator->LiBatch( rays.data() , (unsigned)rays.size() , m_scene , li.data() );
+        g_firstHits = nullptr;
+        const auto time = aovs ? timer.GetPreciseElapsedTime() / (float)rays.size() : 0.0f;
+
+        for( auto k = 0u ; k < rays.size() ; ++k ){
+            auto l = li[k];
+            if( g_clammping > 0.0f )
+                l = l.Clamp( 0.0f , g_clammping );
+
+            sAssert( l.IsValid() , GENERAL );
+
+            if( l.IsValid() ){
+                radiance[owners[k]] += l;
+                ++valid_cnt[owners[k]];
+                if( features )
+                    features[owners[k]] += sampleFeatures( first_hits[k] , l );
+                if( aovs ){
+                    std::fill( sample_aovs.get() , sample_aovs.get() + aov_cnt , 0.0f );
+                    accumulateAOVs( aovs + owners[k] * aov_cnt , sample_aovs.get() , first_hits[k] , time , aov_cnt );
+                }
+            }
+        }
+
+        rays.clear();
+        owners.clear();
+    };
+
+    for( int i = 0 ; i < m_size.y ; i++ ){
+        for( int j = 0 ; j < m_size.x ; j++ ){
+            // generate samples to be used later
+            g_integrator->GenerateSample( m_sampler.get() , m_pixelSamples.get(), m_samplePerPixel, m_scene );
+
+            for( unsigned k = 0 ; k < m_samplePerPixel; ++k ){
+                // rays in a batch are evaluated together, only the camera samples can come from the sequence.
+                if( m_sequenceSampler ){
+                    auto& ps = m_pixelSamples[k];
+                    m_sequenceSampler->StartSample( m_coord.x + j , m_coord.y + i , m_sampleOffset + k );
+                    m_sequenceSampler->Get2D( ps.img_u , ps.img_v );
+                    m_sequenceSampler->Get2D( ps.dof_u , ps.dof_v );
+                }
+
+                rays.push_back( camera->GenerateRay( (float)( m_coord.x + j ) , (float)( m_coord.y + i ) , m_pixelSamples[k] ) );
+                owners.push_back( i * m_size.x + j );
+
+                if( rays.size() >= batch_size )
+                    flush();
+            }
+        }
+    }
+    flush();
+
+    for( int i = 0 ; i < m_size.y ; i++ ){
+        for( int j = 0 ; j < m_size.x ; j++ ){
+            const auto id = i * m_size.x + j;
+            if( valid_cnt[id] > 0 )
+                radiance[id] *= iteration_weight / (float)valid_cnt[id];
+
+            // store the pixel
+            g_imageSensor->StorePixel( m_coord.x + j , m_coord.y + i , radiance[id] , *this );
+            if( features )
+                g_imageSensor->StoreFeatures( m_coord.x + j , m_coord.y + i , features[id] );
+        }
+    }
+}
+
 void PreRender_Task::Execute(){
+    // primary rays share the medium stacks around the camera, there is no need to restore them for each ray.
+    m_scene.CacheCameraMediumStack();
+
     g_integrator->PreProcess(m_scene);
 }
+
+void PrepareIteration_Task::Execute(){
+    // keyed by the task, there is no pixel in the row above the image.
+    sort_seed( (int)m_taskIndex , -1 , m_iteration );
+    g_integrator->PrepareIteration( m_scene , m_iteration , m_taskIndex );
+}
+
+void BeginIteration_Task::Execute(){
+    g_integrator->BeginIteration( m_scene , m_iteration );
+}
+
+void EndIteration_Task::Execute(){
+    g_integrator->EndIteration( m_scene , m_iteration );
+}
@@ -19,6 +19,7 @@
 
 #include "task.h"
 #include "sampler/sampler.h"
+#include "sampler/sequence.h"
 #include "math/vector2.h"
 #include "core/scene.h"
 
@@ -32,7 +33,7 @@ public:
     //! @brief Constructor
     //!
     //! @param priority     New priority of the task.
-    Render_Task(const Vector2i& ori , const Vector2i& size , const Scene& scene ,
+    Render_Task(const Vector2i& ori , const Vector2i& size , const Scene& scene , unsigned iteration ,
                 const char* name , unsigned int priority , const Task::Task_Container& dependencies );
 
     //! @brief  Execute the task
@@ -58,6 +59,17 @@ private:
     const Scene&                        m_scene;            /**< Scene for ray tracing. */
     std::unique_ptr<Sampler>            m_sampler;          /**< Sampler for taking samples. Currently not used. */
     std::unique_ptr<PixelSample[]>      m_pixelSamples;     /**< Samples to take. Currently not used. */
+    std::unique_ptr<SequenceSampler>    m_sequenceSampler;  /**< Sampler driving all random decisions of camera rays, nullptr for random numbers. */
+    unsigned                            m_sampleOffset;     /**< Index of the first sample of each pixel taken in the iteration. */
+    unsigned                            m_iteration;        /**< Index of the iteration the tile belongs to. */
+    unsigned                            m_samplePerPixel;   /**< Number of samples of each pixel taken in the iteration. */
+    bool                                m_isLastIteration;  /**< Whether this is the last iteration of the tile. */
+
+    //! @brief  Render the tile by feeding the integrator with batches of camera rays.
+    //!
+    //! @param  batch_size  Maximum number of camera rays in a batch.
+    //! @param  aovs        AOVs of the tile, nullptr if AOVs are not collected.
+    void        executeInBatches( unsigned batch_size , float* aovs );
 };
 
 //! @brief  PreRender_Task provides a chance for integrators to preprocess some data before rendering.
@@ -69,7 +81,7 @@ public:
     //! @brief Constructor
     //!
     //! @param priority     New priority of the task.
-    PreRender_Task( const Scene& scene , const char* name , unsigned int priority ,
+    PreRender_Task( Scene& scene , const char* name , unsigned int priority ,
                     const Task::Task_Container& dependencies ) :
                     Task( name , priority , dependencies ), m_scene(scene){}
 
@@ -77,5 +89,62 @@ public:
     void        Execute() override;
 
 private:
-    const Scene&   m_scene;
-};
\ No newline at end of file
+    Scene&         m_scene;
+};
+//! @brief  PrepareIteration_Task gathers global data needed by an iteration of rendering.
+//!
+//! Multiple of these tasks are executed in parallel before each iteration, like tracing light
+//! paths for vertex merging in vertex connection and merging.
+class PrepareIteration_Task : public Task {
+public:
+    //! @brief Constructor
+    //!
+    //! @param priority     New priority of the task.
+    PrepareIteration_Task( const Scene& scene , unsigned iteration , unsigned task_index , const char* name ,
+                           unsigned int priority , const Task::Task_Container& dependencies ) :
+                           Task( name , priority , dependencies ), m_scene(scene), m_iteration(iteration), m_taskIndex(task_index){}
+
+    //! @brief  Execute the task
+    void        Execute() override;
+
+private:
+    const Scene&    m_scene;
+    unsigned        m_iteration;
+    unsigned        m_taskIndex;
+};
+
+//! @brief  BeginIteration_Task starts an iteration once all its preparation is done.
+class BeginIteration_Task : public Task {
+public:
+    //! @brief Constructor
+    //!
+    //! @param priority     New priority of the task.
+    BeginIteration_Task( const Scene& scene , unsigned iteration , const char* name , unsigned int priority ,
+                         const Task::Task_Container& dependencies ) :
+                         Task( name , priority , dependencies ), m_scene(scene), m_iteration(iteration){}
+
+    //! @brief  Execute the task
+    void        Execute() override;
+
+private:
+    const Scene&    m_scene;
+    unsigned        m_iteration;
+};
+
+//! @brief  EndIteration_Task finishes an iteration once all its tiles are rendered.
+class EndIteration_Task : public Task {
+public:
+    //! @brief Constructor
+    //!
+    //! @param priority     New priority of the task.
+    EndIteration_Task( const Scene& scene , unsigned iteration , const char* name , unsigned int priority ,
+                       const Task::Task_Container& dependencies ) :
+                       Task( name , priority , dependencies ), m_scene(scene), m_iteration(iteration){}
+
+    //! @brief  Execute the task
+    void        Execute() override;
+
+private:
+    const Scene&    m_scene;
+    unsigned        m_iteration;
+};
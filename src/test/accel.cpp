@@ -0,0 +1,241 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include "thirdparty/gtest/gtest.h"
+#include "unittest_common.h"
+#include "core/primitive.h"
+#include "core/rand.h"
+#include "material/material.h"
+#include "shape/sphere.h"
+#include "accel/bvh.h"
+#include "accel/qbvh.h"
+
+// A material with constant transparency, it doesn't need any shader to be compiled.
+class TransparentMaterial : public MaterialBase{
+public:
+    TransparentMaterial( float transparency ) : m_transparency( transparency ) {}
+
+    void        Serialize( IStreamBase& stream ) override {}
+    void        UpdateScatteringEvent( ScatteringEvent& se ) const override {}
+    void        UpdateMediumStack( const MediumInteraction& mi , const SE_Interaction flag , MediumStack& ms ) const override {}
+    Spectrum    EvaluateTransparency( const SurfaceInteraction& intersection ) const override { return m_transparency; }
+    void        BuildMaterial() override {}
+    StringID    GetUniqueID() const override { return INVALID_SID; }
+    bool        HasTransparency() const override { return m_transparency < 1.0f; }
+    bool        HasSSS() const override { return false; }
+    bool        HasVolumeAttached() const override { return false; }
+
+private:
+    float       m_transparency;
+};
+
+// A set of unit spheres sharing the same material.
+struct SphereSet{
+    std::vector<std::unique_ptr<Sphere>>    spheres;
+    std::vector<std::unique_ptr<Primitive>> primitives;
+    std::vector<const Primitive*>           primitive_list;
+
+    SphereSet( const std::vector<Point>& centers , const MaterialBase* material ){
+        for( const auto& center : centers ){
+            spheres.push_back( std::make_unique<Sphere>() );
+            spheres.back()->SetTransform( Translate( center.x , center.y , center.z ) );
+            primitives.push_back( std::make_unique<Primitive>( material , spheres.back().get() ) );
+            primitive_list.push_back( primitives.back().get() );
+        }
+    }
+
+    void Move( const std::vector<Point>& centers ){
+        for( auto i = 0u ; i < spheres.size() ; ++i )
+            spheres[i]->SetTransform( Translate( centers[i].x , centers[i].y , centers[i].z ) );
+    }
+
+    BBox GetBBox() const {
+        BBox bbox;
+        for( const auto primitive : primitive_list )
+            bbox.Union( primitive->GetBBox() );
+        return bbox;
+    }
+};
+
+// An accelerator counting how many times it is built, a refit falling back to a full rebuild builds it once more.
+template<class T>
+class CountedAccelerator : public T{
+public:
+    void Build( const std::vector<const Primitive*>& primitives , const BBox& bbox ) override {
+        ++m_buildCnt;
+        T::Build( primitives , bbox );
+    }
+    unsigned m_buildCnt = 0;
+};
+
+// Centers of spheres on a jittered grid, spheres don't overlap each other.
+static std::vector<Point> jitteredGrid( unsigned n , float jitter ){
+    std::vector<Point> centers;
+    for( auto i = 0u ; i < n ; ++i ) for( auto j = 0u ; j < n ; ++j ) for( auto k = 0u ; k < n ; ++k ){
+        const auto offset = Vector( sort_canonical() , sort_canonical() , sort_canonical() ) * 2.0f - Vector( 1.0f , 1.0f , 1.0f );
+        centers.push_back( Point( 4.0f * i , 4.0f * j , 4.0f * k ) + offset * jitter );
+    }
+    return centers;
+}
+
+// Both accelerators need to find the same nearest intersections as testing against all primitives one by one does, SIMD
+// intersection tests are slightly less accurate though.
+static void checkSameIntersections( const Accelerator& accel , const Accelerator& reference , const SphereSet& set ){
+    const auto bbox = set.GetBBox();
+    for( auto i = 0u ; i < 4096u ; ++i ){
+        const auto ori = bbox.m_Min + ( bbox.m_Max - bbox.m_Min ) * Vector( sort_canonical() , sort_canonical() , sort_canonical() );
+        const auto dir = normalize( Vector( sort_canonical() , sort_canonical() , sort_canonical() ) * 2.0f - Vector( 1.0f , 1.0f , 1.0f ) );
+        const Ray ray( ori , dir );
+
+        SurfaceInteraction si;
+        auto hit = false;
+        for( const auto primitive : set.primitive_list )
+            hit |= primitive->GetIntersect( ray , &si );
+
+        for( const auto a : { &accel , &reference } ){
+            SurfaceInteraction si_accel;
+            EXPECT_EQ( hit , a->GetIntersect( ray , si_accel ) );
+            if( hit ){
+                EXPECT_EQ( si.primitive , si_accel.primitive );
+                EXPECT_NEAR( si.t , si_accel.t , si.t * 1e-4f );
+            }
+        }
+    }
+}
+
+// Both intersections of a shadow ray passing through a transparent sphere attenuate the ray, no matter which accelerator is used.
+TEST(ACCELERATOR, TransparentSphereAttenuation) {
+    const TransparentMaterial material( 0.5f );
+    SphereSet set( { Point( 0.0f , 0.0f , 0.0f ) , Point( 4.0f , 0.0f , 0.0f ) , Point( 8.0f , 0.0f , 0.0f ) } , &material );
+
+    Bvh bvh;
+    bvh.Build( set.primitive_list , set.GetBBox() );
+    Qbvh qbvh;
+    qbvh.Build( set.primitive_list , set.GetBBox() );
+
+    // through the center of the first sphere, through both sides of all spheres, starting inside the first sphere and
+    // stopping inside the last one.
+    const Ray rays[] = {
+        Ray( Point( 0.0f , 0.0f , -5.0f ) , Vector( 0.0f , 0.0f , 1.0f ) , 0 , 0.0f , 10.0f ),
+        Ray( Point( -5.0f , 0.1f , 0.0f ) , Vector( 1.0f , 0.0f , 0.0f ) , 0 , 0.0f , 20.0f ),
+        Ray( Point( 0.0f , 0.0f , 0.0f ) , Vector( 1.0f , 0.0f , 0.0f ) , 0 , 0.0f , 8.0f ),
+    };
+    const float expected[] = { 0.25f , 0.015625f , 0.0625f };
+
+    for( auto i = 0u ; i < sizeof( rays ) / sizeof( rays[0] ) ; ++i ){
+        Spectrum per_hit , bvh_att , qbvh_att;
+        bvh.Accelerator::GetAttenuation( rays + i , 1 , &per_hit );
+        bvh.GetAttenuation( rays + i , 1 , &bvh_att );
+        qbvh.GetAttenuation( rays + i , 1 , &qbvh_att );
+
+        EXPECT_NEAR( per_hit.GetMaxComponent() , expected[i] , 1e-5f );
+        EXPECT_NEAR( bvh_att.GetMaxComponent() , expected[i] , 1e-5f );
+        EXPECT_NEAR( qbvh_att.GetMaxComponent() , expected[i] , 1e-5f );
+    }
+}
+
+// Slightly moved primitives are handled by refitting the existing tree, which is as good as a fresh build.
+TEST(ACCELERATOR, Refit) {
+    sort_seed( 0 );
+    const TransparentMaterial material( 1.0f );
+    SphereSet set( jitteredGrid( 8 , 0.5f ) , &material );
+
+    CountedAccelerator<Bvh> bvh;
+    bvh.Build( set.primitive_list , set.GetBBox() );
+    CountedAccelerator<Qbvh> qbvh;
+    qbvh.Build( set.primitive_list , set.GetBBox() );
+
+    // the whole set drifts away from where it was too, the tree is useless without updated bounding boxes.
+    auto centers = jitteredGrid( 8 , 0.5f );
+    for( auto& center : centers )
+        center += Vector( 1.5f , -1.5f , 1.5f );
+    set.Move( centers );
+    bvh.Refit();
+    qbvh.Refit();
+    EXPECT_EQ( 1u , bvh.m_buildCnt );
+    EXPECT_EQ( 1u , qbvh.m_buildCnt );
+
+    Bvh reference;
+    reference.Build( set.primitive_list , set.GetBBox() );
+    checkSameIntersections( bvh , reference , set );
+    checkSameIntersections( qbvh , reference , set );
+}
+
+// Primitives shuffled all over the scene make the refit tree far worse than a fresh one, it falls back to a full rebuild.
+TEST(ACCELERATOR, RefitFallbackToRebuild) {
+    sort_seed( 0 );
+    const TransparentMaterial material( 1.0f );
+    auto centers = jitteredGrid( 8 , 0.5f );
+    SphereSet set( centers , &material );
+
+    CountedAccelerator<Bvh> bvh;
+    bvh.Build( set.primitive_list , set.GetBBox() );
+    CountedAccelerator<Qbvh> qbvh;
+    qbvh.Build( set.primitive_list , set.GetBBox() );
+
+    for( auto i = (unsigned)centers.size() - 1 ; i > 0 ; --i )
+        std::swap( centers[i] , centers[ std::min( i , (unsigned)( sort_canonical() * ( i + 1 ) ) ) ] );
+    set.Move( centers );
+    bvh.Refit();
+    qbvh.Refit();
+    EXPECT_EQ( 2u , bvh.m_buildCnt );
+    EXPECT_EQ( 2u , qbvh.m_buildCnt );
+
+    Bvh reference;
+    reference.Build( set.primitive_list , set.GetBBox() );
+    checkSameIntersections( bvh , reference , set );
+    checkSameIntersections( qbvh , reference , set );
+}
+
+// Trees of different depths traversed by the same thread share the traversal stack, it has to fit the deepest one.
+TEST(ACCELERATOR, TreesOfDifferentDepths) {
+    sort_seed( 0 );
+    const TransparentMaterial material( 0.5f );
+    SphereSet shallow_set( { Point( 0.0f , 0.0f , 0.0f ) } , &material );
+    SphereSet deep_set( jitteredGrid( 10 , 0.5f ) , &material );
+
+    Qbvh shallow;
+    shallow.Build( shallow_set.primitive_list , shallow_set.GetBBox() );
+    Qbvh deep;
+    deep.Build( deep_set.primitive_list , deep_set.GetBBox() );
+
+    // the shallow tree is traversed first, so that the stack starts small.
+    const Ray ray( Point( 0.0f , 0.0f , -5.0f ) , Vector( 0.0f , 0.0f , 1.0f ) , 0 , 0.0f , 10.0f );
+    SurfaceInteraction si;
+    EXPECT_TRUE( shallow.GetIntersect( ray , si ) );
+    Spectrum attenuation;
+    shallow.GetAttenuation( &ray , 1 , &attenuation );
+    EXPECT_NEAR( attenuation.GetMaxComponent() , 0.25f , 1e-5f );
+
+    Bvh reference;
+    reference.Build( deep_set.primitive_list , deep_set.GetBBox() );
+    checkSameIntersections( deep , reference , deep_set );
+
+    // shadow rays along the diagonal of the grid pass through lots of nodes.
+    const auto bbox = deep_set.GetBBox();
+    for( auto i = 0u ; i < 256u ; ++i ){
+        const auto ori = bbox.m_Min + ( bbox.m_Max - bbox.m_Min ) * Vector( sort_canonical() , sort_canonical() , sort_canonical() );
+        const Ray shadow_ray( ori , normalize( bbox.m_Max - ori ) , 0 , 0.0f , distance( ori , bbox.m_Max ) );
+        Spectrum deep_att , reference_att;
+        deep.GetAttenuation( &shadow_ray , 1 , &deep_att );
+        reference.GetAttenuation( &shadow_ray , 1 , &reference_att );
+        EXPECT_NEAR( deep_att.GetMaxComponent() , reference_att.GetMaxComponent() , 1e-4f );
+    }
+}
@@ -19,10 +19,12 @@
 
 #ifdef AVX_ENABLED
 #define SIMD_AVX_IMPLEMENTATION
+#define SIMD_BVH_IMPLEMENTATION
 #endif
 
 #include "simd.hpp"
 
 #ifdef AVX_ENABLED
 #undef SIMD_AVX_IMPLEMENTATION
+#undef SIMD_BVH_IMPLEMENTATION
 #endif
\ No newline at end of file
@@ -0,0 +1,97 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+*/
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "thirdparty/gtest/gtest.h"
+#include "imagesensor/denoiser.h"
+#include "core/rand.h"
+
+static constexpr int        WIDTH = 37;
+static constexpr int        HEIGHT = 29;
+static constexpr unsigned   SAMPLE_CNT = 16;
+
+// Features of a pixel with all samples hitting the same surface.
+static PixelFeatures pixelFeatures( const Spectrum& albedo , const Vector& normal , float depth , float luminance , float luminance_sqr ){
+    PixelFeatures features;
+    features.albedo = albedo * (float)SAMPLE_CNT;
+    features.normal = normal * (float)SAMPLE_CNT;
+    features.depth = depth * SAMPLE_CNT;
+    features.luminance = luminance * SAMPLE_CNT;
+    features.luminance_sqr = luminance_sqr * SAMPLE_CNT;
+    features.sample_cnt = SAMPLE_CNT;
+    return features;
+}
+
+// There is nothing to smooth out in a constant image, it should stay the same.
+TEST(DENOISE, ConstantImage) {
+    const auto pixel_cnt = WIDTH * HEIGHT;
+    const Spectrum color( 0.3f , 0.5f , 0.7f );
+    const std::vector<Spectrum> input( pixel_cnt , color );
+    const std::vector<PixelFeatures> features( pixel_cnt , pixelFeatures( Spectrum( 0.8f , 0.6f , 0.4f ) , Vector( 0.0f , 1.0f , 0.0f ) , 3.0f , color.GetIntensity() , color.GetIntensity() * color.GetIntensity() ) );
+
+    for( const auto simd : { true , false } ){
+        std::vector<Spectrum> output( pixel_cnt );
+        DenoiseImage( WIDTH , HEIGHT , input.data() , features.data() , output.data() , 3 , simd );
+        for( const auto& c : output ){
+            EXPECT_NEAR( c.r , color.r , 1e-4f );
+            EXPECT_NEAR( c.g , color.g , 1e-4f );
+            EXPECT_NEAR( c.b , color.b , 1e-4f );
+        }
+    }
+}
+
+// The scalar version is the reference, the SIMD version should match it up to floating point precision.
+TEST(DENOISE, SimdMatchesScalar) {
+    const auto pixel_cnt = WIDTH * HEIGHT;
+    std::vector<Spectrum> input( pixel_cnt );
+    std::vector<PixelFeatures> features( pixel_cnt );
+
+    // a noisy image of two surfaces with different albedo, normal and depth.
+    sort_seed( 3 );
+    for( auto y = 0 ; y < HEIGHT ; ++y ){
+        for( auto x = 0 ; x < WIDTH ; ++x ){
+            const auto i = y * WIDTH + x;
+            const auto left = x < WIDTH / 2;
+            const auto albedo = left ? Spectrum( 0.9f , 0.2f , 0.2f ) : Spectrum( 0.2f , 0.9f , 0.4f );
+            const auto normal = left ? Vector( 0.0f , 0.0f , 1.0f ) : Vector( 1.0f , 0.0f , 0.0f );
+            const auto depth = left ? 2.0f : 5.0f + sort_canonical();
+            input[i] = albedo * ( 0.5f + 2.0f * sort_canonical() );
+            const auto luminance = input[i].GetIntensity();
+            features[i] = pixelFeatures( albedo , normal , depth , luminance , luminance * luminance * ( 1.0f + sort_canonical() ) );
+        }
+    }
+
+    std::vector<Spectrum> simd_output( pixel_cnt ) , scalar_output( pixel_cnt );
+    DenoiseImage( WIDTH , HEIGHT , input.data() , features.data() , simd_output.data() , 4 , true );
+    DenoiseImage( WIDTH , HEIGHT , input.data() , features.data() , scalar_output.data() , 1 , false );
+
+    for( auto i = 0 ; i < pixel_cnt ; ++i ){
+        const auto& s = simd_output[i];
+        const auto& r = scalar_output[i];
+        EXPECT_NEAR( s.r , r.r , 1e-3f * std::max( 1.0f , r.r ) );
+        EXPECT_NEAR( s.g , r.g , 1e-3f * std::max( 1.0f , r.g ) );
+        EXPECT_NEAR( s.b , r.b , 1e-3f * std::max( 1.0f , r.b ) );
+    }
+
+    // the image is actually filtered, otherwise matching each other proves nothing.
+    auto changed_cnt = 0;
+    for( auto i = 0 ; i < pixel_cnt ; ++i )
+        changed_cnt += fabs( scalar_output[i].GetIntensity() - input[i].GetIntensity() ) > 1e-3f;
+    EXPECT_GT( changed_cnt , pixel_cnt / 2 );
+}
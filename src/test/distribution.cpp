@@ -23,6 +23,7 @@
 #include "scatteringevent/bsdf/disney.h"
 #include <thread>
 #include "core/samplemethod.h"
+#include "integrator/pathguiding.h"
 
 // Check PDF evaluation
 void checkDist( const MicroFacetDistribution* dist ){
@@ -74,3 +75,42 @@ TEST(DISTRIBUTION, ClearcoatGGX) {
     checkAll(&cggx);
 }
 #endif
+
+// Check the learned guiding distribution of incident radiance
+TEST(DISTRIBUTION, GuidingDTree) {
+    // record radiance mostly coming from around the up direction.
+    DTree training;
+    const auto record = [&]( DTree& tree ){
+        for( auto i = 0 ; i < 1024 * 64 ; ++i ){
+            const auto wi = UniformSampleSphere( sort_canonical() , sort_canonical() );
+            tree.Record( wi , std::pow( std::max( 0.0f , wi.y ) , 8.0f ) + 0.01f );
+        }
+    };
+    record( training );
+
+    DTree dtree;
+    dtree.Refine( training , 0.01f , 20 );
+    record( dtree );
+
+    // the pdf of sampled directions should match the pdf evaluation.
+    for( auto i = 0 ; i < 1024 ; ++i ){
+        auto pdf = 0.0f;
+        const auto wi = dtree.Sample( sort_canonical() , sort_canonical() , pdf );
+        EXPECT_NEAR( pdf , dtree.Pdf( wi ) , pdf * 0.001f );
+    }
+
+    // the pdf should integrate to one over the sphere.
+    double final_total = ParrallReduction<double, 8, 1024 * 128>( [&](){
+            const auto wi = UniformSampleSphere( sort_canonical() , sort_canonical() );
+            return dtree.Pdf( wi ) / UniformSpherePdf();
+        } );
+    EXPECT_NEAR(final_total, 1.0f, 0.01f);
+
+    // directions should be sampled with their pdf.
+    final_total = ParrallReduction<double, 8, 1024 * 128>( [&](){
+            auto pdf = 0.0f;
+            dtree.Sample( sort_canonical() , sort_canonical() , pdf );
+            return pdf > 0.0f ? 1.0f / pdf : 0.0f;
+        } );
+    EXPECT_NEAR(final_total, FOUR_PI, 0.05f);
+}
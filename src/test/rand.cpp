@@ -0,0 +1,89 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+*/
+
+#include <thread>
+#include <vector>
+#include "thirdparty/gtest/gtest.h"
+#include "core/rand.h"
+
+// Canonical numbers should be uniformly distributed in [0,1).
+TEST(RAND, Uniformity) {
+    constexpr int BIN_CNT = 16;
+    constexpr int N = 1024 * 1024;
+    int bins[BIN_CNT] = { 0 };
+
+    sort_seed( 1 );
+    for( auto i = 0 ; i < N ; ++i ){
+        const auto r = sort_canonical();
+        ASSERT_GE( r , 0.0f );
+        ASSERT_LT( r , 1.0f );
+        ++bins[(int)( r * BIN_CNT )];
+    }
+    for( auto i = 0 ; i < BIN_CNT ; ++i )
+        EXPECT_NEAR( (float)bins[i] / N , 1.0f / BIN_CNT , 0.001f );
+}
+
+// Bulk generation takes both the SIMD and the scalar path if the size is not a multiple of four.
+TEST(RAND, BulkFill) {
+    constexpr unsigned N = 1024 * 1024 + 3;
+    std::vector<float> samples( N );
+
+    sort_seed( 2 );
+    sort_canonical( samples.data() , N );
+
+    double sum = 0.0;
+    for( const auto r : samples ){
+        ASSERT_GE( r , 0.0f );
+        ASSERT_LT( r , 1.0f );
+        sum += r;
+    }
+    EXPECT_NEAR( sum / N , 0.5 , 0.002 );
+
+    // consecutive fills take different keys, they don't repeat each other.
+    float a[16] , b[16];
+    sort_canonical( a , 16 );
+    sort_canonical( b , 16 );
+    auto same_cnt = 0;
+    for( auto i = 0 ; i < 16 ; ++i )
+        same_cnt += a[i] == b[i];
+    EXPECT_LT( same_cnt , 16 );
+}
+
+// The same key results in the same sequence, no matter which thread takes it.
+TEST(RAND, KeyedSequence) {
+    constexpr int N = 64;
+    auto generate = []( int x , int y , unsigned index , float* samples ){
+        sort_seed( x , y , index );
+        for( auto i = 0 ; i < N ; ++i )
+            samples[i] = sort_canonical();
+    };
+
+    float s0[N] , s1[N] , s2[N] , s3[N];
+    generate( 3 , 5 , 0 , s0 );
+    std::thread( [&](){ generate( 3 , 5 , 0 , s1 ); } ).join();
+    generate( 3 , 5 , 1 , s2 );
+    generate( 5 , 3 , 0 , s3 );
+
+    auto diff2 = 0 , diff3 = 0;
+    for( auto i = 0 ; i < N ; ++i ){
+        EXPECT_EQ( s0[i] , s1[i] );
+        diff2 += s0[i] != s2[i];
+        diff3 += s0[i] != s3[i];
+    }
+    EXPECT_GT( diff2 , N / 2 );
+    EXPECT_GT( diff3 , N / 2 );
+}
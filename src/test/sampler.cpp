@@ -0,0 +1,138 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+*/
+
+#include <vector>
+#include "thirdparty/gtest/gtest.h"
+#include "sampler/sobol.h"
+#include "sampler/bluenoise.h"
+
+// A sampler returning the index of the dimension taken, it exposes the order dimensions are consumed in.
+class DimensionSampler : public SequenceSampler{
+protected:
+    float sample( unsigned dimension ) const override{
+        return (float)dimension;
+    }
+};
+
+// Fixed point numbers are converted to canonical numbers strictly less than one.
+TEST(SAMPLER, FixedToCanonical) {
+    EXPECT_EQ( fixed_to_canonical( 0u ) , 0.0f );
+    EXPECT_LT( fixed_to_canonical( 0xffffffffu ) , 1.0f );
+    EXPECT_LT( fixed_to_canonical( 0xffffff80u ) , 1.0f );
+    for( auto i = 0u ; i < 256u ; ++i ){
+        const auto f = fixed_to_canonical( 0xffffffffu - i );
+        EXPECT_GE( f , 0.0f );
+        EXPECT_LT( f , 1.0f );
+    }
+}
+
+// A pair of numbers taken through 'Get2D' always starts at an even dimension.
+TEST(SAMPLER, Get2DAlignment) {
+    DimensionSampler sampler;
+    sampler.StartSample( 0 , 0 , 0 );
+
+    float u , v;
+    sampler.Get2D( u , v );
+    EXPECT_EQ( u , 0.0f );
+    EXPECT_EQ( v , 1.0f );
+
+    // the odd dimension left by a single number is skipped.
+    EXPECT_EQ( sampler.Get1D() , 2.0f );
+    sampler.Get2D( u , v );
+    EXPECT_EQ( u , 4.0f );
+    EXPECT_EQ( v , 5.0f );
+
+    // no dimension is skipped if the pair is aligned already.
+    EXPECT_EQ( sampler.Get1D() , 6.0f );
+    EXPECT_EQ( sampler.Get1D() , 7.0f );
+    sampler.Get2D( u , v );
+    EXPECT_EQ( u , 8.0f );
+    EXPECT_EQ( v , 9.0f );
+
+    // a new sample counts dimensions from zero again.
+    sampler.StartSample( 0 , 0 , 1 );
+    EXPECT_EQ( sampler.Get1D() , 0.0f );
+}
+
+// Every pair of dimensions, including the padded ones, is a (0,2)-net for the first power of two samples of a pixel.
+TEST(SAMPLER, SobolStratification) {
+    constexpr unsigned LOG_N = 8;
+    constexpr unsigned N = 1u << LOG_N;
+    constexpr unsigned PAIR_CNT = 6;
+
+    SobolSampler sampler;
+    for( const auto pixel : { 0 , 1 , 17 } ){
+        std::vector<float> points[PAIR_CNT];
+        for( auto i = 0u ; i < N ; ++i ){
+            sampler.StartSample( pixel , 2 * pixel , i );
+            for( auto k = 0u ; k < PAIR_CNT ; ++k ){
+                float u , v;
+                sampler.Get2D( u , v );
+                ASSERT_GE( u , 0.0f );
+                ASSERT_LT( u , 1.0f );
+                ASSERT_GE( v , 0.0f );
+                ASSERT_LT( v , 1.0f );
+                points[k].push_back( u );
+                points[k].push_back( v );
+            }
+        }
+
+        // each elementary interval of area 1/N contains exactly one point.
+        for( auto k = 0u ; k < PAIR_CNT ; ++k ){
+            for( auto bits_u = 0u ; bits_u <= LOG_N ; ++bits_u ){
+                const auto res_u = 1u << bits_u , res_v = N >> bits_u;
+                std::vector<unsigned> strata( N , 0u );
+                for( auto i = 0u ; i < N ; ++i ){
+                    const auto su = (unsigned)( points[k][2 * i] * res_u );
+                    const auto sv = (unsigned)( points[k][2 * i + 1] * res_v );
+                    ++strata[sv * res_u + su];
+                }
+                for( const auto cnt : strata )
+                    EXPECT_EQ( cnt , 1u ) << "pixel " << pixel << ", pair " << k << ", " << res_u << "x" << res_v << " strata";
+            }
+        }
+    }
+}
+
+// Blue noise rotation shifts the points toroidally, each dimension stays well stratified in 1D.
+TEST(SAMPLER, BlueNoiseStratification) {
+    constexpr unsigned N = 256;
+    constexpr unsigned BIN_CNT = 16;
+    constexpr unsigned DIM_CNT = 8;
+
+    BlueNoiseSampler sampler;
+    for( const auto pixel : { 0 , 5 , 63 } ){
+        unsigned bins[DIM_CNT][BIN_CNT] = { { 0 } };
+        for( auto i = 0u ; i < N ; ++i ){
+            sampler.StartSample( pixel , pixel + 1 , i );
+            for( auto d = 0u ; d < DIM_CNT ; ++d ){
+                const auto r = sampler.Get1D();
+                ASSERT_GE( r , 0.0f );
+                ASSERT_LT( r , 1.0f );
+                ++bins[d][(unsigned)( r * BIN_CNT )];
+            }
+        }
+
+        // a rotated interval of N / BIN_CNT points overlaps at most one extra point on either side.
+        for( auto d = 0u ; d < DIM_CNT ; ++d ){
+            for( auto b = 0u ; b < BIN_CNT ; ++b ){
+                EXPECT_GE( bins[d][b] , N / BIN_CNT - 1 );
+                EXPECT_LE( bins[d][b] , N / BIN_CNT + 1 );
+            }
+        }
+    }
+}
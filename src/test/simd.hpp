@@ -17,7 +17,12 @@
 
 #include <math.h>
 #include "thirdparty/gtest/gtest.h"
+#include <random>
 #include "simd/simd_wrapper.h"
+#include "simd/simd_ray_utils.h"
+#include "simd/simd_line.h"
+#include "simd/simd_analytic.h"
+#include "simd/simd_bbox.h"
 
 #ifdef SIMD_AVX_IMPLEMENTATION
     #define SIMD_TEST       SIMD_AVX
@@ -495,4 +500,174 @@ TEST(SIMD_TEST, simd_minreduction_ps) {
         EXPECT_EQ( reduction[0] , correct_reduction[0] );
 }
 
+TEST(SIMD_TEST, simd_load_u8_ps) {
+    unsigned char data[SIMD_CHANNEL];
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+        data[i] = (unsigned char)( 255 - 37 * i );
+
+    const auto simd_data = simd_load_u8_ps( data );
+    for( int i = 0 ; i < SIMD_CHANNEL ; ++i )
+        EXPECT_EQ( simd_data[i] , (float)data[i] );
+}
+
+// Dequantized boxes should always contain the original ones, no matter how small, large or far away they are.
+TEST(SIMD_TEST, simd_quantized_bbox) {
+    std::mt19937 rng( 0 );
+    std::uniform_real_distribution<float> dist( 0.0f , 1.0f );
+
+    // random number spanning many orders of magnitude.
+    const auto random_scale = [&]( float min_exp , float max_exp ){
+        return powf( 10.0f , min_exp + ( max_exp - min_exp ) * dist( rng ) );
+    };
+
+    for( auto k = 0 ; k < 4096 ; ++k ){
+        const auto center = Point( ( 2.0f * dist( rng ) - 1.0f ) * random_scale( -3.0f , 6.0f ) ,
+                                   ( 2.0f * dist( rng ) - 1.0f ) * random_scale( -3.0f , 6.0f ) ,
+                                   ( 2.0f * dist( rng ) - 1.0f ) * random_scale( -3.0f , 6.0f ) );
+        const auto node_extent = random_scale( -6.0f , 6.0f );
+
+        BBox bbox[SIMD_CHANNEL];
+        bool valid[SIMD_CHANNEL];
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+            valid[i] = ( i + k ) % 5 != 0;
+            for( auto axis = 0 ; axis < 3 ; ++axis ){
+                const auto lo = center[axis] + ( 2.0f * dist( rng ) - 1.0f ) * node_extent;
+                // some boxes are flat or even a single point along an axis.
+                const auto hi = ( k + i + axis ) % 4 == 0 ? lo : lo + dist( rng ) * node_extent * random_scale( -6.0f , 0.0f );
+                bbox[i].m_Min[axis] = lo;
+                bbox[i].m_Max[axis] = hi;
+            }
+        }
+
+        // every few nodes, all boxes collapse into the same point.
+        if( k % 64 == 1 ){
+            for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+                bbox[i] = BBox( center , center );
+        }
+
+        // some nodes span almost the whole range of float.
+        if( k % 64 == 2 ){
+            bbox[0] = BBox( Point( -1e30f , -1e30f , -1e30f ) , Point( -1e30f , -1e30f , -1e30f ) );
+            bbox[1] = BBox( Point( 1e30f , 1e30f , 1e30f ) , Point( 3e38f , 3e38f , 3e38f ) );
+            valid[0] = valid[1] = true;
+        }
+
+        const auto bb = DequantizeBBox_SIMD( QuantizeBBox_SIMD( bbox , valid ) );
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+            if( !valid[i] ){
+                EXPECT_EQ( 0 , simd_movemask_ps( bb.m_mask ) & ( 1 << i ) );
+                continue;
+            }
+            EXPECT_NE( 0 , simd_movemask_ps( bb.m_mask ) & ( 1 << i ) );
+            EXPECT_LE( bb.m_min_x[i] , bbox[i].m_Min.x );
+            EXPECT_LE( bb.m_min_y[i] , bbox[i].m_Min.y );
+            EXPECT_LE( bb.m_min_z[i] , bbox[i].m_Min.z );
+            EXPECT_GE( bb.m_max_x[i] , bbox[i].m_Max.x );
+            EXPECT_GE( bb.m_max_y[i] , bbox[i].m_Max.y );
+            EXPECT_GE( bb.m_max_z[i] , bbox[i].m_Max.z );
+        }
+    }
+}
+
+// Pieces of a line in a packet should report each intersection exactly once, by the piece that holds it.
+TEST(SIMD_TEST, simd_line_piece) {
+    Line line( Point( 0.0f , 0.0f , 0.0f ) , Point( 1.0f , 2.0f , 1.5f ) , 0.0f , 1.0f , 0.05f , 0.02f , 0 );
+    line.SetTransform( Transform() );
+    const Primitive primitive( nullptr , &line );
+
+    constexpr int piece_cnt = 4;
+    Simd_Line line_simd;
+    for( auto i = 0 ; i < piece_cnt ; ++i )
+        line_simd.PushLine( &primitive , (float)i / piece_cnt , ( i + 1 == piece_cnt ) ? 1.0f : (float)( i + 1 ) / piece_cnt );
+    EXPECT_TRUE( line_simd.PackData() );
+
+    Vector axis0 , axis1;
+    const auto dir = normalize( line.GetCenterPoint( 1.0f ) - line.GetCenterPoint( 0.0f ) );
+    coordinateSystem( dir , axis0 , axis1 );
+
+    std::mt19937 rng( 0 );
+    std::uniform_real_distribution<float> dist( 0.0f , 1.0f );
+    for( auto k = 0 ; k < 1024 ; ++k ){
+        // keep away from the boundaries between pieces to avoid precision issues.
+        const auto piece = k % piece_cnt;
+        const auto s = ( piece + 0.05f + 0.9f * dist( rng ) ) / piece_cnt;
+        const auto phi = TWO_PI * dist( rng );
+        const auto n = axis0 * cos( phi ) + axis1 * sin( phi );
+
+        const Ray ray( line.GetCenterPoint( s ) + n * 2.0f , -n );
+        Simd_Ray_Data ray_simd;
+        resolveRayData( ray , ray_simd );
+
+        simd_data mask , t_simd , inter_x , inter_y , inter_z;
+        EXPECT_TRUE( intersectLine_Inner( ray , ray_simd , line_simd , mask , t_simd , inter_x , inter_y , inter_z ) );
+        EXPECT_EQ( 1 << piece , simd_movemask_ps( mask ) );
+
+        SurfaceInteraction intersection;
+        EXPECT_TRUE( line.GetIntersect( ray , &intersection ) );
+        EXPECT_NEAR( intersection.t , t_simd[piece] , 1e-4f );
+    }
+}
+
+// Packets of analytic shapes should report exactly the same nearest intersection as the shapes themselves.
+template<class T_Shape, class T_Packet>
+void checkAnalyticPacket(){
+    std::mt19937 rng( 0 );
+    std::uniform_real_distribution<float> dist( 0.0f , 1.0f );
+    const auto random_point = [&]( float extent ){
+        return Point( ( 2.0f * dist( rng ) - 1.0f ) * extent , ( 2.0f * dist( rng ) - 1.0f ) * extent , ( 2.0f * dist( rng ) - 1.0f ) * extent );
+    };
+
+    // leave one channel empty to make sure invalid channels are never reported.
+    constexpr int shape_cnt = SIMD_CHANNEL - 1;
+    T_Shape shapes[shape_cnt];
+    std::unique_ptr<Primitive> primitives[shape_cnt];
+    T_Packet packet;
+    for( auto i = 0 ; i < shape_cnt ; ++i ){
+        const auto center = random_point( 2.0f );
+        shapes[i].SetTransform( Translate( center.x , center.y , center.z ) * RotateX( TWO_PI * dist( rng ) ) * RotateZ( TWO_PI * dist( rng ) ) );
+        primitives[i] = std::make_unique<Primitive>( nullptr , &shapes[i] );
+        packet.PushPrimitive( primitives[i].get() );
+    }
+    EXPECT_TRUE( packet.PackData() );
+
+    for( auto k = 0 ; k < 4096 ; ++k ){
+        const auto ori = random_point( 4.0f );
+        const Ray ray( ori , normalize( random_point( 2.0f ) - ori ) );
+        Simd_Ray_Data ray_simd;
+        resolveRayData( ray , ray_simd );
+
+        SurfaceInteraction expected;
+        auto hit = false;
+        for( auto i = 0 ; i < shape_cnt ; ++i )
+            hit |= primitives[i]->GetIntersect( ray , &expected );
+
+        SurfaceInteraction intersection;
+        EXPECT_EQ( hit , intersectAnalytic_SIMD( ray , ray_simd , packet , &intersection ) );
+        EXPECT_EQ( hit , intersectAnalyticFast_SIMD( ray , ray_simd , packet ) );
+        if( !hit )
+            continue;
+
+        EXPECT_EQ( expected.primitive , intersection.primitive );
+        EXPECT_NEAR( expected.t , intersection.t , 1e-4f );
+        EXPECT_NEAR( expected.intersect.x , intersection.intersect.x , 1e-4f );
+        EXPECT_NEAR( expected.intersect.y , intersection.intersect.y , 1e-4f );
+        EXPECT_NEAR( expected.intersect.z , intersection.intersect.z , 1e-4f );
+        EXPECT_NEAR( expected.normal.x , intersection.normal.x , 1e-4f );
+        EXPECT_NEAR( expected.normal.y , intersection.normal.y , 1e-4f );
+        EXPECT_NEAR( expected.normal.z , intersection.normal.z , 1e-4f );
+    }
+}
+
+TEST(SIMD_TEST, simd_sphere) {
+    checkAnalyticPacket<Sphere, Simd_Sphere>();
+}
+
+TEST(SIMD_TEST, simd_disk) {
+    checkAnalyticPacket<Disk, Simd_Disk>();
+}
+
+TEST(SIMD_TEST, simd_quad) {
+    checkAnalyticPacket<Quad, Simd_Quad>();
+}
+
 #endif
@@ -19,10 +19,12 @@
 
 #ifdef SSE_ENABLED
 #define SIMD_SSE_IMPLEMENTATION
+#define SIMD_BVH_IMPLEMENTATION
 #endif
 
 #include "simd.hpp"
 
 #ifdef SSE_ENABLED
 #undef SIMD_SSE_IMPLEMENTATION
+#undef SIMD_BVH_IMPLEMENTATION
 #endif
\ No newline at end of file
@@ -20,6 +20,7 @@
 #include <functional>
 #include <thread>
 #include <vector>
+#include "core/rand.h"
 
 // TN : thread number
 // N :  task number in each thread
@@ -30,6 +31,7 @@ T ParrallReduction( std::function<T()> func ){
     std::thread threads[TN];
     for (int i = 0; i < TN; ++i)
         threads[i] = std::thread([&]( int tid ){
+            sort_seed( tid + 1 );
             T local = 0.0f;
             for (long long j = 0; j < N; ++j)
                 local += (T)(func() * ((double)1.0 / (double)(N * TN)));
@@ -52,10 +54,11 @@ void ParrallRun( std::function<void()> func ){
     // executing tasks in different threads
     std::thread threads[TN];
     for (int i = 0; i < TN; ++i)
-        threads[i] = std::thread([&](){
+        threads[i] = std::thread([&]( int tid ){
+            sort_seed( tid + 1 );
             for (long long j = 0; j < N; ++j )
                 func();
-        });
+        }, i );
 
     // make sure all threads are finished
     for (int i = 0; i < TN; ++i)
@@ -68,6 +71,7 @@ void ParrallRun( std::function<void(int tid)> func ){
     std::thread threads[TN];
     for (int i = 0; i < TN; ++i)
         threads[i] = std::thread([&](int tid){
+            sort_seed( tid + 1 );
             for (long long j = 0; j < N; ++j )
                 func(tid);
         }, i );